@@ -22,6 +22,7 @@
 #include "dkim-internal.h"
 #include "dkim-types.h"
 #include "dkim-tables.h"
+#include "dkim-dns.h"
 #include "util.h"
 
 #ifdef USE_GNUTLS
@@ -107,7 +108,7 @@ dkim_atps_check(DKIM *dkim, DKIM_SIGINFO *sig, struct timeval *timeout,
 	u_char *adomain;
 	u_char *txtfound = NULL;
 	u_char *ahash = NULL;
-	void *qh;
+	struct dkim_dnsflight *fl;
 	u_char *p;
 	u_char *cp;
 	u_char *eom;
@@ -244,10 +245,9 @@ dkim_atps_check(DKIM *dkim, DKIM_SIGINFO *sig, struct timeval *timeout,
 		return DKIM_STAT_CANTVRFY;
 	}
 
-	/* send it */
+	/* send it, or join an identical query in flight */
 	anslen = sizeof ansbuf;
-	status = lib->dkiml_dns_start(lib->dkiml_dns_service, T_TXT,
-	                              query, ansbuf, anslen, &qh);
+	status = dkim_dns_flight_start(lib, T_TXT, query, &fl);
 	if (status != DKIM_DNS_SUCCESS)
 	{
 		*res = DKIM_ATPS_UNKNOWN;
@@ -257,10 +257,10 @@ dkim_atps_check(DKIM *dkim, DKIM_SIGINFO *sig, struct timeval *timeout,
 	/* wait for the reply */
 	to.tv_sec = dkim->dkim_timeout;
 	to.tv_usec = 0;
-	status = lib->dkiml_dns_waitreply(lib->dkiml_dns_service, qh,
-	                                  timeout == NULL ? &to : timeout,
-	                                  &anslen, &error, NULL);
-	(void) lib->dkiml_dns_cancel(lib->dkiml_dns_service, qh);
+	status = dkim_dns_flight_wait(lib, fl,
+	                              timeout == NULL ? &to : timeout,
+	                              ansbuf, &anslen, &error, NULL);
+	dkim_dns_flight_cancel(lib, fl);
 
 	if (status != DKIM_DNS_SUCCESS)
 	{
@@ -2,7 +2,7 @@
 **  Copyright (c) 2007-2009 Sendmail, Inc. and its suppliers.
 **    All rights reserved.
 **
-**  Copyright (c) 2009, 2012, 2013, The Trusted Domain Project.
+**  Copyright (c) 2009, 2012, 2013, 2015, The Trusted Domain Project.
 **    All rights reserved.
 */
 
@@ -13,17 +13,12 @@
 /* system includes */
 #include <sys/param.h>
 #include <sys/types.h>
-#include <sys/stat.h>
 #include <assert.h>
-#include <stdio.h>
-#include <fcntl.h>
 #include <errno.h>
 #include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
-
-/* libdb includes */
-#include <db.h>
+#include <time.h>
 
 /* libopendkim includes */
 #include "dkim-internal.h"
@@ -40,117 +35,293 @@
 #endif /* USE_STRL_H */
 
 /* limits, macros, etc. */
-#define	BUFRSZ			1024
-#define DB_MODE			(S_IRUSR|S_IWUSR)
-
-#ifndef DB_NOTFOUND
-# define DB_NOTFOUND		1
-#endif /* ! DB_NOTFOUND */
+#define	CACHE_SHARDS		16		/* independently locked shards */
+#define	CACHE_MINBUCKETS	64		/* initial hash buckets/shard */
+#define	CACHE_WHEELSLOTS	256		/* expiry wheel slots/shard */
+#define	CACHE_WHEELGRAIN	16		/* seconds per wheel slot */
 
-#ifndef DB_VERSION_MAJOR
-# define DB_VERSION_MAJOR	1
-#endif /* ! DB_VERSION_MAJOR */
-
-#define DB_VERSION_CHECK(x,y,z) ((DB_VERSION_MAJOR == (x) && \
-				  DB_VERSION_MINOR == (y) && \
-				  DB_VERSION_PATCH >= (z)) || \
-				 (DB_VERSION_MAJOR == (x) && \
-				  DB_VERSION_MINOR > (y)) || \
-				 DB_VERSION_MAJOR > (x))
+#ifndef DKIM_CACHE_MAXBYTES
+# define DKIM_CACHE_MAXBYTES	(16 * 1024 * 1024)
+#endif /* ! DKIM_CACHE_MAXBYTES */
 
 /* data types */
 struct dkim_cache_entry
 {
-	int		cache_ttl;
-	time_t		cache_when;
-	char		cache_data[BUFRSZ + 1];
+	_Bool			cache_ref;	/* referenced since last sweep */
+	u_int			cache_hash;
+	u_int			cache_slot;	/* expiry wheel slot */
+	int			cache_ttl;
+	time_t			cache_when;
+	time_t			cache_expire;	/* cache_when + cache_ttl */
+	size_t			cache_size;	/* bytes charged to budget */
+	char *			cache_key;
+	char *			cache_data;
+	struct dkim_cache_entry * cache_hnext;	/* hash chain */
+	struct dkim_cache_entry * cache_wprev;	/* expiry wheel slot */
+	struct dkim_cache_entry * cache_wnext;
+	struct dkim_cache_entry * cache_cprev;	/* eviction clock */
+	struct dkim_cache_entry * cache_cnext;
 };
 
-/* globals */
-static pthread_mutex_t cache_stats_lock; /* stats lock */
-static u_int c_hits = 0;		/* cache hits */
-static u_int c_queries = 0;		/* cache queries */
-static u_int c_expired = 0;		/* expired cache hits */
-static pthread_mutex_t cache_lock;	/* cache lock */
+struct dkim_cache_shard
+{
+	u_int			shard_nbuckets;
+	u_int			shard_nkeys;
+	u_int			shard_queries;
+	u_int			shard_hits;
+	u_int			shard_expired;
+	time_t			shard_wheeltick;
+	size_t			shard_bytes;
+	size_t			shard_budget;
+	pthread_mutex_t		shard_lock;
+	struct dkim_cache_entry ** shard_buckets;
+	struct dkim_cache_entry * shard_hand;
+	struct dkim_cache_entry * shard_wheel[CACHE_WHEELSLOTS];
+};
+
+struct dkim_cache
+{
+	struct dkim_cache_shard	cache_shards[CACHE_SHARDS];
+};
 
 /*
-**  DKIM_CACHE_INIT -- initialize an on-disk cache of entries
+**  DKIM_CACHE_HASH -- hash a cache key
 **
 **  Parameters:
-**  	err -- error code (returned)
-**  	tmpdir -- temporary directory to use (may be NULL)
+**  	str -- key
 **
 **  Return value:
-**  	A DB handle referring to the cache, or NULL on error.
+**  	Hash value.
 */
 
-DB *
-dkim_cache_init(int *err, char *tmpdir)
+static u_int
+dkim_cache_hash(const char *str)
 {
-	int status = 0;
-	DB *cache = NULL;
+	u_int h = 2166136261U;
+	const u_char *p;
+
+	for (p = (const u_char *) str; *p != '\0'; p++)
+	{
+		h ^= *p;
+		h *= 16777619U;
+	}
+
+	return h;
+}
 
-	c_hits = 0;
-	c_queries = 0;
-	c_expired = 0;
+/*
+**  DKIM_CACHE_SHARD -- select the shard holding a key
+**
+**  Parameters:
+**  	cache -- cache handle
+**  	hash -- hash of the key
+**
+**  Return value:
+**  	Pointer to the shard.
+**
+**  Notes:
+**  	The shard is picked from the top bits of the hash, and the bucket
+**  	within it from the bottom bits, so the two are independent.
+*/
 
-	(void) pthread_mutex_init(&cache_stats_lock, NULL);
-	(void) pthread_mutex_init(&cache_lock, NULL);
+static struct dkim_cache_shard *
+dkim_cache_shard(struct dkim_cache *cache, u_int hash)
+{
+	return &cache->cache_shards[(hash >> 24) % CACHE_SHARDS];
+}
 
-#if DB_VERSION_CHECK(3,0,0)
-	status = db_create(&cache, NULL, 0);
-	if (status == 0)
+/*
+**  DKIM_CACHE_WHEELSLOT -- select the expiry wheel slot for an entry
+**
+**  Parameters:
+**  	shard -- shard
+**  	expire -- time at which the entry expires
+**
+**  Return value:
+**  	Slot number.
+**
+**  Notes:
+**  	Entries whose expiry time is already behind the wheel go into the
+**  	current slot so that the next sweep will see them.
+*/
+
+static u_int
+dkim_cache_wheelslot(struct dkim_cache_shard *shard, time_t expire)
+{
+	time_t tick;
+
+	tick = expire / CACHE_WHEELGRAIN;
+	if (tick < shard->shard_wheeltick)
+		tick = shard->shard_wheeltick;
+
+	return (u_int) (tick % CACHE_WHEELSLOTS);
+}
+
+/*
+**  DKIM_CACHE_REMOVE -- remove an entry from a shard and free it
+**
+**  Parameters:
+**  	shard -- shard, which must be locked
+**  	ce -- entry to remove
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkim_cache_remove(struct dkim_cache_shard *shard, struct dkim_cache_entry *ce)
+{
+	struct dkim_cache_entry **pp;
+
+	/* hash chain */
+	for (pp = &shard->shard_buckets[ce->cache_hash & (shard->shard_nbuckets - 1)];
+	     *pp != ce;
+	     pp = &(*pp)->cache_hnext)
+		assert(*pp != NULL);
+	*pp = ce->cache_hnext;
+
+	/* expiry wheel */
+	if (ce->cache_wprev != NULL)
+		ce->cache_wprev->cache_wnext = ce->cache_wnext;
+	else
+		shard->shard_wheel[ce->cache_slot] = ce->cache_wnext;
+	if (ce->cache_wnext != NULL)
+		ce->cache_wnext->cache_wprev = ce->cache_wprev;
+
+	/* eviction clock */
+	if (ce->cache_cnext == ce)
 	{
-# if DB_VERSION_CHECK(4,2,0)
-		/* tell libdb which temporary directory to use */
-		if (tmpdir != NULL && tmpdir[0] != '\0')
-		{
-			DB_ENV *env = NULL;
+		shard->shard_hand = NULL;
+	}
+	else
+	{
+		ce->cache_cprev->cache_cnext = ce->cache_cnext;
+		ce->cache_cnext->cache_cprev = ce->cache_cprev;
+		if (shard->shard_hand == ce)
+			shard->shard_hand = ce->cache_cnext;
+	}
 
-#  if DB_VERSION_CHECK(4,3,0)
-			env = cache->get_env(cache);
-#  else /* DB_VERSION_CHECK(4,3,0) */
-			(void) cache->get_env(cache, &env);
-#  endif /* DB_VERISON_CHECK(4,3,0) */
+	shard->shard_nkeys--;
+	shard->shard_bytes -= ce->cache_size;
 
-			if (env != NULL)
-				(void) env->set_tmp_dir(env, tmpdir);
+	free(ce);
+}
+
+/*
+**  DKIM_CACHE_GROW -- double the number of hash buckets in a shard
+**
+**  Parameters:
+**  	shard -- shard, which must be locked
+**
+**  Return value:
+**  	None.  On allocation failure the shard is left as it was, just
+**  	with longer chains.
+*/
+
+static void
+dkim_cache_grow(struct dkim_cache_shard *shard)
+{
+	u_int c;
+	u_int nbuckets;
+	struct dkim_cache_entry *ce;
+	struct dkim_cache_entry *next;
+	struct dkim_cache_entry **buckets;
+
+	nbuckets = shard->shard_nbuckets * 2;
+
+	buckets = (struct dkim_cache_entry **) calloc(nbuckets,
+	                                              sizeof(struct dkim_cache_entry *));
+	if (buckets == NULL)
+		return;
+
+	for (c = 0; c < shard->shard_nbuckets; c++)
+	{
+		for (ce = shard->shard_buckets[c]; ce != NULL; ce = next)
+		{
+			next = ce->cache_hnext;
+			ce->cache_hnext = buckets[ce->cache_hash & (nbuckets - 1)];
+			buckets[ce->cache_hash & (nbuckets - 1)] = ce;
 		}
-# endif /* DB_VERISON_CHECK(4,2,0) */
-
-# if DB_VERSION_CHECK(4,1,25)
-		status = cache->open(cache, NULL, NULL, NULL, DB_HASH,
-		                     DB_CREATE, DB_MODE);
-# else /* DB_VERSION_CHECK(4,1,25) */
-		status = cache->open(cache, NULL, NULL, DB_HASH,
-		                     DB_CREATE, DB_MODE);
-# endif /* DB_VERSION_CHECK(4,1,25) */
 	}
-#elif DB_VERSION_CHECK(2,0,0)
-	status = db_open(NULL, DB_HASH, DB_CREATE, DB_MODE,
-	                 NULL, NULL, &cache);
-#else /* ! DB_VERSION_CHECK(2,0,0) */
-	cache = dbopen(NULL, (O_CREAT|O_RDWR), DB_MODE, DB_HASH, NULL);
-	if (cache == NULL)
-		status = errno;
-#endif /* DB_VERSION_CHECK */
 
-	if (status != 0)
+	free(shard->shard_buckets);
+	shard->shard_buckets = buckets;
+	shard->shard_nbuckets = nbuckets;
+}
+
+/*
+**  DKIM_CACHE_INIT -- initialize an in-memory cache of entries
+**
+**  Parameters:
+**  	err -- error code (returned)
+**  	maxbytes -- memory budget for cached entries, or 0 for the default
+**
+**  Return value:
+**  	A handle referring to the cache, or NULL on error.
+**
+**  Notes:
+**  	The cache is split into shards, each with its own lock, so that
+**  	threads looking up different keys rarely contend.  Each shard
+**  	gets an equal share of "maxbytes"; when it is exceeded, entries
+**  	are evicted in CLOCK (second chance) order.
+*/
+
+struct dkim_cache *
+dkim_cache_init(int *err, size_t maxbytes)
+{
+	int c;
+	struct dkim_cache *cache;
+	struct dkim_cache_shard *shard;
+
+	if (maxbytes == 0)
+		maxbytes = DKIM_CACHE_MAXBYTES;
+
+	cache = (struct dkim_cache *) malloc(sizeof *cache);
+	if (cache == NULL)
 	{
 		if (err != NULL)
-			*err = status;
-
+			*err = errno;
 		return NULL;
 	}
 
+	memset(cache, '\0', sizeof *cache);
+
+	for (c = 0; c < CACHE_SHARDS; c++)
+	{
+		shard = &cache->cache_shards[c];
+
+		shard->shard_buckets = (struct dkim_cache_entry **) calloc(CACHE_MINBUCKETS,
+		                                                           sizeof(struct dkim_cache_entry *));
+		if (shard->shard_buckets == NULL)
+		{
+			if (err != NULL)
+				*err = errno;
+
+			while (--c >= 0)
+			{
+				free(cache->cache_shards[c].shard_buckets);
+				(void) pthread_mutex_destroy(&cache->cache_shards[c].shard_lock);
+			}
+
+			free(cache);
+			return NULL;
+		}
+
+		shard->shard_nbuckets = CACHE_MINBUCKETS;
+		shard->shard_budget = maxbytes / CACHE_SHARDS;
+		shard->shard_wheeltick = time(NULL) / CACHE_WHEELGRAIN;
+
+		(void) pthread_mutex_init(&shard->shard_lock, NULL);
+	}
+
 	return cache;
 }
 
 /*
-**  DKIM_CACHE_QUERY -- query an on-disk cache of entries
+**  DKIM_CACHE_QUERY -- query an in-memory cache of entries
 **
 **  Parameters:
-**  	db -- DB handle referring to the cache
+**  	cache -- cache handle
 **  	str -- key to query
 **  	ttl -- time-to-live; ignore any record older than this; if 0, apply
 **  	       the TTL in the record
@@ -167,90 +338,66 @@ dkim_cache_init(int *err, char *tmpdir)
 */
 
 int
-dkim_cache_query(DB *db, char *str, int ttl, char *buf, size_t *buflen,
-                 int *err)
+dkim_cache_query(struct dkim_cache *cache, char *str, int ttl, char *buf,
+                 size_t *buflen, int *err)
 {
-	int status;
+	u_int hash;
 	time_t now;
-	DBT q;
-	DBT d;
-	struct dkim_cache_entry ce;
+	struct dkim_cache_shard *shard;
+	struct dkim_cache_entry *ce;
 
-	assert(db != NULL);
+	assert(cache != NULL);
 	assert(str != NULL);
 	assert(buf != NULL);
 	assert(err != NULL);
 
-	memset(&q, '\0', sizeof q);
-	memset(&d, '\0', sizeof d);
-
-	q.data = str;
-	q.size = strlen(q.data);
-
-#if DB_VERSION_CHECK(2,0,0)
-	d.flags = DB_DBT_USERMEM;
-	d.data = (void *) &ce;
-	d.ulen = sizeof ce;
-#endif /* DB_VERSION_CHECK(2,0,0) */
-
 	(void) time(&now);
 
-	pthread_mutex_lock(&cache_stats_lock);
-	c_queries++;
-	pthread_mutex_unlock(&cache_stats_lock);
+	hash = dkim_cache_hash(str);
+	shard = dkim_cache_shard(cache, hash);
 
-	pthread_mutex_lock(&cache_lock);
+	pthread_mutex_lock(&shard->shard_lock);
 
-#if DB_VERSION_CHECK(2,0,0)
-	status = db->get(db, NULL, &q, &d, 0);
-#else /* DB_VERSION_CHECK(2,0,0) */
-	status = db->get(db, &q, &d, 0);
-#endif /* DB_VERSION_CHECK(2,0,0) */
+	shard->shard_queries++;
 
-	pthread_mutex_unlock(&cache_lock);
-
-	if (status == 0)
+	for (ce = shard->shard_buckets[hash & (shard->shard_nbuckets - 1)];
+	     ce != NULL;
+	     ce = ce->cache_hnext)
 	{
-#if !DB_VERSION_CHECK(2,0,0)
-		memset(&ce, '\0', sizeof ce);
-		memcpy(&ce, d.data, MIN(sizeof ce, d.size));
-#endif /* ! DB_VERSION_CHECK(2,0,0) */
-
-		if (ttl != 0)
-			ce.cache_ttl = ttl;
-		if (ce.cache_when + ce.cache_ttl < now)
-		{
-			pthread_mutex_lock(&cache_stats_lock);
-			c_expired++;
-			pthread_mutex_unlock(&cache_stats_lock);
-
-			return 1;
-		}
-
-		pthread_mutex_lock(&cache_stats_lock);
-		c_hits++;
-		pthread_mutex_unlock(&cache_stats_lock);
-
-		strlcpy(buf, ce.cache_data, *buflen);
-		*buflen = strlen(ce.cache_data);
-		return 0;
+		if (ce->cache_hash == hash && strcmp(ce->cache_key, str) == 0)
+			break;
 	}
-	else if (status != DB_NOTFOUND)
+
+	if (ce == NULL)
 	{
-		*err = status;
-		return -1;
+		pthread_mutex_unlock(&shard->shard_lock);
+		return 1;
 	}
-	else
+
+	if ((ttl == 0 && ce->cache_expire < now) ||
+	    (ttl != 0 && ce->cache_when + ttl < now))
 	{
+		shard->shard_expired++;
+		pthread_mutex_unlock(&shard->shard_lock);
 		return 1;
 	}
+
+	shard->shard_hits++;
+	ce->cache_ref = TRUE;
+
+	strlcpy(buf, ce->cache_data, *buflen);
+	*buflen = strlen(ce->cache_data);
+
+	pthread_mutex_unlock(&shard->shard_lock);
+
+	return 0;
 }
 
 /*
-**  DKIM_CACHE_INSERT -- insert data into an on-disk cache of entries
+**  DKIM_CACHE_INSERT -- insert data into an in-memory cache of entries
 **
 **  Parameters:
-**  	db -- DB handle referring to the cache
+**  	cache -- cache handle
 **  	str -- key to insert
 **  	data -- data to insert
 **  	ttl -- time-to-live
@@ -259,63 +406,133 @@ dkim_cache_query(DB *db, char *str, int ttl, char *buf, size_t *buflen,
 **  Return value:
 **  	-1 -- error; caller should check "err"
 **  	0 -- cache updated
+**
+**  Notes:
+**  	An entry too large to fit in its shard's share of the memory
+**  	budget is silently not cached.
 */
 
 int
-dkim_cache_insert(DB *db, char *str, char *data, int ttl, int *err)
+dkim_cache_insert(struct dkim_cache *cache, char *str, char *data, int ttl,
+                  int *err)
 {
-	int status;
+	u_int hash;
+	u_int slot;
+	size_t keylen;
+	size_t datalen;
+	size_t size;
 	time_t now;
-	DBT q;
-	DBT d;
-	struct dkim_cache_entry ce;
+	struct dkim_cache_shard *shard;
+	struct dkim_cache_entry *ce;
+	struct dkim_cache_entry *victim;
 
-	assert(db != NULL);
+	assert(cache != NULL);
 	assert(str != NULL);
 	assert(data != NULL);
 	assert(err != NULL);
 
 	(void) time(&now);
 
-	memset(&q, '\0', sizeof q);
-	memset(&d, '\0', sizeof d);
+	hash = dkim_cache_hash(str);
+	shard = dkim_cache_shard(cache, hash);
 
-	q.data = str;
-	q.size = strlen(str);
+	keylen = strlen(str);
+	datalen = strlen(data);
+	size = sizeof *ce + keylen + datalen + 2;
 
-	d.data = (void *) &ce;
-	d.size = sizeof ce;
+	if (size > shard->shard_budget)
+		return 0;
 
-	ce.cache_when = now;
-	ce.cache_ttl = ttl;
-	strlcpy(ce.cache_data, data, sizeof ce.cache_data);
+	ce = (struct dkim_cache_entry *) malloc(size);
+	if (ce == NULL)
+	{
+		*err = errno;
+		return -1;
+	}
+
+	memset(ce, '\0', sizeof *ce);
+	ce->cache_hash = hash;
+	ce->cache_ttl = ttl;
+	ce->cache_when = now;
+	ce->cache_expire = now + ttl;
+	ce->cache_size = size;
+	ce->cache_key = (char *) (ce + 1);
+	ce->cache_data = ce->cache_key + keylen + 1;
+	memcpy(ce->cache_key, str, keylen + 1);
+	memcpy(ce->cache_data, data, datalen + 1);
+
+	pthread_mutex_lock(&shard->shard_lock);
+
+	/* replace any existing entry */
+	for (victim = shard->shard_buckets[hash & (shard->shard_nbuckets - 1)];
+	     victim != NULL;
+	     victim = victim->cache_hnext)
+	{
+		if (victim->cache_hash == hash &&
+		    strcmp(victim->cache_key, str) == 0)
+		{
+			dkim_cache_remove(shard, victim);
+			break;
+		}
+	}
+
+	/* make room */
+	while (shard->shard_bytes + size > shard->shard_budget)
+	{
+		victim = shard->shard_hand;
+		assert(victim != NULL);
+
+		shard->shard_hand = victim->cache_cnext;
+
+		if (victim->cache_ref)
+			victim->cache_ref = FALSE;
+		else
+			dkim_cache_remove(shard, victim);
+	}
 
-	pthread_mutex_lock(&cache_lock);
+	if (shard->shard_nkeys >= shard->shard_nbuckets)
+		dkim_cache_grow(shard);
 
-#if DB_VERSION_CHECK(2,0,0)
-	status = db->put(db, NULL, &q, &d, 0);
-#else /* DB_VERSION_CHECK(2,0,0) */
-	status = db->put(db, &q, &d, 0);
-#endif /* DB_VERSION_CHECK(2,0,0) */
+	/* hash chain */
+	ce->cache_hnext = shard->shard_buckets[hash & (shard->shard_nbuckets - 1)];
+	shard->shard_buckets[hash & (shard->shard_nbuckets - 1)] = ce;
 
-	pthread_mutex_unlock(&cache_lock);
+	/* expiry wheel */
+	slot = dkim_cache_wheelslot(shard, ce->cache_expire);
+	ce->cache_slot = slot;
+	ce->cache_wnext = shard->shard_wheel[slot];
+	if (ce->cache_wnext != NULL)
+		ce->cache_wnext->cache_wprev = ce;
+	shard->shard_wheel[slot] = ce;
 
-	if (status == 0)
+	/* eviction clock; new entries go just behind the hand */
+	if (shard->shard_hand == NULL)
 	{
-		return 0;
+		ce->cache_cnext = ce;
+		ce->cache_cprev = ce;
+		shard->shard_hand = ce;
 	}
 	else
 	{
-		*err = status;
-		return -1;
+		ce->cache_cnext = shard->shard_hand;
+		ce->cache_cprev = shard->shard_hand->cache_cprev;
+		ce->cache_cprev->cache_cnext = ce;
+		shard->shard_hand->cache_cprev = ce;
 	}
+
+	shard->shard_nkeys++;
+	shard->shard_bytes += size;
+
+	pthread_mutex_unlock(&shard->shard_lock);
+
+	return 0;
 }
 
 /*
-**  DKIM_CACHE_EXPIRE -- expire records in an on-disk cache of entries
+**  DKIM_CACHE_EXPIRE -- expire records in an in-memory cache of entries
 **
 **  Parameters:
-**  	db -- DB handle referring to the cache
+**  	cache -- cache handle
 **  	ttl -- time-to-live; delete any record older than this; if 0, apply
 **  	       the TTL in the record
 **  	err -- error code (returned)
@@ -323,223 +540,189 @@ dkim_cache_insert(DB *db, char *str, char *data, int ttl, int *err)
 **  Return value:
 **  	-1 -- error; caller should check "err"
 **  	otherwise -- count of deleted records
+**
+**  Notes:
+**  	When "ttl" is 0, only the expiry wheel slots the clock has moved
+**  	through since the last call are examined, so the cost depends on
+**  	how much has expired rather than on the size of the cache.  Only
+**  	one shard is locked at a time.
 */
 
 int
-dkim_cache_expire(DB *db, int ttl, int *err)
+dkim_cache_expire(struct dkim_cache *cache, int ttl, int *err)
 {
-#if !DB_VERSION_CHECK(2,0,0)
-	bool first = TRUE;
-#endif /* ! DB_VERSION_CHECK(2,0,0) */
-	bool delete;
+	int c;
 	int deleted = 0;
-	int status;
+	u_int n;
 	time_t now;
-#if DB_VERSION_CHECK(2,0,0)
-	DBC *dbc;
-#endif /* DB_VERSION_CHECK(2,0,0) */
-	DBT q;
-	DBT d;
-	char name[DKIM_MAXHOSTNAMELEN + 1];
-	struct dkim_cache_entry ce;
-
-	assert(db != NULL);
-	assert(err != NULL);
+	time_t tick;
+	struct dkim_cache_shard *shard;
+	struct dkim_cache_entry *ce;
+	struct dkim_cache_entry *next;
 
-	memset(&q, '\0', sizeof q);
-	memset(&d, '\0', sizeof d);
+	assert(cache != NULL);
+	assert(err != NULL);
 
 	(void) time(&now);
 
-	pthread_mutex_lock(&cache_lock);
-
-#if DB_VERSION_CHECK(2,0,0)
-	status = db->cursor(db, NULL, &dbc, 0);
-	if (status != 0)
+	for (c = 0; c < CACHE_SHARDS; c++)
 	{
-		*err = status;
-		pthread_mutex_unlock(&cache_lock);
-		return -1;
-	}
-#endif /* DB_VERSION_CHECK(2,0,0) */
+		shard = &cache->cache_shards[c];
 
-	for (;;)
-	{
-		memset(name, '\0', sizeof name);
-		memset(&ce, '\0', sizeof ce);
-
-#if DB_VERSION_CHECK(3,0,0)
-		q.data = name;
-		q.flags = DB_DBT_USERMEM;
-		q.ulen = sizeof name;
-#endif /* DB_VERSION_CHECK(3,0,0) */
-
-#if DB_VERSION_CHECK(3,0,0)
-		d.data = (void *) &ce;
-		d.flags = DB_DBT_USERMEM;
-		d.ulen = sizeof ce;
-#endif /* DB_VERSION_CHECK(3,0,0) */
-
-#if DB_VERSION_CHECK(2,0,0)
-		status = dbc->c_get(dbc, &q, &d, DB_NEXT);
-		if (status == DB_NOTFOUND)
-		{
-			break;
-		}
-		else if (status != 0)
-		{
-			*err = status;
-			break;
-		}
-#else /* DB_VERSION_CHECK(2,0,0) */
-		status = db->seq(db, &q, &d, first ? R_FIRST : R_NEXT);
-		if (status == DB_NOTFOUND)
-		{
-			break;
-		}
-		else if (status != 0)
-		{
-			*err = status;
-			break;
-		}
+		pthread_mutex_lock(&shard->shard_lock);
 
-		first = FALSE;
-
-		memcpy(name, q.data, MIN(sizeof name, q.size));
-		memcpy((void *) &ce, d.data, MIN(sizeof ce, d.size));
-#endif /* DB_VERSION_CHECK(2,0,0) */
-
-		delete = FALSE;
-		if (ttl == 0)
+		if (ttl != 0)
 		{
-			if (ce.cache_when + ce.cache_ttl < now)
-				delete = TRUE;
+			n = shard->shard_nkeys;
+			ce = shard->shard_hand;
+
+			while (n-- > 0)
+			{
+				next = ce->cache_cnext;
+				if (ce->cache_when + ttl < now)
+				{
+					dkim_cache_remove(shard, ce);
+					deleted++;
+				}
+				ce = next;
+			}
 		}
 		else
 		{
-			if (ce.cache_when + ttl < now)
-				delete = TRUE;
-		}
+			tick = now / CACHE_WHEELGRAIN;
+			if (tick - shard->shard_wheeltick >= CACHE_WHEELSLOTS)
+				shard->shard_wheeltick = tick - CACHE_WHEELSLOTS + 1;
 
-		if (delete)
-		{
-#if DB_VERSION_CHECK(2,0,0)
-			status = dbc->c_del(dbc, 0);
-#else /* DB_VERSION_CHECK(2,0,0) */
-			status = db->del(db, &q, R_CURSOR);
-#endif /* DB_VERSION_CHECK(2,0,0) */
-			if (status != 0)
+			for (;;)
 			{
-				*err = status;
-				deleted = -1;
-				break;
+				n = (u_int) (shard->shard_wheeltick % CACHE_WHEELSLOTS);
+
+				for (ce = shard->shard_wheel[n]; ce != NULL; ce = next)
+				{
+					next = ce->cache_wnext;
+					if (ce->cache_expire < now)
+					{
+						dkim_cache_remove(shard, ce);
+						deleted++;
+					}
+				}
+
+				if (shard->shard_wheeltick == tick)
+					break;
+
+				shard->shard_wheeltick++;
 			}
-
-			deleted++;
 		}
-	}
-
-#if DB_VERSION_CHECK(2,0,0)
-	(void) dbc->c_close(dbc);
-#endif /* DB_VERSION_CHECK(2,0,0) */
 
-	pthread_mutex_unlock(&cache_lock);
+		pthread_mutex_unlock(&shard->shard_lock);
+	}
 
 	return deleted;
 }
 
 /*
-**  DKIM_CACHE_CLOSE -- close a cache database
+**  DKIM_CACHE_CLOSE -- destroy a cache
 **
 **  Parameters:
-**  	db -- cache DB handle
+**  	cache -- cache handle
 **
 **  Return value:
 **  	None.
 */
 
 void
-dkim_cache_close(DB *db)
+dkim_cache_close(struct dkim_cache *cache)
 {
-	assert(db != NULL);
+	int c;
+	u_int b;
+	struct dkim_cache_shard *shard;
+	struct dkim_cache_entry *ce;
+	struct dkim_cache_entry *next;
 
-#if DB_VERSION_CHECK(2,0,0)
-	(void) db->close(db, 0);
-#else /* DB_VERSION_CHECK(2,0,0) */
-	(void) db->close(db);
-#endif /* DB_VERSION_CHECK(2,0,0) */
+	assert(cache != NULL);
 
-	(void) pthread_mutex_destroy(&cache_lock);
+	for (c = 0; c < CACHE_SHARDS; c++)
+	{
+		shard = &cache->cache_shards[c];
+
+		for (b = 0; b < shard->shard_nbuckets; b++)
+		{
+			for (ce = shard->shard_buckets[b]; ce != NULL; ce = next)
+			{
+				next = ce->cache_hnext;
+				free(ce);
+			}
+		}
+
+		free(shard->shard_buckets);
+		(void) pthread_mutex_destroy(&shard->shard_lock);
+	}
+
+	free(cache);
 }
 
 /*
 **  DKIM_CACHE_STATS -- retrieve cache performance statistics
 **
 **  Parameters:
+**  	cache -- cache handle
 **  	queries -- number of queries handled (returned)
 **  	hits -- number of cache hits (returned)
 **  	expired -- number of expired hits (returned)
+**  	keys -- number of keys in the cache (returned)
+**  	reset -- if TRUE, reset the queries, hits and expired counters
 **
 **  Return value:
 **  	None.
 **
 **  Notes:
 **  	Any of the parameters may be NULL if the corresponding datum
-**  	is not of interest.
+**  	is not of interest.  The totals are gathered one shard at a time,
+**  	so they are not a single atomic snapshot.
 */
 
 void
-dkim_cache_stats(DB *db, u_int *queries, u_int *hits, u_int *expired,
-                 u_int *keys, _Bool reset)
+dkim_cache_stats(struct dkim_cache *cache, u_int *queries, u_int *hits,
+                 u_int *expired, u_int *keys, _Bool reset)
 {
-	pthread_mutex_lock(&cache_stats_lock);
+	int c;
+	u_int q = 0;
+	u_int h = 0;
+	u_int e = 0;
+	u_int k = 0;
+	struct dkim_cache_shard *shard;
 
-	if (queries != NULL)
-		*queries = c_queries;
+	assert(cache != NULL);
 
-	if (hits != NULL)
-		*hits = c_hits;
+	for (c = 0; c < CACHE_SHARDS; c++)
+	{
+		shard = &cache->cache_shards[c];
 
-	if (expired != NULL)
-		*expired = c_expired;
+		pthread_mutex_lock(&shard->shard_lock);
 
-	if (keys != NULL)
-	{
-#if DB_VERSION_CHECK(2,0,0)
-		DB_HASH_STAT *sp;
-
-# if DB_VERSION_CHECK(4,3,0)
-		if (db->stat(db, NULL, (void *) &sp, 0) != 0)
-# elif DB_VERSION_CHECK(4,0,0)
-		if (db->stat(db, (void *) &sp, 0) != 0)
-# else /* DB_VERSION_CHECK(4,0,0) */
-		if (db->stat(db, (void *) &sp, NULL, 0) != 0)
-# endif /* DB_VERSION_CHECK(4,0,0) */
-		{
-			*keys = (u_int) -1;
-		}
-		else
+		q += shard->shard_queries;
+		h += shard->shard_hits;
+		e += shard->shard_expired;
+		k += shard->shard_nkeys;
+
+		if (reset)
 		{
-# if DB_VERSION_CHECK(3,0,0)
-			*keys = sp->hash_nkeys;
-# else /* DB_VERSION_CHECK(3,0,0) */
-			*keys = sp->hash_nrecs;
-# endif /* DB_VERSION_CHECK(3,0,0) */
-			free(sp);
+			shard->shard_queries = 0;
+			shard->shard_hits = 0;
+			shard->shard_expired = 0;
 		}
-#else /* DB_VERSION_CHECK(2,0,0) */
-		*keys = (u_int) -1;
-#endif /* DB_VERSION_CHECK(2,0,0) */
-	}
 
-	if (reset)
-	{
-		c_queries = 0;
-		c_hits = 0;
-		c_expired = 0;
+		pthread_mutex_unlock(&shard->shard_lock);
 	}
 
-	pthread_mutex_unlock(&cache_stats_lock);
+	if (queries != NULL)
+		*queries = q;
+	if (hits != NULL)
+		*hits = h;
+	if (expired != NULL)
+		*expired = e;
+	if (keys != NULL)
+		*keys = k;
 }
 
 #endif /* QUERY_CACHE */
@@ -2,7 +2,7 @@
 **  Copyright (c) 2007 Sendmail, Inc. and its suppliers.
 **    All rights reserved.
 **
-**  Copyright (c) 2009, 2012, 2013, The Trusted Domain Project.
+**  Copyright (c) 2009, 2012, 2013, 2015, The Trusted Domain Project.
 **    All rights reserved.
 */
 
@@ -15,17 +15,19 @@
 
 #ifdef QUERY_CACHE
 
-/* libdb includes */
-#include <db.h>
+/* data types */
+struct dkim_cache;
 
 /* prototypes */
-extern void dkim_cache_close __P((DB *));
-extern int dkim_cache_expire __P((DB *, int, int *));
-extern DB *dkim_cache_init __P((int *, char *));
-extern int dkim_cache_insert __P((DB *, char *, char *, int, int *));
-extern int dkim_cache_query __P((DB *, char *, int, char *, size_t *, int *));
-extern void dkim_cache_stats __P((DB *, u_int *, u_int *, u_int *, u_int *,
-                                  _Bool));
+extern void dkim_cache_close __P((struct dkim_cache *));
+extern int dkim_cache_expire __P((struct dkim_cache *, int, int *));
+extern struct dkim_cache *dkim_cache_init __P((int *, size_t));
+extern int dkim_cache_insert __P((struct dkim_cache *, char *, char *, int,
+                                  int *));
+extern int dkim_cache_query __P((struct dkim_cache *, char *, int, char *,
+                                 size_t *, int *));
+extern void dkim_cache_stats __P((struct dkim_cache *, u_int *, u_int *,
+                                  u_int *, u_int *, _Bool));
 
 #endif /* QUERY_CACHE */
 
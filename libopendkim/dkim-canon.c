@@ -23,6 +23,7 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <limits.h>
+#include <stdint.h>
 #ifdef USE_TRE
 # ifdef TRE_PRE_080
 #  include <tre/regex.h>
@@ -38,6 +39,17 @@
 # include <regex.h>
 #endif /* USE_TRE */
 
+/* vector extensions, if available */
+#if defined(__SSE2__) && !defined(DKIM_CANON_NOSIMD)
+# define DKIM_CANON_SSE2
+# include <emmintrin.h>
+# if (defined(__x86_64__) || defined(__i386__)) && \
+     ((defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__))
+#  define DKIM_CANON_AVX2
+#  include <immintrin.h>
+# endif /* (__x86_64__ || __i386__) && (__GNUC__ >= 5 || __clang__) */
+#endif /* __SSE2__ && ! DKIM_CANON_NOSIMD */
+
 /* libopendkim includes */
 #include "dkim-internal.h"
 #include "dkim-types.h"
@@ -66,8 +78,165 @@
 /* prototypes */
 extern void dkim_error __P((DKIM *, const char *, ...));
 
+/* body scanners */
+typedef u_char *(*dkim_canon_scan_t) __P((u_char *, u_char *,
+                                         int, int, int));
+
+static u_char *dkim_canon_scan_generic __P((u_char *, u_char *,
+                                            int, int, int));
+
+static dkim_canon_scan_t dkim_canon_scanner = dkim_canon_scan_generic;
+
 /* ========================= PRIVATE SECTION ========================= */
 
+/*
+**  DKIM_CANON_SCAN_GENERIC -- find the next interesting byte in a body chunk
+**
+**  Parameters:
+**  	p -- start of the region to scan
+**  	end -- end of the region to scan (exclusive)
+**  	c1, c2, c3 -- bytes to find
+**
+**  Return value:
+**  	Pointer to the first byte in [p, end) that matches one of c1, c2
+**  	or c3, or "end" if there is none.
+**
+**  Notes:
+**  	Portable version; compares eight bytes at a time using the usual
+**  	"has a zero byte" trick and falls back to a bytewise scan only
+**  	for the word that contains a match.
+*/
+
+#define	DKIM_CANON_ONES		0x0101010101010101ULL
+#define	DKIM_CANON_HIGHS	0x8080808080808080ULL
+#define	DKIM_CANON_HASZERO(x)	(((x) - DKIM_CANON_ONES) & ~(x) & DKIM_CANON_HIGHS)
+
+static u_char *
+dkim_canon_scan_generic(u_char *p, u_char *end, int c1, int c2, int c3)
+{
+	uint64_t w;
+	uint64_t m1;
+	uint64_t m2;
+	uint64_t m3;
+
+	m1 = DKIM_CANON_ONES * (u_char) c1;
+	m2 = DKIM_CANON_ONES * (u_char) c2;
+	m3 = DKIM_CANON_ONES * (u_char) c3;
+
+	while (end - p >= (ssize_t) sizeof w)
+	{
+		memcpy(&w, p, sizeof w);
+
+		if (DKIM_CANON_HASZERO(w ^ m1) ||
+		    DKIM_CANON_HASZERO(w ^ m2) ||
+		    DKIM_CANON_HASZERO(w ^ m3))
+			break;
+
+		p += sizeof w;
+	}
+
+	for (; p < end; p++)
+	{
+		if (*p == c1 || *p == c2 || *p == c3)
+			break;
+	}
+
+	return p;
+}
+
+#ifdef DKIM_CANON_SSE2
+/*
+**  DKIM_CANON_SCAN_SSE2 -- find the next interesting byte in a body chunk
+**
+**  Parameters:
+**  	p -- start of the region to scan
+**  	end -- end of the region to scan (exclusive)
+**  	c1, c2, c3 -- bytes to find
+**
+**  Return value:
+**  	As for dkim_canon_scan_generic(), but sixteen bytes at a time.
+*/
+
+static u_char *
+dkim_canon_scan_sse2(u_char *p, u_char *end, int c1, int c2, int c3)
+{
+	int mask;
+	__m128i m;
+	__m128i v;
+	__m128i v1;
+	__m128i v2;
+	__m128i v3;
+
+	v1 = _mm_set1_epi8((char) c1);
+	v2 = _mm_set1_epi8((char) c2);
+	v3 = _mm_set1_epi8((char) c3);
+
+	while (end - p >= 16)
+	{
+		v = _mm_loadu_si128((const __m128i *) p);
+		m = _mm_or_si128(_mm_cmpeq_epi8(v, v1),
+		                 _mm_cmpeq_epi8(v, v2));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, v3));
+		mask = _mm_movemask_epi8(m);
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+
+		p += 16;
+	}
+
+	return dkim_canon_scan_generic(p, end, c1, c2, c3);
+}
+#endif /* DKIM_CANON_SSE2 */
+
+#ifdef DKIM_CANON_AVX2
+/*
+**  DKIM_CANON_SCAN_AVX2 -- find the next interesting byte in a body chunk
+**
+**  Parameters:
+**  	p -- start of the region to scan
+**  	end -- end of the region to scan (exclusive)
+**  	c1, c2, c3 -- bytes to find
+**
+**  Return value:
+**  	As for dkim_canon_scan_generic(), but thirty-two bytes at a time.
+**
+**  Notes:
+**  	Compiled for AVX2 regardless of the global compiler flags; only
+**  	selected by dkim_canon_scaninit() if the CPU supports it.
+*/
+
+__attribute__((target("avx2")))
+static u_char *
+dkim_canon_scan_avx2(u_char *p, u_char *end, int c1, int c2, int c3)
+{
+	unsigned int mask;
+	__m256i m;
+	__m256i v;
+	__m256i v1;
+	__m256i v2;
+	__m256i v3;
+
+	v1 = _mm256_set1_epi8((char) c1);
+	v2 = _mm256_set1_epi8((char) c2);
+	v3 = _mm256_set1_epi8((char) c3);
+
+	while (end - p >= 32)
+	{
+		v = _mm256_loadu_si256((const __m256i *) p);
+		m = _mm256_or_si256(_mm256_cmpeq_epi8(v, v1),
+		                    _mm256_cmpeq_epi8(v, v2));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, v3));
+		mask = (unsigned int) _mm256_movemask_epi8(m);
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+
+		p += 32;
+	}
+
+	return dkim_canon_scan_sse2(p, end, c1, c2, c3);
+}
+#endif /* DKIM_CANON_AVX2 */
+
 /*
 **  DKIM_CANON_FREE -- destroy a canonicalization
 **
@@ -172,7 +341,7 @@ dkim_canon_free(DKIM *dkim, DKIM_CANON *canon)
 }
 
 /*
-**  DKIM_CANON_WRITE -- write data to canonicalization stream(s)
+**  DKIM_CANON_HASH -- feed data to one canonicalization's hash
 **
 **  Parameters:
 **  	canon -- DKIM_CANON handle
@@ -184,7 +353,7 @@ dkim_canon_free(DKIM *dkim, DKIM_CANON *canon)
 */
 
 static void
-dkim_canon_write(DKIM_CANON *canon, u_char *buf, size_t buflen)
+dkim_canon_hash(DKIM_CANON *canon, u_char *buf, size_t buflen)
 {
 	assert(canon != NULL);
 
@@ -250,6 +419,37 @@ dkim_canon_write(DKIM_CANON *canon, u_char *buf, size_t buflen)
 		canon->canon_remain -= buflen;
 }
 
+/*
+**  DKIM_CANON_WRITE -- write data to canonicalization stream(s)
+**
+**  Parameters:
+**  	canon -- DKIM_CANON handle
+**  	buf -- buffer containing canonicalized data
+**  	buflen -- number of bytes to consume
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Body canonicalizations that share this one's stream (see
+**  	dkim_add_canon()) are fed the same data, each subject to its
+**  	own length limit.
+*/
+
+static void
+dkim_canon_write(DKIM_CANON *canon, u_char *buf, size_t buflen)
+{
+	DKIM_CANON *cur;
+
+	assert(canon != NULL);
+
+	if (buf != NULL && buflen > 0)
+		canon->canon_output = TRUE;
+
+	for (cur = canon; cur != NULL; cur = cur->canon_taps)
+		dkim_canon_hash(cur, buf, buflen);
+}
+
 /*
 **  DKIM_CANON_BUFFER -- buffer for dkim_canon_write()
 **
@@ -474,6 +674,13 @@ dkim_canon_header_string(struct dkim_dstring *dstr, dkim_canon_t canon,
 **
 **  Return value:
 **  	A DKIM_STAT constant.
+**
+**  Notes:
+**  	"crlf" is set only for header fields of the message, which don't
+**  	change once added.  Their relaxed form is computed the first time
+**  	it's needed and kept with the header field, so every signature
+**  	and hash covering it hashes the same bytes.  The simple form is
+**  	the header field as received, so it's hashed from there.
 */
 
 static DKIM_STAT
@@ -486,6 +693,24 @@ dkim_canon_header(DKIM *dkim, DKIM_CANON *canon, struct dkim_header *hdr,
 	assert(canon != NULL);
 	assert(hdr != NULL);
 
+	if (crlf && canon->canon_canon == DKIM_CANON_SIMPLE)
+	{
+		dkim_canon_buffer(canon, NULL, 0);
+		dkim_canon_buffer(canon, hdr->hdr_text, hdr->hdr_textlen);
+		dkim_canon_buffer(canon, CRLF, 2);
+
+		return DKIM_STAT_OK;
+	}
+
+	if (crlf && hdr->hdr_relaxed != NULL)
+	{
+		dkim_canon_buffer(canon, NULL, 0);
+		dkim_canon_buffer(canon, hdr->hdr_relaxed,
+		                  hdr->hdr_relaxedlen);
+
+		return DKIM_STAT_OK;
+	}
+
 	if (dkim->dkim_canonbuf == NULL)
 	{
 		dkim->dkim_canonbuf = dkim_dstring_new(dkim, hdr->hdr_textlen,
@@ -507,6 +732,24 @@ dkim_canon_header(DKIM *dkim, DKIM_CANON *canon, struct dkim_header *hdr,
 	if (status != DKIM_STAT_OK)
 		return status;
 
+	if (crlf)
+	{
+		DKIM *owner = dkim;
+
+#ifdef _FFR_RESIGN
+		/* header fields bound from another handle are freed by it */
+		if (dkim->dkim_resign != NULL && dkim->dkim_hdrbind)
+			owner = dkim->dkim_resign;
+#endif /* _FFR_RESIGN */
+
+		hdr->hdr_relaxedlen = dkim_dstring_len(dkim->dkim_canonbuf);
+		hdr->hdr_relaxed = dkim_strdup(owner,
+		                               dkim_dstring_get(dkim->dkim_canonbuf),
+		                               hdr->hdr_relaxedlen);
+		if (hdr->hdr_relaxed == NULL)
+			return DKIM_STAT_NORESOURCE;
+	}
+
 	dkim_canon_buffer(canon, dkim_dstring_get(dkim->dkim_canonbuf),
 	                  dkim_dstring_len(dkim->dkim_canonbuf));
 
@@ -536,35 +779,136 @@ dkim_canon_flushblanks(DKIM_CANON *canon)
 }
 
 /*
-**  DKIM_CANON_FIXCRLF -- rebuffer a body chunk, fixing "naked" CRs and LFs
+**  DKIM_CANON_GETSCANNER -- select a body scanner for a DKIM handle
 **
 **  Parameters:
 **  	dkim -- DKIM handle
-**  	canon -- canonicalization being handled
+**
+**  Return value:
+**  	The body scanner to use.
+*/
+
+static dkim_canon_scan_t
+dkim_canon_getscanner(DKIM *dkim)
+{
+	assert(dkim != NULL);
+
+	if ((dkim->dkim_libhandle->dkiml_flags & DKIM_LIBFLAGS_NOSIMD) != 0)
+		return dkim_canon_scan_generic;
+	else
+		return dkim_canon_scanner;
+}
+
+/*
+**  DKIM_CANON_WORDROOM -- how much of a word will fit in canon_buf
+**
+**  Parameters:
+**  	canon -- DKIM_CANON handle
+**  	len -- length of the word fragment to be added
+**
+**  Return value:
+**  	Number of bytes of "len" that canon_buf will accept.
+**
+**  Notes:
+**  	canon_buf is size-limited, and the bytewise code this replaced
+**  	silently dropped anything beyond the limit.  That behaviour is
+**  	preserved here so that body hashes do not change.
+*/
+
+static size_t
+dkim_canon_wordroom(DKIM_CANON *canon, size_t len)
+{
+	struct dkim_dstring *ds;
+
+	assert(canon != NULL);
+
+	ds = canon->canon_buf;
+
+	if (ds->ds_max <= 0)
+		return len;
+	else if (ds->ds_len + 1 >= ds->ds_max)
+		return 0;
+	else
+		return MIN(len, (size_t) (ds->ds_max - ds->ds_len - 1));
+}
+
+/*
+**  DKIM_CANON_FIXCRLF -- fix "naked" CRs and LFs in a body chunk
+**
+**  Parameters:
+**  	dkim -- DKIM handle
+**  	prev -- last byte of the previous body chunk
 **  	buf -- buffer to be fixed
 **  	buflen -- number of bytes at "buf"
+**  	out -- fixed chunk (returned)
+**  	outlen -- number of bytes at "out" (returned)
 **
 **  Return value:
 **  	A DKIM_STAT_* constant.
 **
 **  Side effects:
-**  	dkim->dkim_canonbuf will be initialized and used.
+**  	dkim->dkim_canonbuf will be initialized and used if the chunk
+**  	needs fixing; otherwise "out" is simply "buf".
+**
+**  Notes:
+**  	A CR at the very end of the chunk is passed through unchanged;
+**  	whether it is solitary depends on the next chunk, which the
+**  	canonicalizations handle themselves.
 */
 
 static DKIM_STAT
-dkim_canon_fixcrlf(DKIM *dkim, DKIM_CANON *canon, u_char *buf, size_t buflen)
+dkim_canon_fixcrlf(DKIM *dkim, u_char prev, u_char *buf, size_t buflen,
+                   u_char **out, size_t *outlen)
 {
-	u_char prev;
 	u_char *p;
+	u_char *q;
 	u_char *eob;
+	dkim_canon_scan_t scan;
 
 	assert(dkim != NULL);
-	assert(canon != NULL);
 	assert(buf != NULL);
+	assert(out != NULL);
+	assert(outlen != NULL);
+
+	scan = dkim_canon_getscanner(dkim);
+
+	eob = buf + buflen - 1;
+
+	/*
+	**  Most chunks already have proper line endings; find the first
+	**  CR or LF that isn't part of a CRLF, and don't copy anything
+	**  if there isn't one.
+	*/
+
+	for (p = buf; p <= eob; p++)
+	{
+		p = scan(p, eob + 1, '\r', '\n', '\n');
+		if (p > eob)
+			break;
+
+		if (*p == '\n')
+		{
+			if ((p == buf ? prev : *(p - 1)) != '\r')
+				break;
+		}
+		else if (p < eob)
+		{
+			if (*(p + 1) != '\n')
+				break;
+			p++;
+		}
+	}
+
+	if (p > eob)
+	{
+		*out = buf;
+		*outlen = buflen;
+		return DKIM_STAT_OK;
+	}
 
 	if (dkim->dkim_canonbuf == NULL)
 	{
-		dkim->dkim_canonbuf = dkim_dstring_new(dkim, buflen, 0);
+		dkim->dkim_canonbuf = dkim_dstring_new(dkim, buflen + 2, 0);
 		if (dkim->dkim_canonbuf == NULL)
 			return DKIM_STAT_NORESOURCE;
 	}
@@ -573,12 +917,25 @@ dkim_canon_fixcrlf(DKIM *dkim, DKIM_CANON *canon, u_char *buf, size_t buflen)
 		dkim_dstring_blank(dkim->dkim_canonbuf);
 	}
 
-	eob = buf + buflen - 1;
-
-	prev = canon->canon_lastchar;
+	/* everything before the first problem is fine as it is */
+	if (p > buf)
+	{
+		dkim_dstring_catn(dkim->dkim_canonbuf, buf, p - buf);
+		prev = *(p - 1);
+	}
 
-	for (p = buf; p <= eob; p++)
+	for (; p <= eob; p++)
 	{
+		if (*p != '\r' && *p != '\n')
+		{
+			/* copy everything up to the next CR or LF at once */
+			q = scan(p, eob + 1, '\r', '\n', '\n');
+			dkim_dstring_catn(dkim->dkim_canonbuf, p, q - p);
+			prev = *(q - 1);
+			p = q - 1;
+			continue;
+		}
+
 		if (*p == '\n' && prev != '\r')
 		{
 			/* fix a solitary LF */
@@ -602,11 +959,49 @@ dkim_canon_fixcrlf(DKIM *dkim, DKIM_CANON *canon, u_char *buf, size_t buflen)
 		prev = *p;
 	}
 
+	*out = dkim_dstring_get(dkim->dkim_canonbuf);
+	*outlen = dkim_dstring_len(dkim->dkim_canonbuf);
+
 	return DKIM_STAT_OK;
 }
 
 /* ========================= PUBLIC SECTION ========================= */
 
+/*
+**  DKIM_CANON_SCANINIT -- select the fastest available body scanner
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	TRUE iff a vectorized body scanner was selected.
+**
+**  Notes:
+**  	The choice depends only on the CPU, so it is safe for concurrent
+**  	callers to race here; they will all store the same answer.
+*/
+
+_Bool
+dkim_canon_scaninit(void)
+{
+#ifdef DKIM_CANON_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		dkim_canon_scanner = dkim_canon_scan_avx2;
+		return TRUE;
+	}
+#endif /* DKIM_CANON_AVX2 */
+
+#ifdef DKIM_CANON_SSE2
+	dkim_canon_scanner = dkim_canon_scan_sse2;
+	return TRUE;
+#else /* DKIM_CANON_SSE2 */
+	dkim_canon_scanner = dkim_canon_scan_generic;
+	return FALSE;
+#endif /* DKIM_CANON_SSE2 */
+}
+
 /*
 **  DKIM_CANON_INIT -- initialize all canonicalizations
 **
@@ -630,18 +1025,25 @@ dkim_canon_init(DKIM *dkim, _Bool tmp, _Bool keep)
 
 	for (cur = dkim->dkim_canonhead; cur != NULL; cur = cur->canon_next)
 	{
-		cur->canon_hashbuf = DKIM_MALLOC(dkim, DKIM_HASHBUFSIZE);
-		if (cur->canon_hashbuf == NULL)
+		/* shared body streams are buffered by their owner */
+		if (cur->canon_stream == NULL)
 		{
-			dkim_error(dkim, "unable to allocate %d byte(s)",
-			           DKIM_HASHBUFSIZE);
-			return DKIM_STAT_NORESOURCE;
+			cur->canon_hashbuf = DKIM_MALLOC(dkim,
+			                                 DKIM_HASHBUFSIZE);
+			if (cur->canon_hashbuf == NULL)
+			{
+				dkim_error(dkim,
+				           "unable to allocate %d byte(s)",
+				           DKIM_HASHBUFSIZE);
+				return DKIM_STAT_NORESOURCE;
+			}
+			cur->canon_hashbufsize = DKIM_HASHBUFSIZE;
+			cur->canon_hashbuflen = 0;
+			cur->canon_buf = dkim_dstring_new(dkim, BUFRSZ,
+			                                  BUFRSZ);
+			if (cur->canon_buf == NULL)
+				return DKIM_STAT_NORESOURCE;
 		}
-		cur->canon_hashbufsize = DKIM_HASHBUFSIZE;
-		cur->canon_hashbuflen = 0;
-		cur->canon_buf = dkim_dstring_new(dkim, BUFRSZ, BUFRSZ);
-		if (cur->canon_buf == NULL)
-			return DKIM_STAT_NORESOURCE;
 
 		switch (cur->canon_hashtype)
 		{
@@ -846,6 +1248,7 @@ dkim_add_canon(DKIM *dkim, _Bool hdr, dkim_canon_t canon, int hashtype,
 {
 	DKIM_CANON *cur;
 	DKIM_CANON *new;
+	DKIM_CANON *stream = NULL;
 
 	assert(dkim != NULL);
 	assert(canon == DKIM_CANON_SIMPLE || canon == DKIM_CANON_RELAXED);
@@ -863,12 +1266,21 @@ dkim_add_canon(DKIM *dkim, _Bool hdr, dkim_canon_t canon, int hashtype,
 	{
 		for (cur = dkim->dkim_canonhead; cur != NULL; cur = cur->canon_next)
 		{
-			if (cur->canon_hdr ||
-			    cur->canon_hashtype != hashtype ||
-			    cur->canon_canon != canon)
+			if (cur->canon_hdr || cur->canon_canon != canon)
 				continue;
 
-			if (length != cur->canon_length)
+			/*
+			**  Any body canonicalization of the same mode
+			**  produces the same stream; remember the first
+			**  one so a new one can tap into it rather than
+			**  canonicalizing the body again.
+			*/
+
+			if (stream == NULL && cur->canon_stream == NULL)
+				stream = cur;
+
+			if (cur->canon_hashtype != hashtype ||
+			    length != cur->canon_length)
 				continue;
 
 			if (cout != NULL)
@@ -905,7 +1317,10 @@ dkim_add_canon(DKIM *dkim, _Bool hdr, dkim_canon_t canon, int hashtype,
 	new->canon_sigheader = sighdr;
 	new->canon_hdrlist = hdrlist;
 	new->canon_buf = NULL;
+	new->canon_stream = stream;
+	new->canon_taps = NULL;
 	new->canon_next = NULL;
+	new->canon_output = FALSE;
 	new->canon_blankline = TRUE;
 	new->canon_blanks = 0;
 	new->canon_bodystate = 0;
@@ -914,6 +1329,13 @@ dkim_add_canon(DKIM *dkim, _Bool hdr, dkim_canon_t canon, int hashtype,
 	new->canon_hashbuf = NULL;
 	new->canon_lastchar = '\0';
 
+	if (stream != NULL)
+	{
+		for (cur = stream; cur->canon_taps != NULL; cur = cur->canon_taps)
+			continue;
+		cur->canon_taps = new;
+	}
+
 	if (dkim->dkim_canonhead == NULL)
 	{
 		dkim->dkim_canontail = new;
@@ -951,23 +1373,22 @@ dkim_add_canon(DKIM *dkim, _Bool hdr, dkim_canon_t canon, int hashtype,
 **
 **  	If any of the returned pointers is NULL, then a header named by
 **  	"hdrlist" was not found.
+**
+**  	Each name is looked up in the handle's header name index, so this
+**  	doesn't rescan the whole header block per name.
 */
 
 int
 dkim_canon_selecthdrs(DKIM *dkim, u_char *hdrlist, struct dkim_header **ptrs,
                       int nptrs)
 {
-	int c;
 	int n;
-	int m;
 	int shcnt;
 	size_t len;
-	char *bar;
-	char *ctx;
 	u_char *colon;
+	u_char *end;
+	u_char *name;
 	struct dkim_header *hdr;
-	struct dkim_header **lhdrs;
-	u_char **hdrs;
 
 	assert(dkim != NULL);
 	assert(ptrs != NULL);
@@ -993,85 +1414,45 @@ dkim_canon_selecthdrs(DKIM *dkim, u_char *hdrlist, struct dkim_header **ptrs,
 		return n;
 	}
 
-	if (dkim->dkim_hdrlist == NULL)
-	{
-		dkim->dkim_hdrlist = dkim_malloc(dkim->dkim_libhandle,
-		                                 dkim->dkim_closure,
-		                                 DKIM_MAXHEADER);
-		if (dkim->dkim_hdrlist == NULL)
-		{
-			dkim_error(dkim, "unable to allocate %d bytes(s)",
-			           DKIM_MAXHEADER);
-
-			return -1;
-		}
-	}
-
-	strlcpy((char *) dkim->dkim_hdrlist, (char *) hdrlist, DKIM_MAXHEADER);
-
 	/* mark all headers as not used */
 	for (hdr = dkim->dkim_hhead; hdr != NULL; hdr = hdr->hdr_next)
 		hdr->hdr_flags &= ~DKIM_HDR_SIGNED;
 
-	n = dkim->dkim_hdrcnt * sizeof(struct dkim_header *);
-	lhdrs = DKIM_MALLOC(dkim, n);
-	if (lhdrs == NULL)
-		return -1;
-	memset(lhdrs, '\0', n);
-
-	shcnt = 1;
-	for (colon = dkim->dkim_hdrlist; *colon != '\0'; colon++)
-	{
-		if (*colon == ':')
-			shcnt++;
-	}
-	n = sizeof(u_char *) * shcnt;
-	hdrs = DKIM_MALLOC(dkim, n);
-	if (hdrs == NULL)
-	{
-		(void) DKIM_FREE(dkim, lhdrs);
-		return -1;
-	}
-	memset(hdrs, '\0', n);
-
-	n = 0;
-
-	/* make a split-out copy of hdrlist */
-	for (bar = strtok_r((char *) dkim->dkim_hdrlist, ":", &ctx);
-	     bar != NULL;
-	     bar = strtok_r(NULL, ":", &ctx))
-	{
-		hdrs[n] = (u_char *) bar;
-		n++;
-	}
+	len = strlen((char *) hdrlist);
+	end = hdrlist + MIN(len, DKIM_MAXHEADER - 1);
 
 	/* for each named header, find the last unused one and use it up */
 	shcnt = 0;
-	for (c = 0; c < n; c++)
+	for (name = hdrlist; ; name = colon + 1)
 	{
-		lhdrs[shcnt] = NULL;
-
-		len = MIN(DKIM_MAXHEADER, strlen((char *) hdrs[c]));
-		while (len > 0 &&
-		       DKIM_ISWSP(hdrs[c][len - 1]))
-			len--;
+		colon = memchr(name, ':', end - name);
+		if (colon == NULL)
+			colon = end;
 
-		for (hdr = dkim->dkim_hhead; hdr != NULL; hdr = hdr->hdr_next)
+		if (colon > name)
 		{
-			if (hdr->hdr_flags & DKIM_HDR_SIGNED)
-				continue;
-
-			if (len == hdr->hdr_namelen &&
-			    strncasecmp((char *) hdr->hdr_text,
-			                (char *) hdrs[c], len) == 0)
-				lhdrs[shcnt] = hdr;
+			len = colon - name;
+			while (len > 0 && DKIM_ISWSP(name[len - 1]))
+				len--;
+
+			hdr = dkim_hdr_find(dkim, name, len);
+			if (hdr != NULL)
+				hdr = hdr->hdr_samelast;
+			while (hdr != NULL &&
+			       (hdr->hdr_flags & DKIM_HDR_SIGNED) != 0)
+				hdr = hdr->hdr_sameprev;
+
+			if (hdr != NULL)
+			{
+				hdr->hdr_flags |= DKIM_HDR_SIGNED;
+				if (shcnt < nptrs)
+					ptrs[shcnt] = hdr;
+				shcnt++;
+			}
 		}
 
-		if (lhdrs[shcnt] != NULL)
-		{
-			lhdrs[shcnt]->hdr_flags |= DKIM_HDR_SIGNED;
-			shcnt++;
-		}
+		if (colon == end)
+			break;
 	}
 
 	/* bounds check */
@@ -1080,27 +1461,10 @@ dkim_canon_selecthdrs(DKIM *dkim, u_char *hdrlist, struct dkim_header **ptrs,
 		dkim_error(dkim, "too many headers (found %d, max %d)", shcnt,
 		           nptrs);
 
-		DKIM_FREE(dkim, lhdrs);
-		DKIM_FREE(dkim, hdrs);
-
 		return -1;
 	}
 
-	/* copy to the caller's buffers */
-	m = 0;
-	for (c = 0; c < shcnt; c++)
-	{
-		if (lhdrs[c] != NULL)
-		{
-			ptrs[m] = lhdrs[c];
-			m++;
-		}
-	}
-
-	DKIM_FREE(dkim, lhdrs);
-	DKIM_FREE(dkim, hdrs);
-
-	return m;
+	return shcnt;
 }
 
 /*
@@ -1656,10 +2020,15 @@ dkim_canon_bodychunk(DKIM *dkim, u_char *buf, size_t buflen)
 	u_int wlen;
 	DKIM_CANON *cur;
 	size_t plen;
+	size_t room;
+	size_t fixedlen = 0;
+	u_char *fixed = NULL;
 	u_char *p;
+	u_char *q;
 	u_char *wrote;
 	u_char *eob;
 	u_char *start;
+	dkim_canon_scan_t scan;
 
 	assert(dkim != NULL);
 
@@ -1667,23 +2036,42 @@ dkim_canon_bodychunk(DKIM *dkim, u_char *buf, size_t buflen)
 
 	fixcrlf = (dkim->dkim_libhandle->dkiml_flags & DKIM_LIBFLAGS_FIXCRLF);
 
+	scan = dkim_canon_getscanner(dkim);
+
 	for (cur = dkim->dkim_canonhead; cur != NULL; cur = cur->canon_next)
 	{
 		/* skip done hashes and those which are of the wrong type */
 		if (cur->canon_done || cur->canon_hdr)
 			continue;
 
-		start = buf;
-		plen = buflen;
+		/* skip those fed by another canonicalization's stream */
+		if (cur->canon_stream != NULL)
+			continue;
 
-		if (fixcrlf)
+		/*
+		**  The fixed chunk is the same for every canonicalization,
+		**  since all of them have seen the same input so far; fix
+		**  it for the first one and reuse it for the rest.
+		*/
+
+		if (fixcrlf && fixed == NULL)
 		{
-			status = dkim_canon_fixcrlf(dkim, cur, buf, buflen);
+			status = dkim_canon_fixcrlf(dkim, cur->canon_lastchar,
+			                            buf, buflen,
+			                            &fixed, &fixedlen);
 			if (status != DKIM_STAT_OK)
 				return status;
+		}
 
-			start = dkim_dstring_get(dkim->dkim_canonbuf);
-			plen = dkim_dstring_len(dkim->dkim_canonbuf);
+		if (fixed != NULL)
+		{
+			start = fixed;
+			plen = fixedlen;
+		}
+		else
+		{
+			start = buf;
+			plen = buflen;
 		}
 
 		eob = start + plen - 1;
@@ -1748,6 +2136,14 @@ dkim_canon_bodychunk(DKIM *dkim, u_char *buf, size_t buflen)
 						if (cur->canon_blanks > 0)
 							dkim_canon_flushblanks(cur);
 						cur->canon_blankline = FALSE;
+
+						/* consume the rest of the line */
+						q = scan(p, eob + 1,
+						         '\r', '\n', '\n');
+						wlen += q - p;
+						cur->canon_lastchar = *(q - 1);
+						p = q - 1;
+						continue;
 					}
 
 					wlen++;
@@ -1766,6 +2162,53 @@ dkim_canon_bodychunk(DKIM *dkim, u_char *buf, size_t buflen)
 		  case DKIM_CANON_RELAXED:
 			for (p = start; p <= eob; p++)
 			{
+				/*
+				**  Outside of a CR, an ordinary byte starts
+				**  or continues a word; find the end of the
+				**  word and handle it all at once.
+				*/
+
+				if (cur->canon_bodystate != 2 &&
+				    !DKIM_ISWSP(*p) && *p != '\r')
+				{
+					q = scan(p, eob + 1, '\r', ' ', '\t');
+
+					if (cur->canon_bodystate == 1)
+					{
+						dkim_canon_flushblanks(cur);
+						dkim_canon_buffer(cur, SP, 1);
+					}
+
+					cur->canon_blankline = FALSE;
+					cur->canon_bodystate = 3;
+
+					room = dkim_canon_wordroom(cur, q - p);
+
+					/*
+					**  If the whole word is here and is
+					**  terminated by a space or a CRLF,
+					**  it can go straight to the hash.
+					*/
+
+					if (dkim_dstring_len(cur->canon_buf) == 0 &&
+					    room == q - p && q <= eob &&
+					    (DKIM_ISWSP(*q) ||
+					     (q < eob && *(q + 1) == '\n')))
+					{
+						dkim_canon_flushblanks(cur);
+						dkim_canon_buffer(cur, p, q - p);
+					}
+					else if (room > 0)
+					{
+						dkim_dstring_catn(cur->canon_buf,
+						                  p, room);
+					}
+
+					cur->canon_lastchar = *(q - 1);
+					p = q - 1;
+					continue;
+				}
+
 				switch (cur->canon_bodystate)
 				{
 				  case 0:
@@ -1934,29 +2377,45 @@ dkim_canon_closebody(DKIM *dkim)
 		if (cur->canon_done || cur->canon_hdr)
 			continue;
 
-		/* handle unprocessed content */
-		if (dkim_dstring_len(cur->canon_buf) > 0)
+		/*
+		**  Flush the stream if this canonicalization owns one.
+		**  Any that tap into it come later in the list, so they
+		**  see all of its output before they are finalized.
+		*/
+
+		if (cur->canon_stream == NULL)
 		{
-			if ((dkim->dkim_libhandle->dkiml_flags & DKIM_LIBFLAGS_FIXCRLF) != 0)
+			/* handle unprocessed content */
+			if (dkim_dstring_len(cur->canon_buf) > 0)
 			{
-				dkim_canon_buffer(cur,
-				                  dkim_dstring_get(cur->canon_buf),
-				                  dkim_dstring_len(cur->canon_buf));
-				dkim_canon_buffer(cur, CRLF, 2);
-			}
-			else
-			{
-				dkim_error(dkim, "CRLF at end of body missing");
-				return DKIM_STAT_SYNTAX;
+				if ((dkim->dkim_libhandle->dkiml_flags & DKIM_LIBFLAGS_FIXCRLF) != 0)
+				{
+					dkim_canon_buffer(cur,
+					                  dkim_dstring_get(cur->canon_buf),
+					                  dkim_dstring_len(cur->canon_buf));
+					dkim_canon_buffer(cur, CRLF, 2);
+				}
+				else
+				{
+					dkim_error(dkim,
+					           "CRLF at end of body missing");
+					return DKIM_STAT_SYNTAX;
+				}
 			}
-		}
 
-		/* "simple" canonicalization must include at least a CRLF */
-		if (cur->canon_canon == DKIM_CANON_SIMPLE &&
-		    cur->canon_wrote == 0)
-			dkim_canon_buffer(cur, CRLF, 2);
+			/*
+			**  "simple" canonicalization must include at least
+			**  a CRLF; test whether the stream has written
+			**  anything rather than what this one hashed, since
+			**  the two differ when there's a length limit.
+			*/
 
-		dkim_canon_buffer(cur, NULL, 0);
+			if (cur->canon_canon == DKIM_CANON_SIMPLE &&
+			    !cur->canon_output)
+				dkim_canon_buffer(cur, CRLF, 2);
+
+			dkim_canon_buffer(cur, NULL, 0);
+		}
 
 		/* finalize */
 		switch (cur->canon_hashtype)
@@ -11,6 +11,7 @@
 /* system includes */
 #include <sys/param.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <arpa/nameser.h>
 #include <resolv.h>
@@ -19,9 +20,13 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <ctype.h>
+#include <pthread.h>
 
 /* libopendkim includes */
 #include "dkim.h"
+#include "dkim-internal.h"
+#include "dkim-types.h"
 #include "dkim-dns.h"
 
 /* OpenDKIM includes */
@@ -31,6 +36,9 @@
 #ifndef MAXPACKET
 # define MAXPACKET      8192
 #endif /* ! MAXPACKET */
+#ifndef MIN
+# define MIN(x,y)	((x) < (y) ? (x) : (y))
+#endif /* ! MIN */
 
 /*
 **  Standard UNIX resolver stub functions
@@ -330,3 +338,403 @@ dkim_res_nslist(void *srv, const char *nslist)
 
 	return DKIM_DNS_SUCCESS;
 }
+
+/*
+**  Shared queries
+**
+**  Concurrent requests for the same name and type, e.g. for one key by
+**  many messages from a bulk sender, are attached to one outstanding
+**  query rather than each starting its own.  Only one requester at a time
+**  waits on the underlying service; the others wait for it to finish and
+**  then copy the shared answer.
+*/
+
+/*
+**  DKIM_DNS_FLIGHT_HASH -- hash a query name
+**
+**  Parameters:
+**  	qname -- query name
+**
+**  Return value:
+**  	A bucket number for the library's table of shared queries.
+*/
+
+static u_int
+dkim_dns_flight_hash(const u_char *qname)
+{
+	u_int h = 5381;
+
+	while (*qname != '\0')
+	{
+		h = (h << 5) + h + tolower(*qname);
+		qname++;
+	}
+
+	return h % DKIM_FLIGHTBUCKETS;
+}
+
+/*
+**  DKIM_DNS_FLIGHT_UNLINK -- remove a shared query from the table
+**
+**  Parameters:
+**  	lib -- library handle
+**  	fl -- shared query
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Caller must hold the library's dkiml_flightlock.
+*/
+
+static void
+dkim_dns_flight_unlink(DKIM_LIB *lib, struct dkim_dnsflight *fl)
+{
+	struct dkim_dnsflight **prev;
+
+	if (!fl->fl_linked)
+		return;
+
+	for (prev = &lib->dkiml_flights[dkim_dns_flight_hash(fl->fl_qname)];
+	     *prev != NULL;
+	     prev = &(*prev)->fl_next)
+	{
+		if (*prev == fl)
+		{
+			*prev = fl->fl_next;
+			break;
+		}
+	}
+
+	fl->fl_next = NULL;
+	fl->fl_linked = FALSE;
+}
+
+/*
+**  DKIM_DNS_FLIGHT_FREE -- release a shared query
+**
+**  Parameters:
+**  	fl -- shared query
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkim_dns_flight_free(struct dkim_dnsflight *fl)
+{
+	pthread_cond_destroy(&fl->fl_cond);
+	free(fl->fl_ansbuf);
+	free(fl->fl_qname);
+	free(fl);
+}
+
+/*
+**  DKIM_DNS_FLIGHT_START -- start a query, or join an identical one
+**                           already in flight
+**
+**  Parameters:
+**  	lib -- library handle
+**  	type -- RR type to query
+**  	qname -- the question to ask
+**  	flp -- shared query handle (returned)
+**
+**  Return value:
+**  	A DKIM_DNS_* constant.
+**
+**  Notes:
+**  	The resolver service must already be initialized.  Each successful
+**  	call must be matched by a call to dkim_dns_flight_cancel().
+*/
+
+int
+dkim_dns_flight_start(DKIM_LIB *lib, int type, u_char *qname,
+                      struct dkim_dnsflight **flp)
+{
+	int status;
+	u_int h;
+	void *q;
+	struct dkim_dnsflight *fl;
+
+	assert(lib != NULL);
+	assert(qname != NULL);
+	assert(flp != NULL);
+
+	h = dkim_dns_flight_hash(qname);
+
+	pthread_mutex_lock(&lib->dkiml_flightlock);
+
+	for (fl = lib->dkiml_flights[h]; fl != NULL; fl = fl->fl_next)
+	{
+		if (fl->fl_type == type &&
+		    strcasecmp((char *) fl->fl_qname, (char *) qname) == 0)
+		{
+			fl->fl_refcnt++;
+			pthread_mutex_unlock(&lib->dkiml_flightlock);
+			*flp = fl;
+			return DKIM_DNS_SUCCESS;
+		}
+	}
+
+	fl = (struct dkim_dnsflight *) malloc(sizeof *fl);
+	if (fl == NULL)
+	{
+		pthread_mutex_unlock(&lib->dkiml_flightlock);
+		return DKIM_DNS_ERROR;
+	}
+	memset(fl, '\0', sizeof *fl);
+
+	fl->fl_qname = (u_char *) strdup((char *) qname);
+	fl->fl_ansbuf = (u_char *) malloc(MAXPACKET);
+	if (fl->fl_qname == NULL || fl->fl_ansbuf == NULL)
+	{
+		pthread_mutex_unlock(&lib->dkiml_flightlock);
+		if (fl->fl_qname != NULL)
+			free(fl->fl_qname);
+		if (fl->fl_ansbuf != NULL)
+			free(fl->fl_ansbuf);
+		free(fl);
+		return DKIM_DNS_ERROR;
+	}
+
+	fl->fl_type = type;
+	fl->fl_refcnt = 1;
+	fl->fl_dnssec = DKIM_DNSSEC_UNKNOWN;
+	pthread_cond_init(&fl->fl_cond, NULL);
+
+	fl->fl_next = lib->dkiml_flights[h];
+	lib->dkiml_flights[h] = fl;
+	fl->fl_linked = TRUE;
+
+	pthread_mutex_unlock(&lib->dkiml_flightlock);
+
+	/* the stock resolver answers before this returns */
+	status = lib->dkiml_dns_start(lib->dkiml_dns_service, type, qname,
+	                              fl->fl_ansbuf, MAXPACKET, &q);
+
+	pthread_mutex_lock(&lib->dkiml_flightlock);
+
+	if (status != DKIM_DNS_SUCCESS)
+	{
+		/* anyone who joined meanwhile gets the error */
+		fl->fl_done = TRUE;
+		fl->fl_status = DKIM_DNS_ERROR;
+		dkim_dns_flight_unlink(lib, fl);
+		pthread_cond_broadcast(&fl->fl_cond);
+
+		fl->fl_refcnt--;
+		if (fl->fl_refcnt == 0)
+		{
+			pthread_mutex_unlock(&lib->dkiml_flightlock);
+			dkim_dns_flight_free(fl);
+		}
+		else
+		{
+			pthread_mutex_unlock(&lib->dkiml_flightlock);
+		}
+
+		return DKIM_DNS_ERROR;
+	}
+
+	fl->fl_query = q;
+	fl->fl_started = TRUE;
+	pthread_cond_broadcast(&fl->fl_cond);
+
+	pthread_mutex_unlock(&lib->dkiml_flightlock);
+
+	*flp = fl;
+
+	return DKIM_DNS_SUCCESS;
+}
+
+/*
+**  DKIM_DNS_FLIGHT_WAIT -- wait for the answer to a shared query
+**
+**  Parameters:
+**  	lib -- library handle
+**  	fl -- shared query handle
+**  	to -- timeout (or NULL)
+**  	buf -- where to copy the answer
+**  	buflen -- bytes available at "buf"; updated to bytes copied
+**  	error -- error code (returned)
+**  	dnssec -- DNSSEC status (returned)
+**
+**  Return value:
+**  	A DKIM_DNS_* constant, as from the service's waitreply function.
+**  	"buf", "buflen", "error" and "dnssec" are only updated once the
+**  	query is complete.
+*/
+
+int
+dkim_dns_flight_wait(DKIM_LIB *lib, struct dkim_dnsflight *fl,
+                     struct timeval *to, u_char *buf, size_t *buflen,
+                     int *error, int *dnssec)
+{
+	int status;
+	size_t anslen;
+	struct timeval now;
+	struct timeval left;
+	struct timespec deadline;
+
+	assert(lib != NULL);
+	assert(fl != NULL);
+	assert(buf != NULL);
+	assert(buflen != NULL);
+
+	if (to != NULL)
+	{
+		(void) gettimeofday(&now, NULL);
+
+		deadline.tv_sec = now.tv_sec + to->tv_sec;
+		deadline.tv_nsec = (now.tv_usec + to->tv_usec) * 1000;
+		if (deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec += deadline.tv_nsec / 1000000000;
+			deadline.tv_nsec %= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&lib->dkiml_flightlock);
+
+	while (!fl->fl_done)
+	{
+		if (fl->fl_started && !fl->fl_collecting)
+		{
+			int err = 0;
+			int sec = DKIM_DNSSEC_UNKNOWN;
+
+			/* nobody is waiting on the service, so we will */
+			fl->fl_collecting = TRUE;
+
+			if (to != NULL)
+			{
+				(void) gettimeofday(&now, NULL);
+
+				left.tv_sec = deadline.tv_sec - now.tv_sec;
+				left.tv_usec = deadline.tv_nsec / 1000 - now.tv_usec;
+				if (left.tv_usec < 0)
+				{
+					left.tv_sec--;
+					left.tv_usec += 1000000;
+				}
+				if (left.tv_sec < 0)
+				{
+					left.tv_sec = 0;
+					left.tv_usec = 0;
+				}
+			}
+
+			pthread_mutex_unlock(&lib->dkiml_flightlock);
+
+			anslen = MAXPACKET;
+			status = lib->dkiml_dns_waitreply(lib->dkiml_dns_service,
+			                                  fl->fl_query,
+			                                  to == NULL ? NULL
+			                                             : &left,
+			                                  &anslen, &err, &sec);
+
+			pthread_mutex_lock(&lib->dkiml_flightlock);
+
+			fl->fl_collecting = FALSE;
+
+			if (status == DKIM_DNS_SUCCESS ||
+			    status == DKIM_DNS_ERROR)
+			{
+				fl->fl_done = TRUE;
+				fl->fl_status = status;
+				fl->fl_anslen = MIN(anslen, MAXPACKET);
+				fl->fl_error = err;
+				fl->fl_dnssec = sec;
+
+				/* later requests start a fresh query */
+				dkim_dns_flight_unlink(lib, fl);
+			}
+
+			/* let the others take over or collect the answer */
+			pthread_cond_broadcast(&fl->fl_cond);
+
+			if (!fl->fl_done)
+			{
+				pthread_mutex_unlock(&lib->dkiml_flightlock);
+				return status;
+			}
+		}
+		else if (to == NULL)
+		{
+			(void) pthread_cond_wait(&fl->fl_cond,
+			                         &lib->dkiml_flightlock);
+		}
+		else
+		{
+			(void) gettimeofday(&now, NULL);
+			if (now.tv_sec > deadline.tv_sec ||
+			    (now.tv_sec == deadline.tv_sec &&
+			     now.tv_usec * 1000 >= deadline.tv_nsec))
+			{
+				pthread_mutex_unlock(&lib->dkiml_flightlock);
+				return DKIM_DNS_EXPIRED;
+			}
+
+			(void) pthread_cond_timedwait(&fl->fl_cond,
+			                              &lib->dkiml_flightlock,
+			                              &deadline);
+		}
+	}
+
+	status = fl->fl_status;
+	if (status == DKIM_DNS_SUCCESS)
+	{
+		*buflen = MIN(*buflen, fl->fl_anslen);
+		memcpy(buf, fl->fl_ansbuf, *buflen);
+	}
+	if (error != NULL)
+		*error = fl->fl_error;
+	if (dnssec != NULL)
+		*dnssec = fl->fl_dnssec;
+
+	pthread_mutex_unlock(&lib->dkiml_flightlock);
+
+	return status;
+}
+
+/*
+**  DKIM_DNS_FLIGHT_CANCEL -- release a shared query
+**
+**  Parameters:
+**  	lib -- library handle
+**  	fl -- shared query handle
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	The underlying query is cancelled when its last requester lets go.
+*/
+
+void
+dkim_dns_flight_cancel(DKIM_LIB *lib, struct dkim_dnsflight *fl)
+{
+	assert(lib != NULL);
+	assert(fl != NULL);
+
+	pthread_mutex_lock(&lib->dkiml_flightlock);
+
+	assert(fl->fl_refcnt > 0);
+
+	fl->fl_refcnt--;
+	if (fl->fl_refcnt > 0)
+	{
+		pthread_mutex_unlock(&lib->dkiml_flightlock);
+		return;
+	}
+
+	dkim_dns_flight_unlink(lib, fl);
+
+	pthread_mutex_unlock(&lib->dkiml_flightlock);
+
+	if (fl->fl_query != NULL)
+		(void) lib->dkiml_dns_cancel(lib->dkiml_dns_service,
+		                             fl->fl_query);
+
+	dkim_dns_flight_free(fl);
+}
@@ -9,7 +9,16 @@
 /* libopendkim includes */
 #include "dkim.h"
 
+/* data types */
+struct dkim_dnsflight;
+
 /* prototypes */
+extern void dkim_dns_flight_cancel __P((DKIM_LIB *, struct dkim_dnsflight *));
+extern int dkim_dns_flight_start __P((DKIM_LIB *, int, u_char *,
+                                      struct dkim_dnsflight **));
+extern int dkim_dns_flight_wait __P((DKIM_LIB *, struct dkim_dnsflight *,
+                                     struct timeval *, u_char *, size_t *,
+                                     int *, int *));
 extern int dkim_res_cancel __P((void *, void *));
 extern void dkim_res_close __P((void *));
 extern int dkim_res_init __P((void **));
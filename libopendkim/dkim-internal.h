@@ -118,6 +118,7 @@ typedef int dkim_set_t;
 
 #define	DKIM_KEYTYPE_UNKNOWN	(-1)
 #define	DKIM_KEYTYPE_RSA	0
+#define	DKIM_KEYTYPE_ED25519	1
 
 /*
 **  DKIM_SET -- a set of parameters and values
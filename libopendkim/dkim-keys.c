@@ -26,7 +26,9 @@
 #include "dkim-types.h"
 #include "dkim-keys.h"
 #include "dkim-cache.h"
+#include "dkim-dns.h"
 #include "dkim-test.h"
+#include "dkim-util.h"
 #include "util.h"
 
 /* libbsd if found */
@@ -53,6 +55,139 @@ extern void dkim_error __P((DKIM *, const char *, ...));
 # define T_RRSIG		46
 #endif /* ! T_RRSIG */
 
+/*
+**  DKIM_KEY_QNAME -- construct the name of a key record
+**
+**  Parameters:
+**  	dkim -- DKIM handle
+**  	sig -- DKIM_SIGINFO handle
+**  	qname -- buffer into which to write the name
+**  	qnamelen -- bytes available at "qname"
+**
+**  Return value:
+**  	A DKIM_STAT_* constant.
+*/
+
+static DKIM_STAT
+dkim_key_qname(DKIM *dkim, DKIM_SIGINFO *sig, u_char *qname, size_t qnamelen)
+{
+	int n;
+
+	n = snprintf((char *) qname, qnamelen - 1, "%s.%s.%s",
+	             sig->sig_selector, DKIM_DNSKEYNAME, sig->sig_domain);
+	if (n == -1 || n > qnamelen - 1)
+	{
+		dkim_error(dkim, "key query name too large");
+		return DKIM_STAT_NORESOURCE;
+	}
+
+	return DKIM_STAT_OK;
+}
+
+/*
+**  DKIM_START_KEY_DNS -- start a DNS query for a DKIM key
+**
+**  Parameters:
+**  	dkim -- DKIM handle
+**  	sig -- DKIM_SIGINFO handle
+**
+**  Return value:
+**  	A DKIM_STAT_* constant.
+**
+**  Notes:
+**  	The query is left outstanding on "sig" and its reply is collected
+**  	later by dkim_get_key_dns().  This allows the queries for all
+**  	signatures on a message to be in flight at the same time.  Nothing
+**  	is started if the answer is already in the query cache, and an
+**  	identical query already in flight for another handle is joined
+**  	rather than repeated.
+*/
+
+DKIM_STAT
+dkim_start_key_dns(DKIM *dkim, DKIM_SIGINFO *sig)
+{
+	int status;
+	DKIM_STAT dstatus;
+	DKIM_LIB *lib;
+	struct dkim_dnsflight *fl;
+	unsigned char qname[DKIM_MAXHOSTNAMELEN + 1];
+
+	assert(dkim != NULL);
+	assert(sig != NULL);
+	assert(sig->sig_selector != NULL);
+	assert(sig->sig_domain != NULL);
+
+	if (sig->sig_dnsquery != NULL)
+		return DKIM_STAT_OK;
+
+	lib = dkim->dkim_libhandle;
+
+	dstatus = dkim_key_qname(dkim, sig, qname, sizeof qname);
+	if (dstatus != DKIM_STAT_OK)
+		return dstatus;
+
+#ifdef QUERY_CACHE
+	if (lib->dkiml_cache != NULL)
+	{
+		int err = 0;
+		size_t blen;
+		u_char buf[BUFRSZ + 1];
+
+		blen = sizeof buf;
+		if (dkim_cache_query(lib->dkiml_cache, qname, 0, buf, &blen,
+		                     &err) == 0)
+			return DKIM_STAT_OK;
+	}
+#endif /* QUERY_CACHE */
+
+	if (lib->dkiml_dns_service == NULL &&
+	    lib->dkiml_dns_init != NULL &&
+	    lib->dkiml_dns_init(&lib->dkiml_dns_service) != 0)
+	{
+		dkim_error(dkim, "cannot initialize resolver");
+		return DKIM_STAT_KEYFAIL;
+	}
+
+	status = dkim_dns_flight_start(lib, T_TXT, qname, &fl);
+	if (status != DKIM_DNS_SUCCESS)
+	{
+		dkim_error(dkim, "'%s' query failed", qname);
+		return DKIM_STAT_KEYFAIL;
+	}
+
+	sig->sig_dnsquery = fl;
+
+	return DKIM_STAT_OK;
+}
+
+/*
+**  DKIM_CANCEL_KEY_DNS -- abandon a DNS query started for a DKIM key
+**
+**  Parameters:
+**  	dkim -- DKIM handle
+**  	sig -- DKIM_SIGINFO handle
+**
+**  Return value:
+**  	None.
+*/
+
+void
+dkim_cancel_key_dns(DKIM *dkim, DKIM_SIGINFO *sig)
+{
+	DKIM_LIB *lib;
+
+	assert(dkim != NULL);
+	assert(sig != NULL);
+
+	lib = dkim->dkim_libhandle;
+
+	if (sig->sig_dnsquery != NULL)
+	{
+		dkim_dns_flight_cancel(lib, sig->sig_dnsquery);
+		sig->sig_dnsquery = NULL;
+	}
+}
+
 /*
 **  DKIM_GET_KEY_DNS -- retrieve a DKIM key from DNS
 **
@@ -84,8 +219,8 @@ dkim_get_key_dns(DKIM *dkim, DKIM_SIGINFO *sig, u_char *buf, size_t buflen)
 	int type = -1;
 	int class = -1;
 	size_t anslen;
-	void *q;
 	DKIM_LIB *lib;
+	struct dkim_dnsflight *fl;
 	unsigned char *txtfound = NULL;
 	unsigned char *p;
 	unsigned char *cp;
@@ -103,13 +238,9 @@ dkim_get_key_dns(DKIM *dkim, DKIM_SIGINFO *sig, u_char *buf, size_t buflen)
 
 	lib = dkim->dkim_libhandle;
 
-	n = snprintf((char *) qname, sizeof qname - 1, "%s.%s.%s",
-	             sig->sig_selector, DKIM_DNSKEYNAME, sig->sig_domain);
-	if (n == -1 || n > sizeof qname - 1)
-	{
-		dkim_error(dkim, "key query name too large");
-		return DKIM_STAT_NORESOURCE;
-	}
+	status = dkim_key_qname(dkim, sig, qname, sizeof qname);
+	if (status != DKIM_STAT_OK)
+		return status;
 
 #ifdef QUERY_CACHE
 	/* see if we have this data already cached */
@@ -140,34 +271,40 @@ dkim_get_key_dns(DKIM *dkim, DKIM_SIGINFO *sig, u_char *buf, size_t buflen)
 		timeout.tv_sec = dkim->dkim_timeout;
 		timeout.tv_usec = 0;
 
-		if (lib->dkiml_dns_service == NULL &&
-		    lib->dkiml_dns_init != NULL &&
-		    lib->dkiml_dns_init(&lib->dkiml_dns_service) != 0)
+		if (sig->sig_dnsquery != NULL)
 		{
-			dkim_error(dkim, "cannot initialize resolver");
-			return DKIM_STAT_KEYFAIL;
+			/* collect the query dkim_start_key_dns() started */
+			fl = sig->sig_dnsquery;
 		}
-
-		status = lib->dkiml_dns_start(lib->dkiml_dns_service, T_TXT,
-		                              qname, ansbuf, anslen, &q);
-
-		if (status != 0)
+		else
 		{
-			dkim_error(dkim, "'%s' query failed", qname);
-			return DKIM_STAT_KEYFAIL;
+			if (lib->dkiml_dns_service == NULL &&
+			    lib->dkiml_dns_init != NULL &&
+			    lib->dkiml_dns_init(&lib->dkiml_dns_service) != 0)
+			{
+				dkim_error(dkim, "cannot initialize resolver");
+				return DKIM_STAT_KEYFAIL;
+			}
+
+			/* join an identical query if one is in flight */
+			status = dkim_dns_flight_start(lib, T_TXT, qname, &fl);
+			if (status != DKIM_DNS_SUCCESS)
+			{
+				dkim_error(dkim, "'%s' query failed", qname);
+				return DKIM_STAT_KEYFAIL;
+			}
 		}
-	
+
 		if (lib->dkiml_dns_callback == NULL)
 		{
 			timeout.tv_sec = dkim->dkim_timeout;
 			timeout.tv_usec = 0;
 
-			status = lib->dkiml_dns_waitreply(lib->dkiml_dns_service,
-			                                  q,
-			                                  dkim->dkim_timeout == 0 ? NULL
-			                                                          : &timeout,
-			                                  &anslen, &error,
-			                                  &dnssec);
+			status = dkim_dns_flight_wait(lib, fl,
+			                              dkim->dkim_timeout == 0 ? NULL
+			                                                      : &timeout,
+			                              ansbuf, &anslen, &error,
+			                              &dnssec);
 		}
 		else
 		{
@@ -186,13 +323,11 @@ dkim_get_key_dns(DKIM *dkim, DKIM_SIGINFO *sig, u_char *buf, size_t buflen)
 				dkim_min_timeval(&master, &next,
 				                 &timeout, &wt);
 
-				status = lib->dkiml_dns_waitreply(lib->dkiml_dns_service,
-				                                  q,
-				                                  dkim->dkim_timeout == 0 ? NULL
-				                                                          : &timeout,
-				                                  &anslen,
-				                                  &error,
-				                                  &dnssec);
+				status = dkim_dns_flight_wait(lib, fl,
+				                              dkim->dkim_timeout == 0 ? NULL
+				                                                      : &timeout,
+				                              ansbuf, &anslen,
+				                              &error, &dnssec);
 
 				if (wt == &next)
 				{
@@ -209,21 +344,22 @@ dkim_get_key_dns(DKIM *dkim, DKIM_SIGINFO *sig, u_char *buf, size_t buflen)
 			}
 		}
 
+		if (fl == sig->sig_dnsquery)
+			dkim_cancel_key_dns(dkim, sig);
+		else
+			dkim_dns_flight_cancel(lib, fl);
+
 		if (status == DKIM_DNS_EXPIRED)
 		{
-			(void) lib->dkiml_dns_cancel(lib->dkiml_dns_service, q);
 			dkim_error(dkim, "'%s' query timed out", qname);
 			return DKIM_STAT_KEYFAIL;
 		}
 		else if (status == DKIM_DNS_ERROR)
 		{
-			(void) lib->dkiml_dns_cancel(lib->dkiml_dns_service, q);
 			dkim_error(dkim, "'%s' query failed", qname);
 			return DKIM_STAT_KEYFAIL;
 		}
 
-		(void) lib->dkiml_dns_cancel(lib->dkiml_dns_service, q);
-
 		sig->sig_dnssec_key = dnssec;
 	}
 
@@ -2,7 +2,7 @@
 **  Copyright (c) 2005, 2007 Sendmail, Inc. and its suppliers.
 **    All rights reserved.
 **
-**  Copyright (c) 2009, 2012, The Trusted Domain Project.  All rights reserved.
+**  Copyright (c) 2009, 2012, 2015, The Trusted Domain Project.  All rights reserved.
 */
 
 #ifndef _DKIM_KEYS_H_
@@ -12,9 +12,15 @@
 #include "dkim.h"
 
 /* prototypes */
+extern void dkim_cancel_key_dns __P((DKIM *, DKIM_SIGINFO *));
 extern DKIM_STAT dkim_get_key_dns __P((DKIM *, DKIM_SIGINFO *, u_char *,
                                        size_t));
+extern DKIM_STAT dkim_start_key_dns __P((DKIM *, DKIM_SIGINFO *));
 extern DKIM_STAT dkim_get_key_file __P((DKIM *, DKIM_SIGINFO *, u_char *,
                                         size_t));
 
+#ifdef HAVE_ED25519
+extern EVP_PKEY *dkim_privkey_ed25519 __P((u_char *, size_t));
+#endif /* HAVE_ED25519 */
+
 #endif /* ! _DKIM_KEYS_H_ */
@@ -60,6 +60,7 @@ static struct nametable prv_algorithms[] =	/* signing algorithms */
 {
 	{ "rsa-sha1",	DKIM_SIGN_RSASHA1 },
 	{ "rsa-sha256",	DKIM_SIGN_RSASHA256 },
+	{ "ed25519-sha256", DKIM_SIGN_ED25519SHA256 },
 	{ NULL,		-1 },
 };
 struct nametable *algorithms = prv_algorithms;
@@ -83,6 +84,7 @@ struct nametable *hashes = prv_hashes;
 static struct nametable prv_keytypes[] =	/* key types */
 {
 	{ "rsa",	DKIM_KEYTYPE_RSA },
+	{ "ed25519",	DKIM_KEYTYPE_ED25519 },
 	{ NULL,		-1 },
 };
 struct nametable *keytypes = prv_keytypes;
@@ -172,6 +174,7 @@ static struct nametable prv_sigerrors[] =	/* signature parsing errors */
 	{ "version missing",			DKIM_SIGERROR_MISSING_V },
 	{ "version empty",			DKIM_SIGERROR_EMPTY_V },
 	{ "signing key too small",		DKIM_SIGERROR_KEYTOOSMALL },
+	{ "key type does not match algorithm",	DKIM_SIGERROR_KEYTYPEMISMATCH },
 	{ NULL,					-1 },
 };
 struct nametable *sigerrors = prv_sigerrors;
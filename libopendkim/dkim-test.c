@@ -49,6 +49,7 @@
 /* definitions */
 #define	TESTTTL			300
 #define MAXPACKET		8192
+#define	ED25519_PUBKEYLEN	32
 
 /* prototypes from elsewhere */
 extern DKIM_STAT dkim_get_key __P((DKIM *, DKIM_SIGINFO *, _Bool));
@@ -418,6 +419,10 @@ dkim_test_key(DKIM_LIB *lib, char *selector, char *domain,
 #else /* USE_GNUTLS */
 		rsa->rsa_pkey = PEM_read_bio_PrivateKey(keybuf, NULL,
 		                                        NULL, NULL);
+#ifdef HAVE_ED25519
+		if (rsa->rsa_pkey == NULL)
+			rsa->rsa_pkey = dkim_privkey_ed25519(key, keylen);
+#endif /* HAVE_ED25519 */
 		if (rsa->rsa_pkey == NULL)
 		{
 			BIO_free(keybuf);
@@ -431,6 +436,43 @@ dkim_test_key(DKIM_LIB *lib, char *selector, char *domain,
 			return -1;
 		}
 
+#ifdef HAVE_ED25519
+		if (EVP_PKEY_id(rsa->rsa_pkey) == EVP_PKEY_ED25519)
+		{
+			u_char pub[ED25519_PUBKEYLEN];
+			size_t publen = sizeof pub;
+
+			BIO_free(keybuf);
+
+			sig->sig_keytype = DKIM_KEYTYPE_ED25519;
+
+			if (EVP_PKEY_get_raw_public_key(rsa->rsa_pkey, pub,
+			                                &publen) != 1)
+			{
+				(void) dkim_free(dkim);
+				if (err != NULL)
+				{
+					strlcpy(err,
+					        "EVP_PKEY_get_raw_public_key() failed",
+					        errlen);
+				}
+				return -1;
+			}
+
+			if (publen == sig->sig_keylen)
+				status = memcmp(pub, sig->sig_key, publen);
+			else
+				status = 1;
+
+			if (status != 0)
+				strlcpy(err, "keys do not match", errlen);
+
+			(void) dkim_free(dkim);
+
+			return (status == 0 ? 0 : 1);
+		}
+#endif /* HAVE_ED25519 */
+
 		rsa->rsa_rsa = EVP_PKEY_get1_RSA(rsa->rsa_pkey);
 		if (rsa->rsa_rsa == NULL)
 		{
@@ -12,6 +12,7 @@
 
 /* system includes */
 #include <sys/types.h>
+#include <pthread.h>
 #ifdef HAVE_STDBOOL_H
 # include <stdbool.h>
 #endif /* HAVE_STDBOOL_H */
@@ -38,11 +39,6 @@
 # include <openssl/sha.h>
 #endif /* USE_GNUTLS */
 
-#ifdef QUERY_CACHE
-/* libdb includes */
-# include <db.h>
-#endif /* QUERY_CACHE */
-
 /* libopendkim includes */
 #include "dkim.h"
 #include "dkim-internal.h"
@@ -88,12 +84,21 @@ struct dkim_header
 	size_t			hdr_namelen;
 	u_char *		hdr_text;
 	u_char *		hdr_colon;
+	u_char *		hdr_relaxed;	/* relaxed form, with CRLF */
+	size_t			hdr_relaxedlen;
 	struct dkim_header *	hdr_next;
+	struct dkim_header *	hdr_samenext;	/* next of this name */
+	struct dkim_header *	hdr_sameprev;	/* previous of this name */
+	struct dkim_header *	hdr_samelast;	/* last of this name (first only) */
+	struct dkim_header *	hdr_hashnext;	/* bucket chain (first only) */
 };
 
 /* hdr_flags bits */
 #define	DKIM_HDR_SIGNED		0x01
 
+/* buckets in a handle's header name index */
+#define	DKIM_HDRBUCKETS		64
+
 /* struct dkim_plist -- a parameter/value pair */
 struct dkim_plist
 {
@@ -140,6 +145,7 @@ struct dkim_siginfo
 	u_char *		sig_b64key;
 	void *			sig_context;
 	void *			sig_signature;
+	struct dkim_dnsflight *	sig_dnsquery;
 	struct dkim_canon *	sig_hdrcanon;
 	struct dkim_canon *	sig_bodycanon;
 	struct dkim_set *	sig_taglist;
@@ -184,6 +190,7 @@ struct dkim_canon
 	_Bool			canon_done;
 	_Bool			canon_hdr;
 	_Bool			canon_blankline;
+	_Bool			canon_output;
 	int			canon_lastchar;
 	int			canon_bodystate;
 	u_int			canon_hashtype;
@@ -199,6 +206,8 @@ struct dkim_canon
 	void *			canon_hash;
 	struct dkim_dstring *	canon_buf;
 	struct dkim_header *	canon_sigheader;
+	struct dkim_canon *	canon_stream;
+	struct dkim_canon *	canon_taps;
 	struct dkim_canon *	canon_next;
 };
 
@@ -228,6 +237,22 @@ struct dkim_rsa
 #endif /* USE_GNUTLS */
 };
 
+/* struct dkim_privkey -- a parsed private key, shared by signing handles */
+struct dkim_privkey
+{
+	u_int			pk_refcnt;
+#ifdef USE_GNUTLS
+	unsigned int		pk_keysize;
+	gnutls_x509_privkey_t	pk_key;
+	gnutls_privkey_t	pk_privkey;
+#else /* USE_GNUTLS */
+	int			pk_keysize;
+	EVP_PKEY *		pk_pkey;
+#endif /* USE_GNUTLS */
+	pthread_mutex_t		pk_lock;
+	DKIM_LIB *		pk_libhandle;
+};
+
 /* struct dkim_test_dns_data -- simulated DNS replies */
 struct dkim_test_dns_data
 {
@@ -239,6 +264,29 @@ struct dkim_test_dns_data
 	struct dkim_test_dns_data * dns_next;
 };
 
+/* buckets in a library's table of shared DNS queries */
+#define	DKIM_FLIGHTBUCKETS	64
+
+/* struct dkim_dnsflight -- a DNS query shared by concurrent requesters */
+struct dkim_dnsflight
+{
+	_Bool			fl_linked;	/* still in the table */
+	_Bool			fl_started;	/* fl_query is valid */
+	_Bool			fl_collecting;	/* a requester is waiting */
+	_Bool			fl_done;	/* results are final */
+	int			fl_type;
+	int			fl_status;
+	int			fl_error;
+	int			fl_dnssec;
+	u_int			fl_refcnt;
+	size_t			fl_anslen;
+	void *			fl_query;
+	u_char *		fl_qname;
+	u_char *		fl_ansbuf;
+	pthread_cond_t		fl_cond;
+	struct dkim_dnsflight *	fl_next;
+};
+
 /* struct dkim_unbound_cb_data -- libunbound callback data */
 struct dkim_unbound_cb_data
 {
@@ -264,6 +312,7 @@ struct dkim
 	_Bool			dkim_hdrbind;
 #endif /* _FFR_RESIGN */
 	_Bool			dkim_eoh_reentry;
+	_Bool			dkim_defalg;
 	int			dkim_mode;
 	int			dkim_state;
 	int			dkim_chunkstate;
@@ -307,11 +356,11 @@ struct dkim
 	u_char *		dkim_sender;
 	u_char *		dkim_signer;
 	u_char *		dkim_error;
-	u_char *		dkim_hdrlist;
 	u_char *		dkim_zdecode;
 	u_char *		dkim_tmpdir;
 	DKIM_SIGINFO *		dkim_signature;
 	void *			dkim_keydata;
+	DKIM_PRIVKEY *		dkim_privkey;
 	void *			dkim_closure;
 	const void *		dkim_user_context;
 #ifdef _FFR_RESIGN
@@ -324,6 +373,7 @@ struct dkim
 	struct dkim_set *	dkim_sigset;
 	struct dkim_header *	dkim_hhead;
 	struct dkim_header *	dkim_htail;
+	struct dkim_header *	dkim_hindex[DKIM_HDRBUCKETS];
 	struct dkim_header *	dkim_senderhdr;
 	struct dkim_canon *	dkim_canonhead;
 	struct dkim_canon *	dkim_canontail;
@@ -359,7 +409,7 @@ struct dkim_lib
 	u_char **		dkiml_oversignhdrs;
 	u_char **		dkiml_mbs;
 #ifdef QUERY_CACHE
-	DB *			dkiml_cache;
+	struct dkim_cache *	dkiml_cache;
 #endif /* QUERY_CACHE */
 	regex_t			dkiml_hdrre;
 	regex_t			dkiml_skiphdrre;
@@ -401,6 +451,8 @@ struct dkim_lib
 				                        size_t *bytes,
 				                        int *error,
 				                        int *dnssec);
+	pthread_mutex_t		dkiml_flightlock;
+	struct dkim_dnsflight *	dkiml_flights[DKIM_FLIGHTBUCKETS];
 	u_char			dkiml_tmpdir[MAXPATHLEN + 1];
 	u_char			dkiml_queryinfo[MAXPATHLEN + 1];
 };
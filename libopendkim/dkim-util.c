@@ -19,6 +19,7 @@
 #include <assert.h>
 #include <unistd.h>
 #include <limits.h>
+#include <ctype.h>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
@@ -171,6 +172,111 @@ dkim_tmpfile(DKIM *dkim, int *fp, _Bool keep)
 	return DKIM_STAT_OK;
 }
 
+/*
+**  DKIM_HDR_HASH -- hash a header field name for the name index
+**
+**  Parameters:
+**  	name -- header field name
+**  	len -- bytes at "name"
+**
+**  Return value:
+**  	Bucket number in the range [0, DKIM_HDRBUCKETS).
+**
+**  Notes:
+**  	Case-insensitive, since header field names are.
+*/
+
+static u_int
+dkim_hdr_hash(u_char *name, size_t len)
+{
+	uint32_t hash = 2166136261U;
+	size_t c;
+
+	for (c = 0; c < len; c++)
+	{
+		hash ^= (uint32_t) tolower(name[c]);
+		hash *= 16777619U;
+	}
+
+	return hash % DKIM_HDRBUCKETS;
+}
+
+/*
+**  DKIM_HDR_FIND -- find the first header field with a given name
+**
+**  Parameters:
+**  	dkim -- DKIM handle
+**  	name -- header field name
+**  	len -- bytes at "name"
+**
+**  Return value:
+**  	The first header field called "name", or NULL if there isn't one.
+**  	Later fields of the same name follow via hdr_samenext, and the
+**  	last one is at hdr_samelast.
+*/
+
+struct dkim_header *
+dkim_hdr_find(DKIM *dkim, u_char *name, size_t len)
+{
+	struct dkim_header *hdr;
+
+	assert(dkim != NULL);
+	assert(name != NULL);
+
+	for (hdr = dkim->dkim_hindex[dkim_hdr_hash(name, len)];
+	     hdr != NULL;
+	     hdr = hdr->hdr_hashnext)
+	{
+		if (hdr->hdr_namelen == len &&
+		    strncasecmp((char *) hdr->hdr_text, (char *) name,
+		                len) == 0)
+			return hdr;
+	}
+
+	return NULL;
+}
+
+/*
+**  DKIM_HDR_INDEX -- add a new header field to the name index
+**
+**  Parameters:
+**  	dkim -- DKIM handle
+**  	hdr -- header field just appended to the handle's list
+**
+**  Return value:
+**  	None.
+*/
+
+void
+dkim_hdr_index(DKIM *dkim, struct dkim_header *hdr)
+{
+	u_int bucket;
+	struct dkim_header *first;
+
+	assert(dkim != NULL);
+	assert(hdr != NULL);
+
+	hdr->hdr_samenext = NULL;
+	hdr->hdr_sameprev = NULL;
+	hdr->hdr_samelast = NULL;
+	hdr->hdr_hashnext = NULL;
+
+	first = dkim_hdr_find(dkim, hdr->hdr_text, hdr->hdr_namelen);
+	if (first == NULL)
+	{
+		bucket = dkim_hdr_hash(hdr->hdr_text, hdr->hdr_namelen);
+		hdr->hdr_samelast = hdr;
+		hdr->hdr_hashnext = dkim->dkim_hindex[bucket];
+		dkim->dkim_hindex[bucket] = hdr;
+	}
+	else
+	{
+		hdr->hdr_sameprev = first->hdr_samelast;
+		first->hdr_samelast->hdr_samenext = hdr;
+		first->hdr_samelast = hdr;
+	}
+}
+
 /*
 **  DKIM_DSTRING_RESIZE -- resize a dynamic string (dstring)
 **
@@ -31,6 +31,9 @@ extern void dkim_mfree __P((DKIM_LIB *, void *, void *));
 extern unsigned char *dkim_strdup __P((DKIM *, const unsigned char *, size_t));
 extern DKIM_STAT dkim_tmpfile __P((DKIM *, int *, _Bool));
 
+extern struct dkim_header *dkim_hdr_find __P((DKIM *, u_char *, size_t));
+extern void dkim_hdr_index __P((DKIM *, struct dkim_header *));
+
 extern void dkim_dstring_blank __P((struct dkim_dstring *));
 extern _Bool dkim_dstring_cat __P((struct dkim_dstring *, u_char *));
 extern _Bool dkim_dstring_cat1 __P((struct dkim_dstring *, int));
@@ -29,9 +29,7 @@
 #include <string.h>
 #include <limits.h>
 #include <unistd.h>
-#ifndef USE_GNUTLS
-# include <pthread.h>
-#endif /* ! USE_GNUTLS */
+#include <pthread.h>
 #include <resolv.h>
 #ifdef USE_TRE
 # ifdef TRE_PRE_080
@@ -139,6 +137,8 @@ void dkim_error __P((DKIM *, const char *, ...));
 #define	DEFMINKEYBITS		1024
 #define	DEFTIMEOUT		10
 #define	MINSIGLEN		8
+#define	ED25519_KEYBITS		256
+#define	ED25519_SIGLEN		64
 
 /* local definitions needed for DNS queries */
 #define MAXPACKET		8192
@@ -1022,6 +1022,110 @@ dkim_sig_load_ssl_errors(DKIM *dkim, DKIM_SIGINFO *sig, int status)
 #endif /* ! USE_GNUTLS */
 }
 
+/*
+**  DKIM_PRIVKEY_SETALG -- check a signing handle's algorithm against its key
+**
+**  Parameters:
+**  	dkim -- DKIM handle
+**  	keytype -- type of the private key (a DKIM_KEYTYPE_* constant)
+**
+**  Return value:
+**  	A DKIM_STAT_* constant.
+**
+**  Notes:
+**  	A handle created with DKIM_SIGN_DEFAULT signs with ed25519-sha256
+**  	if its key turns out to be an Ed25519 key.  Both algorithms use
+**  	SHA256, so the canonicalizations already set up are unaffected.
+*/
+
+static DKIM_STAT
+dkim_privkey_setalg(DKIM *dkim, int keytype)
+{
+	_Bool ed25519;
+
+	assert(dkim != NULL);
+
+	ed25519 = (dkim->dkim_signalg == DKIM_SIGN_ED25519SHA256);
+
+	if (keytype == DKIM_KEYTYPE_ED25519 && !ed25519 &&
+	    dkim->dkim_defalg && dkim->dkim_signalg == DKIM_SIGN_RSASHA256)
+	{
+		dkim->dkim_signalg = DKIM_SIGN_ED25519SHA256;
+		if (dkim->dkim_siglist != NULL && dkim->dkim_siglist[0] != NULL)
+			dkim->dkim_siglist[0]->sig_signalg = dkim->dkim_signalg;
+
+		ed25519 = TRUE;
+	}
+
+	if (ed25519 != (keytype == DKIM_KEYTYPE_ED25519))
+	{
+		dkim_error(dkim, "%s key cannot make %s signatures",
+		           dkim_code_to_name(keytypes, keytype),
+		           dkim_code_to_name(algorithms, dkim->dkim_signalg));
+		return DKIM_STAT_INVALID;
+	}
+
+	return DKIM_STAT_OK;
+}
+
+#ifdef HAVE_ED25519
+/*
+**  DKIM_PRIVKEY_ED25519 -- decode a base64-encoded Ed25519 private key
+**
+**  Parameters:
+**  	key -- key data
+**  	keylen -- number of bytes at "key"
+**
+**  Return value:
+**  	An EVP_PKEY, or NULL if "key" isn't a base64-encoded Ed25519 key.
+**
+**  Notes:
+**  	Ed25519 keys are usually exchanged as the base64 encoding of the
+**  	raw 32-byte private key (as in the examples in RFC8463); the
+**  	base64 encoding of a PKCS#8 key is also accepted.
+*/
+
+EVP_PKEY *
+dkim_privkey_ed25519(u_char *key, size_t keylen)
+{
+	int len;
+	EVP_PKEY *pkey = NULL;
+	const u_char *p;
+	u_char b64[BUFRSZ + 1];
+	u_char raw[BUFRSZ];
+
+	assert(key != NULL);
+
+	if (keylen >= sizeof b64)
+		return NULL;
+
+	memcpy(b64, key, keylen);
+	b64[keylen] = '\0';
+
+	len = dkim_base64_decode(b64, raw, sizeof raw);
+	if (len == ED25519_KEYBITS / 8)
+	{
+		pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL,
+		                                    raw, len);
+	}
+	else if (len > 0)
+	{
+		p = raw;
+		pkey = d2i_AutoPrivateKey(NULL, &p, len);
+		if (pkey != NULL && EVP_PKEY_id(pkey) != EVP_PKEY_ED25519)
+		{
+			EVP_PKEY_free(pkey);
+			pkey = NULL;
+		}
+	}
+
+	memset(b64, '\0', sizeof b64);
+	memset(raw, '\0', sizeof raw);
+
+	return pkey;
+}
+#endif /* HAVE_ED25519 */
+
 /*
 **  DKIM_PRIVKEY_LOAD -- attempt to load a private key for later use
 **
@@ -1046,7 +1150,8 @@ dkim_privkey_load(DKIM *dkim)
 		return DKIM_STAT_INVALID;
 
 	if (dkim->dkim_signalg != DKIM_SIGN_RSASHA1 &&
-	    dkim->dkim_signalg != DKIM_SIGN_RSASHA256)
+	    dkim->dkim_signalg != DKIM_SIGN_RSASHA256 &&
+	    dkim->dkim_signalg != DKIM_SIGN_ED25519SHA256)
 		return DKIM_STAT_INVALID;
 
 	rsa = (struct dkim_rsa *) dkim->dkim_keydata;
@@ -1065,6 +1170,70 @@ dkim_privkey_load(DKIM *dkim)
 
 	dkim->dkim_keydata = rsa;
 
+	/* already parsed; just take a reference */
+	if (dkim->dkim_privkey != NULL)
+	{
+		DKIM_PRIVKEY *pk;
+
+		pk = dkim->dkim_privkey;
+
+#ifdef USE_GNUTLS
+		if (dkim_privkey_setalg(dkim, DKIM_KEYTYPE_RSA) != DKIM_STAT_OK)
+			return DKIM_STAT_INVALID;
+
+		rsa->rsa_privkey = pk->pk_privkey;
+		rsa->rsa_keysize = pk->pk_keysize;
+#else /* USE_GNUTLS */
+# ifdef HAVE_ED25519
+		if (EVP_PKEY_id(pk->pk_pkey) == EVP_PKEY_ED25519)
+		{
+			if (dkim_privkey_setalg(dkim,
+			                        DKIM_KEYTYPE_ED25519) != DKIM_STAT_OK)
+				return DKIM_STAT_INVALID;
+
+			EVP_PKEY_up_ref(pk->pk_pkey);
+			rsa->rsa_pkey = pk->pk_pkey;
+			rsa->rsa_keysize = pk->pk_keysize;
+			rsa->rsa_rsaout = DKIM_MALLOC(dkim, ED25519_SIGLEN);
+			if (rsa->rsa_rsaout == NULL)
+			{
+				dkim_error(dkim,
+				           "unable to allocate %d byte(s)",
+				           ED25519_SIGLEN);
+				return DKIM_STAT_NORESOURCE;
+			}
+
+			return DKIM_STAT_OK;
+		}
+# endif /* HAVE_ED25519 */
+
+		if (dkim_privkey_setalg(dkim, DKIM_KEYTYPE_RSA) != DKIM_STAT_OK)
+			return DKIM_STAT_INVALID;
+
+		rsa->rsa_rsa = EVP_PKEY_get1_RSA(pk->pk_pkey);
+		if (rsa->rsa_rsa == NULL)
+		{
+			dkim_load_ssl_errors(dkim, 0);
+			dkim_error(dkim, "EVP_PKEY_get1_RSA() failed");
+			return DKIM_STAT_NORESOURCE;
+		}
+
+		rsa->rsa_keysize = pk->pk_keysize;
+		rsa->rsa_pad = RSA_PKCS1_PADDING;
+		rsa->rsa_rsaout = DKIM_MALLOC(dkim, rsa->rsa_keysize / 8);
+		if (rsa->rsa_rsaout == NULL)
+		{
+			dkim_error(dkim, "unable to allocate %d byte(s)",
+			           rsa->rsa_keysize / 8);
+			RSA_free(rsa->rsa_rsa);
+			rsa->rsa_rsa = NULL;
+			return DKIM_STAT_NORESOURCE;
+		}
+#endif /* USE_GNUTLS */
+
+		return DKIM_STAT_OK;
+	}
+
 #ifdef USE_GNUTLS
 	rsa->rsa_keydata.data = dkim->dkim_key;
 	rsa->rsa_keydata.size = dkim->dkim_keylen;
@@ -1130,6 +1299,9 @@ dkim_privkey_load(DKIM *dkim)
 	(void) gnutls_privkey_get_pk_algorithm(rsa->rsa_privkey,
 	                                       &rsa->rsa_keysize);
 
+	if (dkim_privkey_setalg(dkim, DKIM_KEYTYPE_RSA) != DKIM_STAT_OK)
+		return DKIM_STAT_INVALID;
+
 #else /* USE_GNUTLS */
 
 	if (strncmp((char *) dkim->dkim_key, "-----", 5) == 0)
@@ -1150,6 +1322,16 @@ dkim_privkey_load(DKIM *dkim)
 	{						/* DER */
 		rsa->rsa_pkey = d2i_PrivateKey_bio(rsa->rsa_keydata, NULL);
 
+# ifdef HAVE_ED25519
+		if (rsa->rsa_pkey == NULL)
+		{
+			rsa->rsa_pkey = dkim_privkey_ed25519(dkim->dkim_key,
+			                                     dkim->dkim_keylen);
+			if (rsa->rsa_pkey != NULL)
+				ERR_clear_error();
+		}
+# endif /* HAVE_ED25519 */
+
 		if (rsa->rsa_pkey == NULL)
 		{
 			dkim_load_ssl_errors(dkim, 0);
@@ -1160,6 +1342,29 @@ dkim_privkey_load(DKIM *dkim)
 		}
 	}
 
+# ifdef HAVE_ED25519
+	if (EVP_PKEY_id(rsa->rsa_pkey) == EVP_PKEY_ED25519)
+	{
+		if (dkim_privkey_setalg(dkim,
+		                        DKIM_KEYTYPE_ED25519) != DKIM_STAT_OK)
+			return DKIM_STAT_INVALID;
+
+		rsa->rsa_keysize = ED25519_KEYBITS;
+		rsa->rsa_rsaout = DKIM_MALLOC(dkim, ED25519_SIGLEN);
+		if (rsa->rsa_rsaout == NULL)
+		{
+			dkim_error(dkim, "unable to allocate %d byte(s)",
+			           ED25519_SIGLEN);
+			return DKIM_STAT_NORESOURCE;
+		}
+
+		return DKIM_STAT_OK;
+	}
+# endif /* HAVE_ED25519 */
+
+	if (dkim_privkey_setalg(dkim, DKIM_KEYTYPE_RSA) != DKIM_STAT_OK)
+		return DKIM_STAT_INVALID;
+
 	rsa->rsa_rsa = EVP_PKEY_get1_RSA(rsa->rsa_pkey);
 	if (rsa->rsa_rsa == NULL)
 	{
@@ -1188,6 +1393,261 @@ dkim_privkey_load(DKIM *dkim)
 	return DKIM_STAT_OK;
 }
 
+/*
+**  DKIM_PRIVKEY_PARSE -- parse private key data into a DKIM_PRIVKEY
+**
+**  Parameters:
+**  	pk -- DKIM_PRIVKEY to populate
+**  	key -- key data (PEM or DER)
+**  	keylen -- number of bytes at "key"
+**
+**  Return value:
+**  	A DKIM_STAT_* constant.
+**
+**  Notes:
+**  	On failure, anything already allocated is left in "pk" for
+**  	dkim_privkey_free() to release.
+*/
+
+static DKIM_STAT
+dkim_privkey_parse(DKIM_PRIVKEY *pk, u_char *key, size_t keylen)
+{
+#ifdef USE_GNUTLS
+	int status;
+	gnutls_datum_t keydata;
+	gnutls_x509_crt_fmt_t fmt;
+
+	assert(pk != NULL);
+	assert(key != NULL);
+
+	keydata.data = key;
+	keydata.size = keylen;
+
+	if (keylen > 5 && strncmp((char *) key, "-----", 5) == 0)
+		fmt = GNUTLS_X509_FMT_PEM;
+	else
+		fmt = GNUTLS_X509_FMT_DER;
+
+	status = gnutls_x509_privkey_init(&pk->pk_key);
+	if (status != GNUTLS_E_SUCCESS)
+		return DKIM_STAT_NORESOURCE;
+
+	status = gnutls_x509_privkey_import(pk->pk_key, &keydata, fmt);
+	if (status != GNUTLS_E_SUCCESS)
+		return DKIM_STAT_NORESOURCE;
+
+	status = gnutls_privkey_init(&pk->pk_privkey);
+	if (status != GNUTLS_E_SUCCESS)
+		return DKIM_STAT_NORESOURCE;
+
+	status = gnutls_privkey_import_x509(pk->pk_privkey, pk->pk_key, 0);
+	if (status != GNUTLS_E_SUCCESS)
+		return DKIM_STAT_NORESOURCE;
+
+	(void) gnutls_privkey_get_pk_algorithm(pk->pk_privkey,
+	                                       &pk->pk_keysize);
+#else /* USE_GNUTLS */
+	BIO *keydata;
+	RSA *rsa;
+
+	assert(pk != NULL);
+	assert(key != NULL);
+
+	keydata = BIO_new_mem_buf(key, keylen);
+	if (keydata == NULL)
+		return DKIM_STAT_NORESOURCE;
+
+	if (keylen > 5 && strncmp((char *) key, "-----", 5) == 0)
+		pk->pk_pkey = PEM_read_bio_PrivateKey(keydata, NULL, NULL, NULL);
+	else
+		pk->pk_pkey = d2i_PrivateKey_bio(keydata, NULL);
+
+	BIO_free(keydata);
+
+# ifdef HAVE_ED25519
+	if (pk->pk_pkey == NULL)
+	{
+		pk->pk_pkey = dkim_privkey_ed25519(key, keylen);
+		if (pk->pk_pkey != NULL)
+			ERR_clear_error();
+	}
+
+	if (pk->pk_pkey != NULL && EVP_PKEY_id(pk->pk_pkey) == EVP_PKEY_ED25519)
+	{
+		pk->pk_keysize = ED25519_KEYBITS;
+		return DKIM_STAT_OK;
+	}
+# endif /* HAVE_ED25519 */
+
+	if (pk->pk_pkey == NULL)
+		return DKIM_STAT_NORESOURCE;
+
+	rsa = EVP_PKEY_get1_RSA(pk->pk_pkey);
+	if (rsa == NULL)
+		return DKIM_STAT_NORESOURCE;
+
+	pk->pk_keysize = RSA_size(rsa) * 8;
+	RSA_free(rsa);
+#endif /* USE_GNUTLS */
+
+	return DKIM_STAT_OK;
+}
+
+/*
+**  DKIM_PRIVKEY_NEW -- parse a private key for use by many signing handles
+**
+**  Parameters:
+**  	libhandle -- DKIM_LIB handle
+**  	secretkey -- secret key (PEM, or base64-encoded DER)
+**  	statp -- status (returned)
+**
+**  Return value:
+**  	A new DKIM_PRIVKEY handle, or NULL on failure.
+*/
+
+DKIM_PRIVKEY *
+dkim_privkey_new(DKIM_LIB *libhandle, const dkim_sigkey_t secretkey,
+                 DKIM_STAT *statp)
+{
+	int keylen;
+	DKIM_STAT status;
+	u_char *key;
+	DKIM_PRIVKEY *new;
+
+	assert(libhandle != NULL);
+	assert(secretkey != NULL);
+	assert(statp != NULL);
+
+	new = (DKIM_PRIVKEY *) dkim_malloc(libhandle, NULL, sizeof *new);
+	if (new == NULL)
+	{
+		*statp = DKIM_STAT_NORESOURCE;
+		return NULL;
+	}
+
+	memset(new, '\0', sizeof *new);
+	new->pk_refcnt = 1;
+	new->pk_libhandle = libhandle;
+	pthread_mutex_init(&new->pk_lock, NULL);
+
+	/* do DER decoding here if needed */
+	if (strncmp((char *) secretkey, "MII", 3) == 0)
+	{
+		size_t b64len;
+
+		b64len = strlen((char *) secretkey);
+
+		key = (u_char *) dkim_malloc(libhandle, NULL, b64len);
+		if (key == NULL)
+		{
+			dkim_privkey_free(new);
+			*statp = DKIM_STAT_NORESOURCE;
+			return NULL;
+		}
+
+		keylen = dkim_base64_decode(secretkey, key, b64len);
+		if (keylen <= 0)
+			status = DKIM_STAT_NORESOURCE;
+		else
+			status = dkim_privkey_parse(new, key, keylen);
+
+		memset(key, '\0', b64len);
+		dkim_mfree(libhandle, NULL, key);
+	}
+	else
+	{
+		status = dkim_privkey_parse(new, secretkey,
+		                            strlen((char *) secretkey));
+	}
+
+	if (status != DKIM_STAT_OK)
+	{
+		dkim_privkey_free(new);
+		*statp = status;
+		return NULL;
+	}
+
+	*statp = DKIM_STAT_OK;
+
+	return new;
+}
+
+/*
+**  DKIM_PRIVKEY_REF -- add a reference to a DKIM_PRIVKEY
+**
+**  Parameters:
+**  	pk -- DKIM_PRIVKEY handle
+**
+**  Return value:
+**  	None.
+*/
+
+void
+dkim_privkey_ref(DKIM_PRIVKEY *pk)
+{
+	assert(pk != NULL);
+
+	pthread_mutex_lock(&pk->pk_lock);
+	assert(pk->pk_refcnt > 0);
+	pk->pk_refcnt++;
+	pthread_mutex_unlock(&pk->pk_lock);
+}
+
+/*
+**  DKIM_PRIVKEY_FREE -- drop a reference to a DKIM_PRIVKEY
+**
+**  Parameters:
+**  	pk -- DKIM_PRIVKEY handle
+**
+**  Return value:
+**  	None.
+*/
+
+void
+dkim_privkey_free(DKIM_PRIVKEY *pk)
+{
+	u_int refcnt;
+
+	assert(pk != NULL);
+
+	pthread_mutex_lock(&pk->pk_lock);
+	assert(pk->pk_refcnt > 0);
+	refcnt = --pk->pk_refcnt;
+	pthread_mutex_unlock(&pk->pk_lock);
+
+	if (refcnt > 0)
+		return;
+
+#ifdef USE_GNUTLS
+	PRIVKEY_CLOBBER(pk->pk_privkey);
+	KEY_CLOBBER(pk->pk_key);
+#else /* USE_GNUTLS */
+	EVP_CLOBBER(pk->pk_pkey);
+#endif /* USE_GNUTLS */
+
+	pthread_mutex_destroy(&pk->pk_lock);
+
+	dkim_mfree(pk->pk_libhandle, NULL, pk);
+}
+
+/*
+**  DKIM_PRIVKEY_BITS -- report the size of a DKIM_PRIVKEY
+**
+**  Parameters:
+**  	pk -- DKIM_PRIVKEY handle
+**
+**  Return value:
+**  	Size of the key, in bits.
+*/
+
+unsigned int
+dkim_privkey_bits(DKIM_PRIVKEY *pk)
+{
+	assert(pk != NULL);
+
+	return (unsigned int) pk->pk_keysize;
+}
+
 /*
 **  DKIM_CHECK_REQUIREDHDRS -- see if all requried headers are present
 **
@@ -1202,10 +1662,8 @@ dkim_privkey_load(DKIM *dkim)
 static const unsigned char *
 dkim_check_requiredhdrs(DKIM *dkim)
 {
-	_Bool found;
 	int c;
 	size_t len;
-	struct dkim_header *hdr;
 	u_char **required_signhdrs;
 
 	assert(dkim != NULL);
@@ -1213,22 +1671,9 @@ dkim_check_requiredhdrs(DKIM *dkim)
 	required_signhdrs = dkim->dkim_libhandle->dkiml_requiredhdrs;
 	for (c = 0; required_signhdrs[c] != NULL; c++)
 	{
-		found = FALSE;
-		len = strlen((char *) required_signhdrs[c]);
-
-		for (hdr = dkim->dkim_hhead; hdr != NULL; hdr = hdr->hdr_next)
-		{
-			if (hdr->hdr_namelen == len &&
-			    strncasecmp((char *) hdr->hdr_text,
-			                (char *) required_signhdrs[c],
-			                len) == 0)
-			{
-				found = TRUE;
-				break;
-			}
-		}
+		len = strlen((char *) required_signhdrs[c]);
 
-		if (!found)
+		if (dkim_hdr_find(dkim, required_signhdrs[c], len) == NULL)
 			return required_signhdrs[c];
 	}
 
@@ -1280,20 +1725,12 @@ dkim_get_header(DKIM *dkim, u_char *name, size_t namelen, int inst)
 	else
 		len = namelen;
 
-	for (hdr = dkim->dkim_hhead; hdr != NULL; hdr = hdr->hdr_next)
-	{
-		if (hdr->hdr_namelen == len &&
-		    strncasecmp((char *) hdr->hdr_text,
-		                (char *) name, len) == 0)
-		{
-			if (inst == 0)
-				return hdr;
-			else
-				inst--;
-		}
-	}
+	for (hdr = dkim_hdr_find(dkim, name, len);
+	     hdr != NULL && inst > 0;
+	     hdr = hdr->hdr_samenext)
+		inst--;
 
-	return NULL;
+	return hdr;
 }
 
 /*
@@ -2028,6 +2465,19 @@ dkim_siglist_setup(DKIM *dkim)
 				}
 				break;
 
+			  case DKIM_SIGN_ED25519SHA256:
+				if (dkim_libfeature(lib, DKIM_FEATURE_SHA256) &&
+				    dkim_libfeature(lib, DKIM_FEATURE_ED25519))
+				{
+					hashtype = DKIM_HASHTYPE_SHA256;
+				}
+				else
+				{
+					dkim->dkim_siglist[c]->sig_error = DKIM_SIGERROR_INVALID_A;
+					continue;
+				}
+				break;
+
 			  default:
 				assert(0);
 				/* NOTREACHED */
@@ -2064,6 +2514,7 @@ dkim_siglist_setup(DKIM *dkim)
 		hdrlist = param;
 
 		/* determine signing length */
+		signlen = (ssize_t) -1;
 		param = dkim_param_get(set, (u_char *) "l");
 		if (param != NULL)
 		{
@@ -2643,23 +3094,14 @@ dkim_getsender(DKIM *dkim)
 	DKIM_STAT status;
 	unsigned char *domain;
 	unsigned char *user;
-	struct dkim_header *sender = NULL;
-	struct dkim_header *cur;
+	struct dkim_header *sender;
 
 	assert(dkim != NULL);
 
 	if (dkim->dkim_sender != NULL)
 		return DKIM_STAT_OK;
 
-	for (cur = dkim->dkim_hhead; cur != NULL; cur = cur->hdr_next)
-	{
-		if (cur->hdr_namelen == 4 &&
-		    strncasecmp("from", (char *) cur->hdr_text, 4) == 0)
-		{
-			sender = cur;
-			break;
-		}
-	}
+	sender = dkim_hdr_find(dkim, (u_char *) "from", 4);
 
 	if (sender == NULL)
 	{
@@ -2924,6 +3366,19 @@ dkim_get_key(DKIM *dkim, DKIM_SIGINFO *sig, _Bool test)
 		return DKIM_STAT_SYNTAX;
 	}
 
+	sig->sig_keytype = dkim_name_to_code(keytypes, (char *) p);
+
+	/* ...and that it can make this kind of signature */
+	if (!test &&
+	    (sig->sig_keytype == DKIM_KEYTYPE_ED25519) !=
+	    (sig->sig_signalg == DKIM_SIGN_ED25519SHA256))
+	{
+		dkim_error(dkim, "key type '%s' does not match signature algorithm",
+		           p);
+		sig->sig_error = DKIM_SIGERROR_KEYTYPEMISMATCH;
+		return DKIM_STAT_CANTVRFY;
+	}
+
 	if (!gotkey)
 	{
 		/* decode the key */
@@ -3209,6 +3664,7 @@ dkim_eoh_sign(DKIM *dkim)
 		break;
 
 	  case DKIM_SIGN_RSASHA256:
+	  case DKIM_SIGN_ED25519SHA256:
 		hashtype = DKIM_HASHTYPE_SHA256;
 		break;
 
@@ -3287,6 +3743,61 @@ dkim_eoh_sign(DKIM *dkim)
 	return DKIM_STAT_OK;
 }
 
+/*
+**  DKIM_START_KEYS -- start key queries for all signatures to be verified
+**
+**  Parameters:
+**  	dkim -- DKIM handle
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Only one query is started for each distinct selector and domain,
+**  	as dkim_get_key() copies keys between signatures that share them.
+**  	A failure to start a query isn't reported here; the query will
+**  	simply be retried (and the failure reported) when the key is
+**  	actually needed.
+*/
+
+static void
+dkim_start_keys(DKIM *dkim)
+{
+	int c;
+	int n;
+	DKIM_SIGINFO *sig;
+	DKIM_SIGINFO *osig;
+
+	assert(dkim != NULL);
+
+	for (c = 0; c < dkim->dkim_sigcount; c++)
+	{
+		sig = dkim->dkim_siglist[c];
+
+		if ((sig->sig_flags & DKIM_SIGFLAG_PROCESSED) != 0 ||
+		    (sig->sig_flags & DKIM_SIGFLAG_IGNORE) != 0 ||
+		    sig->sig_error != DKIM_SIGERROR_UNKNOWN ||
+		    sig->sig_query != DKIM_QUERY_DNS ||
+		    sig->sig_selector == NULL || sig->sig_domain == NULL)
+			continue;
+
+		for (n = 0; n < c; n++)
+		{
+			osig = dkim->dkim_siglist[n];
+
+			if (osig->sig_dnsquery != NULL &&
+			    strcmp((char *) osig->sig_domain,
+			           (char *) sig->sig_domain) == 0 &&
+			    strcmp((char *) osig->sig_selector,
+			           (char *) sig->sig_selector) == 0)
+				break;
+		}
+
+		if (n == c)
+			(void) dkim_start_key_dns(dkim, sig);
+	}
+}
+
 /*
 **  DKIM_EOH_VERIFY -- declare end-of-headers; set up verification
 ** 
@@ -3418,6 +3929,16 @@ dkim_eoh_verify(DKIM *dkim)
 			return status;
 	}
 
+	/*
+	**  Start the key queries for all still-enabled signatures now so
+	**  they can all be in flight at once; dkim_sig_process() collects
+	**  the replies.  Skipped when a local lookup function or simulated
+	**  DNS replies will be used instead.
+	*/
+
+	if (lib->dkiml_key_lookup == NULL && dkim->dkim_dnstesth == NULL)
+		dkim_start_keys(dkim);
+
 	/* do public key verification of all still-enabled signatures here */
 	if ((lib->dkiml_flags & DKIM_LIBFLAGS_DELAYSIGPROC) == 0)
 	{
@@ -3639,7 +4160,10 @@ dkim_eom_sign(DKIM *dkim)
 
 	if (dkim->dkim_keydata == NULL)
 	{
-		if (dkim_privkey_load(dkim) != DKIM_STAT_OK)
+		ret = dkim_privkey_load(dkim);
+		if (ret == DKIM_STAT_INVALID)
+			return ret;
+		else if (ret != DKIM_STAT_OK)
 			return DKIM_STAT_NORESOURCE;
 	}
 
@@ -3647,7 +4171,7 @@ dkim_eom_sign(DKIM *dkim)
 #ifdef USE_GNUTLS
 	if (rsa->rsa_privkey == NULL)
 #else /* USE_GNUTLS */
-	if (rsa->rsa_rsa == NULL)
+	if (rsa->rsa_rsa == NULL && rsa->rsa_pkey == NULL)
 #endif /* USE_GNUTLS */
 	{
 		dkim_error(dkim, "private key load failed");
@@ -3658,7 +4182,9 @@ dkim_eom_sign(DKIM *dkim)
 	sig->sig_signature = dkim->dkim_keydata;
 	sig->sig_flags |= DKIM_SIGFLAG_KEYLOADED;
 
-	if (sig->sig_keybits < dkim->dkim_libhandle->dkiml_minkeybits)
+	/* the minimum size applies to RSA keys */
+	if (sig->sig_signalg != DKIM_SIGN_ED25519SHA256 &&
+	    sig->sig_keybits < dkim->dkim_libhandle->dkiml_minkeybits)
 	{
 		sig->sig_error = DKIM_SIGERROR_KEYTOOSMALL;
 		dkim_error(dkim,
@@ -3688,6 +4214,14 @@ dkim_eom_sign(DKIM *dkim)
 		break;
 	  }
 
+	  case DKIM_SIGN_ED25519SHA256:
+		assert(sig->sig_hashtype == DKIM_HASHTYPE_SHA256);
+
+		sig->sig_signature = (void *) dkim->dkim_keydata;
+		sig->sig_keytype = DKIM_KEYTYPE_ED25519;
+
+		break;
+
 	  default:
 		assert(0);
 	}
@@ -3807,6 +4341,46 @@ dkim_eom_sign(DKIM *dkim)
 
 		break;
 	  }
+
+# ifdef HAVE_ED25519
+	  case DKIM_SIGN_ED25519SHA256:
+	  {
+		size_t edlen;
+		EVP_MD_CTX *mdctx;
+		struct dkim_rsa *rsa;
+
+		rsa = (struct dkim_rsa *) sig->sig_signature;
+
+		/* RFC8463: sign the header hash with PureEdDSA */
+		mdctx = EVP_MD_CTX_new();
+		if (mdctx == NULL)
+		{
+			dkim_error(dkim, "EVP_MD_CTX_new() failed");
+			return DKIM_STAT_NORESOURCE;
+		}
+
+		edlen = ED25519_SIGLEN;
+		if (EVP_DigestSignInit(mdctx, NULL, NULL, NULL,
+		                       rsa->rsa_pkey) != 1 ||
+		    EVP_DigestSign(mdctx, rsa->rsa_rsaout, &edlen,
+		                   digest, diglen) != 1)
+		{
+			dkim_load_ssl_errors(dkim, 0);
+			dkim_error(dkim, "signature generation failed");
+			EVP_MD_CTX_free(mdctx);
+			return DKIM_STAT_INTERNAL;
+		}
+
+		EVP_MD_CTX_free(mdctx);
+
+		rsa->rsa_rsaoutlen = edlen;
+
+		signature = rsa->rsa_rsaout;
+		siglen = rsa->rsa_rsaoutlen;
+
+		break;
+	  }
+# endif /* HAVE_ED25519 */
 #endif /* USE_GNUTLS */
 
 	  default:
@@ -4016,6 +4590,7 @@ dkim_eom_verify(DKIM *dkim, _Bool *testkey)
 				*/
 
 				if (sig->sig_error == 0 &&
+				    sig->sig_keytype == DKIM_KEYTYPE_RSA &&
 				    sig->sig_keybits < lib->dkiml_minkeybits)
 				{
 					sig->sig_error = DKIM_SIGERROR_KEYTOOSMALL;
@@ -4107,6 +4682,10 @@ dkim_eom_verify(DKIM *dkim, _Bool *testkey)
 	return ret;
 }
 
+#ifdef QUERY_CACHE
+static pthread_mutex_t cache_init_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif /* QUERY_CACHE */
+
 /*
 **  DKIM_NEW -- allocate a new message context
 **
@@ -4168,8 +4747,10 @@ dkim_new(DKIM_LIB *libhandle, const unsigned char *id, void *memclosure,
 	{
 		int err = 0;
 
-		libhandle->dkiml_cache = dkim_cache_init(&err,
-		                                         libhandle->dkiml_tmpdir);
+		pthread_mutex_lock(&cache_init_lock);
+		if (libhandle->dkiml_cache == NULL)
+			libhandle->dkiml_cache = dkim_cache_init(&err, 0);
+		pthread_mutex_unlock(&cache_init_lock);
 	}
 #endif /* QUERY_CACHE */
 
@@ -4301,6 +4882,9 @@ dkim_init(void *(*caller_mallocf)(void *closure, size_t nbytes),
 	libhandle->dkiml_dns_start = dkim_res_query;
 	libhandle->dkiml_dns_cancel = dkim_res_cancel;
 	libhandle->dkiml_dns_waitreply = dkim_res_waitreply;
+	pthread_mutex_init(&libhandle->dkiml_flightlock, NULL);
+	memset(libhandle->dkiml_flights, '\0',
+	       sizeof libhandle->dkiml_flights);
 	
 #define FEATURE_INDEX(x)	((x) / (8 * sizeof(u_int)))
 #define FEATURE_OFFSET(x)	((x) % (8 * sizeof(u_int)))
@@ -4325,6 +4909,9 @@ dkim_init(void *(*caller_mallocf)(void *closure, size_t nbytes),
 #ifdef HAVE_SHA256
 	FEATURE_ADD(libhandle, DKIM_FEATURE_SHA256);
 #endif /* HAVE_SHA256 */
+#ifdef HAVE_ED25519
+	FEATURE_ADD(libhandle, DKIM_FEATURE_ED25519);
+#endif /* HAVE_ED25519 */
 #ifdef _FFR_DNSSEC
 	FEATURE_ADD(libhandle, DKIM_FEATURE_DNSSEC);
 #endif /* _FFR_DNSSEC */
@@ -4337,6 +4924,10 @@ dkim_init(void *(*caller_mallocf)(void *closure, size_t nbytes),
 	FEATURE_ADD(libhandle, DKIM_FEATURE_OVERSIGN);
 	FEATURE_ADD(libhandle, DKIM_FEATURE_XTAGS);
 
+	/* pick a body scanner for this CPU */
+	if (dkim_canon_scaninit())
+		FEATURE_ADD(libhandle, DKIM_FEATURE_SIMD);
+
 	/* initialize the resolver */
 	(void) res_init();
 
@@ -4382,6 +4973,8 @@ dkim_close(DKIM_LIB *lib)
 
 	if (lib->dkiml_dns_close != NULL && lib->dkiml_dns_service != NULL)
 		lib->dkiml_dns_close(lib->dkiml_dns_service);
+
+	pthread_mutex_destroy(&lib->dkiml_flightlock);
 	
 	free((void *) lib);
 
@@ -4850,6 +5443,7 @@ dkim_free(DKIM *dkim)
 			next = hdr->hdr_next;
 
 			CLOBBER(hdr->hdr_text);
+			CLOBBER(hdr->hdr_relaxed);
 			CLOBBER(hdr);
 
 			hdr = next;
@@ -4893,9 +5487,12 @@ dkim_free(DKIM *dkim)
 			if (dkim->dkim_siglist[c]->sig_sslerrbuf != NULL)
 				dkim_dstring_free(dkim->dkim_siglist[c]->sig_sslerrbuf);
 
+			dkim_cancel_key_dns(dkim, dkim->dkim_siglist[c]);
+
 			CLOBBER(dkim->dkim_siglist[c]->sig_key);
 			CLOBBER(dkim->dkim_siglist[c]->sig_sig);
-			if (dkim->dkim_siglist[c]->sig_keytype == DKIM_KEYTYPE_RSA)
+			if (dkim->dkim_siglist[c]->sig_keytype == DKIM_KEYTYPE_RSA ||
+			    dkim->dkim_siglist[c]->sig_keytype == DKIM_KEYTYPE_ED25519)
 			{
 				struct dkim_rsa *rsa;
 
@@ -4903,6 +5500,10 @@ dkim_free(DKIM *dkim)
 				if (rsa != NULL)
 				{
 #ifdef USE_GNUTLS
+					/* owned by dkim_privkey, if any */
+					if (dkim->dkim_privkey != NULL)
+						rsa->rsa_privkey = NULL;
+
 					KEY_CLOBBER(rsa->rsa_key);
 					PUBKEY_CLOBBER(rsa->rsa_pubkey);
 					PRIVKEY_CLOBBER(rsa->rsa_privkey);
@@ -4964,6 +5565,9 @@ dkim_free(DKIM *dkim)
 	/* destroy canonicalizations */
 	dkim_canon_cleanup(dkim);
 
+	if (dkim->dkim_privkey != NULL)
+		dkim_privkey_free(dkim->dkim_privkey);
+
 	CLOBBER(dkim->dkim_b64sig);
 	CLOBBER(dkim->dkim_selector);
 	CLOBBER(dkim->dkim_domain);
@@ -4973,7 +5577,6 @@ dkim_free(DKIM *dkim)
 	CLOBBER(dkim->dkim_signer);
 	CLOBBER(dkim->dkim_error);
 	CLOBBER(dkim->dkim_zdecode);
-	CLOBBER(dkim->dkim_hdrlist);
 
 	DSTRING_CLOBBER(dkim->dkim_hdrbuf);
 	DSTRING_CLOBBER(dkim->dkim_canonbuf);
@@ -4985,13 +5588,12 @@ dkim_free(DKIM *dkim)
 }
 
 /*
-**  DKIM_SIGN -- allocate a handle for use in a signature operation
+**  DKIM_SIGN_NEW -- allocate a handle for a signature operation, minus key
 **
 **  Parameters:
 **  	libhandle -- DKIM_LIB handle
 **  	id -- identification string (e.g. job ID) for logging
 **  	memclosure -- memory closure for allocations (or NULL)
-**  	secretkey -- secret key (PEM format)
 **  	selector -- selector to be used when generating the signature header
 **  	domain -- domain for which this message is being signed
 **  	hdrcanonalg -- canonicalization algorithm to use for headers
@@ -5004,17 +5606,16 @@ dkim_free(DKIM *dkim)
 **  	A new signing handle, or NULL.
 */
 
-DKIM *
-dkim_sign(DKIM_LIB *libhandle, const unsigned char *id, void *memclosure,
-          const dkim_sigkey_t secretkey, const unsigned char *selector,
-          const unsigned char *domain, dkim_canon_t hdrcanonalg,
-	  dkim_canon_t bodycanonalg, dkim_alg_t signalg,
-          ssize_t length, DKIM_STAT *statp)
+static DKIM *
+dkim_sign_new(DKIM_LIB *libhandle, const unsigned char *id, void *memclosure,
+              const unsigned char *selector, const unsigned char *domain,
+              dkim_canon_t hdrcanonalg, dkim_canon_t bodycanonalg,
+              dkim_alg_t signalg, ssize_t length, DKIM_STAT *statp)
 {
+	_Bool defalg;
 	DKIM *new;
 
 	assert(libhandle != NULL);
-	assert(secretkey != NULL);
 	assert(selector != NULL);
 	assert(domain != NULL);
 	assert(hdrcanonalg == DKIM_CANON_SIMPLE ||
@@ -5022,9 +5623,19 @@ dkim_sign(DKIM_LIB *libhandle, const unsigned char *id, void *memclosure,
 	assert(bodycanonalg == DKIM_CANON_SIMPLE ||
 	       bodycanonalg == DKIM_CANON_RELAXED);
 	assert(signalg == DKIM_SIGN_DEFAULT ||
-	       signalg == DKIM_SIGN_RSASHA1 || signalg == DKIM_SIGN_RSASHA256);
+	       signalg == DKIM_SIGN_RSASHA1 || signalg == DKIM_SIGN_RSASHA256 ||
+	       signalg == DKIM_SIGN_ED25519SHA256);
 	assert(statp != NULL);
 
+	defalg = (signalg == DKIM_SIGN_DEFAULT);
+
+	if (signalg == DKIM_SIGN_ED25519SHA256 &&
+	    !dkim_libfeature(libhandle, DKIM_FEATURE_ED25519))
+	{
+		*statp = DKIM_STAT_INVALID;
+		return NULL;
+	}
+
 	if (dkim_libfeature(libhandle, DKIM_FEATURE_SHA256))
 	{
 		if (signalg == DKIM_SIGN_DEFAULT)
@@ -5032,7 +5643,8 @@ dkim_sign(DKIM_LIB *libhandle, const unsigned char *id, void *memclosure,
 	}
 	else
 	{
-		if (signalg == DKIM_SIGN_RSASHA256)
+		if (signalg == DKIM_SIGN_RSASHA256 ||
+		    signalg == DKIM_SIGN_ED25519SHA256)
 		{
 			*statp = DKIM_STAT_INVALID;
 			return NULL;
@@ -5048,7 +5660,55 @@ dkim_sign(DKIM_LIB *libhandle, const unsigned char *id, void *memclosure,
 	if (new != NULL)
 	{
 		new->dkim_mode = DKIM_MODE_SIGN;
+		new->dkim_defalg = defalg;
+
+		new->dkim_selector = dkim_strdup(new, selector, 0);
+		new->dkim_domain = dkim_strdup(new, domain, 0);
+		if (length == (ssize_t) -1)
+			new->dkim_signlen = ULONG_MAX;
+		else
+			new->dkim_signlen = length;
+	}
+
+	return new;
+}
+
+/*
+**  DKIM_SIGN -- allocate a handle for use in a signature operation
+**
+**  Parameters:
+**  	libhandle -- DKIM_LIB handle
+**  	id -- identification string (e.g. job ID) for logging
+**  	memclosure -- memory closure for allocations (or NULL)
+**  	secretkey -- secret key (PEM format)
+**  	selector -- selector to be used when generating the signature header
+**  	domain -- domain for which this message is being signed
+**  	hdrcanonalg -- canonicalization algorithm to use for headers
+**  	bodycanonalg -- canonicalization algorithm to use for body
+**  	signalg -- signing algorithm to use
+**  	length -- how many bytes of the body to sign (-1 for all)
+**  	statp -- status (returned)
+**
+**  Return value:
+**  	A new signing handle, or NULL.
+*/
+
+DKIM *
+dkim_sign(DKIM_LIB *libhandle, const unsigned char *id, void *memclosure,
+          const dkim_sigkey_t secretkey, const unsigned char *selector,
+          const unsigned char *domain, dkim_canon_t hdrcanonalg,
+	  dkim_canon_t bodycanonalg, dkim_alg_t signalg,
+          ssize_t length, DKIM_STAT *statp)
+{
+	DKIM *new;
+
+	assert(secretkey != NULL);
 
+	new = dkim_sign_new(libhandle, id, memclosure, selector, domain,
+	                    hdrcanonalg, bodycanonalg, signalg, length, statp);
+
+	if (new != NULL)
+	{
 		/* do DER decoding here if needed */
 		if (strncmp((char *) secretkey, "MII", 3) == 0)
 		{
@@ -5087,13 +5747,50 @@ dkim_sign(DKIM_LIB *libhandle, const unsigned char *id, void *memclosure,
 				return NULL;
 			}
 		}
+	}
 
-		new->dkim_selector = dkim_strdup(new, selector, 0);
-		new->dkim_domain = dkim_strdup(new, domain, 0);
-		if (length == (ssize_t) -1)
-			new->dkim_signlen = ULONG_MAX;
-		else
-			new->dkim_signlen = length;
+	return new;
+}
+
+/*
+**  DKIM_SIGN_PRIVKEY -- allocate a signing handle using a parsed key
+**
+**  Parameters:
+**  	libhandle -- DKIM_LIB handle
+**  	id -- identification string (e.g. job ID) for logging
+**  	memclosure -- memory closure for allocations (or NULL)
+**  	key -- parsed private key, from dkim_privkey_new()
+**  	selector -- selector to be used when generating the signature header
+**  	domain -- domain for which this message is being signed
+**  	hdrcanonalg -- canonicalization algorithm to use for headers
+**  	bodycanonalg -- canonicalization algorithm to use for body
+**  	signalg -- signing algorithm to use
+**  	length -- how many bytes of the body to sign (-1 for all)
+**  	statp -- status (returned)
+**
+**  Return value:
+**  	A new signing handle, or NULL.
+*/
+
+DKIM *
+dkim_sign_privkey(DKIM_LIB *libhandle, const unsigned char *id,
+                  void *memclosure, DKIM_PRIVKEY *key,
+                  const unsigned char *selector, const unsigned char *domain,
+                  dkim_canon_t hdrcanonalg, dkim_canon_t bodycanonalg,
+                  dkim_alg_t signalg, ssize_t length, DKIM_STAT *statp)
+{
+	DKIM *new;
+
+	assert(key != NULL);
+	assert(key->pk_libhandle == libhandle);
+
+	new = dkim_sign_new(libhandle, id, memclosure, selector, domain,
+	                    hdrcanonalg, bodycanonalg, signalg, length, statp);
+
+	if (new != NULL)
+	{
+		dkim_privkey_ref(key);
+		new->dkim_privkey = key;
 	}
 
 	return new;
@@ -5179,6 +5876,8 @@ dkim_resign(DKIM *new, DKIM *old, _Bool hdrbind)
 	if (new->dkim_hdrbind)
 	{
 		new->dkim_hhead = old->dkim_hhead;
+		memcpy(new->dkim_hindex, old->dkim_hindex,
+		       sizeof new->dkim_hindex);
 		new->dkim_hdrcnt = old->dkim_hdrcnt;
 	}
 
@@ -5198,6 +5897,7 @@ dkim_resign(DKIM *new, DKIM *old, _Bool hdrbind)
 		break;
 
 	  case DKIM_SIGN_RSASHA256:
+	  case DKIM_SIGN_ED25519SHA256:
 		hashtype = DKIM_HASHTYPE_SHA256;
 		break;
 
@@ -5453,61 +6153,117 @@ dkim_sig_process(DKIM *dkim, DKIM_SIGINFO *sig)
 
 		sig->sig_keybits = rsa->rsa_keysize;
 #else /* USE_GNUTLS */
-		rsa->rsa_pkey = d2i_PUBKEY_bio(key, NULL);
-		if (rsa->rsa_pkey == NULL)
+		if (sig->sig_signalg == DKIM_SIGN_ED25519SHA256)
 		{
-			dkim_sig_load_ssl_errors(dkim, sig, 0);
-			dkim_error(dkim, "s=%s d=%s: d2i_PUBKEY_bio() failed",
-			           dkim_sig_getselector(sig),
-			           dkim_sig_getdomain(sig));
+# ifdef HAVE_ED25519
+			EVP_MD_CTX *mdctx;
 
 			BIO_free(key);
 
-			sig->sig_error = DKIM_SIGERROR_KEYDECODE;
+			/* RFC8463: "p=" is the raw public key */
+			rsa->rsa_pkey = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519,
+			                                            NULL,
+			                                            sig->sig_key,
+			                                            sig->sig_keylen);
+			if (rsa->rsa_pkey == NULL)
+			{
+				dkim_sig_load_ssl_errors(dkim, sig, 0);
+				dkim_error(dkim,
+				           "s=%s d=%s: EVP_PKEY_new_raw_public_key() failed",
+				           dkim_sig_getselector(sig),
+				           dkim_sig_getdomain(sig));
 
-			return DKIM_STAT_OK;
-		}
+				sig->sig_error = DKIM_SIGERROR_KEYDECODE;
+
+				return DKIM_STAT_OK;
+			}
+
+			rsa->rsa_keysize = ED25519_KEYBITS / 8;
+			sig->sig_keybits = ED25519_KEYBITS;
+
+			mdctx = EVP_MD_CTX_new();
+			if (mdctx == NULL)
+			{
+				dkim_error(dkim, "EVP_MD_CTX_new() failed");
+				return DKIM_STAT_NORESOURCE;
+			}
+
+			rsastat = EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL,
+			                               rsa->rsa_pkey);
+			if (rsastat == 1)
+			{
+				rsastat = EVP_DigestVerify(mdctx, sig->sig_sig,
+				                           sig->sig_siglen,
+				                           digest, diglen);
+			}
 
-		/* set up the RSA object */
-		rsa->rsa_rsa = EVP_PKEY_get1_RSA(rsa->rsa_pkey);
-		if (rsa->rsa_rsa == NULL)
-		{
 			dkim_sig_load_ssl_errors(dkim, sig, 0);
-			dkim_error(dkim,
-			           "s=%s d=%s: EVP_PKEY_get1_RSA() failed",
-			           dkim_sig_getselector(sig),
-			           dkim_sig_getdomain(sig));
 
+			EVP_MD_CTX_free(mdctx);
+# else /* HAVE_ED25519 */
+			/* dkim_siglist_setup() rejects these */
 			BIO_free(key);
+			rsastat = 0;
+# endif /* HAVE_ED25519 */
+		}
+		else
+		{
+			rsa->rsa_pkey = d2i_PUBKEY_bio(key, NULL);
+			if (rsa->rsa_pkey == NULL)
+			{
+				dkim_sig_load_ssl_errors(dkim, sig, 0);
+				dkim_error(dkim, "s=%s d=%s: d2i_PUBKEY_bio() failed",
+				           dkim_sig_getselector(sig),
+				           dkim_sig_getdomain(sig));
 
-			sig->sig_error = DKIM_SIGERROR_KEYDECODE;
+				BIO_free(key);
 
-			return DKIM_STAT_OK;
-		}
+				sig->sig_error = DKIM_SIGERROR_KEYDECODE;
 
-		rsa->rsa_keysize = RSA_size(rsa->rsa_rsa);
-		rsa->rsa_pad = RSA_PKCS1_PADDING;
+				return DKIM_STAT_OK;
+			}
 
-		rsa->rsa_rsain = sig->sig_sig;
-		rsa->rsa_rsainlen = sig->sig_siglen;
+			/* set up the RSA object */
+			rsa->rsa_rsa = EVP_PKEY_get1_RSA(rsa->rsa_pkey);
+			if (rsa->rsa_rsa == NULL)
+			{
+				dkim_sig_load_ssl_errors(dkim, sig, 0);
+				dkim_error(dkim,
+				           "s=%s d=%s: EVP_PKEY_get1_RSA() failed",
+				           dkim_sig_getselector(sig),
+				           dkim_sig_getdomain(sig));
 
-		sig->sig_keybits = 8 * rsa->rsa_keysize;
+				BIO_free(key);
 
-		nid = NID_sha1;
+				sig->sig_error = DKIM_SIGERROR_KEYDECODE;
 
-		if (dkim_libfeature(dkim->dkim_libhandle,
-		                    DKIM_FEATURE_SHA256) &&
-		    sig->sig_hashtype == DKIM_HASHTYPE_SHA256)
-			nid = NID_sha256;
+				return DKIM_STAT_OK;
+			}
 
-		rsastat = RSA_verify(nid, digest, diglen, rsa->rsa_rsain,
-	                    	rsa->rsa_rsainlen, rsa->rsa_rsa);
+			rsa->rsa_keysize = RSA_size(rsa->rsa_rsa);
+			rsa->rsa_pad = RSA_PKCS1_PADDING;
 
-		dkim_sig_load_ssl_errors(dkim, sig, 0);
+			rsa->rsa_rsain = sig->sig_sig;
+			rsa->rsa_rsainlen = sig->sig_siglen;
 
-		BIO_free(key);
-		RSA_free(rsa->rsa_rsa);
-		rsa->rsa_rsa = NULL;
+			sig->sig_keybits = 8 * rsa->rsa_keysize;
+
+			nid = NID_sha1;
+
+			if (dkim_libfeature(dkim->dkim_libhandle,
+			                    DKIM_FEATURE_SHA256) &&
+			    sig->sig_hashtype == DKIM_HASHTYPE_SHA256)
+				nid = NID_sha256;
+
+			rsastat = RSA_verify(nid, digest, diglen, rsa->rsa_rsain,
+		                    	rsa->rsa_rsainlen, rsa->rsa_rsa);
+
+			dkim_sig_load_ssl_errors(dkim, sig, 0);
+
+			BIO_free(key);
+			RSA_free(rsa->rsa_rsa);
+			rsa->rsa_rsa = NULL;
+		}
 #endif /* USE_GNUTLS */
 
 		if (rsastat == 1)
@@ -6163,6 +6919,8 @@ dkim_header(DKIM *dkim, u_char *hdr, size_t len)
 	else
 		h->hdr_colon = h->hdr_text + (colon - hdr);
 	h->hdr_flags = 0;
+	h->hdr_relaxed = NULL;
+	h->hdr_relaxedlen = 0;
 	h->hdr_next = NULL;
 
 	if (dkim->dkim_hhead == NULL)
@@ -6176,6 +6934,8 @@ dkim_header(DKIM *dkim, u_char *hdr, size_t len)
 		dkim->dkim_htail = h;
 	}
 
+	dkim_hdr_index(dkim, h);
+
 	dkim->dkim_hdrcnt++;
 
 	if (h->hdr_colon != NULL)
@@ -6776,11 +7536,15 @@ dkim_getsighdr_d(DKIM *dkim, size_t initial, u_char **buf, size_t *buflen)
 			/* force wrapping of "b=" ? */
 
 			forcewrap = FALSE;
-			if (sig->sig_keytype == DKIM_KEYTYPE_RSA)
+			if (sig->sig_keytype == DKIM_KEYTYPE_RSA ||
+			    sig->sig_keytype == DKIM_KEYTYPE_ED25519)
 			{
 				u_int siglen;
 
-				siglen = BASE64SIZE(sig->sig_keybits / 8);
+				if (sig->sig_keytype == DKIM_KEYTYPE_ED25519)
+					siglen = BASE64SIZE(ED25519_SIGLEN);
+				else
+					siglen = BASE64SIZE(sig->sig_keybits / 8);
 				if (strcmp(which, "b") == 0 &&
 				    len + whichlen + siglen + 1 >= dkim->dkim_margin)
 					forcewrap = TRUE;
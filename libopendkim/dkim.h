@@ -155,6 +155,7 @@ typedef int DKIM_SIGERROR;
 #define	DKIM_SIGERROR_MISSING_V		44	/* v= tag missing */
 #define	DKIM_SIGERROR_EMPTY_V		45	/* v= tag empty */
 #define	DKIM_SIGERROR_KEYTOOSMALL	46	/* too few key bits */
+#define	DKIM_SIGERROR_KEYTYPEMISMATCH	47	/* key type/algorithm mismatch */
 
 /* generic DNS error codes */
 #define	DKIM_DNS_ERROR		(-1)		/* error in transit */
@@ -185,6 +186,7 @@ typedef int dkim_alg_t;
 #define DKIM_SIGN_DEFAULT	(-1)	/* use internal default */
 #define DKIM_SIGN_RSASHA1	0	/* an RSA-signed SHA1 digest */
 #define DKIM_SIGN_RSASHA256	1	/* an RSA-signed SHA256 digest */
+#define DKIM_SIGN_ED25519SHA256	2	/* an Ed25519-signed SHA256 digest */
 
 /*
 **  DKIM_QUERY -- query method
@@ -274,6 +276,7 @@ typedef int dkim_opts_t;
 #define DKIM_LIBFLAGS_DROPSIGNER	0x00004000
 #define DKIM_LIBFLAGS_STRICTRESIGN	0x00008000
 #define DKIM_LIBFLAGS_REQUESTREPORTS	0x00010000
+#define DKIM_LIBFLAGS_NOSIMD		0x00020000
 
 #define	DKIM_LIBFLAGS_DEFAULT		DKIM_LIBFLAGS_NONE
 
@@ -316,6 +319,13 @@ typedef struct dkim DKIM;
 
 typedef unsigned char * dkim_sigkey_t;
 
+/*
+**  DKIM_PRIVKEY -- parsed private key, reusable across signing handles
+*/
+
+struct dkim_privkey;
+typedef struct dkim_privkey DKIM_PRIVKEY;
+
 /*
 **  DKIM_SIGINFO -- signature information for use by the caller
 */
@@ -416,6 +426,45 @@ extern DKIM *dkim_sign __P((DKIM_LIB *libhandle, const unsigned char *id,
                             dkim_alg_t sign_alg,
                             ssize_t length, DKIM_STAT *statp));
 
+/*
+**  DKIM_SIGN_PRIVKEY -- make a new DKIM context for signing with a parsed key
+**
+**  Parameters:
+**  	libhandle -- library handle, returned by dkim_init()
+**  	id -- an opaque printable string for identifying this message, suitable
+**  	      for use in logging or debug output; may not be NULL
+**  	memclosure -- memory closure, for use by user-provided malloc/free
+**  	key -- private key, returned by dkim_privkey_new()
+**  	selector -- selector being used to sign
+**  	domain -- domain on behalf of which we're signing
+**  	hdr_canon_alg -- canonicalization algorithm to use for headers;
+**  	                 one of the DKIM_CANON_* macros, or -1 for default
+**  	body_canon_alg -- canonicalization algorithm to use for body;
+**  	                  one of the DKIM_CANON_* macros, or -1 for default
+**  	sign_alg -- signing algorithm to use; one of the DKIM_SIGN_* macros,
+**  	            or -1 for default
+**  	length -- number of bytes of the body to sign (-1 == all)
+**  	statp -- pointer to a DKIM_STAT which is updated by this call
+**
+**  Return value:
+**  	A newly-allocated DKIM handle, or NULL on failure.  "statp" will be
+**  	updated.
+**
+**  Notes:
+**  	Identical to dkim_sign() except that the key is not parsed again;
+**  	the new handle holds its own reference to "key".
+*/
+
+extern DKIM *dkim_sign_privkey __P((DKIM_LIB *libhandle,
+                                    const unsigned char *id,
+                                    void *memclosure, DKIM_PRIVKEY *key,
+                                    const unsigned char *selector,
+                                    const unsigned char *domain,
+                                    dkim_canon_t hdr_canon_alg,
+                                    dkim_canon_t body_canon_alg,
+                                    dkim_alg_t sign_alg,
+                                    ssize_t length, DKIM_STAT *statp));
+
 /*
 **  DKIM_VERIFY -- make a new DKIM context for verifying
 **
@@ -1369,8 +1418,10 @@ extern unsigned long dkim_ssl_version __P((void));
 #define DKIM_FEATURE_RESIGN		7
 #define DKIM_FEATURE_ATPS		8
 #define DKIM_FEATURE_XTAGS		9
+#define DKIM_FEATURE_SIMD		10
+#define DKIM_FEATURE_ED25519		11
 
-#define	DKIM_FEATURE_MAX		9
+#define	DKIM_FEATURE_MAX		11
 
 extern _Bool dkim_libfeature __P((DKIM_LIB *lib, u_int fc));
 
@@ -1782,6 +1833,65 @@ extern DKIM_STAT dkim_add_xtag __P((DKIM *, const char *, const char *));
 
 extern DKIM_STAT dkim_privkey_load __P((DKIM *));
 
+/*
+**  DKIM_PRIVKEY_NEW -- parse a private key for use by many signing handles
+**
+**  Parameters:
+**  	libhandle -- library handle, returned by dkim_init()
+**  	secretkey -- private key (PEM, or base64-encoded DER)
+**  	statp -- pointer to a DKIM_STAT which is updated by this call
+**
+**  Return value:
+**  	A new DKIM_PRIVKEY handle with one reference, or NULL on failure.
+**
+**  Notes:
+**  	The handle is safe to share among threads.  It must not outlive
+**  	the library handle.
+*/
+
+extern DKIM_PRIVKEY *dkim_privkey_new __P((DKIM_LIB *libhandle,
+                                           const dkim_sigkey_t secretkey,
+                                           DKIM_STAT *statp));
+
+/*
+**  DKIM_PRIVKEY_REF -- add a reference to a parsed private key
+**
+**  Parameters:
+**  	pk -- DKIM_PRIVKEY handle
+**
+**  Return value:
+**  	None.
+*/
+
+extern void dkim_privkey_ref __P((DKIM_PRIVKEY *pk));
+
+/*
+**  DKIM_PRIVKEY_FREE -- drop a reference to a parsed private key
+**
+**  Parameters:
+**  	pk -- DKIM_PRIVKEY handle
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	The key is destroyed when its last reference is dropped.
+*/
+
+extern void dkim_privkey_free __P((DKIM_PRIVKEY *pk));
+
+/*
+**  DKIM_PRIVKEY_BITS -- report the size of a parsed private key
+**
+**  Parameters:
+**  	pk -- DKIM_PRIVKEY handle
+**
+**  Return value:
+**  	Size of the key, in bits.
+*/
+
+extern unsigned int dkim_privkey_bits __P((DKIM_PRIVKEY *pk));
+
 /*
 **  DKIM_ATPS_CHECK -- check for Authorized Third Party Signing
 **
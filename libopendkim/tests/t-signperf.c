@@ -105,6 +105,8 @@ alg_code(char *name)
 		return (dkim_alg_t) DKIM_SIGN_RSASHA1;
 	else if (strcasecmp(name, "rsa-sha256") == 0)
 		return (dkim_alg_t) DKIM_SIGN_RSASHA256;
+	else if (strcasecmp(name, "ed25519-sha256") == 0)
+		return (dkim_alg_t) DKIM_SIGN_ED25519SHA256;
 	else
 		return (dkim_alg_t) DKIM_SIGN_UNKNOWN;
 }
@@ -133,6 +135,9 @@ alg_name(dkim_alg_t code)
 	  case DKIM_SIGN_RSASHA256:
 		return "rsa-sha256";
 
+	  case DKIM_SIGN_ED25519SHA256:
+		return "ed25519-sha256";
+
 	  case DKIM_SIGN_UNKNOWN:
 	  default:
 		return "unknown";
@@ -177,16 +182,21 @@ int
 main(int argc, char **argv)
 {
 	DKIM_STAT status;
-	u_int signcnt = 0;
+	u_int signcnt;
+	u_int flags;
 	int c;
 	int w;
 	int rate;
+	int pass;
+	int npasses;
+	double mbps;
 	size_t msgsize = DEFMSGSIZE;
 	size_t msgrem;
 	size_t wsz;
 	char *p;
 	DKIM *dkim;
 	DKIM_LIB *lib;
+	char *selector;
 	dkim_sigkey_t key;
 	unsigned char hdr[MAXHEADER + 1];
 	unsigned char body[BODYBUFRSZ];
@@ -274,6 +284,14 @@ main(int argc, char **argv)
 		else
 			signalg = DKIM_SIGN_RSASHA1;
 	}
+	else if (signalg == DKIM_SIGN_ED25519SHA256 &&
+	         !dkim_libfeature(lib, DKIM_FEATURE_ED25519))
+	{
+		fprintf(stdout, "*** SIGNING SPEED TEST: %s SKIPPED\n",
+		        alg_name(signalg));
+		dkim_close(lib);
+		return 0;
+	}
 	else if (signalg == DKIM_SIGN_RSASHA256 &&
 	         !dkim_libfeature(lib, DKIM_FEATURE_SHA256))
 	{
@@ -288,7 +306,16 @@ main(int argc, char **argv)
 	        canon_name(hcanon), canon_name(bcanon), alg_name(signalg),
 	        (unsigned int) msgsize, (long) testint);
 
-	key = KEY;
+	if (signalg == DKIM_SIGN_ED25519SHA256)
+	{
+		key = KEYED25519;
+		selector = SELECTORED25519;
+	}
+	else
+	{
+		key = KEY;
+		selector = SELECTOR;
+	}
 
 	srandom(time(NULL));
 
@@ -306,61 +333,86 @@ main(int argc, char **argv)
 		w++;
 	}
 
-	(void) time(&start);
+	/*
+	**  Run once with the default body scanner, then again with the
+	**  portable one if the default was vectorized, so the two can be
+	**  compared.
+	*/
+
+	npasses = dkim_libfeature(lib, DKIM_FEATURE_SIMD) ? 2 : 1;
 
-	while (time(NULL) < start + testint)
+	for (pass = 0; pass < npasses; pass++)
 	{
-		dkim = dkim_sign(lib, JOBID, NULL, key, SELECTOR, DOMAIN,
-		                 hcanon, bcanon, signalg, -1L, &status);
+		(void) dkim_options(lib, DKIM_OP_GETOPT, DKIM_OPTS_FLAGS,
+		                    &flags, sizeof flags);
+		if (pass == 0)
+			flags &= ~DKIM_LIBFLAGS_NOSIMD;
+		else
+			flags |= DKIM_LIBFLAGS_NOSIMD;
+		(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_FLAGS,
+		                    &flags, sizeof flags);
 
-		status = dkim_header(dkim, HEADER02, strlen(HEADER02));
+		signcnt = 0;
 
-		status = dkim_header(dkim, HEADER03, strlen(HEADER03));
+		(void) time(&start);
 
-		status = dkim_header(dkim, HEADER04, strlen(HEADER04));
+		while (time(NULL) < start + testint)
+		{
+			dkim = dkim_sign(lib, JOBID, NULL, key, selector, DOMAIN,
+			                 hcanon, bcanon, signalg, -1L, &status);
 
-		status = dkim_header(dkim, HEADER05, strlen(HEADER05));
+			status = dkim_header(dkim, HEADER02, strlen(HEADER02));
 
-		status = dkim_header(dkim, HEADER06, strlen(HEADER06));
+			status = dkim_header(dkim, HEADER03, strlen(HEADER03));
 
-		status = dkim_header(dkim, HEADER07, strlen(HEADER07));
+			status = dkim_header(dkim, HEADER04, strlen(HEADER04));
 
-		status = dkim_header(dkim, HEADER08, strlen(HEADER08));
+			status = dkim_header(dkim, HEADER05, strlen(HEADER05));
 
-		status = dkim_header(dkim, HEADER09, strlen(HEADER09));
+			status = dkim_header(dkim, HEADER06, strlen(HEADER06));
 
-		status = dkim_eoh(dkim);
+			status = dkim_header(dkim, HEADER07, strlen(HEADER07));
 
-		msgrem = msgsize;
+			status = dkim_header(dkim, HEADER08, strlen(HEADER08));
 
-		while (msgrem > 0)
-		{
-			wsz = MIN(msgrem, sizeof body);
+			status = dkim_header(dkim, HEADER09, strlen(HEADER09));
 
-			status = dkim_body(dkim, body, wsz);
+			status = dkim_eoh(dkim);
 
-			msgrem -= wsz;
-		}
+			msgrem = msgsize;
+
+			while (msgrem > 0)
+			{
+				wsz = MIN(msgrem, sizeof body);
 
-		(void) dkim_body(dkim, CRLF, 2);
+				status = dkim_body(dkim, body, wsz);
 
-		status = dkim_eom(dkim, NULL);
+				msgrem -= wsz;
+			}
 
-		memset(hdr, '\0', sizeof hdr);
-		status = dkim_getsighdr(dkim, hdr, sizeof hdr,
-		                        strlen(DKIM_SIGNHEADER) + 2);
+			(void) dkim_body(dkim, CRLF, 2);
 
-		status = dkim_free(dkim);
+			status = dkim_eom(dkim, NULL);
 
-		signcnt++;
-	}
+			memset(hdr, '\0', sizeof hdr);
+			status = dkim_getsighdr(dkim, hdr, sizeof hdr,
+			                        strlen(DKIM_SIGNHEADER) + 2);
 
-	dkim_close(lib);
+			status = dkim_free(dkim);
 
-	rate = signcnt / testint;
+			signcnt++;
+		}
+
+		rate = signcnt / testint;
+		mbps = ((double) signcnt * msgsize) / testint / (1024 * 1024);
+
+		fprintf(stdout,
+		        "*** %u messages signed (%d msgs/sec, %.2f MB/s, %s scanner)\n",
+		        signcnt, rate, mbps,
+		        pass == 0 && npasses > 1 ? "vectorized" : "portable");
+	}
 
-	fprintf(stdout, "*** %u messages signed (%d msgs/sec)\n",
-	        signcnt, rate);
+	dkim_close(lib);
 
 	return 0;
 }
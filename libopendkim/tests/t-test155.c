@@ -0,0 +1,265 @@
+/*
+**  Copyright (c) 2005-2008 Sendmail, Inc. and its suppliers.
+**    All rights reserved.
+**
+**  Copyright (c) 2009, 2011, 2012, 2015, The Trusted Domain Project.
+**    All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef USE_GNUTLS
+# include <gnutls/gnutls.h>
+#endif /* USE_GNUTLS */
+
+/* libopendkim includes */
+#include "../dkim.h"
+#include "t-testdata.h"
+
+#define	MAXHEADER	4096
+#define	NSIGS		5
+
+#ifndef TRUE
+# define TRUE		1
+#endif /* ! TRUE */
+
+/*
+**  MSG_BODY -- feed the test body to a handle
+**
+**  Parameters:
+**  	dkim -- DKIM handle
+**
+**  Return value:
+**  	None.
+*/
+
+void
+msg_body(DKIM *dkim)
+{
+	DKIM_STAT status;
+
+	status = dkim_body(dkim, BODY00, strlen(BODY00));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_body(dkim, BODY01A, strlen(BODY01A));
+	assert(status == DKIM_STAT_OK);
+	status = dkim_body(dkim, BODY01B, strlen(BODY01B));
+	assert(status == DKIM_STAT_OK);
+	status = dkim_body(dkim, BODY01C, strlen(BODY01C));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_body(dkim, BODY01E, strlen(BODY01E));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_body(dkim, BODY02, strlen(BODY02));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_body(dkim, BODY03, strlen(BODY03));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_body(dkim, BODY04, strlen(BODY04));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_body(dkim, BODY03, strlen(BODY03));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_body(dkim, BODY05, strlen(BODY05));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_body(dkim, BODY03, strlen(BODY03));
+	assert(status == DKIM_STAT_OK);
+	status = dkim_body(dkim, BODY03, strlen(BODY03));
+	assert(status == DKIM_STAT_OK);
+}
+
+/*
+**  SIGN_MESSAGE -- generate a signature over the test message
+**
+**  Parameters:
+**  	lib -- DKIM_LIB handle
+**  	bcanon -- body canonicalization
+**  	alg -- signing algorithm
+**  	length -- body length limit
+**  	hdr -- buffer to receive the signature header field
+**  	hdrlen -- bytes available at "hdr"
+**
+**  Return value:
+**  	None.
+*/
+
+void
+sign_message(DKIM_LIB *lib, dkim_canon_t bcanon, dkim_alg_t alg,
+             ssize_t length, unsigned char *hdr, size_t hdrlen)
+{
+	size_t len;
+	DKIM_STAT status;
+	DKIM *dkim;
+	dkim_sigkey_t key;
+
+	key = KEY;
+
+	dkim = dkim_sign(lib, JOBID, NULL, key, SELECTOR, DOMAIN,
+	                 DKIM_CANON_RELAXED, bcanon, alg, length, &status);
+	assert(dkim != NULL);
+
+	if (length != (ssize_t) -1)
+	{
+		status = dkim_setpartial(dkim, TRUE);
+		assert(status == DKIM_STAT_OK);
+	}
+
+	status = dkim_header(dkim, HEADER05, strlen(HEADER05));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_header(dkim, HEADER06, strlen(HEADER06));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_header(dkim, HEADER08, strlen(HEADER08));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_eoh(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	msg_body(dkim);
+
+	status = dkim_eom(dkim, NULL);
+	assert(status == DKIM_STAT_OK);
+
+	len = snprintf(hdr, hdrlen, "%s: ", DKIM_SIGNHEADER);
+	status = dkim_getsighdr(dkim, hdr + len, hdrlen - len, len + 1);
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_free(dkim);
+	assert(status == DKIM_STAT_OK);
+}
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	The usual.
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+main(int argc, char **argv)
+{
+	int c;
+	int nsigs;
+	DKIM_STAT status;
+	uint64_t fixed_time;
+	ssize_t canonlen;
+	ssize_t signlen;
+	DKIM *dkim;
+	DKIM_LIB *lib;
+	DKIM_SIGINFO **sigs;
+	dkim_query_t qtype = DKIM_QUERY_FILE;
+	unsigned char hdr[NSIGS][MAXHEADER + 1];
+
+	printf("*** verifying several signatures sharing body canonicalizations\n");
+
+#ifdef USE_GNUTLS
+	(void) gnutls_global_init();
+#endif /* USE_GNUTLS */
+
+	/* instantiate the library */
+	lib = dkim_init(NULL, NULL);
+	assert(lib != NULL);
+
+	if (!dkim_libfeature(lib, DKIM_FEATURE_SHA256))
+	{
+		printf("*** verifying several signatures sharing body canonicalizations SKIPPED\n");
+		dkim_close(lib);
+		return 0;
+	}
+
+	/* fix signing time */
+	fixed_time = 1172620939;
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_FIXEDTIME,
+	                    &fixed_time, sizeof fixed_time);
+
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_QUERYMETHOD,
+	                    &qtype, sizeof qtype);
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_QUERYINFO,
+	                    KEYFILE, strlen(KEYFILE));
+
+	/*
+	**  Three "simple" body hashes that differ by hash type or length,
+	**  and two "relaxed" ones, one of which stops inside the blank
+	**  lines at the end of the body.
+	*/
+
+	sign_message(lib, DKIM_CANON_SIMPLE, DKIM_SIGN_RSASHA1, -1L,
+	             hdr[0], sizeof hdr[0]);
+	sign_message(lib, DKIM_CANON_SIMPLE, DKIM_SIGN_RSASHA256, -1L,
+	             hdr[1], sizeof hdr[1]);
+	sign_message(lib, DKIM_CANON_SIMPLE, DKIM_SIGN_RSASHA256, 40L,
+	             hdr[2], sizeof hdr[2]);
+	sign_message(lib, DKIM_CANON_RELAXED, DKIM_SIGN_RSASHA256, -1L,
+	             hdr[3], sizeof hdr[3]);
+	sign_message(lib, DKIM_CANON_RELAXED, DKIM_SIGN_RSASHA1, 0L,
+	             hdr[4], sizeof hdr[4]);
+
+	dkim = dkim_verify(lib, JOBID, NULL, &status);
+	assert(dkim != NULL);
+
+	for (c = 0; c < NSIGS; c++)
+	{
+		status = dkim_header(dkim, hdr[c], strlen(hdr[c]));
+		assert(status == DKIM_STAT_OK);
+	}
+
+	status = dkim_header(dkim, HEADER05, strlen(HEADER05));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_header(dkim, HEADER06, strlen(HEADER06));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_header(dkim, HEADER08, strlen(HEADER08));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_eoh(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	msg_body(dkim);
+
+	status = dkim_eom(dkim, NULL);
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_getsiglist(dkim, &sigs, &nsigs);
+	assert(status == DKIM_STAT_OK);
+	assert(nsigs == NSIGS);
+
+	for (c = 0; c < nsigs; c++)
+	{
+		assert((dkim_sig_getflags(sigs[c]) & DKIM_SIGFLAG_PASSED) != 0);
+		assert(dkim_sig_getbh(sigs[c]) == DKIM_SIGBH_MATCH);
+	}
+
+	status = dkim_sig_getcanonlen(dkim, sigs[2], NULL, &canonlen,
+	                              &signlen);
+	assert(status == DKIM_STAT_OK);
+	assert(canonlen == 40);
+	assert(signlen == 40);
+
+	status = dkim_sig_getcanonlen(dkim, sigs[4], NULL, &canonlen,
+	                              &signlen);
+	assert(status == DKIM_STAT_OK);
+	assert(canonlen == 0);
+	assert(signlen == 0);
+
+	status = dkim_free(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	dkim_close(lib);
+
+	return 0;
+}
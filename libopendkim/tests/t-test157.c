@@ -0,0 +1,148 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/* libopendkim includes */
+#include "../dkim.h"
+#include "../dkim-cache.h"
+
+#define	BUFRSZ		1024
+#define	MAXBYTES	(16 * 1024)
+#define	NKEYS		1000
+#define	HOTKEY		"hot._domainkey.example.com"
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	The usual.
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+main(int argc, char **argv)
+{
+#ifndef QUERY_CACHE
+	printf("*** query cache eviction and expiry SKIPPED\n");
+
+#else /* ! QUERY_CACHE */
+
+	int c;
+	int status;
+	int err;
+	u_int keys;
+	size_t buflen;
+	struct dkim_cache *cache;
+	char key[BUFRSZ + 1];
+	char data[BUFRSZ + 1];
+	char buf[BUFRSZ + 1];
+
+	printf("*** query cache eviction and expiry\n");
+
+	err = 0;
+
+	cache = dkim_cache_init(&err, MAXBYTES);
+	assert(cache != NULL);
+
+	memset(data, 'x', 100);
+	data[100] = '\0';
+
+	printf("--- memory budget is enforced\n");
+	for (c = 0; c < NKEYS; c++)
+	{
+		snprintf(key, sizeof key, "s%d._domainkey.example.com", c);
+		status = dkim_cache_insert(cache, key, data, 3600, &err);
+		assert(status == 0);
+	}
+
+	dkim_cache_stats(cache, NULL, NULL, NULL, &keys, FALSE);
+	assert(keys > 0);
+	assert(keys < MAXBYTES / 100);
+
+	buflen = sizeof buf;
+	status = dkim_cache_query(cache, key, 0, buf, &buflen, &err);
+	assert(status == 0);
+	assert(buflen == 100);
+
+	printf("--- recently used records survive eviction\n");
+	status = dkim_cache_insert(cache, HOTKEY, "hot", 3600, &err);
+	assert(status == 0);
+
+	for (c = 0; c < NKEYS; c++)
+	{
+		buflen = sizeof buf;
+		status = dkim_cache_query(cache, HOTKEY, 0, buf, &buflen, &err);
+		assert(status == 0);
+		assert(strcmp(buf, "hot") == 0);
+
+		snprintf(key, sizeof key, "t%d._domainkey.example.com", c);
+		status = dkim_cache_insert(cache, key, data, 3600, &err);
+		assert(status == 0);
+	}
+
+	printf("--- oversized records are not cached\n");
+	memset(buf, 'y', BUFRSZ);
+	buf[BUFRSZ] = '\0';
+	status = dkim_cache_insert(cache, "big._domainkey.example.com", buf,
+	                           3600, &err);
+	assert(status == 0);
+	buflen = sizeof buf;
+	status = dkim_cache_query(cache, "big._domainkey.example.com", 0,
+	                          buf, &buflen, &err);
+	assert(status == 1);
+
+	printf("--- replacing a record\n");
+	status = dkim_cache_insert(cache, HOTKEY, "hotter", 3600, &err);
+	assert(status == 0);
+	buflen = sizeof buf;
+	status = dkim_cache_query(cache, HOTKEY, 0, buf, &buflen, &err);
+	assert(status == 0);
+	assert(strcmp(buf, "hotter") == 0);
+
+	dkim_cache_close(cache);
+
+	printf("--- expiring records by their own time-to-live\n");
+	cache = dkim_cache_init(&err, 0);
+	assert(cache != NULL);
+
+	for (c = 0; c < 100; c++)
+	{
+		snprintf(key, sizeof key, "s%d._domainkey.example.com", c);
+		status = dkim_cache_insert(cache, key, "data",
+		                           c % 4 == 0 ? 3600 : -1, &err);
+		assert(status == 0);
+	}
+
+	status = dkim_cache_expire(cache, 0, &err);
+	assert(status == 75);
+
+	dkim_cache_stats(cache, NULL, NULL, NULL, &keys, FALSE);
+	assert(keys == 25);
+
+	status = dkim_cache_expire(cache, 0, &err);
+	assert(status == 0);
+
+	buflen = sizeof buf;
+	status = dkim_cache_query(cache, "s0._domainkey.example.com", 0,
+	                          buf, &buflen, &err);
+	assert(status == 0);
+	buflen = sizeof buf;
+	status = dkim_cache_query(cache, "s1._domainkey.example.com", 0,
+	                          buf, &buflen, &err);
+	assert(status == 1);
+
+	dkim_cache_close(cache);
+#endif /* ! QUERY_CACHE */
+
+	return 0;
+}
@@ -0,0 +1,176 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef USE_GNUTLS
+# include <gnutls/gnutls.h>
+#endif /* USE_GNUTLS */
+
+/* libopendkim includes */
+#include "../dkim.h"
+#include "t-testdata.h"
+
+/* libbsd if found */
+#ifdef USE_BSD_H
+# include <bsd/string.h>
+#endif /* USE_BSD_H */
+
+/* libstrl if needed */
+#ifdef USE_STRL_H
+# include <strl.h>
+#endif /* USE_STRL_H */
+
+#define	MAXHEADER	4096
+
+/* body chunks with bare CRs and LFs, some of them split across chunks */
+char *broken[] =
+{
+	"line one\nline two\r\n",
+	"ends with CR\r",
+	"next chunk without LF\r\n",
+	"split CRLF\r",
+	"\nbare CR\rin middle\r\nx",
+	"\nclean line\r\n",
+	NULL
+};
+
+/* the same body with proper line endings */
+char *fixed[] =
+{
+	"line one\r\nline two\r\n",
+	"ends with CR\r\n",
+	"next chunk without LF\r\n",
+	"split CRLF\r\n",
+	"bare CR\r\nin middle\r\nx\r\n",
+	"clean line\r\n",
+	NULL
+};
+
+/*
+**  SIGN -- sign a message and return its signature
+**
+**  Parameters:
+**  	lib -- library handle
+**  	canon -- canonicalization to use for both header and body
+**  	body -- body chunks
+**  	hdr -- signature header (returned)
+**  	hdrlen -- bytes available at "hdr"
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+sign(DKIM_LIB *lib, dkim_canon_t canon, char **body, u_char *hdr,
+     size_t hdrlen)
+{
+	int c;
+	DKIM_STAT status;
+	DKIM *dkim;
+
+	dkim = dkim_sign(lib, JOBID, NULL, (dkim_sigkey_t) KEY, SELECTOR,
+	                 DOMAIN, canon, canon, DKIM_SIGN_RSASHA1, -1L,
+	                 &status);
+	assert(dkim != NULL);
+
+	status = dkim_header(dkim, HEADER02, strlen(HEADER02));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_header(dkim, HEADER05, strlen(HEADER05));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_header(dkim, HEADER06, strlen(HEADER06));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_eoh(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	for (c = 0; body[c] != NULL; c++)
+	{
+		status = dkim_body(dkim, body[c], strlen(body[c]));
+		assert(status == DKIM_STAT_OK);
+	}
+
+	status = dkim_eom(dkim, NULL);
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_getsighdr(dkim, hdr, hdrlen,
+	                        strlen(DKIM_SIGNHEADER) + 2);
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_free(dkim);
+	assert(status == DKIM_STAT_OK);
+}
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	The usual.
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+main(int argc, char **argv)
+{
+	int c;
+	u_int flags;
+	uint64_t fixed_time;
+	DKIM_LIB *fixlib;
+	DKIM_LIB *lib;
+	dkim_canon_t canons[2] = { DKIM_CANON_SIMPLE, DKIM_CANON_RELAXED };
+	unsigned char hdr[MAXHEADER + 1];
+	unsigned char fixhdr[MAXHEADER + 1];
+
+	printf("*** simple and relaxed rsa-sha1 signing with chunking and FIXCRLF\n");
+
+#ifdef USE_GNUTLS
+	(void) gnutls_global_init();
+#endif /* USE_GNUTLS */
+
+	/* instantiate the libraries, one of them fixing line endings */
+	lib = dkim_init(NULL, NULL);
+	assert(lib != NULL);
+
+	fixlib = dkim_init(NULL, NULL);
+	assert(fixlib != NULL);
+
+	flags = DKIM_LIBFLAGS_FIXCRLF;
+	(void) dkim_options(fixlib, DKIM_OP_SETOPT, DKIM_OPTS_FLAGS, &flags,
+	                    sizeof flags);
+
+	/* fix signing time */
+	fixed_time = 1172620939;
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_FIXEDTIME,
+	                    &fixed_time, sizeof fixed_time);
+	(void) dkim_options(fixlib, DKIM_OP_SETOPT, DKIM_OPTS_FIXEDTIME,
+	                    &fixed_time, sizeof fixed_time);
+
+	for (c = 0; c < 2; c++)
+	{
+		sign(lib, canons[c], fixed, hdr, sizeof hdr);
+		sign(fixlib, canons[c], broken, fixhdr, sizeof fixhdr);
+
+		assert(strcmp(hdr, fixhdr) == 0);
+
+		/* a body that needs no fixing signs the same either way */
+		sign(fixlib, canons[c], fixed, fixhdr, sizeof fixhdr);
+
+		assert(strcmp(hdr, fixhdr) == 0);
+	}
+
+	dkim_close(fixlib);
+	dkim_close(lib);
+
+	return 0;
+}
@@ -0,0 +1,285 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef USE_GNUTLS
+# include <gnutls/gnutls.h>
+#endif /* USE_GNUTLS */
+
+/* libopendkim includes */
+#include "../dkim.h"
+#include "t-testdata.h"
+
+/* libbsd if found */
+#ifdef USE_BSD_H
+# include <bsd/string.h>
+#endif /* USE_BSD_H */
+
+/* libstrl if needed */
+#ifdef USE_STRL_H
+# include <strl.h>
+#endif /* USE_STRL_H */
+
+#define	BUFRSZ		1024
+#define	MAXHEADER	4096
+
+/*
+**  MESSAGE -- feed the test message to a handle
+**
+**  Parameters:
+**  	dkim -- DKIM handle
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+message(DKIM *dkim)
+{
+	DKIM_STAT status;
+
+	status = dkim_header(dkim, HEADER02, strlen(HEADER02));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_header(dkim, HEADER05, strlen(HEADER05));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_header(dkim, HEADER06, strlen(HEADER06));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_header(dkim, HEADER07, strlen(HEADER07));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_header(dkim, HEADER08, strlen(HEADER08));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_header(dkim, HEADER09, strlen(HEADER09));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_eoh(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_body(dkim, BODY00, strlen(BODY00));
+	assert(status == DKIM_STAT_OK);
+}
+
+/*
+**  SIGN -- sign the test message and return its signature header
+**
+**  Parameters:
+**  	lib -- library handle
+**  	key -- private key
+**  	selector -- selector
+**  	alg -- signing algorithm
+**  	hdr -- signature header, including its name (returned)
+**  	hdrlen -- bytes available at "hdr"
+**
+**  Return value:
+**  	Status from dkim_eom().
+*/
+
+static DKIM_STAT
+sign(DKIM_LIB *lib, char *key, char *selector, dkim_alg_t alg,
+     u_char *hdr, size_t hdrlen)
+{
+	DKIM_STAT status;
+	DKIM_STAT eomstat;
+	DKIM *dkim;
+
+	dkim = dkim_sign(lib, JOBID, NULL, (dkim_sigkey_t) key, selector,
+	                 DOMAIN, DKIM_CANON_RELAXED, DKIM_CANON_SIMPLE,
+	                 alg, -1L, &status);
+	assert(dkim != NULL);
+
+	message(dkim);
+
+	eomstat = dkim_eom(dkim, NULL);
+	if (eomstat == DKIM_STAT_OK)
+	{
+		snprintf(hdr, hdrlen, "%s: ", DKIM_SIGNHEADER);
+		status = dkim_getsighdr(dkim, hdr + strlen(hdr),
+		                        hdrlen - strlen(hdr),
+		                        strlen(DKIM_SIGNHEADER) + 2);
+		assert(status == DKIM_STAT_OK);
+	}
+
+	status = dkim_free(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	return eomstat;
+}
+
+/*
+**  VERIFY -- verify the test message
+**
+**  Parameters:
+**  	lib -- library handle
+**  	hdrs -- signature headers
+**  	nhdrs -- number of signature headers
+**  	expect -- expected dkim_eom() status
+**  	sigerror -- expected error on the first signature
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+verify(DKIM_LIB *lib, u_char **hdrs, int nhdrs, DKIM_STAT expect,
+       int sigerror)
+{
+	int c;
+	int nsigs;
+	unsigned int bits;
+	DKIM_STAT status;
+	DKIM *dkim;
+	DKIM_SIGINFO **sigs;
+
+	dkim = dkim_verify(lib, JOBID, NULL, &status);
+	assert(dkim != NULL);
+
+	for (c = 0; c < nhdrs; c++)
+	{
+		status = dkim_header(dkim, hdrs[c], strlen(hdrs[c]));
+		assert(status == DKIM_STAT_OK);
+	}
+
+	message(dkim);
+
+	status = dkim_eom(dkim, NULL);
+	assert(status == expect);
+
+	status = dkim_getsiglist(dkim, &sigs, &nsigs);
+	assert(status == DKIM_STAT_OK);
+	assert(nsigs == nhdrs);
+
+	assert(dkim_sig_geterror(sigs[0]) == sigerror);
+
+	for (c = 0; c < nsigs && sigerror == DKIM_SIGERROR_OK; c++)
+	{
+		assert(dkim_sig_geterror(sigs[c]) == DKIM_SIGERROR_OK);
+		assert((dkim_sig_getflags(sigs[c]) & DKIM_SIGFLAG_PASSED) != 0);
+		assert(dkim_sig_getbh(sigs[c]) == DKIM_SIGBH_MATCH);
+	}
+
+	if (sigerror == DKIM_SIGERROR_OK)
+	{
+		status = dkim_sig_getkeysize(sigs[0], &bits);
+		assert(status == DKIM_STAT_OK);
+		assert(bits == 256);
+	}
+
+	status = dkim_free(dkim);
+	assert(status == DKIM_STAT_OK);
+}
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	The usual.
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+main(int argc, char **argv)
+{
+	uint64_t fixed_time;
+	DKIM_STAT status;
+	DKIM_LIB *lib;
+	dkim_query_t qtype = DKIM_QUERY_FILE;
+	u_char *hdrs[2];
+	unsigned char hdr[MAXHEADER + 1];
+	unsigned char pemhdr[MAXHEADER + 1];
+	unsigned char rsahdr[MAXHEADER + 1];
+	char err[BUFRSZ];
+
+#ifdef USE_GNUTLS
+	(void) gnutls_global_init();
+#endif /* USE_GNUTLS */
+
+	/* instantiate the library */
+	lib = dkim_init(NULL, NULL);
+	assert(lib != NULL);
+
+	if (!dkim_libfeature(lib, DKIM_FEATURE_ED25519))
+	{
+		printf("*** relaxed/simple ed25519-sha256 signing and verifying SKIPPED\n");
+		dkim_close(lib);
+		return 0;
+	}
+
+	printf("*** relaxed/simple ed25519-sha256 signing and verifying\n");
+
+	/* fix signing time */
+	fixed_time = 1172620939;
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_FIXEDTIME,
+	                    &fixed_time, sizeof fixed_time);
+
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_QUERYMETHOD,
+	                    &qtype, sizeof qtype);
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_QUERYINFO,
+	                    KEYFILE, strlen(KEYFILE));
+
+	printf("--- raw key, explicit algorithm\n");
+	status = sign(lib, KEYED25519, SELECTORED25519,
+	              DKIM_SIGN_ED25519SHA256, hdr, sizeof hdr);
+	assert(status == DKIM_STAT_OK);
+	assert(strstr(hdr, "a=ed25519-sha256;") != NULL);
+
+	hdrs[0] = hdr;
+	verify(lib, hdrs, 1, DKIM_STAT_OK, DKIM_SIGERROR_OK);
+
+	/* signatures are deterministic, so the key format doesn't show */
+	printf("--- PEM key, algorithm chosen from the key\n");
+	status = sign(lib, KEYED25519PEM, SELECTORED25519,
+	              DKIM_SIGN_DEFAULT, pemhdr, sizeof pemhdr);
+	assert(status == DKIM_STAT_OK);
+	assert(strcmp(hdr, pemhdr) == 0);
+
+	printf("--- RSA and ed25519 signatures on one message\n");
+	status = sign(lib, KEY, SELECTOR, DKIM_SIGN_DEFAULT,
+	              rsahdr, sizeof rsahdr);
+	assert(status == DKIM_STAT_OK);
+	assert(strstr(rsahdr, "a=rsa-sha256;") != NULL);
+
+	hdrs[0] = hdr;
+	hdrs[1] = rsahdr;
+	verify(lib, hdrs, 2, DKIM_STAT_OK, DKIM_SIGERROR_OK);
+
+	printf("--- key record of the wrong type\n");
+	status = sign(lib, KEYED25519, SELECTOR, DKIM_SIGN_ED25519SHA256,
+	              hdr, sizeof hdr);
+	assert(status == DKIM_STAT_OK);
+
+	hdrs[0] = hdr;
+	verify(lib, hdrs, 1, DKIM_STAT_CANTVRFY,
+	       DKIM_SIGERROR_KEYTYPEMISMATCH);
+
+	printf("--- private keys match the published key\n");
+	assert(dkim_test_key(lib, SELECTORED25519, DOMAIN, KEYED25519,
+	                     strlen(KEYED25519), NULL, err, sizeof err) == 0);
+	assert(dkim_test_key(lib, SELECTORED25519, DOMAIN, KEYED25519PEM,
+	                     strlen(KEYED25519PEM), NULL, err,
+	                     sizeof err) == 0);
+	assert(dkim_test_key(lib, SELECTOR, DOMAIN, KEYED25519,
+	                     strlen(KEYED25519), NULL, err, sizeof err) == 1);
+
+	printf("--- RSA key with an ed25519 algorithm\n");
+	status = sign(lib, KEY, SELECTOR, DKIM_SIGN_ED25519SHA256,
+	              hdr, sizeof hdr);
+	assert(status == DKIM_STAT_INVALID);
+
+	dkim_close(lib);
+
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef USE_GNUTLS
+# include <gnutls/gnutls.h>
+#endif /* USE_GNUTLS */
+
+/* libopendkim includes */
+#include "../dkim.h"
+#include "t-testdata.h"
+
+#define	MAXHEADER	4096
+
+#define	RCVD00	"received: received data 4"
+
+char *over_sign[] =
+{
+	"Received",
+	"Reply-To",
+	NULL
+};
+
+/*
+**  MESSAGE -- feed the test message to a handle
+**
+**  Parameters:
+**  	dkim -- DKIM handle
+**  	hdrs -- header fields to send first
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+message(DKIM *dkim, char **hdrs)
+{
+	int c;
+	DKIM_STAT status;
+
+	for (c = 0; hdrs[c] != NULL; c++)
+	{
+		status = dkim_header(dkim, hdrs[c], strlen(hdrs[c]));
+		assert(status == DKIM_STAT_OK);
+	}
+
+	status = dkim_eoh(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_body(dkim, BODY00, strlen(BODY00));
+	assert(status == DKIM_STAT_OK);
+}
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	The usual.
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+main(int argc, char **argv)
+{
+	int nsigs;
+	DKIM_STAT status;
+	uint64_t fixed_time;
+	DKIM *dkim;
+	DKIM_LIB *lib;
+	DKIM_SIGINFO **sigs;
+	dkim_query_t qtype = DKIM_QUERY_FILE;
+	unsigned char hdr[MAXHEADER + 1];
+	char *signhdrs[] = { HEADER02, HEADER05, RCVD00, HEADER03, HEADER06,
+	                     HEADER04, HEADER07, HEADER08, HEADER09, NULL };
+	char *verhdrs[] = { hdr, HEADER02, HEADER05, RCVD00, HEADER03,
+	                    HEADER06, HEADER04, HEADER07, HEADER08, HEADER09,
+	                    NULL };
+	char *badhdrs[] = { hdr, HEADER02, HEADER05, HEADER03, RCVD00,
+	                    HEADER06, HEADER04, HEADER07, HEADER08, HEADER09,
+	                    NULL };
+	char *addhdrs[] = { hdr, HEADER01, HEADER02, HEADER05, RCVD00,
+	                    HEADER03, HEADER06, HEADER04, HEADER07, HEADER08,
+	                    HEADER09, NULL };
+
+#ifdef USE_GNUTLS
+	(void) gnutls_global_init();
+#endif /* USE_GNUTLS */
+
+	/* instantiate the library */
+	lib = dkim_init(NULL, NULL);
+	assert(lib != NULL);
+
+	if (!dkim_libfeature(lib, DKIM_FEATURE_SHA256))
+	{
+		printf("*** repeated and oversigned header fields SKIPPED\n");
+		dkim_close(lib);
+		return 0;
+	}
+
+	printf("*** repeated and oversigned header fields\n");
+
+	/* fix signing time */
+	fixed_time = 1172620939;
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_FIXEDTIME,
+	                    &fixed_time, sizeof fixed_time);
+
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_OVERSIGNHDRS,
+	                    &over_sign, sizeof (char **));
+
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_QUERYMETHOD,
+	                    &qtype, sizeof qtype);
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_QUERYINFO,
+	                    KEYFILE, strlen(KEYFILE));
+
+	dkim = dkim_sign(lib, JOBID, NULL, KEY, SELECTOR, DOMAIN,
+	                 DKIM_CANON_RELAXED, DKIM_CANON_SIMPLE,
+	                 DKIM_SIGN_RSASHA256, -1L, &status);
+	assert(dkim != NULL);
+
+	message(dkim, signhdrs);
+
+	status = dkim_eom(dkim, NULL);
+	assert(status == DKIM_STAT_OK);
+
+	/* every instance, in order, plus one more of each oversigned name */
+	snprintf(hdr, sizeof hdr, "%s: ", DKIM_SIGNHEADER);
+	status = dkim_getsighdr(dkim, hdr + strlen(hdr),
+	                        sizeof hdr - strlen(hdr),
+	                        strlen(DKIM_SIGNHEADER) + 2);
+	assert(status == DKIM_STAT_OK);
+	assert(strstr(hdr, "h=Received:From:received:Received:To:Received:Date:Subject:\r\n\t Message-ID:Received:Reply-To;") != NULL);
+
+	status = dkim_free(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	/* the signed message verifies */
+	dkim = dkim_verify(lib, JOBID, NULL, &status);
+	assert(dkim != NULL);
+
+	message(dkim, verhdrs);
+
+	status = dkim_eom(dkim, NULL);
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_getsiglist(dkim, &sigs, &nsigs);
+	assert(status == DKIM_STAT_OK);
+	assert(nsigs == 1);
+	assert((dkim_sig_getflags(sigs[0]) & DKIM_SIGFLAG_PASSED) != 0);
+
+	status = dkim_free(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	/* swapping two instances of the same name breaks it */
+	dkim = dkim_verify(lib, JOBID, NULL, &status);
+	assert(dkim != NULL);
+
+	message(dkim, badhdrs);
+
+	status = dkim_eom(dkim, NULL);
+	assert(status == DKIM_STAT_BADSIG);
+
+	status = dkim_free(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	/* so does adding another instance of an oversigned name */
+	dkim = dkim_verify(lib, JOBID, NULL, &status);
+	assert(dkim != NULL);
+
+	message(dkim, addhdrs);
+
+	status = dkim_eom(dkim, NULL);
+	assert(status == DKIM_STAT_BADSIG);
+
+	status = dkim_free(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	dkim_close(lib);
+
+	return 0;
+}
@@ -0,0 +1,348 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <assert.h>
+#include <string.h>
+#include <resolv.h>
+#include <stdio.h>
+
+#ifdef USE_GNUTLS
+# include <gnutls/gnutls.h>
+#endif /* USE_GNUTLS */
+
+/* libopendkim includes */
+#include "../dkim.h"
+#include "t-testdata.h"
+
+/* libbsd if found */
+#ifdef USE_BSD_H
+# include <bsd/string.h>
+#endif /* USE_BSD_H */
+
+/* libstrl if needed */
+#ifdef USE_STRL_H
+# include <strl.h>
+#endif /* USE_STRL_H */
+
+#define	BUFRSZ		1024
+#define	MAXHEADER	4096
+#define	MAXQUERIES	4
+#define	NHANDLES	2
+
+#ifndef MIN
+# define MIN(x,y)	((x) < (y) ? (x) : (y))
+#endif /* ! MIN */
+
+struct stub_query
+{
+	_Bool		sq_active;
+	size_t		sq_buflen;
+	unsigned char *	sq_buf;
+	unsigned char	sq_name[BUFRSZ];
+};
+
+int started;
+int waited;
+int cancelled;
+struct stub_query queries[MAXQUERIES];
+
+static int
+stub_dns_cancel(void *srv, void *q)
+{
+	struct stub_query *sq = q;
+
+	assert(sq->sq_active);
+	sq->sq_active = 0;
+	cancelled++;
+
+	return DKIM_DNS_SUCCESS;
+}
+
+static int
+stub_dns_query(void *srv, int type, unsigned char *query,
+               unsigned char *buf, size_t buflen, void **qh)
+{
+	assert(started < MAXQUERIES);
+
+	queries[started].sq_active = 1;
+	queries[started].sq_buf = buf;
+	queries[started].sq_buflen = buflen;
+	strlcpy(queries[started].sq_name, query,
+	        sizeof queries[started].sq_name);
+
+	*qh = &queries[started];
+	started++;
+
+	return DKIM_DNS_SUCCESS;
+}
+
+static int
+stub_dns_waitreply(void *srv, void *qh, struct timeval *to, size_t *bytes,
+                   int *error, int *dnssec)
+{
+	unsigned char *cp;
+	unsigned char *eom;
+	int elen;
+	int slen;
+	int olen;
+	char *q;
+	unsigned char *len;
+	unsigned char *abuf;
+	unsigned char *dnptrs[3];
+	unsigned char **lastdnptr;
+	struct stub_query *sq = qh;
+	HEADER newhdr;
+
+	assert(sq->sq_active);
+	waited++;
+
+	abuf = sq->sq_buf;
+
+	memset(&newhdr, '\0', sizeof newhdr);
+	memset(&dnptrs, '\0', sizeof dnptrs);
+
+	newhdr.qdcount = htons(1);
+	newhdr.ancount = htons(1);
+	newhdr.rcode = NOERROR;
+	newhdr.opcode = QUERY;
+	newhdr.qr = 1;
+	newhdr.id = 0;
+
+	lastdnptr = &dnptrs[2];
+	dnptrs[0] = abuf;
+
+	/* copy out the new header */
+	memcpy(abuf, &newhdr, sizeof newhdr);
+
+	cp = &abuf[HFIXEDSZ];
+	eom = &abuf[sq->sq_buflen];
+
+	/* question section */
+	elen = dn_comp(sq->sq_name, cp, eom - cp, dnptrs, lastdnptr);
+	if (elen == -1)
+		return DKIM_DNS_ERROR;
+	cp += elen;
+	PUTSHORT(T_TXT, cp);
+	PUTSHORT(C_IN, cp);
+
+	/* answer section */
+	elen = dn_comp(sq->sq_name, cp, eom - cp, dnptrs, lastdnptr);
+	if (elen == -1)
+		return DKIM_DNS_ERROR;
+	cp += elen;
+	PUTSHORT(T_TXT, cp);
+	PUTSHORT(C_IN, cp);
+	PUTLONG(0L, cp);
+
+	len = cp;
+	cp += INT16SZ;
+
+	slen = strlen(PUBLICKEY);
+	q = PUBLICKEY;
+	olen = 0;
+
+	while (slen > 0)
+	{
+		elen = MIN(slen, 255);
+		*cp = (char) elen;
+		cp++;
+		olen++;
+		memcpy(cp, q, elen);
+		q += elen;
+		cp += elen;
+		olen += elen;
+		slen -= elen;
+	}
+
+	eom = cp;
+
+	cp = len;
+	PUTSHORT(olen, cp);
+
+	*bytes = eom - abuf;
+
+	if (dnssec != NULL)
+		*dnssec = DKIM_DNSSEC_SECURE;
+
+	return DKIM_DNS_SUCCESS;
+}
+
+/*
+**  MESSAGE -- feed the test message to a handle
+**
+**  Parameters:
+**  	dkim -- DKIM handle
+**  	sighdr -- signature header field to add first (or NULL)
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+message(DKIM *dkim, unsigned char *sighdr)
+{
+	int c;
+	DKIM_STAT status;
+	char *hdrs[] = { HEADER02, HEADER03, HEADER04, HEADER05, HEADER06,
+	                 HEADER07, HEADER08, HEADER09, NULL };
+
+	if (sighdr != NULL)
+	{
+		status = dkim_header(dkim, sighdr, strlen(sighdr));
+		assert(status == DKIM_STAT_OK);
+	}
+
+	for (c = 0; hdrs[c] != NULL; c++)
+	{
+		status = dkim_header(dkim, hdrs[c], strlen(hdrs[c]));
+		assert(status == DKIM_STAT_OK);
+	}
+}
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	The usual.
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+main(int argc, char **argv)
+{
+	int c;
+	int nsigs;
+	u_int flags;
+	DKIM_STAT status;
+	DKIM *dkim;
+	DKIM *vdkim[NHANDLES];
+	DKIM_LIB *lib;
+	DKIM_SIGINFO **sigs;
+	unsigned char hdr[MAXHEADER + 1];
+
+	printf("*** relaxed/simple rsa-sha1 verifying with a shared key query\n");
+
+#ifdef USE_GNUTLS
+	(void) gnutls_global_init();
+#endif /* USE_GNUTLS */
+
+	/* instantiate the library */
+	lib = dkim_init(NULL, NULL);
+	assert(lib != NULL);
+
+	/* DNS stubs for the key lookups */
+	dkim_dns_set_query_service(lib, NULL);
+	dkim_dns_set_query_start(lib, stub_dns_query);
+	dkim_dns_set_query_cancel(lib, stub_dns_cancel);
+	dkim_dns_set_query_waitreply(lib, stub_dns_waitreply);
+
+	/* set flags */
+	flags = (DKIM_LIBFLAGS_TMPFILES|DKIM_LIBFLAGS_DELAYSIGPROC);
+#ifdef TEST_KEEP_FILES
+	flags |= DKIM_LIBFLAGS_KEEPFILES;
+#endif /* TEST_KEEP_FILES */
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_FLAGS, &flags,
+	                    sizeof flags);
+
+	dkim = dkim_sign(lib, JOBID, NULL, (dkim_sigkey_t) KEY, SELECTOR,
+	                 DOMAIN, DKIM_CANON_RELAXED, DKIM_CANON_SIMPLE,
+	                 DKIM_SIGN_RSASHA1, -1L, &status);
+	assert(dkim != NULL);
+
+	message(dkim, NULL);
+
+	status = dkim_eoh(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_body(dkim, BODY00, strlen(BODY00));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_eom(dkim, NULL);
+	assert(status == DKIM_STAT_OK);
+
+	snprintf(hdr, sizeof hdr, "%s: ", DKIM_SIGNHEADER);
+	status = dkim_getsighdr(dkim, hdr + strlen(hdr),
+	                        sizeof hdr - strlen(hdr),
+	                        strlen(DKIM_SIGNHEADER) + 2);
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_free(dkim);
+	assert(status == DKIM_STAT_OK);
+
+	/* two messages needing the same key; the second joins the query */
+	for (c = 0; c < NHANDLES; c++)
+	{
+		vdkim[c] = dkim_verify(lib, JOBID, NULL, &status);
+		assert(vdkim[c] != NULL);
+
+		message(vdkim[c], hdr);
+
+		status = dkim_eoh(vdkim[c]);
+		assert(status == DKIM_STAT_OK);
+	}
+
+	assert(started == 1);
+	assert(waited == 0);
+
+	/* one reply serves both, with its DNSSEC status */
+	for (c = 0; c < NHANDLES; c++)
+	{
+		status = dkim_body(vdkim[c], BODY00, strlen(BODY00));
+		assert(status == DKIM_STAT_OK);
+
+		status = dkim_eom(vdkim[c], NULL);
+		assert(status == DKIM_STAT_OK);
+
+		status = dkim_getsiglist(vdkim[c], &sigs, &nsigs);
+		assert(status == DKIM_STAT_OK);
+		assert(nsigs == 1);
+		assert(dkim_sig_getdnssec(sigs[0]) == DKIM_DNSSEC_SECURE);
+	}
+
+	assert(started == 1);
+	assert(waited == 1);
+
+	/* the query is cancelled when the last handle lets go of it */
+	assert(cancelled == 1);
+	assert(!queries[0].sq_active);
+
+	for (c = 0; c < NHANDLES; c++)
+	{
+		status = dkim_free(vdkim[c]);
+		assert(status == DKIM_STAT_OK);
+	}
+
+	/* once answered, a new request starts a new query */
+	dkim = dkim_verify(lib, JOBID, NULL, &status);
+	assert(dkim != NULL);
+
+	message(dkim, hdr);
+
+	status = dkim_eoh(dkim);
+	assert(status == DKIM_STAT_OK);
+	assert(started == 2);
+
+	status = dkim_body(dkim, BODY00, strlen(BODY00));
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_eom(dkim, NULL);
+	assert(status == DKIM_STAT_OK);
+
+	status = dkim_free(dkim);
+	assert(status == DKIM_STAT_OK);
+	assert(cancelled == 2);
+
+	dkim_close(lib);
+
+	return 0;
+}
@@ -2,7 +2,7 @@
 **  Copyright (c) 2005-2008 Sendmail, Inc. and its suppliers.
 **    All rights reserved.
 **
-**  Copyright (c) 2009, 2011-2013, The Trusted Domain Project.
+**  Copyright (c) 2009, 2011-2013, 2015, The Trusted Domain Project.
 **    All rights reserved.
 */
 
@@ -15,11 +15,6 @@
 #include <string.h>
 #include <unistd.h>
 
-/* libdb includes */
-#ifdef QUERY_CACHE
-# include <db.h>
-#endif /* QUERY_CACHE */
-
 #ifdef USE_GNUTLS
 # include <gnutls/gnutls.h>
 #endif /* USE_GNUTLS */
@@ -55,12 +50,12 @@ main(int argc, char **argv)
 	int err;
 	u_int s1, s2, s3, s4;
 	size_t buflen;
-	DB *cache;
+	struct dkim_cache *cache;
 	char buf[BUFRSZ + 1];
 
 	printf("*** query caching\n");
 
-	cache = dkim_cache_init(NULL, NULL);
+	cache = dkim_cache_init(NULL, 0);
 
 	err = 0;
 
@@ -106,6 +106,8 @@ alg_code(char *name)
 		return (dkim_alg_t) DKIM_SIGN_RSASHA1;
 	else if (strcasecmp(name, "rsa-sha256") == 0)
 		return (dkim_alg_t) DKIM_SIGN_RSASHA256;
+	else if (strcasecmp(name, "ed25519-sha256") == 0)
+		return (dkim_alg_t) DKIM_SIGN_ED25519SHA256;
 	else
 		return (dkim_alg_t) DKIM_SIGN_UNKNOWN;
 }
@@ -134,6 +136,9 @@ alg_name(dkim_alg_t code)
 	  case DKIM_SIGN_RSASHA256:
 		return "rsa-sha256";
 
+	  case DKIM_SIGN_ED25519SHA256:
+		return "ed25519-sha256";
+
 	  case DKIM_SIGN_UNKNOWN:
 	  default:
 		return "unknown";
@@ -178,10 +183,14 @@ int
 main(int argc, char **argv)
 {
 	DKIM_STAT status;
-	u_int verifycnt = 0;
+	u_int verifycnt;
+	u_int flags;
 	int c;
 	int w;
 	int rate;
+	int pass;
+	int npasses;
+	double mbps;
 	size_t msgsize = DEFMSGSIZE;
 	size_t msgrem;
 	size_t wsz;
@@ -194,6 +203,7 @@ main(int argc, char **argv)
 	char *p;
 	DKIM *dkim;
 	DKIM_LIB *lib;
+	char *selector;
 	dkim_sigkey_t key;
 	unsigned char hdr[MAXHEADER + 1];
 	unsigned char body[BODYBUFRSZ];
@@ -276,6 +286,14 @@ main(int argc, char **argv)
 		else
 			signalg = DKIM_SIGN_RSASHA1;
 	}
+	else if (signalg == DKIM_SIGN_ED25519SHA256 &&
+	         !dkim_libfeature(lib, DKIM_FEATURE_ED25519))
+	{
+		fprintf(stdout, "*** VERIFYING SPEED TEST: %s SKIPPED\n",
+		        alg_name(signalg));
+		dkim_close(lib);
+		return 0;
+	}
 	else if (signalg == DKIM_SIGN_RSASHA256 &&
 	         !dkim_libfeature(lib, DKIM_FEATURE_SHA256))
 	{
@@ -290,7 +308,16 @@ main(int argc, char **argv)
 	        canon_name(hcanon), canon_name(bcanon), alg_name(signalg),
 	        (unsigned int) msgsize, (long) testint);
 
-	key = KEY;
+	if (signalg == DKIM_SIGN_ED25519SHA256)
+	{
+		key = KEYED25519;
+		selector = SELECTORED25519;
+	}
+	else
+	{
+		key = KEY;
+		selector = SELECTOR;
+	}
 
 	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_QUERYMETHOD,
 	                    &qtype, sizeof qtype);
@@ -314,7 +341,7 @@ main(int argc, char **argv)
 	}
 
 	/* generate the signature */
-	dkim = dkim_sign(lib, JOBID, NULL, key, SELECTOR, DOMAIN,
+	dkim = dkim_sign(lib, JOBID, NULL, key, selector, DOMAIN,
 	                 hcanon, bcanon, signalg, -1L, &status);
 
 	status = dkim_header(dkim, HEADER02, strlen(HEADER02));
@@ -356,57 +383,82 @@ main(int argc, char **argv)
 
 	status = dkim_free(dkim);
 
-	(void) time(&start);
+	/*
+	**  Run once with the default body scanner, then again with the
+	**  portable one if the default was vectorized, so the two can be
+	**  compared.
+	*/
+
+	npasses = dkim_libfeature(lib, DKIM_FEATURE_SIMD) ? 2 : 1;
 
-	/* begin the verify loop */
-	while (time(NULL) < start + testint)
+	for (pass = 0; pass < npasses; pass++)
 	{
-		dkim = dkim_verify(lib, JOBID, NULL, &status);
+		(void) dkim_options(lib, DKIM_OP_GETOPT, DKIM_OPTS_FLAGS,
+		                    &flags, sizeof flags);
+		if (pass == 0)
+			flags &= ~DKIM_LIBFLAGS_NOSIMD;
+		else
+			flags |= DKIM_LIBFLAGS_NOSIMD;
+		(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_FLAGS,
+		                    &flags, sizeof flags);
 
-		status = dkim_header(dkim, hdr, strlen(hdr));
+		verifycnt = 0;
 
-		status = dkim_header(dkim, HEADER02, strlen(HEADER02));
+		(void) time(&start);
 
-		status = dkim_header(dkim, HEADER03, strlen(HEADER03));
+		/* begin the verify loop */
+		while (time(NULL) < start + testint)
+		{
+			dkim = dkim_verify(lib, JOBID, NULL, &status);
 
-		status = dkim_header(dkim, HEADER04, strlen(HEADER04));
+			status = dkim_header(dkim, hdr, strlen(hdr));
 
-		status = dkim_header(dkim, HEADER05, strlen(HEADER05));
+			status = dkim_header(dkim, HEADER02, strlen(HEADER02));
 
-		status = dkim_header(dkim, HEADER06, strlen(HEADER06));
+			status = dkim_header(dkim, HEADER03, strlen(HEADER03));
 
-		status = dkim_header(dkim, HEADER07, strlen(HEADER07));
+			status = dkim_header(dkim, HEADER04, strlen(HEADER04));
 
-		status = dkim_header(dkim, HEADER08, strlen(HEADER08));
+			status = dkim_header(dkim, HEADER05, strlen(HEADER05));
 
-		status = dkim_header(dkim, HEADER09, strlen(HEADER09));
+			status = dkim_header(dkim, HEADER06, strlen(HEADER06));
 
-		status = dkim_eoh(dkim);
+			status = dkim_header(dkim, HEADER07, strlen(HEADER07));
 
-		msgrem = DEFMSGSIZE;
+			status = dkim_header(dkim, HEADER08, strlen(HEADER08));
 
-		while (msgrem > 0)
-		{
-			wsz = MIN(msgrem, sizeof body);
+			status = dkim_header(dkim, HEADER09, strlen(HEADER09));
 
-			status = dkim_body(dkim, body, wsz);
+			status = dkim_eoh(dkim);
 
-			msgrem -= wsz;
-		}
+			msgrem = DEFMSGSIZE;
 
-		status = dkim_eom(dkim, NULL);
+			while (msgrem > 0)
+			{
+				wsz = MIN(msgrem, sizeof body);
 
-		status = dkim_free(dkim);
+				status = dkim_body(dkim, body, wsz);
 
-		verifycnt++;
-	}
+				msgrem -= wsz;
+			}
 
-	dkim_close(lib);
+			status = dkim_eom(dkim, NULL);
+
+			status = dkim_free(dkim);
 
-	rate = verifycnt / testint;
+			verifycnt++;
+		}
+
+		rate = verifycnt / testint;
+		mbps = ((double) verifycnt * DEFMSGSIZE) / testint / (1024 * 1024);
+
+		fprintf(stdout,
+		        "*** %u messages verified (%d msgs/sec, %.2f MB/s, %s scanner)\n",
+		        verifycnt, rate, mbps,
+		        pass == 0 && npasses > 1 ? "vectorized" : "portable");
+	}
 
-	fprintf(stdout, "*** %u messages verified (%d msgs/sec)\n",
-	        verifycnt, rate);
+	dkim_close(lib);
 
 	return 0;
 }
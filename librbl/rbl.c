@@ -14,6 +14,9 @@
 #include <resolv.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
 #include <assert.h>
 #include <errno.h>
 
@@ -31,14 +34,54 @@
 # define T_RRSIG		46
 #endif /* ! T_RRSIG */
 
+#ifndef FALSE
+# define FALSE			0
+#endif /* ! FALSE */
+#ifndef TRUE
+# define TRUE			1
+#endif /* ! TRUE */
+
+#define	RBL_CACHEWAYS		4
+#define	RBL_CACHEMAXTTL		86400
+
 /* struct rbl_query -- an open RBL query */
 struct rbl_query
 {
+	_Bool			rq_done;
+	RBL_STAT		rq_status;
+	uint32_t		rq_res;
 	void *			rq_qh;
 	size_t			rq_anslen;
+	char			rq_name[RBL_MAXHOSTNAMELEN + 1];
 	u_char			rq_buf[HFIXEDSZ + MAXPACKET];
 };
 
+/* struct rbl_batch -- one subject queried in several RBLs */
+struct rbl_batch
+{
+	int			rb_nqueries;
+	struct rbl_query **	rb_queries;
+};
+
+/* struct rbl_cache_entry -- a cached result */
+struct rbl_cache_entry
+{
+	time_t			rce_expire;
+	RBL_STAT		rce_status;
+	uint32_t		rce_res;
+	char			rce_name[RBL_MAXHOSTNAMELEN + 1];
+};
+
+/* struct rbl_cache -- results shared between RBL handles */
+struct rbl_cache
+{
+	pthread_mutex_t		rc_lock;
+	u_int			rc_nbuckets;
+	u_long			rc_hits;
+	u_long			rc_misses;
+	struct rbl_cache_entry * rc_entries;	/* RBL_CACHEWAYS per bucket */
+};
+
 /* struct rbl_handle -- an RBL library context */
 struct rbl_handle
 {
@@ -46,6 +89,7 @@ struct rbl_handle
 	u_int			rbl_cbint;
 	void *			rbl_cbctx;
 	void *			rbl_closure;
+	RBL_CACHE *		rbl_cache;
 	void *			(*rbl_malloc) (void *closure, size_t nbytes);
 	void			(*rbl_free) (void *closure, void *p);
 	void			(*rbl_dns_callback) (const void *context);
@@ -340,305 +384,900 @@ rbl_res_close(void *srv)
 }
 
 /*
-**  RBL_INIT -- initialize an RBL handle
+**  RBL_MALLOC -- allocate memory
 **
 **  Parameters:
-**  	caller_mallocf -- caller-provided memory allocation function
-**  	caller_freef -- caller-provided memory release function
-**  	closure -- memory closure to pass to the above when used
+**  	rbl -- RBL context in which this is performed
+**  	nbytes -- number of bytes desired
 **
 **  Return value:
-**  	A new RBL handle suitable for use with other RBL functions, or
-**  	NULL on failure.
-**  
-**  Side effects:
-**  	Sudden changes in local density altitude.
+**  	Pointer to allocated memory, or NULL on failure.
 */
 
-RBL *
-rbl_init(void *(*caller_mallocf)(void *closure, size_t nbytes),
-         void (*caller_freef)(void *closure, void *p),
-         void *closure)
+static void *
+rbl_malloc(RBL *rbl, size_t nbytes)
 {
-	RBL *new;
+	assert(rbl != NULL);
 
-	if (caller_mallocf == NULL)
-		new = (RBL *) malloc(sizeof(struct rbl_handle));
+	if (rbl->rbl_malloc == NULL)
+		return malloc(nbytes);
 	else
-		new = caller_mallocf(closure, sizeof(struct rbl_handle));
-
-	if (new == NULL)
-		return NULL;
-
-	memset(new, '\0', sizeof(struct rbl_handle));
-
-	new->rbl_timeout = RBL_DEFTIMEOUT;
-	new->rbl_closure = closure;
-	new->rbl_malloc = caller_mallocf;
-	new->rbl_free = caller_freef;
-	new->rbl_dns_start = rbl_res_query;
-	new->rbl_dns_waitreply = rbl_res_waitreply;
-	new->rbl_dns_cancel = rbl_res_cancel;
-	new->rbl_dns_setns = rbl_res_nslist;
-	new->rbl_dns_close = rbl_res_close;
-
-	return new;
+		return rbl->rbl_malloc(rbl->rbl_closure, nbytes);
 }
 
 /*
-**  RBL_CLOSE -- shut down a RBL instance
+**  RBL_FREE -- release memory
 **
 **  Parameters:
-**  	rbl -- RBL handle to shut down
+**  	rbl -- RBL context in which this is performed
+**  	ptr -- pointer to memory to be freed
 **
 **  Return value:
 **  	None.
 */
 
-void
-rbl_close(RBL *rbl)
+static void
+rbl_free(RBL *rbl, void *ptr)
 {
 	assert(rbl != NULL);
 
-	if (rbl->rbl_dns_service != NULL &&
-	    rbl->rbl_dns_close != NULL)
-		(void) rbl->rbl_dns_close(rbl->rbl_dns_service);
-
-	if (rbl->rbl_free != NULL)
-		rbl->rbl_free(rbl->rbl_closure, rbl);
+	if (rbl->rbl_free == NULL)
+		free(ptr);
 	else
-		free(rbl);
+		rbl->rbl_free(rbl->rbl_closure, ptr);
 }
 
 /*
-**  RBL_GETERROR -- return any stored error string from within the RBL
-**                  context handle
+**  RBL_CACHE_HASH -- hash a query name for the result cache
 **
 **  Parameters:
-**  	rbl -- RBL handle from which to retrieve an error string
+**  	name -- query name
 **
 **  Return value:
-**  	A pointer to the stored string, or NULL if none was stored.
+**  	Hash of "name", ignoring case.
 */
 
-const u_char *
-rbl_geterror(RBL *rbl)
+static u_int
+rbl_cache_hash(char *name)
 {
-	assert(rbl != NULL);
+	u_int hash = 5381;
 
-	return rbl->rbl_error;
+	for (; *name != '\0'; name++)
+		hash = ((hash << 5) + hash) + tolower((u_char) *name);
+
+	return hash;
 }
 
 /*
-**  RBL_SETDOMAIN -- declare the RBL's domain (the query root)
+**  RBL_CACHE_GET -- look up a result in the cache
 **
 **  Parameters:
-**  	rbl -- RBL handle, created by rbl_init()
-**  	qroot -- query root
+**  	cache -- result cache
+**  	name -- query name
+**  	res -- result (returned)
 **
 **  Return value:
-**  	None (yet).
+**  	RBL_STAT_FOUND or RBL_STAT_NOTFOUND from a live cache entry, or
+**  	RBL_STAT_NOREPLY on a cache miss.
 */
 
-void
-rbl_setdomain(RBL *rbl, u_char *qroot)
+static RBL_STAT
+rbl_cache_get(RBL_CACHE *cache, char *name, uint32_t *res)
 {
-	assert(rbl != NULL);
-	assert(qroot != NULL);
+	int c;
+	RBL_STAT status = RBL_STAT_NOREPLY;
+	time_t now;
+	struct rbl_cache_entry *rce;
 
-	strncpy(rbl->rbl_qroot, qroot, sizeof rbl->rbl_qroot);
-	rbl->rbl_qroot[sizeof rbl->rbl_qroot - 1] = '\0';
-}
+	(void) time(&now);
 
-/*
-**  RBL_SETTIMEOUT -- set the DNS timeout
-**
-**  Parameters:
-**  	rbl -- RBL handle, created by rbl_init()
-**  	timeout -- requested timeout (seconds)
-**
-**  Return value:
-**  	None.
-*/
+	rce = &cache->rc_entries[(rbl_cache_hash(name) % cache->rc_nbuckets) *
+	                         RBL_CACHEWAYS];
 
-void
-rbl_settimeout(RBL *rbl, u_int timeout)
-{
-	assert(rbl != NULL);
+	pthread_mutex_lock(&cache->rc_lock);
 
-	rbl->rbl_timeout = timeout;
-}
+	for (c = 0; c < RBL_CACHEWAYS; c++)
+	{
+		if (rce[c].rce_expire > now &&
+		    strcasecmp(rce[c].rce_name, name) == 0)
+		{
+			status = rce[c].rce_status;
+			*res = rce[c].rce_res;
+			break;
+		}
+	}
 
-/*
-**  RBL_SETCALLBACKINT -- set the DNS callback interval
-**
-**  Parameters:
-**  	rbl -- RBL handle, created by rbl_init()
-**  	cbint -- requested callback interval (seconds)
-**
-**  Return value:
-**  	None.
-*/
+	if (status == RBL_STAT_NOREPLY)
+		cache->rc_misses++;
+	else
+		cache->rc_hits++;
 
-void
-rbl_setcallbackint(RBL *rbl, u_int cbint)
-{
-	assert(rbl != NULL);
+	pthread_mutex_unlock(&cache->rc_lock);
 
-	rbl->rbl_cbint = cbint;
+	return status;
 }
 
 /*
-**  RBL_SETCALLBACKCTX -- set the DNS callback context
+**  RBL_CACHE_PUT -- add a result to the cache
 **
 **  Parameters:
-**  	rbl -- RBL handle, created by rbl_init()
-**  	ctx -- context to pass to the DNS callback
+**  	cache -- result cache
+**  	name -- query name
+**  	status -- RBL_STAT_FOUND or RBL_STAT_NOTFOUND
+**  	res -- result
+**  	ttl -- lifetime of the result (seconds)
 **
 **  Return value:
 **  	None.
+**
+**  Notes:
+**  	Each name can only live in one small bucket; when that is full,
+**  	the entry closest to expiring is replaced.
 */
 
-void
-rbl_setcallbackctx(RBL *rbl, void *ctx)
+static void
+rbl_cache_put(RBL_CACHE *cache, char *name, RBL_STAT status, uint32_t res,
+              uint32_t ttl)
 {
-	assert(rbl != NULL);
+	int c;
+	time_t now;
+	struct rbl_cache_entry *rce;
+	struct rbl_cache_entry *victim;
 
-	rbl->rbl_cbctx = ctx;
-}
+	if (ttl > RBL_CACHEMAXTTL)
+		ttl = RBL_CACHEMAXTTL;
 
-/*
-**  RBL_SETDNSCALLBACK -- set the DNS wait callback
-**
-**  Parameters:
-**  	rbl -- RBL handle, created by rbl_init()
-**  	func -- function to call; should take an opaque context pointer
-**
-**  Return value:
-**  	None.
-*/
+	(void) time(&now);
 
-void
-rbl_setdnscallback(RBL *rbl, void (*func)(const void *context))
-{
-	assert(rbl != NULL);
+	rce = &cache->rc_entries[(rbl_cache_hash(name) % cache->rc_nbuckets) *
+	                         RBL_CACHEWAYS];
 
-	rbl->rbl_dns_callback = func;
+	pthread_mutex_lock(&cache->rc_lock);
+
+	victim = &rce[0];
+	for (c = 0; c < RBL_CACHEWAYS; c++)
+	{
+		if (strcasecmp(rce[c].rce_name, name) == 0)
+		{
+			victim = &rce[c];
+			break;
+		}
+
+		if (rce[c].rce_expire < victim->rce_expire)
+			victim = &rce[c];
+	}
+
+	strncpy(victim->rce_name, name, sizeof victim->rce_name);
+	victim->rce_name[sizeof victim->rce_name - 1] = '\0';
+	victim->rce_status = status;
+	victim->rce_res = res;
+	victim->rce_expire = now + ttl;
+
+	pthread_mutex_unlock(&cache->rc_lock);
 }
 
 /*
-**  RBL_DNS_SET_QUERY_SERVICE -- stores a handle representing the DNS
-**                               query service to be used, returning any
-**                               previous handle
+**  RBL_NEGTTL -- find how long a negative reply may be cached
 **
 **  Parameters:
-**  	rbl -- RBL library handle
-**  	h -- handle to be used
+**  	cp -- start of the answer section
+**  	eom -- end of the reply
+**  	hdr -- reply header
 **
 **  Return value:
-**  	Previously stored handle, or NULL if none.
+**  	Negative caching TTL from the SOA in the authority section (the
+**  	lesser of its TTL and its MINIMUM, as in RFC2308), or 0 if there
+**  	was no SOA.
 */
 
-void *
-rbl_dns_set_query_service(RBL *rbl, void *h)
+static uint32_t
+rbl_negttl(u_char *cp, u_char *eom, HEADER *hdr)
 {
-	void *old;
-
-	assert(rbl != NULL);
+	int n;
+	int c;
+	int type;
+	int class;
+	int rdlen;
+	uint32_t ttl;
+	uint32_t minimum;
 
-	old = rbl->rbl_dns_service;
+	c = ntohs((unsigned short) hdr->ancount) +
+	    ntohs((unsigned short) hdr->nscount);
 
-	rbl->rbl_dns_service = h;
+	while (c-- > 0 && cp < eom)
+	{
+		if ((n = dn_skipname(cp, eom)) < 0)
+			return 0;
+		cp += n;
 
-	return old;
-}
+		if (cp + INT16SZ + INT16SZ + INT32SZ + INT16SZ > eom)
+			return 0;
+		GETSHORT(type, cp);
+		GETSHORT(class, cp);
+		GETLONG(ttl, cp);
+		GETSHORT(rdlen, cp);
 
-/*
-**  RBL_DNS_SET_QUERY_START -- stores a pointer to a query start function
-**
-**  Parameters:
-**  	rbl -- RBL library handle
-**  	func -- function to use to start queries
-**
-**  Return value:
-**  	None.
-**
-**  Notes:
-**  	"func" should match the following prototype:
-**  		returns int (status)
-**  		void *dns -- receives handle stored by
-**  		             rbl_dns_set_query_service()
-**  		int type -- DNS RR query type (C_IN assumed)
-**  		char *query -- question to ask
-**  		char *buf -- buffer into which to write reply
-**  		size_t buflen -- size of buf
-**  		void **qh -- returned query handle
-*/
+		if (cp + rdlen > eom)
+			return 0;
 
-void
-rbl_dns_set_query_start(RBL *rbl, int (*func)(void *, int,
-                                              unsigned char *,
-                                              unsigned char *,
-                                              size_t, void **))
-{
-	assert(rbl != NULL);
+		if (type == T_SOA && class == C_IN)
+		{
+			/* skip MNAME and RNAME, then SERIAL through EXPIRE */
+			if ((n = dn_skipname(cp, eom)) < 0)
+				return 0;
+			cp += n;
+			if ((n = dn_skipname(cp, eom)) < 0)
+				return 0;
+			cp += n;
 
-	rbl->rbl_dns_start = func;
-}
+			if (cp + 5 * INT32SZ > eom)
+				return 0;
+			cp += 4 * INT32SZ;
+			GETLONG(minimum, cp);
 
-/*
-**  RBL_DNS_SET_QUERY_CANCEL -- stores a pointer to a query cancel function
-**
-**  Parameters:
-**  	rbl -- RBL library handle
-**  	func -- function to use to cancel running queries
-**
-**  Return value:
-**  	None.
-**
-**  Notes:
-**  	"func" should match the following prototype:
-**  		returns int (status)
-**  		void *dns -- DNS service handle
-**  		void *qh -- query handle to be canceled
-*/
+			return (ttl < minimum ? ttl : minimum);
+		}
 
-void
-rbl_dns_set_query_cancel(RBL *rbl, int (*func)(void *, void *))
-{
-	assert(rbl != NULL);
+		cp += rdlen;
+	}
 
-	rbl->rbl_dns_cancel = func;
+	return 0;
 }
 
 /*
-**  RBL_DNS_SET_QUERY_WAITREPLY -- stores a pointer to wait for a DNS reply
+**  RBL_REPLY -- interpret the reply to a query
 **
 **  Parameters:
-**  	rbl -- RBL library handle
-**  	func -- function to use to wait for a reply
+**  	rbl -- RBL handle
+**  	rq -- query with a completed reply
+**  	res -- result (returned)
+**  	ttl -- how long the result may be cached (returned)
 **
 **  Return value:
-**  	None.
-**
-**  Notes:
-**  	"func" should match the following prototype:
-**  		returns int (status)
-**  		void *dns -- DNS service handle
-**  		void *qh -- handle of query that has completed
-**  		struct timeval *timeout -- how long to wait
-**  		size_t *bytes -- bytes returned
-**  		int *error -- error code returned
-**  		int *dnssec -- DNSSEC status returned
+**  	RBL_STAT_FOUND, RBL_STAT_NOTFOUND or RBL_STAT_ERROR.
 */
 
-void
-rbl_dns_set_query_waitreply(RBL *rbl, int (*func)(void *, void *,
-                                                  struct timeval *,
-                                                  size_t *, int *,
-                                                  int *))
+static RBL_STAT
+rbl_reply(RBL *rbl, struct rbl_query *rq, uint32_t *res, uint32_t *ttl)
 {
-	assert(rbl != NULL);
+	int n;
+	int type;
+	int class;
+	int qdcount;
+	int ancount;
+	uint32_t rrttl;
+	uint32_t foundttl = 0;
+	u_char *cp;
+	u_char *eom;
+	u_char *found = NULL;
+	HEADER hdr;
+	u_char qname[RBL_MAXHOSTNAMELEN + 1];
+
+	/* set up pointers */
+	memcpy(&hdr, rq->rq_buf, sizeof hdr);
+	cp = (u_char *) rq->rq_buf + HFIXEDSZ;
+	eom = (u_char *) rq->rq_buf + rq->rq_anslen;
+
+	/* skip over the name at the front of the answer */
+	for (qdcount = ntohs((unsigned short) hdr.qdcount);
+	     qdcount > 0;
+	     qdcount--)
+	{
+		/* copy it first */
+		(void) dn_expand((unsigned char *) rq->rq_buf, eom, cp,
+		                 (char *) qname, sizeof qname);
+ 
+		if ((n = dn_skipname(cp, eom)) < 0)
+		{
+			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+			         "'%s' reply corrupt", qname);
+			return RBL_STAT_ERROR;
+		}
+		cp += n;
+
+		/* extract the type and class */
+		if (cp + INT16SZ + INT16SZ > eom)
+		{
+			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+			         "'%s' reply corrupt", qname);
+			return RBL_STAT_ERROR;
+		}
+		GETSHORT(type, cp);
+		GETSHORT(class, cp);
+	}
+
+	if (type != T_A || class != C_IN)
+	{
+		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+		         "'%s' unexpected reply type/class", qname);
+		return RBL_STAT_ERROR;
+	}
+
+	/* if NXDOMAIN, return DKIM_STAT_NOKEY */
+	if (hdr.rcode == NXDOMAIN)
+	{
+		*ttl = rbl_negttl(cp, eom, &hdr);
+		return RBL_STAT_NOTFOUND;
+	}
+
+	/* get the answer count */
+	ancount = ntohs((unsigned short) hdr.ancount);
+	if (ancount == 0)
+	{
+		*ttl = rbl_negttl(cp, eom, &hdr);
+		return RBL_STAT_NOTFOUND;
+	}
+
+	/*
+	**  Extract the data from the first TXT answer.
+	*/
+
+	while (--ancount >= 0 && cp < eom)
+	{
+		/* grab the label, even though we know what we asked... */
+		if ((n = dn_expand((unsigned char *) rq->rq_buf, eom, cp,
+		                   (RES_UNC_T) qname, sizeof qname)) < 0)
+		{
+			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+			         "'%s' reply corrupt", qname);
+			return RBL_STAT_ERROR;
+		}
+		/* ...and move past it */
+		cp += n;
+
+		/* extract the type and class */
+		if (cp + INT16SZ + INT16SZ + INT32SZ > eom)
+		{
+			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+			         "'%s' reply corrupt", qname);
+			return RBL_STAT_ERROR;
+		}
+
+		GETSHORT(type, cp);
+		GETSHORT(class, cp);
+
+		/* get the TTL */
+		GETLONG(rrttl, cp);
+
+		/* skip CNAME if found; assume it was resolved */
+		if (type == T_CNAME)
+		{
+			char chost[RBL_MAXHOSTNAMELEN + 1];
+
+			n = dn_expand((u_char *) rq->rq_buf, eom, cp,
+			              chost, RBL_MAXHOSTNAMELEN);
+			cp += n;
+			continue;
+		}
+		else if (type == T_RRSIG)
+		{
+			/* get payload length */
+			if (cp + INT16SZ > eom)
+			{
+				snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+				         "'%s' reply corrupt", qname);
+				return RBL_STAT_ERROR;
+			}
+			GETSHORT(n, cp);
+
+			cp += n;
+
+			continue;
+		}
+		else if (type != T_A)
+		{
+			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+			         "'%s' unexpected reply type/class", qname);
+			return RBL_STAT_ERROR;
+		}
+
+		if (found != NULL)
+		{
+			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+			         "multiple replies for '%s'", qname);
+			return RBL_STAT_ERROR;
+		}
+
+		/* remember where this one started */
+		found = cp;
+		foundttl = rrttl;
+
+		/* get payload length */
+		if (cp + INT16SZ > eom)
+		{
+			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+			         "'%s' reply corrupt", qname);
+			return RBL_STAT_ERROR;
+		}
+		GETSHORT(n, cp);
+
+		/* move forward for now */
+		cp += n;
+	}
+
+	/* if ancount went below 0, there were no good records */
+	if (found == NULL)
+	{
+		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+		         "'%s' reply was unresolved CNAME", qname);
+		return RBL_STAT_ERROR;
+	}
+
+	/* come back to the one we found */
+	cp = found;
+
+	/* get payload length */
+	if (cp + INT16SZ > eom)
+	{
+		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+		         "'%s' reply corrupt", qname);
+		return RBL_STAT_ERROR;
+	}
+
+	GETSHORT(n, cp);
+	if (n != sizeof(uint32_t))
+	{
+		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+		         "'%s' reply corrupt", qname);
+		return RBL_STAT_ERROR;
+	}
+
+	if (cp + n > eom)
+	{
+		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+		         "'%s' reply corrupt", qname);
+		return RBL_STAT_ERROR;
+	}
+
+	/* extract the payload */
+	GETLONG(*res, cp);
+	*ttl = foundttl;
+
+	return RBL_STAT_FOUND;
+}
+
+/*
+**  RBL_START -- start a query, or answer it from the cache
+**
+**  Parameters:
+**  	rbl -- RBL handle
+**  	query -- query string
+**  	qroot -- query root
+**  	rqp -- new query (returned)
+**
+**  Return value:
+** 	RBL_STAT_* -- as defined
+*/
+
+static RBL_STAT
+rbl_start(RBL *rbl, u_char *query, u_char *qroot, struct rbl_query **rqp)
+{
+	int status;
+	struct rbl_query *rq;
+
+	rq = rbl_malloc(rbl, sizeof(*rq));
+	if (rq == NULL)
+		return RBL_STAT_NORESOURCE;
+
+	memset(rq, '\0', sizeof *rq);
+
+	snprintf(rq->rq_name, sizeof rq->rq_name, "%s.%s", query, qroot);
+
+	if (rbl->rbl_cache != NULL)
+	{
+		rq->rq_status = rbl_cache_get(rbl->rbl_cache, rq->rq_name,
+		                              &rq->rq_res);
+		if (rq->rq_status != RBL_STAT_NOREPLY)
+		{
+			rq->rq_done = TRUE;
+			*rqp = rq;
+			return RBL_STAT_OK;
+		}
+	}
+
+	if (rbl->rbl_dns_service == NULL &&
+	    rbl->rbl_dns_init != NULL &&
+	    rbl->rbl_dns_init(&rbl->rbl_dns_service) != 0)
+	{
+		rbl_free(rbl, rq);
+		return RBL_STAT_DNSERROR;
+	}
+
+	status = rbl->rbl_dns_start(rbl->rbl_dns_service, T_A,
+	                            (u_char *) rq->rq_name,
+	                            rq->rq_buf, sizeof rq->rq_buf, &rq->rq_qh);
+
+	if (status != 0)
+	{
+		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+		         "unable to start query for '%s'", rq->rq_name);
+		rbl_free(rbl, rq);
+		return RBL_STAT_DNSERROR;
+	}
+
+	*rqp = rq;
+	return RBL_STAT_OK;
+}
+
+/*
+**  RBL_CHECK -- wait for the outcome of a query
+**
+**  Parameters:
+**  	rbl -- RBL handle
+**  	rq -- query of interest
+**  	timeout -- how long to wait (NULL means forever)
+**
+**  Return value:
+** 	RBL_STAT_* -- as defined; the result is left in "rq"
+**
+**  Notes:
+**  	RBL_STAT_EXPIRED leaves the query pending.  Resolvers report an
+**  	ordinary wait timeout that way, and a later call may still
+**  	collect the reply.
+*/
+
+static RBL_STAT
+rbl_check(RBL *rbl, struct rbl_query *rq, struct timeval *timeout)
+{
+	int dnserr;
+	int status;
+	uint32_t ttl = 0;
+
+	if (rq->rq_done)
+		return rq->rq_status;
+
+	status = rbl->rbl_dns_waitreply(rbl->rbl_dns_service,
+	                                rq->rq_qh, timeout, &rq->rq_anslen,
+	                                &dnserr, NULL);
+
+	if (status == RBL_DNS_NOREPLY)
+		return RBL_STAT_NOREPLY;
+	else if (status == RBL_DNS_EXPIRED)
+		return RBL_STAT_EXPIRED;
+
+	rq->rq_done = TRUE;
+
+	if (status == RBL_DNS_ERROR)
+	{
+		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+		         "error during query");
+		rq->rq_status = RBL_STAT_ERROR;
+	}
+	else
+	{
+		rq->rq_status = rbl_reply(rbl, rq, &rq->rq_res, &ttl);
+
+		if (rbl->rbl_cache != NULL && ttl > 0 &&
+		    rq->rq_status != RBL_STAT_ERROR)
+		{
+			rbl_cache_put(rbl->rbl_cache, rq->rq_name,
+			              rq->rq_status, rq->rq_res, ttl);
+		}
+	}
+
+	return rq->rq_status;
+}
+
+/*
+**  RBL_FINISH -- release a query
+**
+**  Parameters:
+**  	rbl -- RBL handle
+**  	rq -- query to release
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+rbl_finish(RBL *rbl, struct rbl_query *rq)
+{
+	if (rq->rq_qh != NULL)
+		rbl->rbl_dns_cancel(rbl->rbl_dns_service, rq->rq_qh);
+
+	rbl_free(rbl, rq);
+}
+
+/*
+**  RBL_INIT -- initialize an RBL handle
+**
+**  Parameters:
+**  	caller_mallocf -- caller-provided memory allocation function
+**  	caller_freef -- caller-provided memory release function
+**  	closure -- memory closure to pass to the above when used
+**
+**  Return value:
+**  	A new RBL handle suitable for use with other RBL functions, or
+**  	NULL on failure.
+**  
+**  Side effects:
+**  	Sudden changes in local density altitude.
+*/
+
+RBL *
+rbl_init(void *(*caller_mallocf)(void *closure, size_t nbytes),
+         void (*caller_freef)(void *closure, void *p),
+         void *closure)
+{
+	RBL *new;
+
+	if (caller_mallocf == NULL)
+		new = (RBL *) malloc(sizeof(struct rbl_handle));
+	else
+		new = caller_mallocf(closure, sizeof(struct rbl_handle));
+
+	if (new == NULL)
+		return NULL;
+
+	memset(new, '\0', sizeof(struct rbl_handle));
+
+	new->rbl_timeout = RBL_DEFTIMEOUT;
+	new->rbl_closure = closure;
+	new->rbl_malloc = caller_mallocf;
+	new->rbl_free = caller_freef;
+	new->rbl_dns_start = rbl_res_query;
+	new->rbl_dns_waitreply = rbl_res_waitreply;
+	new->rbl_dns_cancel = rbl_res_cancel;
+	new->rbl_dns_setns = rbl_res_nslist;
+	new->rbl_dns_close = rbl_res_close;
+
+	return new;
+}
+
+/*
+**  RBL_CLOSE -- shut down a RBL instance
+**
+**  Parameters:
+**  	rbl -- RBL handle to shut down
+**
+**  Return value:
+**  	None.
+*/
+
+void
+rbl_close(RBL *rbl)
+{
+	assert(rbl != NULL);
+
+	if (rbl->rbl_dns_service != NULL &&
+	    rbl->rbl_dns_close != NULL)
+		(void) rbl->rbl_dns_close(rbl->rbl_dns_service);
+
+	if (rbl->rbl_free != NULL)
+		rbl->rbl_free(rbl->rbl_closure, rbl);
+	else
+		free(rbl);
+}
+
+/*
+**  RBL_GETERROR -- return any stored error string from within the RBL
+**                  context handle
+**
+**  Parameters:
+**  	rbl -- RBL handle from which to retrieve an error string
+**
+**  Return value:
+**  	A pointer to the stored string, or NULL if none was stored.
+*/
+
+const u_char *
+rbl_geterror(RBL *rbl)
+{
+	assert(rbl != NULL);
+
+	return rbl->rbl_error;
+}
+
+/*
+**  RBL_SETDOMAIN -- declare the RBL's domain (the query root)
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	qroot -- query root
+**
+**  Return value:
+**  	None (yet).
+*/
+
+void
+rbl_setdomain(RBL *rbl, u_char *qroot)
+{
+	assert(rbl != NULL);
+	assert(qroot != NULL);
+
+	strncpy(rbl->rbl_qroot, qroot, sizeof rbl->rbl_qroot);
+	rbl->rbl_qroot[sizeof rbl->rbl_qroot - 1] = '\0';
+}
+
+/*
+**  RBL_SETTIMEOUT -- set the DNS timeout
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	timeout -- requested timeout (seconds)
+**
+**  Return value:
+**  	None.
+*/
+
+void
+rbl_settimeout(RBL *rbl, u_int timeout)
+{
+	assert(rbl != NULL);
+
+	rbl->rbl_timeout = timeout;
+}
+
+/*
+**  RBL_SETCALLBACKINT -- set the DNS callback interval
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	cbint -- requested callback interval (seconds)
+**
+**  Return value:
+**  	None.
+*/
+
+void
+rbl_setcallbackint(RBL *rbl, u_int cbint)
+{
+	assert(rbl != NULL);
+
+	rbl->rbl_cbint = cbint;
+}
+
+/*
+**  RBL_SETCALLBACKCTX -- set the DNS callback context
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	ctx -- context to pass to the DNS callback
+**
+**  Return value:
+**  	None.
+*/
+
+void
+rbl_setcallbackctx(RBL *rbl, void *ctx)
+{
+	assert(rbl != NULL);
+
+	rbl->rbl_cbctx = ctx;
+}
+
+/*
+**  RBL_SETDNSCALLBACK -- set the DNS wait callback
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	func -- function to call; should take an opaque context pointer
+**
+**  Return value:
+**  	None.
+*/
+
+void
+rbl_setdnscallback(RBL *rbl, void (*func)(const void *context))
+{
+	assert(rbl != NULL);
+
+	rbl->rbl_dns_callback = func;
+}
+
+/*
+**  RBL_DNS_SET_QUERY_SERVICE -- stores a handle representing the DNS
+**                               query service to be used, returning any
+**                               previous handle
+**
+**  Parameters:
+**  	rbl -- RBL library handle
+**  	h -- handle to be used
+**
+**  Return value:
+**  	Previously stored handle, or NULL if none.
+*/
+
+void *
+rbl_dns_set_query_service(RBL *rbl, void *h)
+{
+	void *old;
+
+	assert(rbl != NULL);
+
+	old = rbl->rbl_dns_service;
+
+	rbl->rbl_dns_service = h;
+
+	return old;
+}
+
+/*
+**  RBL_DNS_SET_QUERY_START -- stores a pointer to a query start function
+**
+**  Parameters:
+**  	rbl -- RBL library handle
+**  	func -- function to use to start queries
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	"func" should match the following prototype:
+**  		returns int (status)
+**  		void *dns -- receives handle stored by
+**  		             rbl_dns_set_query_service()
+**  		int type -- DNS RR query type (C_IN assumed)
+**  		char *query -- question to ask
+**  		char *buf -- buffer into which to write reply
+**  		size_t buflen -- size of buf
+**  		void **qh -- returned query handle
+*/
+
+void
+rbl_dns_set_query_start(RBL *rbl, int (*func)(void *, int,
+                                              unsigned char *,
+                                              unsigned char *,
+                                              size_t, void **))
+{
+	assert(rbl != NULL);
+
+	rbl->rbl_dns_start = func;
+}
+
+/*
+**  RBL_DNS_SET_QUERY_CANCEL -- stores a pointer to a query cancel function
+**
+**  Parameters:
+**  	rbl -- RBL library handle
+**  	func -- function to use to cancel running queries
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	"func" should match the following prototype:
+**  		returns int (status)
+**  		void *dns -- DNS service handle
+**  		void *qh -- query handle to be canceled
+*/
+
+void
+rbl_dns_set_query_cancel(RBL *rbl, int (*func)(void *, void *))
+{
+	assert(rbl != NULL);
+
+	rbl->rbl_dns_cancel = func;
+}
+
+/*
+**  RBL_DNS_SET_QUERY_WAITREPLY -- stores a pointer to wait for a DNS reply
+**
+**  Parameters:
+**  	rbl -- RBL library handle
+**  	func -- function to use to wait for a reply
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	"func" should match the following prototype:
+**  		returns int (status)
+**  		void *dns -- DNS service handle
+**  		void *qh -- handle of query that has completed
+**  		struct timeval *timeout -- how long to wait
+**  		size_t *bytes -- bytes returned
+**  		int *error -- error code returned
+**  		int *dnssec -- DNSSEC status returned
+*/
+
+void
+rbl_dns_set_query_waitreply(RBL *rbl, int (*func)(void *, void *,
+                                                  struct timeval *,
+                                                  size_t *, int *,
+                                                  int *))
+{
+	assert(rbl != NULL);
 
 	rbl->rbl_dns_waitreply = func;
 }
@@ -904,19 +1543,10 @@ rbl_dns_init(RBL *lib)
 RBL_STAT
 rbl_query_cancel(RBL *rbl, void *qh)
 {
-	struct rbl_query *rq;
-
 	assert(rbl != NULL);
 	assert(qh != NULL);
 
-	rq = qh;
-
-	rbl->rbl_dns_cancel(rbl->rbl_dns_service, rq->rq_qh);
-
-	if (rbl->rbl_free != NULL)
-		rbl->rbl_free(rbl->rbl_closure, rq);
-	else
-		free(rq);
+	rbl_finish(rbl, (struct rbl_query *) qh);
 
 	return RBL_STAT_OK;
 }
@@ -936,9 +1566,8 @@ rbl_query_cancel(RBL *rbl, void *qh)
 RBL_STAT
 rbl_query_start(RBL *rbl, u_char *query, void **qh)
 {
-	int status;
+	RBL_STAT status;
 	struct rbl_query *rq;
-	u_char rblquery[RBL_MAXHOSTNAMELEN + 1];
 
 	assert(rbl != NULL);
 	assert(query != NULL);
@@ -951,271 +1580,380 @@ rbl_query_start(RBL *rbl, u_char *query, void **qh)
 		return RBL_STAT_INVALID;
 	}
 
-	snprintf(rblquery, sizeof rblquery, "%s.%s", query, rbl->rbl_qroot);
+	status = rbl_start(rbl, query, rbl->rbl_qroot, &rq);
+	if (status == RBL_STAT_OK)
+		*qh = rq;
 
-	if (rbl->rbl_malloc != NULL)
-		rq = rbl->rbl_malloc(rbl->rbl_closure, sizeof(*rq));
-	else
-		rq = malloc(sizeof(*rq));
+	return status;
+}
 
-	if (rq == NULL)
+/*
+**  RBL_QUERY_CHECK -- check for a reply from an active query
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	qh -- query handle (returned)
+**  	timeout -- timeout
+**  	res -- 32-bit buffer into which to write the result (can be NULL)
+**
+**  Return value:
+** 	RBL_STAT_* -- as defined
+*/
+
+RBL_STAT
+rbl_query_check(RBL *rbl, void *qh, struct timeval *timeout, uint32_t *res)
+{
+	RBL_STAT status;
+	struct rbl_query *rq;
+
+	assert(rbl != NULL);
+	assert(qh != NULL);
+
+	rq = qh;
+
+	status = rbl_check(rbl, rq, timeout);
+
+	if (status == RBL_STAT_FOUND && res != NULL)
+		*res = rq->rq_res;
+
+	/* a definite answer ends the query */
+	if (status == RBL_STAT_FOUND || status == RBL_STAT_NOTFOUND)
+		rbl_finish(rbl, rq);
+
+	return status;
+}
+
+/*
+**  RBL_BATCH_START -- query one subject in several RBLs at once
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	query -- query string
+**  	qroots -- NULL-terminated array of query roots
+**  	bh -- batch handle (returned)
+**
+**  Return value:
+** 	RBL_STAT_* -- as defined
+**
+**  Notes:
+**  	All of the queries are started before this returns, so the batch
+**  	costs about one round trip rather than one per RBL.  Results found
+**  	in the cache set with rbl_setcache() don't cause a query at all.
+*/
+
+RBL_STAT
+rbl_batch_start(RBL *rbl, u_char *query, u_char **qroots, void **bh)
+{
+	int c;
+	int n;
+	RBL_STAT status;
+	struct rbl_batch *rb;
+
+	assert(rbl != NULL);
+	assert(query != NULL);
+	assert(qroots != NULL);
+	assert(bh != NULL);
+
+	for (n = 0; qroots[n] != NULL; n++)
+		continue;
+
+	if (n == 0)
+	{
+		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
+		         "no query roots");
+		return RBL_STAT_INVALID;
+	}
+
+	rb = rbl_malloc(rbl, sizeof *rb);
+	if (rb == NULL)
 		return RBL_STAT_NORESOURCE;
 
-	memset(rq, '\0', sizeof *rq);
+	rb->rb_nqueries = 0;
+	rb->rb_queries = rbl_malloc(rbl, n * sizeof *rb->rb_queries);
+	if (rb->rb_queries == NULL)
+	{
+		rbl_free(rbl, rb);
+		return RBL_STAT_NORESOURCE;
+	}
 
-	if (rbl->rbl_dns_service == NULL &&
-	    rbl->rbl_dns_init != NULL &&
-	    rbl->rbl_dns_init(&rbl->rbl_dns_service) != 0)
-		return RBL_STAT_DNSERROR;
+	for (c = 0; c < n; c++)
+	{
+		status = rbl_start(rbl, query, qroots[c], &rb->rb_queries[c]);
+		if (status != RBL_STAT_OK)
+		{
+			(void) rbl_batch_cancel(rbl, rb);
+			return status;
+		}
 
-	status = rbl->rbl_dns_start(rbl->rbl_dns_service, T_A, rblquery,
-	                            rq->rq_buf, sizeof rq->rq_buf, &rq->rq_qh);
+		rb->rb_nqueries++;
+	}
+
+	*bh = rb;
+
+	return RBL_STAT_OK;
+}
+
+/*
+**  RBL_BATCH_CHECK -- collect replies for a batch of queries
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	bh -- batch handle
+**  	timeout -- how long to wait in all (NULL means forever)
+**
+**  Return value:
+**  	RBL_STAT_OK -- every query in the batch has a result
+**  	RBL_STAT_NOREPLY -- some queries were still outstanding when
+**  	                    "timeout" expired
+**
+**  Notes:
+**  	Results are available from rbl_batch_result() as soon as they
+**  	arrive, so this can be called repeatedly with a short timeout.
+*/
+
+RBL_STAT
+rbl_batch_check(RBL *rbl, void *bh, struct timeval *timeout)
+{
+	_Bool pending = FALSE;
+	int c;
+	struct rbl_batch *rb;
+	struct timeval now;
+	struct timeval left;
+	struct timeval deadline;
+
+	assert(rbl != NULL);
+	assert(bh != NULL);
 
-	if (status == 0)
+	rb = bh;
+
+	if (timeout != NULL)
 	{
-		*qh = rq;
-		return RBL_STAT_OK;
+		(void) gettimeofday(&deadline, NULL);
+		deadline.tv_sec += timeout->tv_sec;
+		deadline.tv_usec += timeout->tv_usec;
+		if (deadline.tv_usec >= 1000000)
+		{
+			deadline.tv_sec += deadline.tv_usec / 1000000;
+			deadline.tv_usec = deadline.tv_usec % 1000000;
+		}
 	}
-	else
+
+	/*
+	**  The queries are all in flight, so waiting for each in turn
+	**  against one deadline costs no more than the slowest of them.
+	*/
+
+	for (c = 0; c < rb->rb_nqueries; c++)
 	{
-		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-		         "unable to start query for '%s'", rblquery);
-		return RBL_STAT_DNSERROR;
+		if (timeout != NULL)
+		{
+			(void) gettimeofday(&now, NULL);
+			left.tv_sec = deadline.tv_sec - now.tv_sec;
+			left.tv_usec = deadline.tv_usec - now.tv_usec;
+			if (left.tv_usec < 0)
+			{
+				left.tv_sec--;
+				left.tv_usec += 1000000;
+			}
+			if (left.tv_sec < 0)
+			{
+				left.tv_sec = 0;
+				left.tv_usec = 0;
+			}
+		}
+
+		(void) rbl_check(rbl, rb->rb_queries[c],
+		                 timeout == NULL ? NULL : &left);
+		if (!rb->rb_queries[c]->rq_done)
+			pending = TRUE;
 	}
+
+	return (pending ? RBL_STAT_NOREPLY : RBL_STAT_OK);
 }
 
 /*
-**  RBL_QUERY_CHECK -- check for a reply from an active query
+**  RBL_BATCH_RESULT -- retrieve the result of one query in a batch
 **
 **  Parameters:
 **  	rbl -- RBL handle, created by rbl_init()
-**  	qh -- query handle (returned)
-**  	timeout -- timeout
+**  	bh -- batch handle
+**  	n -- index of the query root of interest, as passed to
+**  	     rbl_batch_start()
 **  	res -- 32-bit buffer into which to write the result (can be NULL)
 **
 **  Return value:
-** 	RBL_STAT_* -- as defined
+**  	RBL_STAT_FOUND, RBL_STAT_NOTFOUND or RBL_STAT_ERROR once the
+**  	result is known, otherwise RBL_STAT_NOREPLY.
 */
 
 RBL_STAT
-rbl_query_check(RBL *rbl, void *qh, struct timeval *timeout, uint32_t *res)
+rbl_batch_result(RBL *rbl, void *bh, int n, uint32_t *res)
 {
-	int dnserr;
-	int status;
-	int n;
-	int type;
-	int class;
-	int qdcount;
-	int ancount;
+	struct rbl_batch *rb;
 	struct rbl_query *rq;
-	u_char *cp;
-	u_char *eom;
-	u_char *found = NULL;
-	HEADER hdr;
-	u_char qname[RBL_MAXHOSTNAMELEN + 1];
 
 	assert(rbl != NULL);
-	assert(qh != NULL);
+	assert(bh != NULL);
 
-	rq = qh;
+	rb = bh;
 
-	status = rbl->rbl_dns_waitreply(rbl->rbl_dns_service,
-	                                rq->rq_qh, timeout, &rq->rq_anslen,
-	                                &dnserr, NULL);
+	assert(n >= 0 && n < rb->rb_nqueries);
 
-	if (status == RBL_DNS_ERROR)
-	{
-		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-		         "error during query");
-		return RBL_STAT_ERROR;
-	}
-	else if (status == RBL_DNS_NOREPLY)
-	{
+	rq = rb->rb_queries[n];
+
+	if (!rq->rq_done)
 		return RBL_STAT_NOREPLY;
-	}
-	else if (status == RBL_DNS_EXPIRED)
-	{
-		return RBL_STAT_EXPIRED;
-	}
 
-	/* set up pointers */
-	memcpy(&hdr, rq->rq_buf, sizeof hdr);
-	cp = (u_char *) rq->rq_buf + HFIXEDSZ;
-	eom = (u_char *) rq->rq_buf + rq->rq_anslen;
+	if (rq->rq_status == RBL_STAT_FOUND && res != NULL)
+		*res = rq->rq_res;
 
-	/* skip over the name at the front of the answer */
-	for (qdcount = ntohs((unsigned short) hdr.qdcount);
-	     qdcount > 0;
-	     qdcount--)
-	{
-		/* copy it first */
-		(void) dn_expand((unsigned char *) rq->rq_buf, eom, cp,
-		                 (char *) qname, sizeof qname);
- 
-		if ((n = dn_skipname(cp, eom)) < 0)
-		{
-			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-			         "'%s' reply corrupt", qname);
-			return RBL_STAT_ERROR;
-		}
-		cp += n;
+	return rq->rq_status;
+}
 
-		/* extract the type and class */
-		if (cp + INT16SZ + INT16SZ > eom)
-		{
-			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-			         "'%s' reply corrupt", qname);
-			return RBL_STAT_ERROR;
-		}
-		GETSHORT(type, cp);
-		GETSHORT(class, cp);
-	}
+/*
+**  RBL_BATCH_CANCEL -- cancel a batch of queries and release it
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	bh -- batch handle
+**
+**  Return value:
+** 	RBL_STAT_* -- as defined
+*/
 
-	if (type != T_A || class != C_IN)
-	{
-		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-		         "'%s' unexpected reply type/class", qname);
-		return RBL_STAT_ERROR;
-	}
+RBL_STAT
+rbl_batch_cancel(RBL *rbl, void *bh)
+{
+	int c;
+	struct rbl_batch *rb;
 
-	/* if NXDOMAIN, return DKIM_STAT_NOKEY */
-	if (hdr.rcode == NXDOMAIN)
-		return RBL_STAT_NOTFOUND;
+	assert(rbl != NULL);
+	assert(bh != NULL);
 
-	/* get the answer count */
-	ancount = ntohs((unsigned short) hdr.ancount);
-	if (ancount == 0)
-		return RBL_STAT_NOTFOUND;
+	rb = bh;
 
-	/*
-	**  Extract the data from the first TXT answer.
-	*/
+	for (c = 0; c < rb->rb_nqueries; c++)
+		rbl_finish(rbl, rb->rb_queries[c]);
 
-	while (--ancount >= 0 && cp < eom)
-	{
-		/* grab the label, even though we know what we asked... */
-		if ((n = dn_expand((unsigned char *) rq->rq_buf, eom, cp,
-		                   (RES_UNC_T) qname, sizeof qname)) < 0)
-		{
-			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-			         "'%s' reply corrupt", qname);
-			return RBL_STAT_ERROR;
-		}
-		/* ...and move past it */
-		cp += n;
+	rbl_free(rbl, rb->rb_queries);
+	rbl_free(rbl, rb);
 
-		/* extract the type and class */
-		if (cp + INT16SZ + INT16SZ > eom)
-		{
-			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-			         "'%s' reply corrupt", qname);
-			return RBL_STAT_ERROR;
-		}
+	return RBL_STAT_OK;
+}
 
-		GETSHORT(type, cp);
-		GETSHORT(class, cp);
+/*
+**  RBL_CACHE_NEW -- create a result cache
+**
+**  Parameters:
+**  	size -- number of results to hold
+**
+**  Return value:
+**  	A new cache, or NULL on failure.
+**
+**  Notes:
+**  	The cache can be shared by any number of RBL handles in any number
+**  	of threads.  Results are kept for their DNS TTL; negative results
+**  	are only kept if the reply carried an SOA to say for how long.
+*/
 
-		/* skip the TTL */
-		cp += INT32SZ;
+RBL_CACHE *
+rbl_cache_new(u_int size)
+{
+	RBL_CACHE *new;
 
-		/* skip CNAME if found; assume it was resolved */
-		if (type == T_CNAME)
-		{
-			char chost[RBL_MAXHOSTNAMELEN + 1];
+	new = (RBL_CACHE *) malloc(sizeof *new);
+	if (new == NULL)
+		return NULL;
 
-			n = dn_expand((u_char *) rq->rq_buf, eom, cp,
-			              chost, RBL_MAXHOSTNAMELEN);
-			cp += n;
-			continue;
-		}
-		else if (type == T_RRSIG)
-		{
-			/* get payload length */
-			if (cp + INT16SZ > eom)
-			{
-				snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-				         "'%s' reply corrupt", qname);
-				return RBL_STAT_ERROR;
-			}
-			GETSHORT(n, cp);
+	memset(new, '\0', sizeof *new);
 
-			cp += n;
+	new->rc_nbuckets = (size + RBL_CACHEWAYS - 1) / RBL_CACHEWAYS;
+	if (new->rc_nbuckets == 0)
+		new->rc_nbuckets = 1;
 
-			continue;
-		}
-		else if (type != T_A)
-		{
-			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-			         "'%s' unexpected reply type/class", qname);
-			return RBL_STAT_ERROR;
-		}
+	new->rc_entries = calloc(new->rc_nbuckets * RBL_CACHEWAYS,
+	                         sizeof(struct rbl_cache_entry));
+	if (new->rc_entries == NULL)
+	{
+		free(new);
+		return NULL;
+	}
 
-		if (found != NULL)
-		{
-			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-			         "multiple replies for '%s'", qname);
-			return RBL_STAT_ERROR;
-		}
+	if (pthread_mutex_init(&new->rc_lock, NULL) != 0)
+	{
+		free(new->rc_entries);
+		free(new);
+		return NULL;
+	}
 
-		/* remember where this one started */
-		found = cp;
+	return new;
+}
 
-		/* get payload length */
-		if (cp + INT16SZ > eom)
-		{
-			snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-			         "'%s' reply corrupt", qname);
-			return RBL_STAT_ERROR;
-		}
-		GETSHORT(n, cp);
+/*
+**  RBL_CACHE_FREE -- destroy a result cache
+**
+**  Parameters:
+**  	cache -- cache to destroy
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	No RBL handle may still be using the cache.
+*/
 
-		/* move forward for now */
-		cp += n;
-	}
+void
+rbl_cache_free(RBL_CACHE *cache)
+{
+	assert(cache != NULL);
 
-	/* if ancount went below 0, there were no good records */
-	if (found == NULL)
-	{
-		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-		         "'%s' reply was unresolved CNAME", qname);
-		return RBL_STAT_ERROR;
-	}
+	pthread_mutex_destroy(&cache->rc_lock);
+	free(cache->rc_entries);
+	free(cache);
+}
 
-	/* come back to the one we found */
-	cp = found;
+/*
+**  RBL_CACHE_STATS -- report cache activity
+**
+**  Parameters:
+**  	cache -- result cache
+**  	hits -- lookups answered from the cache (returned)
+**  	misses -- lookups that had to query (returned)
+**
+**  Return value:
+**  	None.
+*/
 
-	/* get payload length */
-	if (cp + INT16SZ > eom)
-	{
-		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-		         "'%s' reply corrupt", qname);
-		return RBL_STAT_ERROR;
-	}
+void
+rbl_cache_stats(RBL_CACHE *cache, u_long *hits, u_long *misses)
+{
+	assert(cache != NULL);
 
-	GETSHORT(n, cp);
-	if (n != sizeof(uint32_t))
-	{
-		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-		         "'%s' reply corrupt", qname);
-		return RBL_STAT_ERROR;
-	}
+	pthread_mutex_lock(&cache->rc_lock);
 
-	if (cp + n > eom)
-	{
-		snprintf(rbl->rbl_error, sizeof rbl->rbl_error,
-		         "'%s' reply corrupt", qname);
-		return RBL_STAT_ERROR;
-	}
+	if (hits != NULL)
+		*hits = cache->rc_hits;
+	if (misses != NULL)
+		*misses = cache->rc_misses;
 
-	/* extract the payload */
-	if (res != NULL)
-	{
-		uint32_t addr;
+	pthread_mutex_unlock(&cache->rc_lock);
+}
 
-		GETLONG(addr, cp);
+/*
+**  RBL_SETCACHE -- use a result cache
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	cache -- cache to use, or NULL to stop using one
+**
+**  Return value:
+**  	None.
+*/
 
-		*res = addr;
-	}
+void
+rbl_setcache(RBL *rbl, RBL_CACHE *cache)
+{
+	assert(rbl != NULL);
 
-	return RBL_STAT_FOUND;
+	rbl->rbl_cache = cache;
 }
@@ -41,6 +41,9 @@ typedef int RBL_STAT;
 struct rbl_handle;
 typedef struct rbl_handle RBL;
 
+struct rbl_cache;
+typedef struct rbl_cache RBL_CACHE;
+
 /* prototypes */
 
 /*
@@ -146,6 +149,115 @@ extern RBL_STAT rbl_query_check __P((RBL *, void *, struct timeval *,
 
 extern RBL_STAT rbl_query_cancel __P((RBL *, void *));
 
+/*
+**  RBL_BATCH_START -- query one subject in several RBLs at once
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	query -- query string
+**  	qroots -- NULL-terminated array of query roots
+**  	bh -- batch handle (returned)
+**
+**  Return value:
+** 	RBL_STAT_* -- as defined
+*/
+
+extern RBL_STAT rbl_batch_start __P((RBL *, u_char *, u_char **, void **));
+
+/*
+**  RBL_BATCH_CHECK -- collect replies for a batch of queries
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	bh -- batch handle
+**  	timeout -- how long to wait in all (NULL means forever)
+**
+**  Return value:
+**  	RBL_STAT_OK -- every query in the batch has a result
+**  	RBL_STAT_NOREPLY -- some queries were still outstanding
+*/
+
+extern RBL_STAT rbl_batch_check __P((RBL *, void *, struct timeval *));
+
+/*
+**  RBL_BATCH_RESULT -- retrieve the result of one query in a batch
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	bh -- batch handle
+**  	n -- index of the query root of interest
+**  	res -- 32-bit buffer into which to write the result (can be NULL)
+**
+**  Return value:
+** 	RBL_STAT_* -- as defined; RBL_STAT_NOREPLY if not yet known
+*/
+
+extern RBL_STAT rbl_batch_result __P((RBL *, void *, int, uint32_t *));
+
+/*
+**  RBL_BATCH_CANCEL -- cancel a batch of queries and release it
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	bh -- batch handle
+**
+**  Return value:
+** 	RBL_STAT_* -- as defined
+*/
+
+extern RBL_STAT rbl_batch_cancel __P((RBL *, void *));
+
+/*
+**  RBL_CACHE_NEW -- create a result cache
+**
+**  Parameters:
+**  	size -- number of results to hold
+**
+**  Return value:
+**  	A new cache, or NULL on failure.
+*/
+
+extern RBL_CACHE *rbl_cache_new __P((u_int));
+
+/*
+**  RBL_CACHE_FREE -- destroy a result cache
+**
+**  Parameters:
+**  	cache -- cache to destroy
+**
+**  Return value:
+**  	None.
+*/
+
+extern void rbl_cache_free __P((RBL_CACHE *));
+
+/*
+**  RBL_CACHE_STATS -- report cache activity
+**
+**  Parameters:
+**  	cache -- result cache
+**  	hits -- lookups answered from the cache (returned)
+**  	misses -- lookups that had to query (returned)
+**
+**  Return value:
+**  	None.
+*/
+
+extern void rbl_cache_stats __P((RBL_CACHE *, u_long *, u_long *));
+
+/*
+**  RBL_SETCACHE -- use a result cache
+**
+**  Parameters:
+**  	rbl -- RBL handle, created by rbl_init()
+**  	cache -- cache to use, or NULL to stop using one
+**
+**  Return value:
+**  	None.
+*/
+
+extern void rbl_setcache __P((RBL *, RBL_CACHE *));
+
 /*
 **  RBL_SETTIMEOUT -- set the DNS timeout
 **
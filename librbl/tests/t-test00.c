@@ -0,0 +1,362 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* librbl includes */
+#include "../rbl.h"
+
+#define	SUBJECT		"2.0.0.127"
+#define	NEVER		(-1)
+
+/* a canned answer */
+struct fake_rr
+{
+	char *		fr_qroot;		/* RBL */
+	uint32_t	fr_addr;		/* A record, or 0 for NXDOMAIN */
+	uint32_t	fr_ttl;			/* TTL (or SOA MINIMUM) */
+	int		fr_delay;		/* msecs until answered */
+};
+
+/* an open fake query */
+struct fake_query
+{
+	size_t		fq_len;			/* answer length */
+	struct fake_rr * fq_rr;			/* canned answer */
+	struct timeval	fq_ready;		/* when it is answered */
+};
+
+struct fake_rr answers[] =
+{
+	{ "fast.example",	0x7f000002,	300,	0 },
+	{ "slow.example",	0x7f000004,	300,	200 },
+	{ "clean.example",	0,		60,	50 },
+	{ "dead.example",	0,		60,	NEVER },
+	{ "nottl.example",	0x7f000003,	0,	0 },
+	{ NULL,			0,		0,	0 }
+};
+
+int started;
+int waited;
+int canceled;
+int startedatwait;
+
+/*
+**  ELAPSED -- milliseconds since a given time
+**
+**  Parameters:
+**  	since -- start time
+**
+**  Return value:
+**  	Milliseconds since "since".
+*/
+
+static long
+elapsed(struct timeval *since)
+{
+	struct timeval now;
+
+	(void) gettimeofday(&now, NULL);
+
+	return (now.tv_sec - since->tv_sec) * 1000L +
+	       (now.tv_usec - since->tv_usec) / 1000L;
+}
+
+/*
+**  FAKE_ANSWER -- build an A reply, or NXDOMAIN with an SOA
+**
+**  Parameters:
+**  	qname -- name queried
+**  	rr -- canned answer
+**  	buf -- reply buffer
+**  	buflen -- bytes available at "buf"
+**
+**  Return value:
+**  	Length of the reply.
+*/
+
+static size_t
+fake_answer(char *qname, struct fake_rr *rr, u_char *buf, size_t buflen)
+{
+	int n;
+	u_char *cp;
+	u_char *rdlen;
+	HEADER hdr;
+
+	memset(&hdr, '\0', sizeof hdr);
+	hdr.qr = 1;
+	hdr.rd = 1;
+	hdr.ra = 1;
+	hdr.qdcount = htons(1);
+	if (rr->fr_addr != 0)
+	{
+		hdr.ancount = htons(1);
+	}
+	else
+	{
+		hdr.rcode = NXDOMAIN;
+		hdr.nscount = htons(1);
+	}
+	memcpy(buf, &hdr, sizeof hdr);
+
+	cp = buf + HFIXEDSZ;
+	n = dn_comp(qname, cp, buflen - HFIXEDSZ, NULL, NULL);
+	assert(n > 0);
+	cp += n;
+	PUTSHORT(T_A, cp);
+	PUTSHORT(C_IN, cp);
+
+	if (rr->fr_addr != 0)
+	{
+		PUTSHORT(0xc000 | HFIXEDSZ, cp);
+		PUTSHORT(T_A, cp);
+		PUTSHORT(C_IN, cp);
+		PUTLONG(rr->fr_ttl, cp);
+		PUTSHORT(4, cp);
+		PUTLONG(rr->fr_addr, cp);
+	}
+	else
+	{
+		n = dn_comp(rr->fr_qroot, cp, buflen - (cp - buf), NULL, NULL);
+		assert(n > 0);
+		cp += n;
+		PUTSHORT(T_SOA, cp);
+		PUTSHORT(C_IN, cp);
+		PUTLONG(3600, cp);
+		rdlen = cp;
+		cp += INT16SZ;
+		n = dn_comp(rr->fr_qroot, cp, buflen - (cp - buf), NULL, NULL);
+		cp += n;
+		n = dn_comp(rr->fr_qroot, cp, buflen - (cp - buf), NULL, NULL);
+		cp += n;
+		PUTLONG(1, cp);			/* SERIAL */
+		PUTLONG(3600, cp);		/* REFRESH */
+		PUTLONG(600, cp);		/* RETRY */
+		PUTLONG(86400, cp);		/* EXPIRE */
+		PUTLONG(rr->fr_ttl, cp);	/* MINIMUM */
+		PUTSHORT(cp - rdlen - INT16SZ, rdlen);
+	}
+
+	return cp - buf;
+}
+
+/*
+**  FAKE_START, FAKE_CANCEL, FAKE_WAITREPLY -- a resolver whose answers
+**  arrive after a fixed delay, or never; like the filter's resolver, it
+**  reports a wait that times out as RBL_DNS_EXPIRED
+*/
+
+static int
+fake_start(void *srv, int type, unsigned char *query, unsigned char *buf,
+           size_t buflen, void **qh)
+{
+	int c;
+	size_t len;
+	struct fake_query *fq;
+
+	assert(type == T_A);
+
+	fq = malloc(sizeof *fq);
+	assert(fq != NULL);
+
+	fq->fq_rr = NULL;
+	for (c = 0; answers[c].fr_qroot != NULL; c++)
+	{
+		len = strlen(SUBJECT);
+		if (strncmp((char *) query, SUBJECT, len) == 0 &&
+		    query[len] == '.' &&
+		    strcasecmp((char *) query + len + 1,
+		               answers[c].fr_qroot) == 0)
+			fq->fq_rr = &answers[c];
+	}
+	assert(fq->fq_rr != NULL);
+
+	fq->fq_len = fake_answer((char *) query, fq->fq_rr, buf, buflen);
+
+	(void) gettimeofday(&fq->fq_ready, NULL);
+	fq->fq_ready.tv_usec += fq->fq_rr->fr_delay * 1000;
+	fq->fq_ready.tv_sec += fq->fq_ready.tv_usec / 1000000;
+	fq->fq_ready.tv_usec %= 1000000;
+
+	started++;
+	*qh = fq;
+
+	return RBL_DNS_SUCCESS;
+}
+
+static int
+fake_cancel(void *srv, void *qh)
+{
+	canceled++;
+	free(qh);
+
+	return 0;
+}
+
+static int
+fake_waitreply(void *srv, void *qh, struct timeval *to, size_t *bytes,
+               int *error, int *dnssec)
+{
+	long left;
+	long max;
+	struct fake_query *fq = qh;
+
+	if (waited++ == 0)
+		startedatwait = started;
+
+	assert(to != NULL);
+	max = to->tv_sec * 1000L + to->tv_usec / 1000L;
+
+	if (fq->fq_rr->fr_delay == NEVER)
+	{
+		usleep(max * 1000L);
+		return RBL_DNS_EXPIRED;
+	}
+
+	left = -elapsed(&fq->fq_ready);
+	if (left > max)
+	{
+		usleep(max * 1000L);
+		return RBL_DNS_EXPIRED;
+	}
+
+	if (left > 0)
+		usleep(left * 1000L);
+
+	*bytes = fq->fq_len;
+	if (error != NULL)
+		*error = 0;
+
+	return RBL_DNS_SUCCESS;
+}
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	The usual.
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+main(int argc, char **argv)
+{
+	long msecs;
+	u_long hits;
+	u_long misses;
+	uint32_t res;
+	RBL_STAT status;
+	void *bh;
+	void *qh;
+	RBL *rbl;
+	RBL_CACHE *cache;
+	struct timeval start;
+	struct timeval to;
+	u_char *qroots[] = { (u_char *) "fast.example",
+	                     (u_char *) "slow.example",
+	                     (u_char *) "clean.example",
+	                     (u_char *) "dead.example",
+	                     (u_char *) "nottl.example",
+	                     NULL };
+
+	printf("*** batched RBL queries and result cache\n");
+
+	cache = rbl_cache_new(64);
+	assert(cache != NULL);
+
+	rbl = rbl_init(NULL, NULL, NULL);
+	assert(rbl != NULL);
+
+	rbl_setcache(rbl, cache);
+	rbl_dns_set_query_start(rbl, fake_start);
+	rbl_dns_set_query_cancel(rbl, fake_cancel);
+	rbl_dns_set_query_waitreply(rbl, fake_waitreply);
+
+	/* every query is sent before any reply is awaited */
+	status = rbl_batch_start(rbl, (u_char *) SUBJECT, qroots, &bh);
+	assert(status == RBL_STAT_OK);
+	assert(started == 5);
+
+	/* a quick look collects only what has already arrived */
+	to.tv_sec = 0;
+	to.tv_usec = 0;
+	status = rbl_batch_check(rbl, bh, &to);
+	assert(status == RBL_STAT_NOREPLY);
+	assert(startedatwait == 5);
+	assert(rbl_batch_result(rbl, bh, 0, &res) == RBL_STAT_FOUND);
+	assert(res == 0x7f000002);
+	assert(rbl_batch_result(rbl, bh, 1, NULL) == RBL_STAT_NOREPLY);
+	assert(rbl_batch_result(rbl, bh, 3, NULL) == RBL_STAT_NOREPLY);
+	assert(rbl_batch_result(rbl, bh, 4, &res) == RBL_STAT_FOUND);
+	assert(res == 0x7f000003);
+
+	/* one timeout covers the whole batch and collects the stragglers */
+	to.tv_sec = 1;
+	to.tv_usec = 0;
+	(void) gettimeofday(&start, NULL);
+	status = rbl_batch_check(rbl, bh, &to);
+	msecs = elapsed(&start);
+	assert(status == RBL_STAT_NOREPLY);
+	assert(msecs >= 900 && msecs < 1500);
+	assert(rbl_batch_result(rbl, bh, 1, &res) == RBL_STAT_FOUND);
+	assert(res == 0x7f000004);
+	assert(rbl_batch_result(rbl, bh, 2, NULL) == RBL_STAT_NOTFOUND);
+	assert(rbl_batch_result(rbl, bh, 3, NULL) == RBL_STAT_NOREPLY);
+
+	status = rbl_batch_cancel(rbl, bh);
+	assert(status == RBL_STAT_OK);
+	assert(canceled == 5);
+
+	rbl_cache_stats(cache, &hits, &misses);
+	assert(hits == 0);
+	assert(misses == 5);
+
+	/* positive and negative answers now come from the cache */
+	started = 0;
+	canceled = 0;
+	status = rbl_batch_start(rbl, (u_char *) SUBJECT, qroots, &bh);
+	assert(status == RBL_STAT_OK);
+	assert(started == 2);		/* dead.example, nottl.example */
+	assert(rbl_batch_result(rbl, bh, 0, &res) == RBL_STAT_FOUND);
+	assert(res == 0x7f000002);
+	assert(rbl_batch_result(rbl, bh, 1, &res) == RBL_STAT_FOUND);
+	assert(res == 0x7f000004);
+	assert(rbl_batch_result(rbl, bh, 2, NULL) == RBL_STAT_NOTFOUND);
+	status = rbl_batch_cancel(rbl, bh);
+	assert(status == RBL_STAT_OK);
+	assert(canceled == 2);
+
+	rbl_cache_stats(cache, &hits, &misses);
+	assert(hits == 3);
+	assert(misses == 7);
+
+	/* single queries share the cache */
+	started = 0;
+	rbl_setdomain(rbl, (u_char *) "clean.example");
+	status = rbl_query_start(rbl, (u_char *) SUBJECT, &qh);
+	assert(status == RBL_STAT_OK);
+	assert(started == 0);
+	status = rbl_query_check(rbl, qh, NULL, &res);
+	assert(status == RBL_STAT_NOTFOUND);
+
+	rbl_close(rbl);
+	rbl_cache_free(cache);
+
+	return 0;
+}
@@ -0,0 +1,364 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* libvbr includes */
+#include "../vbr.h"
+
+/* resolver status codes, as used inside libvbr */
+#define	FAKE_DNS_SUCCESS	0
+#define	FAKE_DNS_NOREPLY	2
+
+#define	DOMAIN		"example.com"
+#define	MSGTYPE		"transaction"
+#define	NEVER		(-1)
+#define	TIMEOUT		1
+
+/* a canned answer */
+struct fake_rr
+{
+	char *		fr_cert;		/* certifier */
+	char *		fr_txt;			/* TXT payload */
+	int		fr_delay;		/* msecs until answered */
+};
+
+/* an open fake query */
+struct fake_query
+{
+	size_t		fq_len;			/* answer length */
+	struct fake_rr * fq_rr;			/* canned answer */
+	struct timeval	fq_ready;		/* when it is answered */
+};
+
+struct fake_rr *answers;
+int started;
+int waited;
+int canceled;
+int startedatwait;
+
+/*
+**  ELAPSED -- milliseconds since a given time
+**
+**  Parameters:
+**  	since -- start time
+**
+**  Return value:
+**  	Milliseconds since "since".
+*/
+
+static long
+elapsed(struct timeval *since)
+{
+	struct timeval now;
+
+	(void) gettimeofday(&now, NULL);
+
+	return (now.tv_sec - since->tv_sec) * 1000L +
+	       (now.tv_usec - since->tv_usec) / 1000L;
+}
+
+/*
+**  FAKE_ANSWER -- build a TXT reply
+**
+**  Parameters:
+**  	qname -- name queried
+**  	txt -- TXT payload
+**  	buf -- reply buffer
+**  	buflen -- bytes available at "buf"
+**
+**  Return value:
+**  	Length of the reply.
+*/
+
+static size_t
+fake_answer(char *qname, char *txt, u_char *buf, size_t buflen)
+{
+	int n;
+	u_char *cp;
+	HEADER hdr;
+
+	memset(&hdr, '\0', sizeof hdr);
+	hdr.qr = 1;
+	hdr.rd = 1;
+	hdr.ra = 1;
+	hdr.qdcount = htons(1);
+	hdr.ancount = htons(1);
+	memcpy(buf, &hdr, sizeof hdr);
+
+	cp = buf + HFIXEDSZ;
+	n = dn_comp(qname, cp, buflen - HFIXEDSZ, NULL, NULL);
+	assert(n > 0);
+	cp += n;
+	PUTSHORT(T_TXT, cp);
+	PUTSHORT(C_IN, cp);
+
+	/* the answer's name points back at the question */
+	PUTSHORT(0xc000 | HFIXEDSZ, cp);
+	PUTSHORT(T_TXT, cp);
+	PUTSHORT(C_IN, cp);
+	PUTLONG(300, cp);
+	PUTSHORT(strlen(txt) + 1, cp);
+	*cp++ = strlen(txt);
+	memcpy(cp, txt, strlen(txt));
+	cp += strlen(txt);
+
+	return cp - buf;
+}
+
+/*
+**  FAKE_START, FAKE_CANCEL, FAKE_WAITREPLY -- a resolver whose answers
+**  arrive after a fixed delay, or never
+*/
+
+static int
+fake_start(void *srv, int type, unsigned char *query, unsigned char *buf,
+           size_t buflen, void **qh)
+{
+	int c;
+	struct fake_query *fq;
+	char name[BUFSIZ];
+
+	assert(type == T_TXT);
+
+	fq = malloc(sizeof *fq);
+	assert(fq != NULL);
+
+	fq->fq_rr = NULL;
+	for (c = 0; answers[c].fr_cert != NULL; c++)
+	{
+		snprintf(name, sizeof name, "%s.%s.%s", DOMAIN, VBR_PREFIX,
+		         answers[c].fr_cert);
+		if (strcasecmp(name, (char *) query) == 0)
+			fq->fq_rr = &answers[c];
+	}
+	assert(fq->fq_rr != NULL);
+
+	fq->fq_len = fake_answer((char *) query, fq->fq_rr->fr_txt,
+	                         buf, buflen);
+
+	(void) gettimeofday(&fq->fq_ready, NULL);
+	fq->fq_ready.tv_sec += fq->fq_rr->fr_delay / 1000;
+	fq->fq_ready.tv_usec += (fq->fq_rr->fr_delay % 1000) * 1000;
+	if (fq->fq_ready.tv_usec >= 1000000)
+	{
+		fq->fq_ready.tv_sec++;
+		fq->fq_ready.tv_usec -= 1000000;
+	}
+
+	started++;
+	*qh = fq;
+
+	return FAKE_DNS_SUCCESS;
+}
+
+static int
+fake_cancel(void *srv, void *qh)
+{
+	canceled++;
+	free(qh);
+
+	return 0;
+}
+
+static int
+fake_waitreply(void *srv, void *qh, struct timeval *to, size_t *bytes,
+               int *error, int *dnssec)
+{
+	long left;
+	long max;
+	struct fake_query *fq = qh;
+
+	if (waited++ == 0)
+		startedatwait = started;
+
+	max = to->tv_sec * 1000L + to->tv_usec / 1000L;
+
+	if (fq->fq_rr->fr_delay == NEVER)
+	{
+		usleep(max * 1000L);
+		return FAKE_DNS_NOREPLY;
+	}
+
+	left = -elapsed(&fq->fq_ready);
+	if (left > max)
+	{
+		usleep(max * 1000L);
+		return FAKE_DNS_NOREPLY;
+	}
+
+	if (left > 0)
+		usleep(left * 1000L);
+
+	*bytes = fq->fq_len;
+	if (error != NULL)
+		*error = 0;
+
+	return FAKE_DNS_SUCCESS;
+}
+
+/*
+**  QUERY -- run one VBR query against the fake resolver
+**
+**  Parameters:
+**  	rrs -- canned answers
+**  	certs -- certifiers claimed by the sender
+**  	trusted -- trusted certifiers
+**  	opts -- VBR options
+**  	res -- result (returned)
+**  	cert -- vouching certifier (returned)
+**  	msecs -- time taken (returned)
+**
+**  Return value:
+**  	Status from vbr_query().
+*/
+
+static VBR_STAT
+query(struct fake_rr *rrs, char *certs, u_char **trusted, u_int opts,
+      u_char **res, u_char **cert, long *msecs)
+{
+	VBR_STAT status;
+	VBR *vbr;
+	struct timeval start;
+
+	answers = rrs;
+	started = 0;
+	waited = 0;
+	canceled = 0;
+	startedatwait = 0;
+
+	vbr = vbr_init(NULL, NULL, NULL);
+	assert(vbr != NULL);
+
+	vbr_options(vbr, opts);
+	vbr_setdomain(vbr, (u_char *) DOMAIN);
+	vbr_settype(vbr, (u_char *) MSGTYPE);
+	vbr_setcert(vbr, (u_char *) certs);
+	vbr_trustedcerts(vbr, trusted);
+	(void) vbr_settimeout(vbr, TIMEOUT);
+
+	vbr_dns_set_query_start(vbr, fake_start);
+	vbr_dns_set_query_cancel(vbr, fake_cancel);
+	vbr_dns_set_query_waitreply(vbr, fake_waitreply);
+
+	*res = NULL;
+	*cert = NULL;
+
+	(void) gettimeofday(&start, NULL);
+	status = vbr_query(vbr, res, cert);
+	*msecs = elapsed(&start);
+
+	vbr_close(vbr);
+
+	return status;
+}
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	The usual.
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+main(int argc, char **argv)
+{
+	long msecs;
+	VBR_STAT status;
+	u_char *res;
+	u_char *cert;
+	u_char *trusted[] = { (u_char *) "c.example",
+	                      (u_char *) "b.example",
+	                      (u_char *) "a.example",
+	                      NULL };
+	struct fake_rr mixed[] = {
+		{ "a.example", "list", 100 },
+		{ "b.example", MSGTYPE, 300 },
+		{ "c.example", VBR_ALL, 50 },
+		{ NULL, NULL, 0 }
+	};
+	struct fake_rr slow[] = {
+		{ "a.example", MSGTYPE, NEVER },
+		{ "b.example", MSGTYPE, 100 },
+		{ "c.example", MSGTYPE, NEVER },
+		{ NULL, NULL, 0 }
+	};
+	struct fake_rr dead[] = {
+		{ "a.example", MSGTYPE, NEVER },
+		{ "b.example", MSGTYPE, NEVER },
+		{ "c.example", MSGTYPE, NEVER },
+		{ NULL, NULL, 0 }
+	};
+	struct fake_rr none[] = {
+		{ "a.example", "list", 10 },
+		{ "b.example", "list", 20 },
+		{ "c.example", "list", 30 },
+		{ NULL, NULL, 0 }
+	};
+
+	printf("*** concurrent VBR certifier queries\n");
+
+	/* all queries start together; the sender's order decides */
+	status = query(mixed, "a.example:x.example:B.Example:c.example",
+	               trusted, 0, &res, &cert, &msecs);
+	assert(status == VBR_STAT_OK);
+	assert(strcmp((char *) res, "pass") == 0);
+	assert(cert == trusted[1]);
+	assert(started == 3);
+	assert(startedatwait == 3);
+	assert(canceled == 3);
+
+	/* with only trusted certifiers, our order decides */
+	status = query(mixed, "a.example", trusted, VBR_OPT_TRUSTEDONLY,
+	               &res, &cert, &msecs);
+	assert(status == VBR_STAT_OK);
+	assert(strcmp((char *) res, "pass") == 0);
+	assert(cert == trusted[0]);
+	assert(started == 3);
+	assert(startedatwait == 3);
+	assert(canceled == 3);
+
+	/* a certifier that never answers costs one timeout, not one each */
+	status = query(slow, "a.example:b.example:c.example", trusted, 0,
+	               &res, &cert, &msecs);
+	assert(status == VBR_STAT_OK);
+	assert(strcmp((char *) res, "pass") == 0);
+	assert(cert == trusted[1]);
+	assert(canceled == 3);
+	assert(msecs < 2 * TIMEOUT * 1000);
+
+	/* nobody answers */
+	status = query(dead, "a.example:b.example:c.example", trusted, 0,
+	               &res, &cert, &msecs);
+	assert(status == VBR_STAT_DNSERROR);
+	assert(res == NULL);
+	assert(canceled == 3);
+	assert(msecs < 2 * TIMEOUT * 1000);
+
+	/* nobody vouches */
+	status = query(none, "a.example:b.example:c.example", trusted, 0,
+	               &res, &cert, &msecs);
+	assert(status == VBR_STAT_OK);
+	assert(strcmp((char *) res, "fail") == 0);
+	assert(cert == NULL);
+	assert(canceled == 3);
+
+	return 0;
+}
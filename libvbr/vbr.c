@@ -68,6 +68,7 @@ struct vbr_query
 	int		vq_error;
 	size_t		vq_buflen;
 	void *		vq_qh;
+	u_char *	vq_cert;
 	u_char		vq_buf[HFIXEDSZ + MAXPACKET];
 };
 
@@ -662,6 +663,81 @@ vbr_txt_decode(u_char *ansbuf, size_t anslen, u_char *buf, size_t buflen)
 	return TRUE;
 }
 
+/*
+**  VBR_WAIT -- wait for the reply to one of a set of concurrent queries
+**
+**  Parameters:
+**  	vbr -- VBR handle
+**  	vq -- query of interest
+**  	deadline -- time at which the whole set of queries expires
+**
+**  Return value:
+**  	A VBR_DNS_* code.
+**
+**  Notes:
+**  	Once the deadline has passed, this only collects a reply that has
+**  	already arrived.
+*/
+
+static int
+vbr_wait(VBR *vbr, struct vbr_query *vq, struct timeval *deadline)
+{
+	int status;
+	int dnserr;
+	struct timeval *to;
+	struct timeval timeout;
+	struct timeval ctimeout;
+	struct timeval wstart;
+	struct timeval wstop;
+
+	wstop.tv_sec = 0;
+	wstop.tv_usec = 0;
+
+	for (;;)
+	{
+		(void) gettimeofday(&wstart, NULL);
+
+		/* whatever is left before the deadline */
+		timeout.tv_sec = deadline->tv_sec - wstart.tv_sec;
+		timeout.tv_usec = deadline->tv_usec - wstart.tv_usec;
+		if (timeout.tv_usec < 0)
+		{
+			timeout.tv_sec--;
+			timeout.tv_usec += 1000000;
+		}
+		if (timeout.tv_sec < 0)
+		{
+			timeout.tv_sec = 0;
+			timeout.tv_usec = 0;
+		}
+
+		if (vbr->vbr_dns_callback == NULL)
+		{
+			return vbr->vbr_dns_waitreply(vbr->vbr_dns_service,
+			                              vq->vq_qh, &timeout,
+			                              &vq->vq_buflen, &dnserr,
+			                              NULL);
+		}
+
+		ctimeout.tv_sec = vbr->vbr_callback_int;
+		ctimeout.tv_usec = 0;
+
+		vbr_timeouts(&timeout, &ctimeout, &wstart, &wstop, &to);
+
+		status = vbr->vbr_dns_waitreply(vbr->vbr_dns_service,
+		                                vq->vq_qh, to,
+		                                &vq->vq_buflen, &dnserr,
+		                                NULL);
+
+		(void) gettimeofday(&wstop, NULL);
+
+		if (status != VBR_DNS_NOREPLY || to == &timeout)
+			return status;
+
+		vbr->vbr_dns_callback(vbr->vbr_user_context);
+	}
+}
+
 /* ========================= PUBLIC SECTION ========================= */
 
 /*
@@ -695,6 +771,7 @@ vbr_init(void *(*caller_mallocf)(void *closure, size_t nbytes),
 	new->vbr_malloc = caller_mallocf;
 	new->vbr_free = caller_freef;
 	new->vbr_closure = closure;
+	new->vbr_opts = 0;
 	new->vbr_timeout = DEFTIMEOUT;
 	new->vbr_callback_int = 0;
 	new->vbr_dns_callback = NULL;
@@ -962,28 +1039,37 @@ vbr_trustedcerts(VBR *vbr, u_char **certs)
 **  	VBR_STAT_INVALID -- vbr_trustedcerts(), vbr_settype() and
 **  	                    vbr_setcert() were not all called
 **  	VBR_STAT_DNSERROR -- DNS issue prevented resolution
+**  	VBR_STAT_NORESOURCE -- out of memory
 **
 **  Notes:
 **  	- "pass" is the result if ANY certifier vouched for the message.
 **  	- "res" is not modified if no result could be determined
 **  	- there's no attempt to validate the values found
-**  	- vbr_cert is destroyed by this function
+**  	- all certifier queries are started at once and share a single
+**  	  timeout; if more than one vouches, the first in priority order
+**  	  (the sender's order, or ours with VBR_OPT_TRUSTEDONLY) is
+**  	  reported, and queries still pending once that is known are
+**  	  canceled
 */
 
 VBR_STAT
 vbr_query(VBR *vbr, u_char **res, u_char **cert)
 {
+	_Bool dnserror;
 	int c;
 	int n;
+	int nq;
 	int status;
-	int dnserr;
+	VBR_STAT ret;
 	struct vbr_query *vq;
-	void *qh;
+	struct vbr_query *winner;
+	struct vbr_query **vqs;
 	u_char *p;
 	u_char *last;
 	u_char *last2;
 	u_char *p2;
-	struct timeval timeout;
+	u_char *trusted;
+	struct timeval deadline;
 	u_char certs[VBR_MAXHEADER + 1];
 	u_char query[VBR_MAXHOSTNAMELEN + 1];
 	unsigned char buf[BUFRSZ];
@@ -1002,16 +1088,18 @@ vbr_query(VBR *vbr, u_char **res, u_char **cert)
 
 	strlcpy((char *) certs, vbr->vbr_cert, sizeof certs);
 
-	if (vbr->vbr_malloc != NULL)
-		vq = vbr->vbr_malloc(vbr->vbr_closure, sizeof(*vq));
-	else
-		vq = malloc(sizeof(*vq));
+	/* at most one query per trusted certifier */
+	for (n = 0; vbr->vbr_trusted[n] != NULL; n++)
+		continue;
 
-	if (vq == NULL)
+	vqs = vbr_malloc(vbr, vbr->vbr_closure, (n + 1) * sizeof *vqs);
+	if (vqs == NULL)
 		return VBR_STAT_NORESOURCE;
 
-	memset(vq, '\0', sizeof *vq);
+	ret = VBR_STAT_OK;
+	nq = 0;
 
+	/* pick the certifiers to ask, in priority order, and ask them all */
 	for (c = 0; ; c++)
 	{
 		if ((vbr->vbr_opts & VBR_OPT_TRUSTEDONLY) != 0)
@@ -1024,7 +1112,7 @@ vbr_query(VBR *vbr, u_char **res, u_char **cert)
 			if (vbr->vbr_trusted[c] == NULL)
 				break;
 			else
-				p = vbr->vbr_trusted[c];
+				p = trusted = vbr->vbr_trusted[c];
 		}
 		else
 		{
@@ -1033,115 +1121,106 @@ vbr_query(VBR *vbr, u_char **res, u_char **cert)
 			**  trusted voucher list.
 			*/
 
-			_Bool found;
-
 			p = (u_char *) strtok_r(c == 0 ? (char *) certs : NULL,
 			                        ":", (char **) &last);
 			if (p == NULL)
 				break;
 
-			found = FALSE;
+			trusted = NULL;
 
 			for (n = 0; vbr->vbr_trusted[n] != NULL; n++)
 			{
 				if (strcasecmp((char *) p,
 				               (char *) vbr->vbr_trusted[n]) == 0)
 				{
-					found = TRUE;
+					trusted = vbr->vbr_trusted[n];
 					break;
 				}
 			}
 
-			if (!found)
+			if (trusted == NULL)
+				continue;
+
+			/* the sender may have named it twice */
+			for (n = 0; n < nq; n++)
+			{
+				if (vqs[n]->vq_cert == trusted)
+					break;
+			}
+
+			if (n < nq)
 				continue;
 		}	
 
 		snprintf((char *) query, sizeof query, "%s.%s.%s",
 		         vbr->vbr_domain, VBR_PREFIX, p);
 
-		qh = NULL;
-
 		if (vbr->vbr_dns_init != NULL &&
 		    vbr->vbr_dns_service == NULL &&
 		    vbr->vbr_dns_init(&vbr->vbr_dns_service) != 0)
 		{
-			snprintf(vbr->vbr_error, sizeof vbr->vbr_error,
-			         "unable to start resolver for '%s'",
-			         query);
-			return VBR_STAT_DNSERROR;
+			vbr_error(vbr, "unable to start resolver for '%s'", query);
+			ret = VBR_STAT_DNSERROR;
+			break;
 		}
 
-		status = vbr->vbr_dns_start(vbr->vbr_dns_service, T_TXT, query,
-		                            vq->vq_buf, sizeof vq->vq_buf,
-		                            &vq->vq_qh);
-
-		if (status != VBR_STAT_OK)
+		vq = vbr_malloc(vbr, vbr->vbr_closure, sizeof *vq);
+		if (vq == NULL)
 		{
-			snprintf(vbr->vbr_error, sizeof vbr->vbr_error,
-			         "unable to start query for '%s'",
-			         query);
-			return VBR_STAT_DNSERROR;
+			ret = VBR_STAT_NORESOURCE;
+			break;
 		}
 
-		timeout.tv_sec = vbr->vbr_timeout;
-		timeout.tv_usec = 0;
+		memset(vq, '\0', sizeof *vq);
+		vq->vq_cert = trusted;
+		vqs[nq++] = vq;
 
-		if (vbr->vbr_dns_callback == NULL)
+		status = vbr->vbr_dns_start(vbr->vbr_dns_service, T_TXT, query,
+		                            vq->vq_buf, sizeof vq->vq_buf,
+		                            &vq->vq_qh);
+
+		if (status != VBR_DNS_SUCCESS)
 		{
-			status = vbr->vbr_dns_waitreply(vbr->vbr_dns_service,
-			                                vq->vq_qh,
-			                                &timeout,
-			                                &vq->vq_buflen,
-			                                &dnserr,
-			                                NULL);
+			vq->vq_qh = NULL;
+			vbr_error(vbr, "unable to start query for '%s'", query);
+			ret = VBR_STAT_DNSERROR;
+			break;
 		}
-		else
-		{
-			struct timeval *to;
-			struct timeval wstart;
-			struct timeval wstop;
-			struct timeval ctimeout;
-
-			wstop.tv_sec = 0;
-			wstop.tv_usec = 0;
-
-			for (;;)
-			{
-				(void) gettimeofday(&wstart, NULL);
-
-				ctimeout.tv_sec = vbr->vbr_callback_int;
-				ctimeout.tv_usec = 0;
-
-				timeout.tv_sec = vbr->vbr_timeout;
-				timeout.tv_usec = 0;
+	}
 
-				vbr_timeouts(&timeout, &ctimeout,
-				             &wstart, &wstop,
-				             &to);
+	(void) gettimeofday(&deadline, NULL);
+	deadline.tv_sec += vbr->vbr_timeout;
 
-				status = vbr->vbr_dns_waitreply(vbr->vbr_dns_service,
-				                                vq->vq_qh,
-				                                to,
-				                                &vq->vq_buflen,
-				                                &dnserr,
-				                                NULL);
+	/*
+	**  Collect the replies in priority order.  A reply later in the
+	**  list has usually arrived by the time the ones ahead of it are
+	**  settled, so this takes about as long as the slowest query that
+	**  matters rather than the sum of all of them.
+	*/
 
-				(void) gettimeofday(&wstop, NULL);
+	dnserror = FALSE;
+	winner = NULL;
 
-				if (status != VBR_DNS_NOREPLY ||
-				    to == &timeout)
-					break;
+	for (c = 0; ret == VBR_STAT_OK && c < nq; c++)
+	{
+		vq = vqs[c];
 
-				vbr->vbr_dns_callback(vbr->vbr_user_context);
-			}
-		}
+		status = vbr_wait(vbr, vq, &deadline);
 
 		vbr->vbr_dns_cancel(vbr->vbr_dns_service, vq->vq_qh);
+		vq->vq_qh = NULL;
 
-		if (status == VBR_DNS_ERROR || status == VBR_DNS_EXPIRED)
+		if (status != VBR_DNS_SUCCESS && status != VBR_DNS_REPLY)
 		{
-			vbr_error(vbr, "failed to retrieve %s", query);
-			return VBR_STAT_DNSERROR;
+			if (!dnserror)
+			{
+				vbr_error(vbr, "failed to retrieve %s.%s.%s",
+				          vbr->vbr_domain, VBR_PREFIX,
+				          vq->vq_cert);
+			}
+
+			dnserror = TRUE;
+			continue;
 		}
 
 		/* try to decode the reply */
@@ -1161,16 +1240,48 @@ vbr_query(VBR *vbr, u_char **res, u_char **cert)
 			               (char *) vbr->vbr_type) == 0)
 			{
 				/* we have a winner! */
-				*res = (u_char *) "pass";
-				*cert = p;
-				return VBR_STAT_OK;
+				winner = vq;
+				break;
 			}
 		}
+
+		if (winner != NULL)
+			break;
 	}
 
-	/* nobody vouched */
-	*res = (u_char *) "fail";
-	return VBR_STAT_OK;
+	if (ret == VBR_STAT_OK)
+	{
+		if (winner != NULL)
+		{
+			*res = (u_char *) "pass";
+			*cert = winner->vq_cert;
+		}
+		else if (dnserror)
+		{
+			ret = VBR_STAT_DNSERROR;
+		}
+		else
+		{
+			/* nobody vouched */
+			*res = (u_char *) "fail";
+		}
+	}
+
+	/* anything still outstanding is no longer needed */
+	for (c = 0; c < nq; c++)
+	{
+		if (vqs[c]->vq_qh != NULL)
+		{
+			vbr->vbr_dns_cancel(vbr->vbr_dns_service,
+			                    vqs[c]->vq_qh);
+		}
+
+		vbr_free(vbr, vbr->vbr_closure, vqs[c]);
+	}
+
+	vbr_free(vbr, vbr->vbr_closure, vqs);
+
+	return ret;
 }
 
 /*
@@ -183,6 +183,7 @@ extern void vbr_trustedcerts __P((VBR *, u_char **));
 **  	- "res" is not modified if no result could be determined
 **  	- "cert" and "domain" are not modified if a "pass" is not returned
 **  	- there's no attempt to validate the values found
+**  	- all certifiers are queried at once, within a single timeout
 */
 
 extern VBR_STAT vbr_query __P((VBR *, u_char **, u_char **));
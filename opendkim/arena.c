@@ -0,0 +1,440 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <pthread.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+/* opendkim includes */
+#include "arena.h"
+
+/* macros */
+#define	ARENA_ALIGN	16
+#define	ARENA_CHUNKSZ	32768
+#define	ARENA_LARGE	(ARENA_CHUNKSZ / 4)
+#define	ARENA_KEEPCHUNKS 4
+#define	ARENA_POOLMAX	4
+
+#define	ARENA_ROUNDUP(x) (((x) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+#define	ARENA_HDRSZ	ARENA_ROUNDUP(sizeof(struct arena_hdr))
+#define	ARENA_CHUNKHDRSZ ARENA_ROUNDUP(sizeof(struct arena_chunk))
+#define	ARENA_LARGEHDRSZ ARENA_ROUNDUP(sizeof(struct arena_large))
+
+/* DATA TYPES */
+struct arena_hdr
+{
+	size_t			ah_size;	/* incl. header; 0 == large */
+};
+
+struct arena_chunk
+{
+	size_t			ac_used;
+	struct arena_chunk *	ac_next;
+};
+
+struct arena_large
+{
+	struct arena_large *	al_prev;
+	struct arena_large *	al_next;
+};
+
+struct dkimf_arena
+{
+	u_long			arena_allocs;
+	u_long			arena_sysallocs;
+	struct arena_chunk *	arena_chunks;	/* in use, newest first */
+	struct arena_chunk *	arena_spare;	/* kept across resets */
+	struct arena_large *	arena_large;
+	struct dkimf_arena *	arena_next;	/* in a thread's pool */
+};
+
+struct arena_pool
+{
+	u_int			pool_count;
+	struct dkimf_arena *	pool_head;
+};
+
+/* globals */
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+static pthread_key_t arena_key;
+
+/*
+**  DKIMF_ARENA_DESTROY -- release an arena and all of its memory
+**
+**  Parameters:
+**  	arena -- arena to destroy
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_arena_destroy(struct dkimf_arena *arena)
+{
+	struct arena_chunk *ac;
+	struct arena_large *al;
+
+	while (arena->arena_large != NULL)
+	{
+		al = arena->arena_large;
+		arena->arena_large = al->al_next;
+		free(al);
+	}
+
+	while (arena->arena_chunks != NULL)
+	{
+		ac = arena->arena_chunks;
+		arena->arena_chunks = ac->ac_next;
+		free(ac);
+	}
+
+	while (arena->arena_spare != NULL)
+	{
+		ac = arena->arena_spare;
+		arena->arena_spare = ac->ac_next;
+		free(ac);
+	}
+
+	free(arena);
+}
+
+/*
+**  DKIMF_ARENA_POOLFREE -- release a thread's arena pool at thread exit
+**
+**  Parameters:
+**  	p -- pool to free
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_arena_poolfree(void *p)
+{
+	struct dkimf_arena *arena;
+	struct arena_pool *pool;
+
+	pool = (struct arena_pool *) p;
+
+	while (pool->pool_head != NULL)
+	{
+		arena = pool->pool_head;
+		pool->pool_head = arena->arena_next;
+		dkimf_arena_destroy(arena);
+	}
+
+	free(pool);
+}
+
+/*
+**  DKIMF_ARENA_INIT -- one-time initialization
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_arena_init(void)
+{
+	(void) pthread_key_create(&arena_key, dkimf_arena_poolfree);
+}
+
+/*
+**  DKIMF_ARENA_GET -- get an empty arena, recycling one freed by this
+**                     thread if possible
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	An arena, or NULL on failure.
+**
+**  Notes:
+**  	An arena is not thread-safe; it is meant to be used by one message
+**  	at a time, whose milter callbacks never run concurrently.
+*/
+
+struct dkimf_arena *
+dkimf_arena_get(void)
+{
+	struct dkimf_arena *arena;
+	struct arena_pool *pool;
+
+	(void) pthread_once(&arena_once, dkimf_arena_init);
+
+	pool = (struct arena_pool *) pthread_getspecific(arena_key);
+	if (pool != NULL && pool->pool_head != NULL)
+	{
+		arena = pool->pool_head;
+		pool->pool_head = arena->arena_next;
+		pool->pool_count--;
+		arena->arena_next = NULL;
+		return arena;
+	}
+
+	arena = (struct dkimf_arena *) malloc(sizeof *arena);
+	if (arena == NULL)
+		return NULL;
+
+	memset(arena, '\0', sizeof *arena);
+
+	return arena;
+}
+
+/*
+**  DKIMF_ARENA_PUT -- release everything allocated from an arena and
+**                     return it to this thread's pool
+**
+**  Parameters:
+**  	arena -- arena to release
+**
+**  Return value:
+**  	None.
+*/
+
+void
+dkimf_arena_put(struct dkimf_arena *arena)
+{
+	u_int nspare;
+	struct arena_chunk *ac;
+	struct arena_large *al;
+	struct arena_pool *pool;
+
+	assert(arena != NULL);
+
+	while (arena->arena_large != NULL)
+	{
+		al = arena->arena_large;
+		arena->arena_large = al->al_next;
+		free(al);
+	}
+
+	/* keep a few chunks for the next message */
+	for (nspare = 0, ac = arena->arena_spare;
+	     ac != NULL;
+	     ac = ac->ac_next)
+		nspare++;
+
+	while (arena->arena_chunks != NULL)
+	{
+		ac = arena->arena_chunks;
+		arena->arena_chunks = ac->ac_next;
+
+		if (nspare < ARENA_KEEPCHUNKS)
+		{
+			ac->ac_used = 0;
+			ac->ac_next = arena->arena_spare;
+			arena->arena_spare = ac;
+			nspare++;
+		}
+		else
+		{
+			free(ac);
+		}
+	}
+
+	(void) pthread_once(&arena_once, dkimf_arena_init);
+
+	pool = (struct arena_pool *) pthread_getspecific(arena_key);
+	if (pool == NULL)
+	{
+		pool = (struct arena_pool *) malloc(sizeof *pool);
+		if (pool != NULL)
+		{
+			memset(pool, '\0', sizeof *pool);
+			if (pthread_setspecific(arena_key, pool) != 0)
+			{
+				free(pool);
+				pool = NULL;
+			}
+		}
+	}
+
+	if (pool == NULL || pool->pool_count >= ARENA_POOLMAX)
+	{
+		dkimf_arena_destroy(arena);
+		return;
+	}
+
+	arena->arena_next = pool->pool_head;
+	pool->pool_head = arena;
+	pool->pool_count++;
+}
+
+/*
+**  DKIMF_ARENA_MALLOC -- allocate memory from an arena
+**
+**  Parameters:
+**  	closure -- arena, or NULL to use malloc()
+**  	nbytes -- bytes wanted
+**
+**  Return value:
+**  	Pointer to the allocated memory, or NULL on failure.
+**
+**  Notes:
+**  	This and dkimf_arena_free() match the caller_mallocf and
+**  	caller_freef arguments of dkim_init(), so the arena given to
+**  	dkim_sign() or dkim_verify() supplies all of that handle's memory.
+**  	The library's own allocations pass a NULL closure.
+*/
+
+void *
+dkimf_arena_malloc(void *closure, size_t nbytes)
+{
+	size_t need;
+	struct dkimf_arena *arena;
+	struct arena_chunk *ac;
+	struct arena_hdr *ah;
+
+	if (closure == NULL)
+		return malloc(nbytes);
+
+	arena = (struct dkimf_arena *) closure;
+	arena->arena_allocs++;
+
+	need = ARENA_HDRSZ + ARENA_ROUNDUP(nbytes);
+
+	/* large requests get their own block, released when freed */
+	if (need > ARENA_LARGE)
+	{
+		struct arena_large *al;
+
+		al = (struct arena_large *) malloc(ARENA_LARGEHDRSZ + need);
+		if (al == NULL)
+			return NULL;
+
+		arena->arena_sysallocs++;
+
+		al->al_prev = NULL;
+		al->al_next = arena->arena_large;
+		if (al->al_next != NULL)
+			al->al_next->al_prev = al;
+		arena->arena_large = al;
+
+		ah = (struct arena_hdr *) ((u_char *) al + ARENA_LARGEHDRSZ);
+		ah->ah_size = 0;
+
+		return (u_char *) ah + ARENA_HDRSZ;
+	}
+
+	ac = arena->arena_chunks;
+	if (ac == NULL || ac->ac_used + need > ARENA_CHUNKSZ - ARENA_CHUNKHDRSZ)
+	{
+		if (arena->arena_spare != NULL)
+		{
+			ac = arena->arena_spare;
+			arena->arena_spare = ac->ac_next;
+		}
+		else
+		{
+			ac = (struct arena_chunk *) malloc(ARENA_CHUNKSZ);
+			if (ac == NULL)
+				return NULL;
+
+			arena->arena_sysallocs++;
+		}
+
+		ac->ac_used = 0;
+		ac->ac_next = arena->arena_chunks;
+		arena->arena_chunks = ac;
+	}
+
+	ah = (struct arena_hdr *) ((u_char *) ac + ARENA_CHUNKHDRSZ +
+	                           ac->ac_used);
+	ah->ah_size = need;
+	ac->ac_used += need;
+
+	return (u_char *) ah + ARENA_HDRSZ;
+}
+
+/*
+**  DKIMF_ARENA_FREE -- return memory to an arena
+**
+**  Parameters:
+**  	closure -- arena, or NULL to use free()
+**  	ptr -- memory to free
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Large blocks are released at once.  Other memory is only reclaimed
+**  	if it was the most recent allocation (e.g. a temporary string),
+**  	otherwise it waits for dkimf_arena_put().
+*/
+
+void
+dkimf_arena_free(void *closure, void *ptr)
+{
+	struct dkimf_arena *arena;
+	struct arena_chunk *ac;
+	struct arena_hdr *ah;
+
+	if (closure == NULL)
+	{
+		free(ptr);
+		return;
+	}
+
+	if (ptr == NULL)
+		return;
+
+	arena = (struct dkimf_arena *) closure;
+	ah = (struct arena_hdr *) ((u_char *) ptr - ARENA_HDRSZ);
+
+	if (ah->ah_size == 0)
+	{
+		struct arena_large *al;
+
+		al = (struct arena_large *) ((u_char *) ah - ARENA_LARGEHDRSZ);
+		if (al->al_prev != NULL)
+			al->al_prev->al_next = al->al_next;
+		else
+			arena->arena_large = al->al_next;
+		if (al->al_next != NULL)
+			al->al_next->al_prev = al->al_prev;
+
+		free(al);
+		return;
+	}
+
+	ac = arena->arena_chunks;
+	if (ac != NULL &&
+	    (u_char *) ah + ah->ah_size ==
+	    (u_char *) ac + ARENA_CHUNKHDRSZ + ac->ac_used)
+		ac->ac_used -= ah->ah_size;
+}
+
+/*
+**  DKIMF_ARENA_STATS -- report allocation counts for an arena
+**
+**  Parameters:
+**  	arena -- arena to query
+**  	allocs -- allocations requested from the arena (returned)
+**  	sysallocs -- allocations the arena made from malloc() (returned)
+**
+**  Return value:
+**  	None.
+*/
+
+void
+dkimf_arena_stats(struct dkimf_arena *arena, u_long *allocs,
+                  u_long *sysallocs)
+{
+	assert(arena != NULL);
+
+	if (allocs != NULL)
+		*allocs = arena->arena_allocs;
+	if (sysallocs != NULL)
+		*sysallocs = arena->arena_sysallocs;
+}
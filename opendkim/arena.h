@@ -0,0 +1,34 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+
+#ifdef __STDC__
+# ifndef __P
+#  define __P(x)  x
+# endif /* ! __P */
+#else /* __STDC__ */
+# ifndef __P
+#  define __P(x)  ()
+# endif /* ! __P */
+#endif /* __STDC__ */
+
+/* data types */
+struct dkimf_arena;
+
+/* prototypes */
+extern struct dkimf_arena *dkimf_arena_get __P((void));
+extern void dkimf_arena_put __P((struct dkimf_arena *));
+extern void *dkimf_arena_malloc __P((void *, size_t));
+extern void dkimf_arena_free __P((void *, void *));
+extern void dkimf_arena_stats __P((struct dkimf_arena *, u_long *,
+                                   u_long *));
+
+#endif /* _ARENA_H_ */
@@ -1,5 +1,5 @@
 /*
-**  Copyright (c) 2011-2013, The Trusted Domain Project.  All rights reserved.
+**  Copyright (c) 2011-2015, The Trusted Domain Project.  All rights reserved.
 */
 
 #include "build-config.h"
@@ -15,6 +15,7 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 
 /* libbsd if found */
 #ifdef USE_BSD_H
@@ -31,6 +32,13 @@
 #include "opendkim.h"
 #include "opendkim-db.h"
 
+/* macros */
+#define	FLOWRATE_BUCKETS	64		/* per shard; power of 2 */
+#define	FLOWRATE_FLUSHINTVL	60		/* seconds between writes */
+#define	FLOWRATE_SHARDS		64		/* power of 2 */
+
+#define	FLOWRATE_BUCKET(h)	(((h) / FLOWRATE_SHARDS) % FLOWRATE_BUCKETS)
+
 /* DATA TYPES */
 struct flowdata
 {
@@ -39,8 +47,265 @@ struct flowdata
 	unsigned int	fd_count;
 };
 
+struct flowentry
+{
+	_Bool			fe_dirty;	/* not yet written out */
+	unsigned int		fe_hash;
+	char *			fe_domain;
+	struct flowdata		fe_data;
+	struct flowentry *	fe_next;
+};
+
+struct flowshard
+{
+	time_t			fs_flushed;
+	pthread_mutex_t		fs_lock;
+	struct flowentry *	fs_buckets[FLOWRATE_BUCKETS];
+};
+
 /* GLOBALS */
-pthread_mutex_t ratelock;
+static pthread_once_t flowrate_once = PTHREAD_ONCE_INIT;
+static struct flowshard flowshards[FLOWRATE_SHARDS];
+
+/*
+**  DKIMF_RATE_INIT -- one-time initialization
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_rate_init(void)
+{
+	int c;
+	time_t now;
+
+	(void) time(&now);
+
+	for (c = 0; c < FLOWRATE_SHARDS; c++)
+	{
+		memset(&flowshards[c], '\0', sizeof flowshards[c]);
+		pthread_mutex_init(&flowshards[c].fs_lock, NULL);
+		flowshards[c].fs_flushed = now;
+	}
+}
+
+/*
+**  DKIMF_RATE_HASH -- hash a domain name, ignoring case
+**
+**  Parameters:
+**  	domain -- domain name
+**
+**  Return value:
+**  	Hash value.
+*/
+
+static unsigned int
+dkimf_rate_hash(const char *domain)
+{
+	unsigned int h = 5381;
+	const u_char *p;
+
+	for (p = (const u_char *) domain; *p != '\0'; p++)
+		h = (h << 5) + h + tolower(*p);
+
+	return h;
+}
+
+/*
+**  DKIMF_RATE_FIND -- find a domain's flow data in memory
+**
+**  Parameters:
+**  	fs -- shard to search, which must be locked
+**  	hash -- hash of "domain"
+**  	domain -- domain name
+**
+**  Return value:
+**  	The entry for "domain", or NULL if there is none.
+*/
+
+static struct flowentry *
+dkimf_rate_find(struct flowshard *fs, unsigned int hash, const char *domain)
+{
+	struct flowentry *fe;
+
+	for (fe = fs->fs_buckets[FLOWRATE_BUCKET(hash)];
+	     fe != NULL;
+	     fe = fe->fe_next)
+	{
+		if (fe->fe_hash == hash &&
+		    strcasecmp(fe->fe_domain, domain) == 0)
+			return fe;
+	}
+
+	return NULL;
+}
+
+/*
+**  DKIMF_RATE_LOAD -- start tracking a domain
+**
+**  Parameters:
+**  	domain -- domain name being queried
+**  	ratedb -- data set containing per-domain rate limits
+**  	flowdb -- data set containing per-domain flow data (or NULL)
+**  	factor -- divisor
+**  	ttl -- TTL to apply (i.e. data expiration)
+**  	now -- current time
+**  	f -- flow data (returned)
+**
+**  Return value:
+**  	-1 -- error
+**  	0 -- the domain has no limit
+**  	1 -- success
+**
+**  Notes:
+**  	Unexpired flow data in "flowdb", e.g. from before a restart, is
+**  	used in preference to starting a new period.
+*/
+
+static int
+dkimf_rate_load(const char *domain, DKIMF_DB ratedb, DKIMF_DB flowdb,
+                int factor, int ttl, time_t now, struct flowdata *f)
+{
+	_Bool found = FALSE;
+	int status;
+	char *p;
+	struct dkimf_db_data dbd;
+	char limbuf[BUFRSZ];
+
+	if (flowdb != NULL)
+	{
+		memset(f, '\0', sizeof *f);
+
+		dbd.dbdata_buffer = (void *) f;
+		dbd.dbdata_buflen = sizeof *f;
+		dbd.dbdata_flags = DKIMF_DB_DATA_BINARY;
+		status = dkimf_db_get(flowdb, (void *) domain, 0, &dbd, 1,
+		                      &found);
+		if (status != 0)
+			return -1;
+
+		if (found && f->fd_since + ttl > now)
+			return 1;
+	}
+
+	memset(limbuf, '\0', sizeof limbuf);
+
+	dbd.dbdata_buffer = limbuf;
+	dbd.dbdata_buflen = sizeof limbuf - 1;
+	dbd.dbdata_flags = 0;
+	status = dkimf_db_get(ratedb, (void *) domain, 0, &dbd, 1, &found);
+	if (status != 0)
+		return -1;
+	else if (!found)
+		return 0;
+
+	f->fd_count = 0;
+	f->fd_limit = (unsigned int) strtoul(limbuf, &p, 10) / factor;
+	f->fd_since = now;
+	if (*p != '\0')
+		return -1;
+
+	return 1;
+}
+
+/*
+**  DKIMF_RATE_COLLECT -- take a shard's changed flow data for writing, and
+**                        discard what has expired
+**
+**  Parameters:
+**  	fs -- shard, which must be locked
+**  	ttl -- TTL to apply, or -1 to keep everything
+**  	now -- current time
+**
+**  Return value:
+**  	List of copies of the changed entries; NULL if there are none or
+**  	memory ran out.
+*/
+
+static struct flowentry *
+dkimf_rate_collect(struct flowshard *fs, int ttl, time_t now)
+{
+	int c;
+	size_t len;
+	struct flowentry *fe;
+	struct flowentry *copy;
+	struct flowentry *out = NULL;
+	struct flowentry **prev;
+
+	for (c = 0; c < FLOWRATE_BUCKETS; c++)
+	{
+		prev = &fs->fs_buckets[c];
+
+		while ((fe = *prev) != NULL)
+		{
+			if (fe->fe_dirty)
+			{
+				len = strlen(fe->fe_domain);
+				copy = (struct flowentry *) malloc(sizeof *copy +
+				                                   len + 1);
+				if (copy != NULL)
+				{
+					memcpy(copy, fe, sizeof *copy);
+					copy->fe_domain = (char *) (copy + 1);
+					memcpy(copy->fe_domain, fe->fe_domain,
+					       len + 1);
+					copy->fe_next = out;
+					out = copy;
+					fe->fe_dirty = FALSE;
+				}
+			}
+
+			if (ttl >= 0 && !fe->fe_dirty &&
+			    fe->fe_data.fd_since + ttl <= now)
+			{
+				*prev = fe->fe_next;
+				free(fe);
+				continue;
+			}
+
+			prev = &fe->fe_next;
+		}
+	}
+
+	return out;
+}
+
+/*
+**  DKIMF_RATE_WRITE -- write collected flow data out
+**
+**  Parameters:
+**  	flowdb -- data set containing per-domain flow data (updated)
+**  	list -- entries from dkimf_rate_collect() (freed)
+**
+**  Return value:
+**  	0 on success, -1 if any writes failed.
+*/
+
+static int
+dkimf_rate_write(DKIMF_DB flowdb, struct flowentry *list)
+{
+	int ret = 0;
+	struct flowentry *next;
+
+	while (list != NULL)
+	{
+		next = list->fe_next;
+
+		if (dkimf_db_put(flowdb, list->fe_domain,
+		                 strlen(list->fe_domain), &list->fe_data,
+		                 sizeof list->fe_data) != 0)
+			ret = -1;
+
+		free(list);
+		list = next;
+	}
+
+	return ret;
+}
 
 /*
 **  DKIMF_RATE_CHECK -- conduct a rate limit check, expire data, increment
@@ -57,18 +322,26 @@ pthread_mutex_t ratelock;
 **  	-1 -- error
 **  	0 -- success
 **  	1 -- success, and the domain is at or past its limit
+**
+**  Notes:
+**  	Counts are kept in memory, in shards that are locked separately,
+**  	so checks for different domains rarely wait for each other and
+**  	don't touch "flowdb" at all.  Each shard's changes are written
+**  	to "flowdb" at most every FLOWRATE_FLUSHINTVL seconds, by whichever
+**  	check finds them due, and by dkimf_rate_flush().
 */
 
 int
 dkimf_rate_check(const char *domain, DKIMF_DB ratedb, DKIMF_DB flowdb,
                  int factor, int ttl, unsigned int *limit)
 {
-	_Bool found = FALSE;
 	int status;
+	unsigned int hash;
 	time_t now;
-	struct dkimf_db_data dbd;
+	struct flowentry *fe;
+	struct flowentry *flush = NULL;
+	struct flowshard *fs;
 	struct flowdata f;
-	char limbuf[BUFRSZ];
 
 	assert(ratedb != NULL);
 	assert(flowdb != NULL);
@@ -76,67 +349,73 @@ dkimf_rate_check(const char *domain, DKIMF_DB ratedb, DKIMF_DB flowdb,
 	if (domain == NULL)
 		domain = ".";
 
-	memset(&f, '\0', sizeof f);
+	(void) pthread_once(&flowrate_once, dkimf_rate_init);
 
-	pthread_mutex_lock(&ratelock);
-
-	/* get the current flow data, if any */
-	dbd.dbdata_buffer = (void *) &f;
-	dbd.dbdata_buflen = sizeof f;
-	dbd.dbdata_flags = DKIMF_DB_DATA_BINARY;
-	status = dkimf_db_get(flowdb, (void *) domain, 0, &dbd, 1, &found);
-	if (status != 0)
-	{
-		pthread_mutex_unlock(&ratelock);
-		return -1;
-	}
+	hash = dkimf_rate_hash(domain);
+	fs = &flowshards[hash % FLOWRATE_SHARDS];
 
 	(void) time(&now);
 
+	pthread_mutex_lock(&fs->fs_lock);
+
+	fe = dkimf_rate_find(fs, hash, domain);
+
 	/* if none or if it expired, retrieve the limit */
-	if (!found || f.fd_since + ttl <= now)
+	if (fe == NULL || fe->fe_data.fd_since + ttl <= now)
 	{
-		char *p;
+		pthread_mutex_unlock(&fs->fs_lock);
 
-		dbd.dbdata_buffer = limbuf;
-		dbd.dbdata_buflen = sizeof limbuf;
-		dbd.dbdata_flags = 0;
-		status = dkimf_db_get(ratedb, (void *) domain, 0, &dbd, 1,
-		                      &found);
-		if (status != 0)
-		{
-			pthread_mutex_unlock(&ratelock);
-			return -1;
-		}
-		else if (!found)
+		status = dkimf_rate_load(domain, ratedb,
+		                         fe == NULL ? flowdb : NULL,
+		                         factor, ttl, now, &f);
+		if (status != 1)
+			return status;
+
+		pthread_mutex_lock(&fs->fs_lock);
+
+		/* another thread may have got here first */
+		fe = dkimf_rate_find(fs, hash, domain);
+		if (fe == NULL)
 		{
-			pthread_mutex_unlock(&ratelock);
-			return 0;
-		}
+			size_t len;
+
+			len = strlen(domain);
+			fe = (struct flowentry *) malloc(sizeof *fe + len + 1);
+			if (fe == NULL)
+			{
+				pthread_mutex_unlock(&fs->fs_lock);
+				return -1;
+			}
 
-		f.fd_count = 0;
-		f.fd_limit = (unsigned int) strtoul(limbuf, &p, 10) / factor;
-		(void) time(&f.fd_since);
-		if (*p != '\0')
+			fe->fe_hash = hash;
+			fe->fe_domain = (char *) (fe + 1);
+			memcpy(fe->fe_domain, domain, len + 1);
+			fe->fe_data = f;
+			fe->fe_next = fs->fs_buckets[FLOWRATE_BUCKET(hash)];
+			fs->fs_buckets[FLOWRATE_BUCKET(hash)] = fe;
+		}
+		else if (fe->fe_data.fd_since + ttl <= now)
 		{
-			pthread_mutex_unlock(&ratelock);
-			return -1;
+			fe->fe_data = f;
 		}
 	}
 
 	/* increment the count */
-	f.fd_count++;
+	fe->fe_data.fd_count++;
+	fe->fe_dirty = TRUE;
+	f = fe->fe_data;
 
-	/* write it back out */
-	status = dkimf_db_put(flowdb, (void *) domain, strlen(domain),
-	                      &f, sizeof f);
-	if (status != 0)
+	if (fs->fs_flushed + FLOWRATE_FLUSHINTVL <= now)
 	{
-		pthread_mutex_unlock(&ratelock);
-		return -1;
+		fs->fs_flushed = now;
+		flush = dkimf_rate_collect(fs, ttl, now);
 	}
 
-	pthread_mutex_unlock(&ratelock);
+	pthread_mutex_unlock(&fs->fs_lock);
+
+	/* write changes out, if it's time */
+	if (flush != NULL && dkimf_rate_write(flowdb, flush) != 0)
+		return -1;
 
 	/* copy the limit out */
 	if (limit != NULL)
@@ -145,4 +424,45 @@ dkimf_rate_check(const char *domain, DKIMF_DB ratedb, DKIMF_DB flowdb,
 	return (f.fd_count >= f.fd_limit ? 1 : 0);
 }
 
+/*
+**  DKIMF_RATE_FLUSH -- write all changed flow data out
+**
+**  Parameters:
+**  	flowdb -- data set containing per-domain flow data (updated)
+**
+**  Return value:
+**  	0 on success, -1 if any writes failed.
+**
+**  Notes:
+**  	Called when a configuration is released, so counts survive a
+**  	restart.  They stay in memory for use by later configurations.
+*/
+
+int
+dkimf_rate_flush(DKIMF_DB flowdb)
+{
+	int c;
+	int ret = 0;
+	struct flowentry *flush;
+	struct flowshard *fs;
+
+	assert(flowdb != NULL);
+
+	(void) pthread_once(&flowrate_once, dkimf_rate_init);
+
+	for (c = 0; c < FLOWRATE_SHARDS; c++)
+	{
+		fs = &flowshards[c];
+
+		pthread_mutex_lock(&fs->fs_lock);
+		flush = dkimf_rate_collect(fs, -1, 0);
+		pthread_mutex_unlock(&fs->fs_lock);
+
+		if (flush != NULL && dkimf_rate_write(flowdb, flush) != 0)
+			ret = -1;
+	}
+
+	return ret;
+}
+
 #endif /* _FFR_RATE_LIMIT */
@@ -27,5 +27,6 @@
 /* prototypes */
 extern int dkimf_rate_check __P((const char *, DKIMF_DB, DKIMF_DB, int, int,
                                  unsigned int *));
+extern int dkimf_rate_flush __P((DKIMF_DB));
 
 #endif /* _FLOWRATE_H_ */
@@ -0,0 +1,366 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* libopendkim includes */
+#include <dkim.h>
+
+/* opendkim includes */
+#include "keycache.h"
+#include "opendkim.h"
+
+/* macros */
+#define	KEYCACHE_BUCKETS	1021
+#define	KEYCACHE_RECHECK	60		/* key file check interval */
+
+/* DATA TYPES */
+struct keycache_entry
+{
+	_Bool			kce_file;
+	dev_t			kce_dev;
+	ino_t			kce_ino;
+	off_t			kce_size;
+	time_t			kce_mtime;
+	time_t			kce_ctime;
+	time_t			kce_loaded;
+	char *			kce_name;
+	char *			kce_data;
+	DKIM_PRIVKEY *		kce_key;
+	struct keycache_entry *	kce_next;
+};
+
+struct dkimf_keycache
+{
+	u_long			kc_hits;
+	u_long			kc_misses;
+	pthread_mutex_t		kc_lock;
+	struct keycache_entry *	kc_buckets[KEYCACHE_BUCKETS];
+};
+
+/*
+**  DKIMF_KEYCACHE_HASH -- hash a cache entry name
+**
+**  Parameters:
+**  	name -- entry name
+**
+**  Return value:
+**  	Bucket number.
+*/
+
+static u_int
+dkimf_keycache_hash(const char *name)
+{
+	u_int h = 5381;
+	const u_char *p;
+
+	for (p = (const u_char *) name; *p != '\0'; p++)
+		h = ((h << 5) + h) + *p;
+
+	return h % KEYCACHE_BUCKETS;
+}
+
+/*
+**  DKIMF_KEYCACHE_MATCH -- see if an entry still describes a key file
+**
+**  Parameters:
+**  	kce -- cache entry
+**  	sb -- current stat() results for the key file, or NULL if the key
+**  	      was provided inline
+**  	data -- the inline key data (ignored if "sb" is not NULL)
+**  	now -- current time
+**
+**  Return value:
+**  	TRUE iff the cached key can still be used.
+**
+**  Notes:
+**  	ctime is compared so that a change of ownership or permissions,
+**  	which could make the file insecure, forces the full load path
+**  	(and its security checks) to run again.  Those checks also cover
+**  	the directories above the file, so they are repeated every
+**  	KEYCACHE_RECHECK seconds even if the file is unchanged.
+*/
+
+static _Bool
+dkimf_keycache_match(struct keycache_entry *kce, struct stat *sb,
+                     const char *data, time_t now)
+{
+	if (sb == NULL)
+		return (!kce->kce_file && strcmp(kce->kce_data, data) == 0);
+
+	return (kce->kce_file &&
+	        kce->kce_dev == sb->st_dev &&
+	        kce->kce_ino == sb->st_ino &&
+	        kce->kce_size == sb->st_size &&
+	        kce->kce_mtime == sb->st_mtime &&
+	        kce->kce_ctime == sb->st_ctime &&
+	        now < kce->kce_loaded + KEYCACHE_RECHECK);
+}
+
+/*
+**  DKIMF_KEYCACHE_NEW -- create a parsed private key cache
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	A new cache handle, or NULL on failure.
+*/
+
+struct dkimf_keycache *
+dkimf_keycache_new(void)
+{
+	struct dkimf_keycache *new;
+
+	new = (struct dkimf_keycache *) malloc(sizeof *new);
+	if (new == NULL)
+		return NULL;
+
+	memset(new, '\0', sizeof *new);
+	pthread_mutex_init(&new->kc_lock, NULL);
+
+	return new;
+}
+
+/*
+**  DKIMF_KEYCACHE_FREE -- destroy a parsed private key cache
+**
+**  Parameters:
+**  	kc -- cache handle
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Keys still referenced by signing handles survive until those
+**  	handles are released.
+*/
+
+void
+dkimf_keycache_free(struct dkimf_keycache *kc)
+{
+	int c;
+	struct keycache_entry *kce;
+	struct keycache_entry *next;
+
+	assert(kc != NULL);
+
+	for (c = 0; c < KEYCACHE_BUCKETS; c++)
+	{
+		for (kce = kc->kc_buckets[c]; kce != NULL; kce = next)
+		{
+			next = kce->kce_next;
+			dkim_privkey_free(kce->kce_key);
+			if (kce->kce_data != NULL)
+				free(kce->kce_data);
+			free(kce->kce_name);
+			free(kce);
+		}
+	}
+
+	pthread_mutex_destroy(&kc->kc_lock);
+
+	free(kc);
+}
+
+/*
+**  DKIMF_KEYCACHE_GET -- retrieve a parsed private key
+**
+**  Parameters:
+**  	kc -- cache handle
+**  	name -- entry name
+**  	sb -- current stat() results for the key file, or NULL if the key
+**  	      was provided inline
+**  	data -- the inline key data, if "sb" is NULL
+**
+**  Return value:
+**  	A referenced DKIM_PRIVKEY handle, which the caller must release
+**  	with dkim_privkey_free(), or NULL if there is no usable entry.
+*/
+
+DKIM_PRIVKEY *
+dkimf_keycache_get(struct dkimf_keycache *kc, const char *name,
+                   struct stat *sb, const char *data)
+{
+	time_t now;
+	DKIM_PRIVKEY *key = NULL;
+	struct keycache_entry *kce;
+
+	assert(kc != NULL);
+	assert(name != NULL);
+	assert(sb != NULL || data != NULL);
+
+	(void) time(&now);
+
+	pthread_mutex_lock(&kc->kc_lock);
+
+	for (kce = kc->kc_buckets[dkimf_keycache_hash(name)];
+	     kce != NULL;
+	     kce = kce->kce_next)
+	{
+		if (strcmp(kce->kce_name, name) == 0)
+		{
+			if (dkimf_keycache_match(kce, sb, data, now))
+			{
+				key = kce->kce_key;
+				dkim_privkey_ref(key);
+			}
+
+			break;
+		}
+	}
+
+	if (key != NULL)
+		kc->kc_hits++;
+	else
+		kc->kc_misses++;
+
+	pthread_mutex_unlock(&kc->kc_lock);
+
+	return key;
+}
+
+/*
+**  DKIMF_KEYCACHE_PUT -- store a parsed private key
+**
+**  Parameters:
+**  	kc -- cache handle
+**  	name -- entry name
+**  	sb -- stat() results for the key file when it was read, or NULL if
+**  	      the key was provided inline
+**  	data -- the inline key data, if "sb" is NULL
+**  	key -- parsed key; the cache takes its own reference
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Any existing entry of the same name is replaced, so there is at
+**  	most one entry per name; inline keys should be named by their
+**  	KeyTable entry so that a rotated key replaces the old one.
+**  	Failure to allocate an entry is not an error; the key just isn't
+**  	cached.
+*/
+
+void
+dkimf_keycache_put(struct dkimf_keycache *kc, const char *name,
+                   struct stat *sb, const char *data, DKIM_PRIVKEY *key)
+{
+	u_int bucket;
+	char *copy = NULL;
+	struct keycache_entry *kce;
+
+	assert(kc != NULL);
+	assert(name != NULL);
+	assert(sb != NULL || data != NULL);
+	assert(key != NULL);
+
+	if (sb == NULL)
+	{
+		copy = strdup(data);
+		if (copy == NULL)
+			return;
+	}
+
+	bucket = dkimf_keycache_hash(name);
+
+	pthread_mutex_lock(&kc->kc_lock);
+
+	for (kce = kc->kc_buckets[bucket]; kce != NULL; kce = kce->kce_next)
+	{
+		if (strcmp(kce->kce_name, name) == 0)
+			break;
+	}
+
+	if (kce == NULL)
+	{
+		kce = (struct keycache_entry *) malloc(sizeof *kce);
+		if (kce == NULL)
+		{
+			pthread_mutex_unlock(&kc->kc_lock);
+			if (copy != NULL)
+				free(copy);
+			return;
+		}
+
+		kce->kce_name = strdup(name);
+		if (kce->kce_name == NULL)
+		{
+			free(kce);
+			pthread_mutex_unlock(&kc->kc_lock);
+			if (copy != NULL)
+				free(copy);
+			return;
+		}
+
+		kce->kce_data = NULL;
+
+		kce->kce_next = kc->kc_buckets[bucket];
+		kc->kc_buckets[bucket] = kce;
+	}
+	else
+	{
+		dkim_privkey_free(kce->kce_key);
+		if (kce->kce_data != NULL)
+			free(kce->kce_data);
+	}
+
+	dkim_privkey_ref(key);
+	kce->kce_key = key;
+	kce->kce_data = copy;
+
+	if (sb != NULL)
+	{
+		kce->kce_file = TRUE;
+		kce->kce_dev = sb->st_dev;
+		kce->kce_ino = sb->st_ino;
+		kce->kce_size = sb->st_size;
+		kce->kce_mtime = sb->st_mtime;
+		kce->kce_ctime = sb->st_ctime;
+		(void) time(&kce->kce_loaded);
+	}
+	else
+	{
+		kce->kce_file = FALSE;
+	}
+
+	pthread_mutex_unlock(&kc->kc_lock);
+}
+
+/*
+**  DKIMF_KEYCACHE_STATS -- report parsed private key cache statistics
+**
+**  Parameters:
+**  	kc -- cache handle
+**  	hits -- number of lookups that found a usable key (returned)
+**  	misses -- number of lookups that didn't (returned)
+**
+**  Return value:
+**  	None.
+*/
+
+void
+dkimf_keycache_stats(struct dkimf_keycache *kc, u_long *hits, u_long *misses)
+{
+	assert(kc != NULL);
+
+	pthread_mutex_lock(&kc->kc_lock);
+
+	if (hits != NULL)
+		*hits = kc->kc_hits;
+	if (misses != NULL)
+		*misses = kc->kc_misses;
+
+	pthread_mutex_unlock(&kc->kc_lock);
+}
@@ -0,0 +1,43 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#ifndef _KEYCACHE_H_
+#define _KEYCACHE_H_
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* libopendkim includes */
+#include <dkim.h>
+
+#ifdef __STDC__
+# ifndef __P
+#  define __P(x)  x
+# endif /* ! __P */
+#else /* __STDC__ */
+# ifndef __P
+#  define __P(x)  ()
+# endif /* ! __P */
+#endif /* __STDC__ */
+
+/* data types */
+struct dkimf_keycache;
+
+/* prototypes */
+extern struct dkimf_keycache *dkimf_keycache_new __P((void));
+extern void dkimf_keycache_free __P((struct dkimf_keycache *));
+extern DKIM_PRIVKEY *dkimf_keycache_get __P((struct dkimf_keycache *,
+                                             const char *, struct stat *,
+                                             const char *));
+extern void dkimf_keycache_put __P((struct dkimf_keycache *, const char *,
+                                    struct stat *, const char *,
+                                    DKIM_PRIVKEY *));
+extern void dkimf_keycache_stats __P((struct dkimf_keycache *,
+                                      u_long *, u_long *));
+
+#endif /* _KEYCACHE_H_ */
@@ -132,6 +132,7 @@ struct configdef dkimf_config[] =
 #ifdef POPAUTH
 	{ "POPDBFile",			CONFIG_TYPE_STRING,	FALSE },
 #endif /* POPAUTH */
+	{ "PrefetchKeys",		CONFIG_TYPE_BOOLEAN,	FALSE },
 	{ "Quarantine",			CONFIG_TYPE_BOOLEAN,	FALSE },
 #ifdef QUERY_CACHE
 	{ "QueryCache",			CONFIG_TYPE_BOOLEAN,	FALSE },
@@ -14,6 +14,7 @@
 
 /* system includes */
 #include <sys/types.h>
+#include <sys/time.h>
 #include <sys/uio.h>
 #include <sys/stat.h>
 #include <sys/file.h>
@@ -107,14 +108,27 @@
 # define DEFPOOLMAX		10
 #endif /* _FFR_DB_HANDLE_POOLS */
 #define DKIMF_DB_DEFASIZE	8
+#define	DKIMF_DB_CACHE_DEFTTL	300
+#define	DKIMF_DB_CACHE_DEFNEGTTL 60
+#define	DKIMF_DB_CACHE_DEFSIZE	(1024 * 1024)
+#define	DKIMF_DB_CACHE_MINBUCKETS 64
+#define	DKIMF_DB_CACHE_MAXBUCKETS 65536
 #define DKIMF_DB_MODE		0644
 #define DKIMF_LDAP_MAXURIS	8
 #define DKIMF_LDAP_DEFTIMEOUT	5
 #ifdef _FFR_LDAP_CACHING
 # define DKIMF_LDAP_TTL		600
 #endif /* _FFR_LDAP_CACHING */
+#ifdef USE_ERLANG
+# define DKIMF_ERLANG_MAXIDLE	30
+# define DKIMF_ERLANG_MAXPOOL	10
+#endif /* USE_ERLANG */
 #ifdef _FFR_SOCKETDB
 # define DKIMF_SOCKET_TIMEOUT	5
+# define DKIMF_SOCKET_MAXCONNS	64
+# define DKIMF_SOCKET_MINBACKOFF 1
+# define DKIMF_SOCKET_MAXBACKOFF 60
+# define DKIMF_SOCKET_MAXIOV	3
 #endif /* _FFR_SOCKETDB */
 
 #define	DKIMF_DB_IFLAG_FREEARRAY 0x01
@@ -166,6 +180,9 @@
 # define MIN(x,y)       ((x) < (y) ? (x) : (y))
 #endif /* ! MIN */
 
+#define	DKIMF_DB_INDEXMIN	16		/* minimum index slots */
+#define	DKIMF_DB_CHECKINT	1		/* table file check interval */
+
 /* data types */
 struct dkimf_db
 {
@@ -180,6 +197,46 @@ struct dkimf_db
 	void *			db_cursor;	/* cursor */
 	void *			db_entry;	/* entry (context) */
 	char **			db_array;
+	struct dkimf_db_index *	db_index;	/* FILE/CSL key index */
+	struct dkimf_db_retrie * db_retrie;	/* REFILE suffix trie */
+	struct dkimf_db_cache *	db_cache;	/* result cache */
+};
+
+struct dkimf_db_cachefld
+{
+	u_int			cf_flags;
+	size_t			cf_len;		/* (size_t) -1 == no data */
+	char *			cf_data;
+};
+
+struct dkimf_db_cacheent
+{
+	_Bool			ce_pending;	/* lookup in progress */
+	_Bool			ce_exists;
+	u_int			ce_hash;
+	u_int			ce_reqnum;
+	time_t			ce_expire;
+	size_t			ce_size;	/* bytes allocated */
+	size_t			ce_keylen;
+	char *			ce_key;
+	struct dkimf_db_cachefld * ce_fields;
+	struct dkimf_db_cacheent * ce_hnext;	/* hash chain */
+	struct dkimf_db_cacheent * ce_prev;	/* LRU order */
+	struct dkimf_db_cacheent * ce_next;
+};
+
+struct dkimf_db_cache
+{
+	u_int			cache_mask;
+	u_int			cache_ttl;
+	u_int			cache_negttl;
+	size_t			cache_maxbytes;
+	pthread_mutex_t		cache_lock;
+	pthread_cond_t		cache_cond;
+	struct dkimf_db_cacheent ** cache_buckets;
+	struct dkimf_db_cacheent * cache_head;	/* most recently used */
+	struct dkimf_db_cacheent * cache_tail;
+	struct dkimf_db_cachestats cache_stats;
 };
 
 struct dkimf_db_table
@@ -193,14 +250,58 @@ struct dkimf_db_list
 	char *			db_list_key;
 	char *			db_list_value;
 	struct dkimf_db_list *	db_list_next;
+	struct dkimf_db_list *	db_list_samekey; /* next with same key */
+};
+
+struct dkimf_db_index
+{
+	u_int			db_index_mask;
+	struct dkimf_db_list **	db_index_slots;
 };
 
 struct dkimf_db_relist
 {
 	regex_t			db_relist_re;
+	u_int			db_relist_seq;	/* position in table */
+	char *			db_relist_glob;	/* pattern, if a plain glob */
 	char *			db_relist_data;
 	struct dkimf_db_relist * db_relist_next;
+	struct dkimf_db_relist * db_relist_samesfx; /* next in trie node */
+};
+
+struct dkimf_db_retrie
+{
+	u_char			db_retrie_char;
+	struct dkimf_db_relist * db_retrie_head;
+	struct dkimf_db_relist * db_retrie_tail;
+	struct dkimf_db_retrie * db_retrie_child;
+	struct dkimf_db_retrie * db_retrie_sibling;
+};
+
+#ifdef USE_DB
+# if DB_VERSION_CHECK(4,1,25)
+#  define DKIMF_DB_BDB_MR
+struct dkimf_db_bdbhandle
+{
+	DB_ENV *		bdbh_env;
+	DB *			bdbh_db;
+	struct dkimf_db_bdbhandle * bdbh_next;
+};
+
+struct dkimf_db_bdb
+{
+	time_t			bdb_checked;	/* last file check */
+	dev_t			bdb_dev;	/* file identity... */
+	ino_t			bdb_ino;
+	off_t			bdb_size;
+	time_t			bdb_mtime;	/* ...at last (re)open */
+	char *			bdb_path;
+	struct dkimf_db_bdbhandle * bdb_current;
+	struct dkimf_db_bdbhandle * bdb_retired;
+	pthread_rwlock_t	bdb_lock;
 };
+# endif /* DB_VERSION_CHECK(4,1,25) */
+#endif /* USE_DB */
 
 #ifdef USE_ODBX
 struct dkimf_db_dsn
@@ -262,29 +363,81 @@ struct dkimf_db_lua
 #endif /* USE_LUA */
 
 #ifdef _FFR_SOCKETDB
+struct dkimf_db_sockwait
+{
+	u_long			sw_id;
+	int			sw_status;	/* 0 pending, 1 done, -1 error */
+	int			sw_errno;
+	struct dkimf_dstring *	sw_reply;
+	struct dkimf_db_sockwait * sw_next;
+};
+
+struct dkimf_db_sockconn
+{
+	int			sc_fd;		/* -1 == not connected */
+	_Bool			sc_busy;
+	_Bool			sc_reading;
+	_Bool			sc_writing;
+	_Bool			sc_closing;	/* shut down, not yet closed */
+	u_int			sc_inflight;
+	struct dkimf_dstring *	sc_buf;
+	struct dkimf_db_sockwait * sc_waiters;
+};
+
 struct dkimf_db_socket
 {
-	int			sockdb_fd;
-	struct dkimf_dstring *	sockdb_buf;
+	_Bool			sockdb_pipeline;
+	_Bool			sockdb_emptynf;
+	u_int			sockdb_nconns;
+	u_long			sockdb_nextid;
+	time_t			sockdb_retry;
+	time_t			sockdb_backoff;
+	socklen_t		sockdb_addrlen;
+	struct sockaddr_storage	sockdb_addr;
+	pthread_mutex_t		sockdb_lock;
+	pthread_cond_t		sockdb_cond;
+	struct dkimf_db_sockconn * sockdb_conns;
 };
 #endif /* _FFR_SOCKETDB */
 
 #ifdef USE_MDB
+struct dkimf_db_mdbreader
+{
+	MDB_txn *		mdbr_txn;
+	struct dkimf_db_mdbreader * mdbr_next;
+};
+
 struct dkimf_db_mdb
 {
 	MDB_env *		mdb_env;
 	MDB_txn *		mdb_txn;
 	MDB_dbi			mdb_dbi;
+	pthread_mutex_t		mdb_lock;	/* reader pool lock */
+	struct dkimf_db_mdbreader * mdb_readers; /* idle read transactions */
 };
 #endif /* USE_MDB */
 
 #ifdef USE_ERLANG
+struct dkimf_db_erlconn
+{
+	int			erlc_fd;
+	u_int			erlc_slot;	/* node name number */
+	time_t			erlc_idle;	/* when last returned */
+	ei_cnode		erlc_node;
+	struct dkimf_db_erlconn * erlc_next;
+};
+
 struct dkimf_db_erlang
 {
 	char *			erlang_nodes;
 	char *			erlang_module;
 	char *			erlang_function;
 	char *			erlang_cookie;
+	u_int			erlang_nslots;
+	u_int			erlang_nidle;
+	pthread_mutex_t		erlang_lock;
+	struct dkimf_db_erlconn * erlang_idle;	/* idle connections */
+	struct dkimf_db_erlconn * erlang_spare;	/* closed; names to reuse */
 };
 #endif /* USE_ERLANG */
 
@@ -1003,6 +1156,222 @@ dkimf_db_list_free(struct dkimf_db_list *list)
 	}
 }
 		
+/*
+**  DKIMF_DB_INDEX_HASH -- hash a key for a FILE/CSL index
+**
+**  Parameters:
+**  	key -- key to hash
+**  	icase -- fold case
+**
+**  Return value:
+**  	Hash value.
+*/
+
+static u_int
+dkimf_db_index_hash(const char *key, _Bool icase)
+{
+	u_int h = 5381;
+	const u_char *p;
+
+	if (icase)
+	{
+		for (p = (const u_char *) key; *p != '\0'; p++)
+			h = ((h << 5) + h) + tolower(*p);
+	}
+	else
+	{
+		for (p = (const u_char *) key; *p != '\0'; p++)
+			h = ((h << 5) + h) + *p;
+	}
+
+	return h;
+}
+
+/*
+**  DKIMF_DB_INDEX_FREE -- destroy a FILE/CSL index
+**
+**  Parameters:
+**  	index -- index handle
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	The list entries referenced by the index are not freed.
+*/
+
+static void
+dkimf_db_index_free(struct dkimf_db_index *index)
+{
+	assert(index != NULL);
+
+	free(index->db_index_slots);
+	free(index);
+}
+
+/*
+**  DKIMF_DB_INDEX_NEW -- build a hash index over a FILE/CSL list
+**
+**  Parameters:
+**  	list -- list handle
+**  	nrecs -- number of entries in "list"
+**  	icase -- keys are case-insensitive
+**
+**  Return value:
+**  	A new index handle, or NULL on failure.
+**
+**  Notes:
+**  	The index uses open addressing with linear probing, and is never
+**  	more than half full.  Each slot references the first entry in
+**  	the list having a given key; later entries with the same key
+**  	(e.g. from a VALLIST table) are chained from it in list order
+**  	so that lookups see them in the same order as a list scan would.
+*/
+
+static struct dkimf_db_index *
+dkimf_db_index_new(struct dkimf_db_list *list, int nrecs, _Bool icase)
+{
+	u_int size;
+	u_int slot;
+	struct dkimf_db_list *cur;
+	struct dkimf_db_list *last;
+	struct dkimf_db_index *new;
+
+	assert(list != NULL);
+
+	for (size = DKIMF_DB_INDEXMIN; size < (u_int) nrecs * 2; size <<= 1)
+		continue;
+
+	new = (struct dkimf_db_index *) malloc(sizeof *new);
+	if (new == NULL)
+		return NULL;
+
+	new->db_index_slots = (struct dkimf_db_list **) calloc(size,
+	                                                        sizeof(struct dkimf_db_list *));
+	if (new->db_index_slots == NULL)
+	{
+		free(new);
+		return NULL;
+	}
+
+	new->db_index_mask = size - 1;
+
+	for (cur = list; cur != NULL; cur = cur->db_list_next)
+	{
+		cur->db_list_samekey = NULL;
+
+		slot = dkimf_db_index_hash(cur->db_list_key,
+		                           icase) & new->db_index_mask;
+
+		while (new->db_index_slots[slot] != NULL)
+		{
+			last = new->db_index_slots[slot];
+
+			if ((icase && strcasecmp(last->db_list_key,
+			                         cur->db_list_key) == 0) ||
+			    (!icase && strcmp(last->db_list_key,
+			                      cur->db_list_key) == 0))
+				break;
+
+			slot = (slot + 1) & new->db_index_mask;
+		}
+
+		if (new->db_index_slots[slot] == NULL)
+		{
+			new->db_index_slots[slot] = cur;
+		}
+		else
+		{
+			for (last = new->db_index_slots[slot];
+			     last->db_list_samekey != NULL;
+			     last = last->db_list_samekey)
+				continue;
+
+			last->db_list_samekey = cur;
+		}
+	}
+
+	return new;
+}
+
+/*
+**  DKIMF_DB_INDEX_FIND -- find a key in a FILE/CSL index
+**
+**  Parameters:
+**  	index -- index handle
+**  	key -- key to find
+**  	icase -- keys are case-insensitive
+**
+**  Return value:
+**  	The first list entry having a matching key, or NULL if none.
+**  	Other matching entries can be found by following the
+**  	"db_list_samekey" chain.
+*/
+
+static struct dkimf_db_list *
+dkimf_db_index_find(struct dkimf_db_index *index, const char *key,
+                    _Bool icase)
+{
+	u_int slot;
+	struct dkimf_db_list *cur;
+
+	assert(index != NULL);
+	assert(key != NULL);
+
+	slot = dkimf_db_index_hash(key, icase) & index->db_index_mask;
+
+	while ((cur = index->db_index_slots[slot]) != NULL)
+	{
+		if (icase)
+		{
+			if (strcasecmp(key, cur->db_list_key) == 0)
+				return cur;
+		}
+		else
+		{
+			if (strcmp(key, cur->db_list_key) == 0)
+				return cur;
+		}
+
+		slot = (slot + 1) & index->db_index_mask;
+	}
+
+	return NULL;
+}
+
+/*
+**  DKIMF_DB_LIST_VALMATCH -- apply MATCHBOTH to a FILE/CSL list entry
+**
+**  Parameters:
+**  	db -- database handle
+**  	list -- list entry whose key matched
+**  	req -- request array
+**  	reqnum -- length of "req"
+**
+**  Return value:
+**  	TRUE iff "list" satisfies the query.
+*/
+
+static _Bool
+dkimf_db_list_valmatch(DKIMF_DB db, struct dkimf_db_list *list,
+                       DKIMF_DBDATA req, unsigned int reqnum)
+{
+	if ((db->db_flags & DKIMF_DB_FLAG_MATCHBOTH) == 0 ||
+	    reqnum == 0 || list->db_list_value == NULL)
+		return TRUE;
+
+	if ((db->db_flags & DKIMF_DB_FLAG_ICASE) == 0)
+	{
+		return (strncmp(req[0].dbdata_buffer, list->db_list_value,
+		                req[0].dbdata_buflen) == 0);
+	}
+	else
+	{
+		return (strncasecmp(req[0].dbdata_buffer, list->db_list_value,
+		                    req[0].dbdata_buflen) == 0);
+	}
+}
+
 /*
 **  DKIMF_DB_RELIST_FREE -- destroy a linked regex list
 **
@@ -1023,6 +1392,8 @@ dkimf_db_relist_free(struct dkimf_db_relist *list)
 	while (list != NULL)
 	{
 		regfree(&list->db_relist_re);
+		if (list->db_relist_glob != NULL)
+			free(list->db_relist_glob);
 		if (list->db_relist_data != NULL)
 			free(list->db_relist_data);
 		next = list->db_relist_next;
@@ -1031,109 +1402,1494 @@ dkimf_db_relist_free(struct dkimf_db_relist *list)
 	}
 }
 
-#ifdef USE_LDAP
 /*
-**  DKIMF_DB_OPEN_LDAP -- attempt to contact an LDAP server
+**  DKIMF_DB_MKGLOB -- see if a REFILE pattern is a plain glob
 **
 **  Parameters:
-**  	ld -- LDAP handle (updated on success)
-**  	ldap -- local LDAP data
+**  	pat -- pattern, as it appears in the table
+**  	icase -- table is case-insensitive
 **
 **  Return value:
-**  	An LDAP_* constant.
+**  	A newly-allocated copy of "pat" (folded to lower case if "icase"
+**  	is set) if the regular expression dkimf_mkregexp() makes from it
+**  	only ever matches like a glob whose sole wildcard is "*", or NULL
+**  	if it has to be matched by regexec() (or on allocation failure).
 */
 
-int
-dkimf_db_open_ldap(LDAP **ld, struct dkimf_db_ldap *ldap, char **err)
+static char *
+dkimf_db_mkglob(char *pat, _Bool icase)
 {
-	int v = LDAP_VERSION3;
-	int n;
-	int lderr;
-	char *q;
-	char *r;
-	char *u;
-	struct timeval timeout;
+	char *p;
+	char *glob;
 
-	assert(ld != NULL);
-	assert(ldap != NULL);
+	assert(pat != NULL);
 
-	/* create LDAP handle */
-	lderr = ldap_initialize(ld, ldap->ldap_urilist);
-	if (lderr != LDAP_SUCCESS)
+	for (p = pat; *p != '\0'; p++)
 	{
-		if (err != NULL)
-			*err = ldap_err2string(lderr);
-		return lderr;
+		if (!isascii(*p) || strchr("[](){}?^$|\\", *p) != NULL)
+			return NULL;
 	}
 
-	/* set LDAP version */
-	lderr = ldap_set_option(*ld, LDAP_OPT_PROTOCOL_VERSION, &v);
-	if (lderr != LDAP_OPT_SUCCESS)
-	{
-		if (err != NULL)
-			*err = ldap_err2string(lderr);
-		ldap_unbind_ext(*ld, NULL, NULL);
-		*ld = NULL;
-		return lderr;
-	}
+	glob = strdup(pat);
+	if (glob == NULL)
+		return NULL;
 
-	/* enable auto-restarts */
-	lderr = ldap_set_option(*ld, LDAP_OPT_RESTART, LDAP_OPT_ON);
-	if (lderr != LDAP_OPT_SUCCESS)
+	if (icase)
 	{
-		if (err != NULL)
-			*err = ldap_err2string(lderr);
-		ldap_unbind_ext(*ld, NULL, NULL);
-		*ld = NULL;
-		return lderr;
+		for (p = glob; *p != '\0'; p++)
+			*p = tolower((u_char) *p);
 	}
 
-	/* request timeouts */
-	q = dkimf_db_ldap_param[DKIMF_LDAP_PARAM_TIMEOUT];
-	timeout.tv_sec = DKIMF_LDAP_DEFTIMEOUT;
-	timeout.tv_usec = 0;
-	if (q != NULL)
-	{
-		errno = 0;
-		timeout.tv_sec = strtoul(q, &r, 10);
-		if (errno == ERANGE)
-			timeout.tv_sec = DKIMF_LDAP_DEFTIMEOUT;
-	}
+	return glob;
+}
 
-	lderr = ldap_set_option(*ld, LDAP_OPT_TIMEOUT, &timeout);
-	if (lderr != LDAP_OPT_SUCCESS)
-	{
-		if (err != NULL)
-			*err = ldap_err2string(lderr);
-		ldap_unbind_ext(*ld, NULL, NULL);
-		*ld = NULL;
-		return lderr;
-	}
+/*
+**  DKIMF_DB_GLOBMATCH -- match a string against a glob
+**
+**  Parameters:
+**  	glob -- glob, as returned by dkimf_db_mkglob()
+**  	str -- string to match
+**  	icase -- match case-insensitively
+**
+**  Return value:
+**  	TRUE iff the whole of "str" matches "glob".
+*/
 
-	/* request keepalive */
-	q = dkimf_db_ldap_param[DKIMF_LDAP_PARAM_KA_IDLE];
-	if (q != NULL)
+static _Bool
+dkimf_db_globmatch(const char *glob, const char *str, _Bool icase)
+{
+	const char *g = glob;
+	const char *s = str;
+	const char *gstar = NULL;
+	const char *sstar = NULL;
+	int c;
+
+	while (*s != '\0')
 	{
-		errno = 0;
-		n = strtoul(q, &r, 10);
-		if (errno != ERANGE)
+		c = icase ? tolower((u_char) *s) : *s;
+
+		if (*g == '*')
 		{
-			lderr = ldap_set_option(*ld, LDAP_OPT_X_KEEPALIVE_IDLE,
-			                        &n);
-			if (lderr != LDAP_OPT_SUCCESS)
-			{
-				if (err != NULL)
-					*err = ldap_err2string(lderr);
-				ldap_unbind_ext(*ld, NULL, NULL);
-				*ld = NULL;
-				return lderr;
-			}
+			gstar = g++;
+			sstar = s;
+		}
+		else if (*g == c)
+		{
+			g++;
+			s++;
+		}
+		else if (gstar != NULL)
+		{
+			g = gstar + 1;
+			s = ++sstar;
+		}
+		else
+		{
+			return FALSE;
 		}
 	}
 
-	q = dkimf_db_ldap_param[DKIMF_LDAP_PARAM_KA_PROBES];
-	if (q != NULL)
-	{
+	while (*g == '*')
+		g++;
+
+	return (*g == '\0');
+}
+
+/*
+**  DKIMF_DB_RETRIE_FREE -- destroy a REFILE suffix trie
+**
+**  Parameters:
+**  	trie -- trie node
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	The list entries referenced by the trie are not freed.
+*/
+
+static void
+dkimf_db_retrie_free(struct dkimf_db_retrie *trie)
+{
+	struct dkimf_db_retrie *next;
+
+	while (trie != NULL)
+	{
+		if (trie->db_retrie_child != NULL)
+			dkimf_db_retrie_free(trie->db_retrie_child);
+		next = trie->db_retrie_sibling;
+		free(trie);
+		trie = next;
+	}
+}
+
+/*
+**  DKIMF_DB_RETRIE_NEW -- build a suffix trie over a REFILE list
+**
+**  Parameters:
+**  	list -- list handle
+**  	icase -- table is case-insensitive
+**
+**  Return value:
+**  	The root of a new trie, or NULL on failure.
+**
+**  Notes:
+**  	Each glob entry hangs off the node reached by following its
+**  	literal suffix (everything after its last "*") backwards from the
+**  	root.  Entries that need regexec(), and globs ending in "*", hang
+**  	off the root.  A string can then only match entries found on the
+**  	path traced by its own characters read backwards, so a lookup
+**  	visits at most one node per character of the string.  Entries
+**  	at each node are kept in table order.
+*/
+
+static struct dkimf_db_retrie *
+dkimf_db_retrie_new(struct dkimf_db_relist *list, _Bool icase)
+{
+	u_char c;
+	u_int seq = 0;
+	char *p;
+	char *sfx;
+	struct dkimf_db_retrie *root;
+	struct dkimf_db_retrie *node;
+	struct dkimf_db_retrie *child;
+
+	root = (struct dkimf_db_retrie *) malloc(sizeof *root);
+	if (root == NULL)
+		return NULL;
+	memset(root, '\0', sizeof *root);
+
+	for (; list != NULL; list = list->db_relist_next)
+	{
+		list->db_relist_seq = ++seq;
+		list->db_relist_samesfx = NULL;
+
+		node = root;
+
+		if (list->db_relist_glob != NULL)
+		{
+			sfx = strrchr(list->db_relist_glob, '*');
+			if (sfx == NULL)
+				sfx = list->db_relist_glob;
+			else
+				sfx++;
+
+			for (p = sfx + strlen(sfx); p > sfx; p--)
+			{
+				c = (u_char) *(p - 1);
+
+				for (child = node->db_retrie_child;
+				     child != NULL;
+				     child = child->db_retrie_sibling)
+				{
+					if (child->db_retrie_char == c)
+						break;
+				}
+
+				if (child == NULL)
+				{
+					child = (struct dkimf_db_retrie *) malloc(sizeof *child);
+					if (child == NULL)
+					{
+						dkimf_db_retrie_free(root);
+						return NULL;
+					}
+					memset(child, '\0', sizeof *child);
+
+					child->db_retrie_char = c;
+					child->db_retrie_sibling = node->db_retrie_child;
+					node->db_retrie_child = child;
+				}
+
+				node = child;
+			}
+		}
+
+		if (node->db_retrie_head == NULL)
+			node->db_retrie_head = list;
+		else
+			node->db_retrie_tail->db_relist_samesfx = list;
+		node->db_retrie_tail = list;
+	}
+
+	return root;
+}
+
+/*
+**  DKIMF_DB_RETRIE_CHECK -- check the entries at one REFILE trie node
+**
+**  Parameters:
+**  	node -- trie node
+**  	str -- string to match
+**  	after -- only consider entries after this position in the table
+**  	icase -- match case-insensitively
+**  	best -- earliest matching entry so far (updated)
+**  	errseq -- position of the earliest entry on which regexec()
+**  	          failed, or 0 (updated)
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_db_retrie_check(struct dkimf_db_retrie *node, char *str, u_int after,
+                      _Bool icase, struct dkimf_db_relist **best,
+                      u_int *errseq)
+{
+	int status;
+	struct dkimf_db_relist *re;
+
+	for (re = node->db_retrie_head; re != NULL; re = re->db_relist_samesfx)
+	{
+		if (re->db_relist_seq <= after)
+			continue;
+		if (*best != NULL && re->db_relist_seq >= (*best)->db_relist_seq)
+			return;
+
+		if (re->db_relist_glob != NULL)
+		{
+			if (dkimf_db_globmatch(re->db_relist_glob, str, icase))
+			{
+				*best = re;
+				return;
+			}
+		}
+		else
+		{
+			status = regexec(&re->db_relist_re, str, 0, NULL, 0);
+			if (status == 0)
+			{
+				*best = re;
+				return;
+			}
+			else if (status != REG_NOMATCH &&
+			         (*errseq == 0 || re->db_relist_seq < *errseq))
+			{
+				*errseq = re->db_relist_seq;
+			}
+		}
+	}
+}
+
+/*
+**  DKIMF_DB_RETRIE_FIND -- find the first REFILE entry matching a string
+**
+**  Parameters:
+**  	db -- database handle
+**  	str -- string to match
+**  	after -- only consider entries after this position in the table
+**  	found -- first matching entry, or NULL if none (returned)
+**
+**  Return value:
+**  	0 -- success
+**  	-1 -- regexec() failed on an entry ahead of "*found"
+**
+**  Notes:
+**  	The result is the same entry a walk of the whole list in order
+**  	would have stopped on.  The root, where the entries needing
+**  	regexec() live, is checked last so that a match found further
+**  	down can rule most of them out.
+*/
+
+static int
+dkimf_db_retrie_find(DKIMF_DB db, char *str, u_int after,
+                     struct dkimf_db_relist **found)
+{
+	_Bool icase;
+	u_int errseq = 0;
+	u_char c;
+	char *p;
+	struct dkimf_db_retrie *node;
+	struct dkimf_db_relist *best = NULL;
+
+	assert(db != NULL);
+	assert(str != NULL);
+	assert(found != NULL);
+
+	icase = ((db->db_flags & DKIMF_DB_FLAG_ICASE) != 0);
+
+	node = db->db_retrie;
+
+	for (p = str + strlen(str); p > str; p--)
+	{
+		c = icase ? tolower((u_char) *(p - 1)) : (u_char) *(p - 1);
+
+		for (node = node->db_retrie_child;
+		     node != NULL;
+		     node = node->db_retrie_sibling)
+		{
+			if (node->db_retrie_char == c)
+				break;
+		}
+
+		if (node == NULL)
+			break;
+
+		dkimf_db_retrie_check(node, str, after, icase, &best, &errseq);
+	}
+
+	dkimf_db_retrie_check(db->db_retrie, str, after, icase, &best, &errseq);
+
+	*found = best;
+
+	if (errseq != 0 && (best == NULL || errseq < best->db_relist_seq))
+		return -1;
+
+	return 0;
+}
+
+#ifdef DKIMF_DB_BDB_MR
+/*
+**  DKIMF_DB_BDB_CLOSE -- close a Berkeley DB handle opened for readers
+**
+**  Parameters:
+**  	bh -- handle to close
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_db_bdb_close(struct dkimf_db_bdbhandle *bh)
+{
+	assert(bh != NULL);
+
+	if (bh->bdbh_db != NULL)
+		(void) DKIMF_DBCLOSE(bh->bdbh_db);
+	if (bh->bdbh_env != NULL)
+		(void) bh->bdbh_env->close(bh->bdbh_env, 0);
+
+	free(bh);
+}
+
+/*
+**  DKIMF_DB_BDB_OPEN -- open a Berkeley DB file for concurrent readers
+**
+**  Parameters:
+**  	path -- path to the database file
+**  	sb -- identity of the file that was opened (returned)
+**  	bh -- new handle (returned)
+**
+**  Return value:
+**  	0 on success, or an error code suitable for DB_STRERROR().
+**
+**  Notes:
+**  	The database is opened read-only and free-threaded inside a private
+**  	environment with its own memory pool, so any number of threads can
+**  	read it at once without the table mutex or a file lock.
+*/
+
+static int
+dkimf_db_bdb_open(char *path, struct stat *sb, struct dkimf_db_bdbhandle **bh)
+{
+	int status;
+	struct dkimf_db_bdbhandle *new;
+
+	assert(path != NULL);
+	assert(sb != NULL);
+	assert(bh != NULL);
+
+	new = (struct dkimf_db_bdbhandle *) malloc(sizeof *new);
+	if (new == NULL)
+		return errno;
+	memset(new, '\0', sizeof *new);
+
+	if (stat(path, sb) != 0)
+	{
+		status = errno;
+		free(new);
+		return status;
+	}
+
+	status = db_env_create(&new->bdbh_env, 0);
+	if (status != 0)
+	{
+		free(new);
+		return status;
+	}
+
+	status = new->bdbh_env->open(new->bdbh_env, NULL,
+	                             DB_CREATE|DB_PRIVATE|DB_INIT_MPOOL|DB_THREAD,
+	                             0);
+	if (status == 0)
+		status = db_create(&new->bdbh_db, new->bdbh_env, 0);
+	if (status == 0)
+	{
+		status = new->bdbh_db->open(new->bdbh_db, NULL, path, NULL,
+		                            DB_UNKNOWN, DB_RDONLY|DB_THREAD, 0);
+	}
+
+	if (status != 0)
+	{
+		dkimf_db_bdb_close(new);
+		return status;
+	}
+
+	*bh = new;
+
+	return 0;
+}
+
+/*
+**  DKIMF_DB_BDB_FREE -- release a Berkeley DB table opened for readers
+**
+**  Parameters:
+**  	bdb -- table data
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_db_bdb_free(struct dkimf_db_bdb *bdb)
+{
+	struct dkimf_db_bdbhandle *bh;
+	struct dkimf_db_bdbhandle *next;
+
+	assert(bdb != NULL);
+
+	if (bdb->bdb_current != NULL)
+		dkimf_db_bdb_close(bdb->bdb_current);
+
+	for (bh = bdb->bdb_retired; bh != NULL; bh = next)
+	{
+		next = bh->bdbh_next;
+		dkimf_db_bdb_close(bh);
+	}
+
+	pthread_rwlock_destroy(&bdb->bdb_lock);
+	free(bdb->bdb_path);
+	free(bdb);
+}
+
+/*
+**  DKIMF_DB_BDB_SETID -- record the identity of an open table file
+**
+**  Parameters:
+**  	bdb -- table data
+**  	sb -- stat() results for the file
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_db_bdb_setid(struct dkimf_db_bdb *bdb, struct stat *sb)
+{
+	bdb->bdb_dev = sb->st_dev;
+	bdb->bdb_ino = sb->st_ino;
+	bdb->bdb_size = sb->st_size;
+	bdb->bdb_mtime = sb->st_mtime;
+}
+
+/*
+**  DKIMF_DB_BDB_GET -- get the current handle of a Berkeley DB table
+**
+**  Parameters:
+**  	db -- DKIMF_DB handle
+**
+**  Return value:
+**  	The Berkeley DB handle to use.  The table is read-locked on return;
+**  	the caller releases it with pthread_rwlock_unlock().
+**
+**  Notes:
+**  	At most once every DKIMF_DB_CHECKINT seconds, the file is checked
+**  	for replacement or modification, and reopened if it has changed.
+**  	A handle replaced while a walk is in progress is kept until the
+**  	walk ends, since the walk's cursor refers to it.
+*/
+
+static DB *
+dkimf_db_bdb_get(DKIMF_DB db)
+{
+	time_t now;
+	struct stat sb;
+	struct dkimf_db_bdb *bdb;
+	struct dkimf_db_bdbhandle *bh;
+
+	bdb = (struct dkimf_db_bdb *) db->db_data;
+
+	(void) time(&now);
+
+	pthread_rwlock_rdlock(&bdb->bdb_lock);
+	if (now < bdb->bdb_checked + DKIMF_DB_CHECKINT)
+		return bdb->bdb_current->bdbh_db;
+	pthread_rwlock_unlock(&bdb->bdb_lock);
+
+	pthread_rwlock_wrlock(&bdb->bdb_lock);
+	if (now >= bdb->bdb_checked + DKIMF_DB_CHECKINT)
+	{
+		bdb->bdb_checked = now;
+
+		if (stat(bdb->bdb_path, &sb) == 0 &&
+		    (sb.st_dev != bdb->bdb_dev ||
+		     sb.st_ino != bdb->bdb_ino ||
+		     sb.st_size != bdb->bdb_size ||
+		     sb.st_mtime != bdb->bdb_mtime) &&
+		    dkimf_db_bdb_open(bdb->bdb_path, &sb, &bh) == 0)
+		{
+			if (db->db_cursor != NULL)
+			{
+				bdb->bdb_current->bdbh_next = bdb->bdb_retired;
+				bdb->bdb_retired = bdb->bdb_current;
+			}
+			else
+			{
+				dkimf_db_bdb_close(bdb->bdb_current);
+			}
+
+			bdb->bdb_current = bh;
+			db->db_handle = bh->bdbh_db;
+			dkimf_db_bdb_setid(bdb, &sb);
+		}
+	}
+	pthread_rwlock_unlock(&bdb->bdb_lock);
+
+	pthread_rwlock_rdlock(&bdb->bdb_lock);
+	return bdb->bdb_current->bdbh_db;
+}
+#endif /* DKIMF_DB_BDB_MR */
+
+#ifdef USE_DB
+# if DB_VERSION_CHECK(2,0,0)
+/*
+**  DKIMF_DB_BDB_ENDWALK -- end a walk of a Berkeley DB table
+**
+**  Parameters:
+**  	db -- DKIMF_DB handle
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Closes the walk's cursor, if any, and releases handles that were
+**  	replaced while it was open; nothing else refers to them.
+*/
+
+static void
+dkimf_db_bdb_endwalk(DKIMF_DB db)
+{
+	DBC *dbc;
+#  ifdef DKIMF_DB_BDB_MR
+	struct dkimf_db_bdb *bdb;
+	struct dkimf_db_bdbhandle *bh;
+	struct dkimf_db_bdbhandle *next;
+
+	bdb = (struct dkimf_db_bdb *) db->db_data;
+	if (bdb != NULL)
+		pthread_rwlock_wrlock(&bdb->bdb_lock);
+#  endif /* DKIMF_DB_BDB_MR */
+
+	dbc = (DBC *) db->db_cursor;
+	if (dbc != NULL)
+	{
+		(void) dbc->c_close(dbc);
+		db->db_cursor = NULL;
+	}
+
+#  ifdef DKIMF_DB_BDB_MR
+	if (bdb != NULL)
+	{
+		for (bh = bdb->bdb_retired; bh != NULL; bh = next)
+		{
+			next = bh->bdbh_next;
+			dkimf_db_bdb_close(bh);
+		}
+
+		bdb->bdb_retired = NULL;
+
+		pthread_rwlock_unlock(&bdb->bdb_lock);
+	}
+#  endif /* DKIMF_DB_BDB_MR */
+}
+# endif /* DB_VERSION_CHECK(2,0,0) */
+#endif /* USE_DB */
+
+#ifdef USE_MDB
+/*
+**  DKIMF_DB_MDB_READER -- get a read transaction for an LMDB table
+**
+**  Parameters:
+**  	mdb -- table data
+**  	status -- LMDB status (returned on failure)
+**
+**  Return value:
+**  	A reader whose transaction is ready for use, or NULL on failure.
+**
+**  Notes:
+**  	Idle read transactions are kept reset in a pool and renewed on
+**  	use, so each concurrent lookup has a transaction of its own and
+**  	sees the most recently committed data.  The environment is opened
+**  	with MDB_NOTLS so that a transaction can move between threads.
+*/
+
+static struct dkimf_db_mdbreader *
+dkimf_db_mdb_reader(struct dkimf_db_mdb *mdb, int *status)
+{
+	struct dkimf_db_mdbreader *r;
+
+	pthread_mutex_lock(&mdb->mdb_lock);
+	r = mdb->mdb_readers;
+	if (r != NULL)
+		mdb->mdb_readers = r->mdbr_next;
+	pthread_mutex_unlock(&mdb->mdb_lock);
+
+	if (r != NULL)
+	{
+		*status = mdb_txn_renew(r->mdbr_txn);
+		if (*status != 0)
+		{
+			mdb_txn_abort(r->mdbr_txn);
+			free(r);
+			return NULL;
+		}
+
+		return r;
+	}
+
+	r = (struct dkimf_db_mdbreader *) malloc(sizeof *r);
+	if (r == NULL)
+	{
+		*status = errno;
+		return NULL;
+	}
+
+	*status = mdb_txn_begin(mdb->mdb_env, NULL, MDB_RDONLY, &r->mdbr_txn);
+	if (*status != 0)
+	{
+		free(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+/*
+**  DKIMF_DB_MDB_RELEASE -- return a read transaction to the pool
+**
+**  Parameters:
+**  	mdb -- table data
+**  	r -- reader to return
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_db_mdb_release(struct dkimf_db_mdb *mdb, struct dkimf_db_mdbreader *r)
+{
+	mdb_txn_reset(r->mdbr_txn);
+
+	pthread_mutex_lock(&mdb->mdb_lock);
+	r->mdbr_next = mdb->mdb_readers;
+	mdb->mdb_readers = r;
+	pthread_mutex_unlock(&mdb->mdb_lock);
+}
+#endif /* USE_MDB */
+
+#ifdef _FFR_SOCKETDB
+/*
+**  DKIMF_DB_SOCK_CONNECT -- open a new connection to a socket data set
+**
+**  Parameters:
+**  	sdb -- socket data set
+**
+**  Return value:
+**  	A connected descriptor, or -1 on error (errno is set).
+**
+**  Notes:
+**  	After a failure, further attempts are refused until a backoff
+**  	interval has passed; the interval doubles with each failure up to
+**  	DKIMF_SOCKET_MAXBACKOFF seconds and is cleared by a success.
+**
+**  	The descriptor is non-blocking; dkimf_db_sock_read() and
+**  	dkimf_db_sock_write() wait for it with a timeout.
+*/
+
+static int
+dkimf_db_sock_connect(struct dkimf_db_socket *sdb)
+{
+	int fd;
+	int save_errno = 0;
+	time_t now;
+
+	(void) time(&now);
+
+	pthread_mutex_lock(&sdb->sockdb_lock);
+	if (now < sdb->sockdb_retry)
+	{
+		pthread_mutex_unlock(&sdb->sockdb_lock);
+		errno = ECONNREFUSED;
+		return -1;
+	}
+	pthread_mutex_unlock(&sdb->sockdb_lock);
+
+	fd = socket(sdb->sockdb_addr.ss_family, SOCK_STREAM, 0);
+	if (fd == -1)
+	{
+		save_errno = errno;
+	}
+	else if (connect(fd, (struct sockaddr *) &sdb->sockdb_addr,
+	                 sdb->sockdb_addrlen) != 0 ||
+	         fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) == -1)
+	{
+		save_errno = errno;
+		close(fd);
+		fd = -1;
+	}
+
+	pthread_mutex_lock(&sdb->sockdb_lock);
+	if (fd == -1)
+	{
+		if (sdb->sockdb_backoff == 0)
+			sdb->sockdb_backoff = DKIMF_SOCKET_MINBACKOFF;
+		else
+			sdb->sockdb_backoff = MIN(sdb->sockdb_backoff * 2,
+			                          DKIMF_SOCKET_MAXBACKOFF);
+		sdb->sockdb_retry = now + sdb->sockdb_backoff;
+	}
+	else
+	{
+		sdb->sockdb_backoff = 0;
+		sdb->sockdb_retry = 0;
+	}
+	pthread_mutex_unlock(&sdb->sockdb_lock);
+
+	errno = save_errno;
+	return fd;
+}
+
+/*
+**  DKIMF_DB_SOCK_WRITE -- send a query to a socket data set
+**
+**  Parameters:
+**  	fd -- descriptor
+**  	iov -- query pieces
+**  	iovcnt -- number of entries at "iov"
+**  	timeout -- seconds to wait
+**
+**  Return value:
+**  	Bytes written, or -1 on error or timeout (errno is set).
+**
+**  Notes:
+**  	Writing to a connection the server has closed must fail rather
+**  	than raise SIGPIPE, so that the query can be retried.  A server
+**  	that stops reading can only hold up a write until the timeout;
+**  	after that, part of the query may have been sent, so the
+**  	connection can't be used again.
+*/
+
+static ssize_t
+dkimf_db_sock_write(int fd, struct iovec *iov, int iovcnt, time_t timeout)
+{
+	int c;
+	int status;
+	ssize_t wlen;
+	ssize_t total = 0;
+	time_t now;
+	time_t deadline;
+	fd_set wfds;
+	struct timeval tv;
+	struct iovec left[DKIMF_SOCKET_MAXIOV];
+# ifdef MSG_NOSIGNAL
+	struct msghdr msg;
+# endif /* MSG_NOSIGNAL */
+
+	assert(iovcnt <= DKIMF_SOCKET_MAXIOV);
+
+	memcpy(left, iov, iovcnt * sizeof *iov);
+	iov = left;
+
+	(void) time(&now);
+	deadline = now + timeout;
+
+	while (iovcnt > 0)
+	{
+		FD_ZERO(&wfds);
+		FD_SET(fd, &wfds);
+
+		tv.tv_sec = deadline - now;
+		tv.tv_usec = 0;
+
+		status = select(fd + 1, NULL, &wfds, NULL, &tv);
+		if (status == 0)
+			errno = ETIMEDOUT;
+		if (status != 1)
+			return -1;
+
+# ifdef MSG_NOSIGNAL
+		memset(&msg, '\0', sizeof msg);
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+
+		wlen = sendmsg(fd, &msg, MSG_NOSIGNAL);
+# else /* MSG_NOSIGNAL */
+		wlen = writev(fd, iov, iovcnt);
+# endif /* MSG_NOSIGNAL */
+		if (wlen == -1 && errno != EAGAIN && errno != EINTR)
+			return -1;
+
+		/* skip what went out */
+		for (c = 0; wlen > 0; c++)
+		{
+			total += MIN((size_t) wlen, iov[c].iov_len);
+
+			if ((size_t) wlen < iov[c].iov_len)
+			{
+				iov[c].iov_base = (char *) iov[c].iov_base + wlen;
+				iov[c].iov_len -= wlen;
+				break;
+			}
+
+			wlen -= iov[c].iov_len;
+		}
+		iov += c;
+		iovcnt -= c;
+
+		(void) time(&now);
+		if (iovcnt > 0 && now >= deadline)
+		{
+			errno = ETIMEDOUT;
+			return -1;
+		}
+	}
+
+	return total;
+}
+
+/*
+**  DKIMF_DB_SOCK_READ -- read whatever a socket data set has sent
+**
+**  Parameters:
+**  	fd -- descriptor
+**  	buf -- string to which to append the input
+**  	timeout -- seconds to wait
+**
+**  Return value:
+**  	Bytes read, 0 at end of file, or -1 on error or timeout (errno
+**  	is set).
+*/
+
+static ssize_t
+dkimf_db_sock_read(int fd, struct dkimf_dstring *buf, time_t timeout)
+{
+	int status;
+	ssize_t rlen;
+	fd_set rfds;
+	struct timeval tv;
+	char inbuf[BUFRSZ];
+
+	FD_ZERO(&rfds);
+	FD_SET(fd, &rfds);
+
+	tv.tv_sec = timeout;
+	tv.tv_usec = 0;
+
+	status = select(fd + 1, &rfds, NULL, NULL, &tv);
+	if (status == 0)
+		errno = ETIMEDOUT;
+	if (status != 1)
+		return -1;
+
+	rlen = read(fd, inbuf, sizeof inbuf);
+	if (rlen > 0)
+		dkimf_dstring_catn(buf, (u_char *) inbuf, rlen);
+
+	return rlen;
+}
+
+/*
+**  DKIMF_DB_SOCK_DROP -- discard a pipelined connection, failing every
+**                        request waiting on it
+**
+**  Parameters:
+**  	sdb -- socket data set
+**  	sc -- connection
+**  	err -- errno value to report to the waiters
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Called with sockdb_lock held.  If a thread is reading or writing
+**  	the connection it is only shut down, which makes that I/O fail;
+**  	the thread finishes the job when it's done, so the descriptor is
+**  	never closed under it.
+*/
+
+static void
+dkimf_db_sock_drop(struct dkimf_db_socket *sdb, struct dkimf_db_sockconn *sc,
+                   int err)
+{
+	struct dkimf_db_sockwait *sw;
+
+	if (sc->sc_fd == -1)
+		return;
+
+	if (sc->sc_reading || sc->sc_writing)
+	{
+		if (!sc->sc_closing)
+			(void) shutdown(sc->sc_fd, SHUT_RDWR);
+		sc->sc_closing = TRUE;
+		return;
+	}
+
+	close(sc->sc_fd);
+	sc->sc_fd = -1;
+	sc->sc_closing = FALSE;
+	dkimf_dstring_blank(sc->sc_buf);
+
+	for (sw = sc->sc_waiters; sw != NULL; sw = sw->sw_next)
+	{
+		sw->sw_status = -1;
+		sw->sw_errno = err;
+	}
+
+	sc->sc_waiters = NULL;
+	sc->sc_inflight = 0;
+
+	pthread_cond_broadcast(&sdb->sockdb_cond);
+}
+
+/*
+**  DKIMF_DB_SOCK_DISPATCH -- hand complete pipelined replies to the
+**                            requests waiting for them
+**
+**  Parameters:
+**  	sdb -- socket data set
+**  	sc -- connection
+**
+**  Return value:
+**  	0 on success, -1 if the server sent something malformed.
+**
+**  Notes:
+**  	Called with sockdb_lock held.  Each reply is "id value\n".
+*/
+
+static int
+dkimf_db_sock_dispatch(struct dkimf_db_socket *sdb,
+                       struct dkimf_db_sockconn *sc)
+{
+	u_long id;
+	size_t len;
+	size_t used = 0;
+	char *buf;
+	char *eol;
+	char *q;
+	struct dkimf_db_sockwait *sw;
+	struct dkimf_db_sockwait **prev;
+
+	buf = (char *) dkimf_dstring_get(sc->sc_buf);
+	len = dkimf_dstring_len(sc->sc_buf);
+
+	while ((eol = memchr(buf + used, '\n', len - used)) != NULL)
+	{
+		*eol = '\0';
+
+		id = strtoul(buf + used, &q, 10);
+		if (q == buf + used || (*q != ' ' && *q != '\0'))
+			return -1;
+		if (*q == ' ')
+			q++;
+
+		for (prev = &sc->sc_waiters, sw = sc->sc_waiters;
+		     sw != NULL;
+		     prev = &sw->sw_next, sw = sw->sw_next)
+		{
+			if (sw->sw_id == id)
+				break;
+		}
+
+		/* no requester means it already gave up waiting */
+		if (sw != NULL)
+		{
+			*prev = sw->sw_next;
+			sc->sc_inflight--;
+
+			dkimf_dstring_copy(sw->sw_reply, (u_char *) q);
+			sw->sw_status = 1;
+		}
+
+		used = eol - buf + 1;
+	}
+
+	if (used > 0)
+	{
+		memmove(buf, buf + used, len - used);
+		dkimf_dstring_chop(sc->sc_buf, len - used);
+		pthread_cond_broadcast(&sdb->sockdb_cond);
+	}
+
+	return 0;
+}
+
+/*
+**  DKIMF_DB_SOCK_PIPELINE -- send a query on a pipelined socket data set
+**                            and wait for its reply
+**
+**  Parameters:
+**  	sdb -- socket data set
+**  	buf -- key
+**  	buflen -- bytes at "buf"
+**  	reply -- reply (returned)
+**  	fresh -- the query went out on a new connection (returned)
+**
+**  Return value:
+**  	0 on success, otherwise an errno value.
+**
+**  Notes:
+**  	Each query goes out as "id key\n" on the least busy connection
+**  	that nobody else is writing to.  The write is done without
+**  	sockdb_lock, so a server that is slow to take it only holds up
+**  	queries waiting for that connection.  The first thread to find a
+**  	connection with nobody reading it becomes its reader, passing
+**  	replies to their requesters as they arrive, in whatever order the
+**  	server sends them; the rest sleep until their replies are handed
+**  	over or the timeout passes.
+*/
+
+static int
+dkimf_db_sock_pipeline(struct dkimf_db_socket *sdb, char *buf, size_t buflen,
+                       struct dkimf_dstring *reply, _Bool *fresh)
+{
+	_Bool connfail = FALSE;
+	int c;
+	int fd;
+	int status = 0;
+	ssize_t rlen;
+	time_t now;
+	time_t deadline;
+	struct dkimf_db_sockconn *sc;
+	struct dkimf_db_sockconn *idle;
+	struct dkimf_db_sockwait sw;
+	struct dkimf_db_sockwait **prev;
+	struct timespec ts;
+	struct iovec iov[3];
+	char idbuf[BUFRSZ];
+
+	(void) time(&now);
+	deadline = now + DKIMF_SOCKET_TIMEOUT;
+
+	*fresh = FALSE;
+
+	pthread_mutex_lock(&sdb->sockdb_lock);
+
+	/* pick the connected connection with the fewest requests in flight */
+	for (;;)
+	{
+		sc = NULL;
+		idle = NULL;
+
+		for (c = 0; c < sdb->sockdb_nconns; c++)
+		{
+			if (sdb->sockdb_conns[c].sc_busy ||
+			    sdb->sockdb_conns[c].sc_writing ||
+			    sdb->sockdb_conns[c].sc_closing)
+				continue;
+
+			if (sdb->sockdb_conns[c].sc_fd == -1)
+			{
+				if (idle == NULL)
+					idle = &sdb->sockdb_conns[c];
+			}
+			else if (sc == NULL ||
+			         sdb->sockdb_conns[c].sc_inflight < sc->sc_inflight)
+			{
+				sc = &sdb->sockdb_conns[c];
+			}
+		}
+
+		/* open another connection rather than queue behind one */
+		if (idle != NULL && !connfail &&
+		    (sc == NULL || sc->sc_inflight > 0))
+		{
+			idle->sc_busy = TRUE;
+			pthread_mutex_unlock(&sdb->sockdb_lock);
+
+			fd = dkimf_db_sock_connect(sdb);
+			status = errno;
+
+			pthread_mutex_lock(&sdb->sockdb_lock);
+			idle->sc_busy = FALSE;
+			idle->sc_fd = fd;
+			pthread_cond_broadcast(&sdb->sockdb_cond);
+
+			if (fd != -1)
+			{
+				sc = idle;
+				*fresh = TRUE;
+				break;
+			}
+
+			/*
+			**  "sc" was chosen before the lock was dropped and
+			**  may have been lost since; choose again from what's
+			**  open now.
+			*/
+
+			connfail = TRUE;
+			continue;
+		}
+
+		if (sc != NULL)
+			break;
+
+		if (connfail)
+		{
+			pthread_mutex_unlock(&sdb->sockdb_lock);
+			return status;
+		}
+
+		/* everything is being connected or written; wait for one */
+		pthread_cond_wait(&sdb->sockdb_cond, &sdb->sockdb_lock);
+	}
+
+	sw.sw_id = ++sdb->sockdb_nextid;
+	sw.sw_status = 0;
+	sw.sw_errno = 0;
+	sw.sw_reply = reply;
+
+	snprintf(idbuf, sizeof idbuf, "%lu ", sw.sw_id);
+
+	iov[0].iov_base = idbuf;
+	iov[0].iov_len = strlen(idbuf);
+	iov[1].iov_base = buf;
+	iov[1].iov_len = buflen;
+	iov[2].iov_base = "\n";
+	iov[2].iov_len = 1;
+
+	/*
+	**  Wait for the reply from the start, as it could be dispatched by
+	**  a reader before this thread gets the lock back.  Nobody else
+	**  writes to the connection meanwhile, so queries don't interleave.
+	*/
+
+	sw.sw_next = sc->sc_waiters;
+	sc->sc_waiters = &sw;
+	sc->sc_inflight++;
+
+	sc->sc_writing = TRUE;
+	fd = sc->sc_fd;
+	pthread_mutex_unlock(&sdb->sockdb_lock);
+
+	rlen = dkimf_db_sock_write(fd, iov, 3, deadline - now);
+	status = errno;
+
+	pthread_mutex_lock(&sdb->sockdb_lock);
+	sc->sc_writing = FALSE;
+
+	/* a failure here fails this request too */
+	if (rlen == -1)
+		dkimf_db_sock_drop(sdb, sc, status);
+	else if (sc->sc_closing)
+		dkimf_db_sock_drop(sdb, sc, ECONNRESET);
+
+	pthread_cond_broadcast(&sdb->sockdb_cond);
+
+	while (sw.sw_status == 0)
+	{
+		(void) time(&now);
+		if (now >= deadline)
+		{
+			for (prev = &sc->sc_waiters;
+			     *prev != NULL && *prev != &sw;
+			     prev = &(*prev)->sw_next)
+				continue;
+			if (*prev == &sw)
+			{
+				*prev = sw.sw_next;
+				sc->sc_inflight--;
+			}
+
+			sw.sw_status = -1;
+			sw.sw_errno = ETIMEDOUT;
+			break;
+		}
+
+		if (!sc->sc_reading && !sc->sc_closing)
+		{
+			sc->sc_reading = TRUE;
+			fd = sc->sc_fd;
+			pthread_mutex_unlock(&sdb->sockdb_lock);
+
+			rlen = dkimf_db_sock_read(fd, sc->sc_buf,
+			                          deadline - now);
+			status = errno;
+
+			pthread_mutex_lock(&sdb->sockdb_lock);
+			sc->sc_reading = FALSE;
+
+			/*
+			**  Running out of time only ends this request; the
+			**  others keep their own deadlines.
+			*/
+
+			if (rlen == 0)
+				status = ECONNRESET;
+			if (rlen > 0 && dkimf_db_sock_dispatch(sdb, sc) != 0)
+				dkimf_db_sock_drop(sdb, sc, EPROTO);
+			else if (rlen <= 0 && status != ETIMEDOUT)
+				dkimf_db_sock_drop(sdb, sc, status);
+			else if (sc->sc_closing)
+				dkimf_db_sock_drop(sdb, sc, ECONNRESET);
+
+			/* let somebody else take over reading */
+			pthread_cond_broadcast(&sdb->sockdb_cond);
+		}
+		else
+		{
+			ts.tv_sec = deadline;
+			ts.tv_nsec = 0;
+			(void) pthread_cond_timedwait(&sdb->sockdb_cond,
+			                              &sdb->sockdb_lock, &ts);
+		}
+	}
+
+	pthread_mutex_unlock(&sdb->sockdb_lock);
+
+	return (sw.sw_status == 1 ? 0 : sw.sw_errno);
+}
+
+/*
+**  DKIMF_DB_SOCK_QUERY -- send a query to a socket data set and collect
+**                         its reply
+**
+**  Parameters:
+**  	sdb -- socket data set
+**  	buf -- key
+**  	buflen -- bytes at "buf"
+**  	reply -- reply, without its newline (returned)
+**
+**  Return value:
+**  	0 on success, otherwise an errno value.
+**
+**  Notes:
+**  	Without pipelining, a query has a connection to itself for the
+**  	whole round trip, so up to sockdb_nconns queries can be in
+**  	progress at once.  A query on a connection the server has since
+**  	closed is retried once on a new connection.
+*/
+
+static int
+dkimf_db_sock_query(struct dkimf_db_socket *sdb, char *buf, size_t buflen,
+                    struct dkimf_dstring *reply)
+{
+	_Bool fresh;
+	int c;
+	int status = 0;
+	int attempt;
+	size_t len;
+	ssize_t rlen;
+	char *p;
+	struct dkimf_db_sockconn *sc;
+	struct iovec iov[2];
+
+	if (sdb->sockdb_pipeline)
+	{
+		status = dkimf_db_sock_pipeline(sdb, buf, buflen, reply,
+		                                &fresh);
+		if (status != 0 && status != ETIMEDOUT && !fresh)
+		{
+			status = dkimf_db_sock_pipeline(sdb, buf, buflen,
+			                                reply, &fresh);
+		}
+
+		return status;
+	}
+
+	/* take a free connection, preferring one that's already open */
+	pthread_mutex_lock(&sdb->sockdb_lock);
+	for (;;)
+	{
+		sc = NULL;
+
+		for (c = 0; c < sdb->sockdb_nconns; c++)
+		{
+			if (sdb->sockdb_conns[c].sc_busy)
+				continue;
+
+			if (sc == NULL || sdb->sockdb_conns[c].sc_fd != -1)
+				sc = &sdb->sockdb_conns[c];
+			if (sc->sc_fd != -1)
+				break;
+		}
+
+		if (sc != NULL)
+			break;
+
+		pthread_cond_wait(&sdb->sockdb_cond, &sdb->sockdb_lock);
+	}
+	sc->sc_busy = TRUE;
+	pthread_mutex_unlock(&sdb->sockdb_lock);
+
+	iov[0].iov_base = buf;
+	iov[0].iov_len = buflen;
+	iov[1].iov_base = "\n";
+	iov[1].iov_len = 1;
+
+	for (attempt = 0; attempt < 2; attempt++)
+	{
+		fresh = (sc->sc_fd == -1);
+		if (fresh)
+		{
+			sc->sc_fd = dkimf_db_sock_connect(sdb);
+			if (sc->sc_fd == -1)
+			{
+				status = errno;
+				break;
+			}
+		}
+
+		dkimf_dstring_blank(sc->sc_buf);
+
+		rlen = dkimf_db_sock_write(sc->sc_fd, iov, 2,
+		                           DKIMF_SOCKET_TIMEOUT);
+		if (rlen == (ssize_t) (buflen + 1))
+		{
+			for (;;)
+			{
+				rlen = dkimf_db_sock_read(sc->sc_fd, sc->sc_buf,
+				                          DKIMF_SOCKET_TIMEOUT);
+				if (rlen <= 0)
+					break;
+
+				p = (char *) dkimf_dstring_get(sc->sc_buf);
+				len = dkimf_dstring_len(sc->sc_buf);
+				if (p[len - 1] == '\n')
+					break;
+			}
+		}
+
+		if (rlen > 0)
+		{
+			dkimf_dstring_chop(sc->sc_buf,
+			                   dkimf_dstring_len(sc->sc_buf) - 1);
+			dkimf_dstring_copy(reply, dkimf_dstring_get(sc->sc_buf));
+			status = 0;
+			break;
+		}
+
+		status = (rlen == 0 ? ECONNRESET : errno);
+		close(sc->sc_fd);
+		sc->sc_fd = -1;
+
+		/* a timeout, or a connection we just made, isn't retried */
+		if (fresh || status == ETIMEDOUT)
+			break;
+	}
+
+	pthread_mutex_lock(&sdb->sockdb_lock);
+	sc->sc_busy = FALSE;
+	pthread_cond_signal(&sdb->sockdb_cond);
+	pthread_mutex_unlock(&sdb->sockdb_lock);
+
+	return status;
+}
+#endif /* _FFR_SOCKETDB */
+
+#ifdef USE_LDAP
+/*
+**  DKIMF_DB_OPEN_LDAP -- attempt to contact an LDAP server
+**
+**  Parameters:
+**  	ld -- LDAP handle (updated on success)
+**  	ldap -- local LDAP data
+**
+**  Return value:
+**  	An LDAP_* constant.
+*/
+
+int
+dkimf_db_open_ldap(LDAP **ld, struct dkimf_db_ldap *ldap, char **err)
+{
+	int v = LDAP_VERSION3;
+	int n;
+	int lderr;
+	char *q;
+	char *r;
+	char *u;
+	struct timeval timeout;
+
+	assert(ld != NULL);
+	assert(ldap != NULL);
+
+	/* create LDAP handle */
+	lderr = ldap_initialize(ld, ldap->ldap_urilist);
+	if (lderr != LDAP_SUCCESS)
+	{
+		if (err != NULL)
+			*err = ldap_err2string(lderr);
+		return lderr;
+	}
+
+	/* set LDAP version */
+	lderr = ldap_set_option(*ld, LDAP_OPT_PROTOCOL_VERSION, &v);
+	if (lderr != LDAP_OPT_SUCCESS)
+	{
+		if (err != NULL)
+			*err = ldap_err2string(lderr);
+		ldap_unbind_ext(*ld, NULL, NULL);
+		*ld = NULL;
+		return lderr;
+	}
+
+	/* enable auto-restarts */
+	lderr = ldap_set_option(*ld, LDAP_OPT_RESTART, LDAP_OPT_ON);
+	if (lderr != LDAP_OPT_SUCCESS)
+	{
+		if (err != NULL)
+			*err = ldap_err2string(lderr);
+		ldap_unbind_ext(*ld, NULL, NULL);
+		*ld = NULL;
+		return lderr;
+	}
+
+	/* request timeouts */
+	q = dkimf_db_ldap_param[DKIMF_LDAP_PARAM_TIMEOUT];
+	timeout.tv_sec = DKIMF_LDAP_DEFTIMEOUT;
+	timeout.tv_usec = 0;
+	if (q != NULL)
+	{
+		errno = 0;
+		timeout.tv_sec = strtoul(q, &r, 10);
+		if (errno == ERANGE)
+			timeout.tv_sec = DKIMF_LDAP_DEFTIMEOUT;
+	}
+
+	lderr = ldap_set_option(*ld, LDAP_OPT_TIMEOUT, &timeout);
+	if (lderr != LDAP_OPT_SUCCESS)
+	{
+		if (err != NULL)
+			*err = ldap_err2string(lderr);
+		ldap_unbind_ext(*ld, NULL, NULL);
+		*ld = NULL;
+		return lderr;
+	}
+
+	/* request keepalive */
+	q = dkimf_db_ldap_param[DKIMF_LDAP_PARAM_KA_IDLE];
+	if (q != NULL)
+	{
+		errno = 0;
+		n = strtoul(q, &r, 10);
+		if (errno != ERANGE)
+		{
+			lderr = ldap_set_option(*ld, LDAP_OPT_X_KEEPALIVE_IDLE,
+			                        &n);
+			if (lderr != LDAP_OPT_SUCCESS)
+			{
+				if (err != NULL)
+					*err = ldap_err2string(lderr);
+				ldap_unbind_ext(*ld, NULL, NULL);
+				*ld = NULL;
+				return lderr;
+			}
+		}
+	}
+
+	q = dkimf_db_ldap_param[DKIMF_LDAP_PARAM_KA_PROBES];
+	if (q != NULL)
+	{
 		errno = 0;
 		n = strtoul(q, &r, 10);
 		if (errno != ERANGE)
@@ -1330,40 +3086,50 @@ dkimf_db_type(DKIMF_DB db)
 **  DKIMF_DB_ERL_CONNECT -- connect to a distributed Erlang node
 **
 **  Parameters:
-**	db -- DKIMF_DB handle
+**	e -- Erlang data set
+**	slot -- connection's slot number
 **	ecp -- Pointer to ei_cnode
 **
 **  Return value:
 **	File descriptor or -1 on error.
+**
+**  Notes:
+**	Every open connection gets a node name of its own, as a node
+**	accepts only one connection from a given name at a time.  The name
+**	comes from the slot number, so names are reused as connections are
+**	replaced and a node doesn't collect a new one (an atom, which it
+**	never frees) for every reconnection.
 */
 
 static int
-dkimf_db_erl_connect(DKIMF_DB db, ei_cnode *ecp)
+dkimf_db_erl_connect(struct dkimf_db_erlang *e, u_int slot, ei_cnode *ecp)
 {
 	int fd;
 	int ret;
 	int instance;
 	unsigned int seed;
-	char node_name[12];
+	char node_name[BUFRSZ];
+	char nodes[BUFRSZ + 1];
 	struct timeval tv;
 	char *q;
 	char *last;
-	struct dkimf_db_erlang *e;
 
 	gettimeofday(&tv, NULL);
 	seed = tv.tv_sec * tv.tv_usec;
 	instance = rand_r(&seed) % 999;
 
-	e = (struct dkimf_db_erlang *) db->db_data;
-
-	snprintf(node_name, sizeof node_name, "opendkim%d", instance);
+	snprintf(node_name, sizeof node_name, "opendkim%lu_%u",
+	         (u_long) getpid(), slot);
 
 	ret = ei_connect_init(ecp, node_name, e->erlang_cookie, instance);
 	if (ret != 0)
 		return -1;
 
+	/* strtok_r() would otherwise truncate the node list */
+	strlcpy(nodes, e->erlang_nodes, sizeof nodes);
+
 	fd = -1;
-	for (q = strtok_r(e->erlang_nodes, ",", &last);
+	for (q = strtok_r(nodes, ",", &last);
 	     q != NULL;
 	     q = strtok_r(NULL, ",", &last))
 	{
@@ -1377,6 +3143,244 @@ dkimf_db_erl_connect(DKIMF_DB db, ei_cnode *ecp)
 	return fd;
 }
 
+/*
+**  DKIMF_DB_ERL_SLOT -- get a connection slot for an Erlang data set
+**
+**  Parameters:
+**	e -- Erlang data set
+**
+**  Return value:
+**	An unconnected connection handle, or NULL on error.
+**
+**  Notes:
+**	A slot released by dkimf_db_erl_release() is reused before a new
+**	one is made, so there are never more slots than there have been
+**	connections open at once.
+*/
+
+static struct dkimf_db_erlconn *
+dkimf_db_erl_slot(struct dkimf_db_erlang *e)
+{
+	struct dkimf_db_erlconn *conn;
+
+	pthread_mutex_lock(&e->erlang_lock);
+	conn = e->erlang_spare;
+	if (conn != NULL)
+		e->erlang_spare = conn->erlc_next;
+	pthread_mutex_unlock(&e->erlang_lock);
+
+	if (conn != NULL)
+		return conn;
+
+	conn = (struct dkimf_db_erlconn *) malloc(sizeof *conn);
+	if (conn == NULL)
+		return NULL;
+
+	memset(conn, '\0', sizeof *conn);
+	conn->erlc_fd = -1;
+
+	pthread_mutex_lock(&e->erlang_lock);
+	conn->erlc_slot = e->erlang_nslots++;
+	pthread_mutex_unlock(&e->erlang_lock);
+
+	return conn;
+}
+
+/*
+**  DKIMF_DB_ERL_RELEASE -- close an Erlang connection and release its slot
+**
+**  Parameters:
+**	e -- Erlang data set
+**	conn -- connection
+**
+**  Return value:
+**	None.
+*/
+
+static void
+dkimf_db_erl_release(struct dkimf_db_erlang *e, struct dkimf_db_erlconn *conn)
+{
+	if (conn->erlc_fd >= 0)
+		close(conn->erlc_fd);
+	conn->erlc_fd = -1;
+
+	pthread_mutex_lock(&e->erlang_lock);
+	conn->erlc_next = e->erlang_spare;
+	e->erlang_spare = conn;
+	pthread_mutex_unlock(&e->erlang_lock);
+}
+
+/*
+**  DKIMF_DB_ERL_ALIVE -- check that an idle Erlang connection is still up
+**
+**  Parameters:
+**	conn -- connection
+**
+**  Return value:
+**	TRUE iff the connection can be used.
+**
+**  Notes:
+**	Nothing but ticks (four zero bytes) should arrive on an idle
+**	connection.  Those are answered in kind; anything else, including
+**	end of file, means the connection is no longer usable.
+*/
+
+static _Bool
+dkimf_db_erl_alive(struct dkimf_db_erlconn *conn)
+{
+	_Bool ticked = FALSE;
+	int c;
+	int status;
+	ssize_t rlen;
+	fd_set rfds;
+	struct timeval tv;
+	char buf[BUFRSZ];
+
+	for (;;)
+	{
+		FD_ZERO(&rfds);
+		FD_SET(conn->erlc_fd, &rfds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+
+		status = select(conn->erlc_fd + 1, &rfds, NULL, NULL, &tv);
+		if (status == 0)
+			break;
+		else if (status < 0)
+			return FALSE;
+
+		rlen = read(conn->erlc_fd, buf, sizeof buf);
+		if (rlen <= 0)
+			return FALSE;
+
+		for (c = 0; c < rlen; c++)
+		{
+			if (buf[c] != '\0')
+				return FALSE;
+		}
+
+		ticked = TRUE;
+	}
+
+	if (ticked)
+	{
+		memset(buf, '\0', 4);
+		if (write(conn->erlc_fd, buf, 4) != 4)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+**  DKIMF_DB_ERL_RPC -- call the data set's function on an Erlang node
+**
+**  Parameters:
+**	db -- DKIMF_DB handle
+**	args -- encoded arguments
+**	resp -- response (returned)
+**
+**  Return value:
+**	As for ei_rpc().
+**
+**  Notes:
+**	Connections are kept open and reused by later calls.  One that
+**	has been idle longer than DKIMF_ERLANG_MAXIDLE seconds (about half
+**	of a node's default tick time, after which it gives up on a quiet
+**	peer) or fails dkimf_db_erl_alive() is replaced.  A call that fails
+**	on a reused connection is tried once more on a new one.  At most
+**	DKIMF_ERLANG_MAXPOOL connections are kept idle; any beyond that,
+**	left over from a burst of concurrent calls, are closed.
+*/
+
+static int
+dkimf_db_erl_rpc(DKIMF_DB db, ei_x_buff *args, ei_x_buff *resp)
+{
+	_Bool fresh;
+	int ret = -1;
+	int attempt;
+	time_t now;
+	struct dkimf_db_erlang *e;
+	struct dkimf_db_erlconn *conn;
+
+	e = (struct dkimf_db_erlang *) db->db_data;
+
+	for (attempt = 0; attempt < 2; attempt++)
+	{
+		(void) time(&now);
+
+		/* find a healthy idle connection */
+		for (;;)
+		{
+			pthread_mutex_lock(&e->erlang_lock);
+			conn = e->erlang_idle;
+			if (conn != NULL)
+			{
+				e->erlang_idle = conn->erlc_next;
+				e->erlang_nidle--;
+			}
+			pthread_mutex_unlock(&e->erlang_lock);
+
+			if (conn == NULL ||
+			    (now - conn->erlc_idle <= DKIMF_ERLANG_MAXIDLE &&
+			     dkimf_db_erl_alive(conn)))
+				break;
+
+			dkimf_db_erl_release(e, conn);
+		}
+
+		fresh = (conn == NULL);
+		if (fresh)
+		{
+			conn = dkimf_db_erl_slot(e);
+			if (conn == NULL)
+				return -1;
+
+			conn->erlc_fd = dkimf_db_erl_connect(e,
+			                                     conn->erlc_slot,
+			                                     &conn->erlc_node);
+			if (conn->erlc_fd < 0)
+			{
+				dkimf_db_erl_release(e, conn);
+				return -1;
+			}
+		}
+
+		ret = ei_rpc(&conn->erlc_node, conn->erlc_fd,
+		             e->erlang_module, e->erlang_function,
+		             args->buff, args->index, resp);
+		if (ret != -1)
+		{
+			conn->erlc_idle = time(NULL);
+
+			pthread_mutex_lock(&e->erlang_lock);
+			if (e->erlang_nidle < DKIMF_ERLANG_MAXPOOL)
+			{
+				conn->erlc_next = e->erlang_idle;
+				e->erlang_idle = conn;
+				e->erlang_nidle++;
+				conn = NULL;
+			}
+			pthread_mutex_unlock(&e->erlang_lock);
+
+			if (conn != NULL)
+				dkimf_db_erl_release(e, conn);
+
+			return ret;
+		}
+
+		dkimf_db_erl_release(e, conn);
+
+		if (fresh)
+			break;
+
+		ei_x_free(resp);
+		ei_x_new(resp);
+	}
+
+	return ret;
+}
+
 /*
 **  DKIMF_DB_ERL_FREE -- free allocated memory for Erlang configuration
 **
@@ -1390,8 +3394,24 @@ dkimf_db_erl_connect(DKIMF_DB db, ei_cnode *ecp)
 static void
 dkimf_db_erl_free(struct dkimf_db_erlang *ep)
 {
+	struct dkimf_db_erlconn *conn;
+
 	if (ep == NULL)
 		return;
+	while (ep->erlang_idle != NULL)
+	{
+		conn = ep->erlang_idle;
+		ep->erlang_idle = conn->erlc_next;
+		close(conn->erlc_fd);
+		free(conn);
+	}
+	while (ep->erlang_spare != NULL)
+	{
+		conn = ep->erlang_spare;
+		ep->erlang_spare = conn->erlc_next;
+		free(conn);
+	}
+	pthread_mutex_destroy(&ep->erlang_lock);
 	if (ep->erlang_nodes != NULL)
 		free(ep->erlang_nodes);
 	if (ep->erlang_module != NULL)
@@ -1779,6 +3799,396 @@ dkimf_db_erl_decode_response(ei_x_buff *resp, const char *notfound,
 }
 #endif /* USE_ERLANG */
 
+/*
+**  DKIMF_DB_CACHE_HASH -- hash a key for the result cache
+**
+**  Parameters:
+**  	key -- key to hash
+**  	keylen -- bytes at "key"
+**
+**  Return value:
+**  	Hash value.
+*/
+
+static u_int
+dkimf_db_cache_hash(const char *key, size_t keylen)
+{
+	u_int h = 5381;
+	const u_char *p;
+	const u_char *end;
+
+	end = (const u_char *) key + keylen;
+	for (p = (const u_char *) key; p < end; p++)
+		h = ((h << 5) + h) + *p;
+
+	return h;
+}
+
+/*
+**  DKIMF_DB_CACHE_MKENT -- allocate a result cache entry
+**
+**  Parameters:
+**  	key -- key
+**  	keylen -- bytes at "key"
+**  	req -- request array
+**  	reqnum -- length of request array
+**  	datalen -- bytes of value data to reserve
+**
+**  Return value:
+**  	A new entry with its key and request shape filled in, or NULL.
+**
+**  Notes:
+**  	The key, the per-field descriptions and the value data all live
+**  	in the same allocation as the entry.
+*/
+
+static struct dkimf_db_cacheent *
+dkimf_db_cache_mkent(char *key, size_t keylen, DKIMF_DBDATA req,
+                     unsigned int reqnum, size_t datalen)
+{
+	int c;
+	size_t size;
+	struct dkimf_db_cacheent *ce;
+
+	size = sizeof *ce + reqnum * sizeof(struct dkimf_db_cachefld) +
+	       keylen + datalen;
+
+	ce = (struct dkimf_db_cacheent *) malloc(size);
+	if (ce == NULL)
+		return NULL;
+
+	memset(ce, '\0', sizeof *ce);
+
+	ce->ce_size = size;
+	ce->ce_reqnum = reqnum;
+	ce->ce_fields = (struct dkimf_db_cachefld *) (ce + 1);
+	ce->ce_key = (char *) (ce->ce_fields + reqnum);
+	ce->ce_keylen = keylen;
+	ce->ce_hash = dkimf_db_cache_hash(key, keylen);
+	memcpy(ce->ce_key, key, keylen);
+
+	for (c = 0; c < reqnum; c++)
+	{
+		ce->ce_fields[c].cf_flags = req[c].dbdata_flags;
+		ce->ce_fields[c].cf_len = (size_t) -1;
+		ce->ce_fields[c].cf_data = NULL;
+	}
+
+	return ce;
+}
+
+/*
+**  DKIMF_DB_CACHE_FIND -- find a result cache entry
+**
+**  Parameters:
+**  	cache -- result cache
+**  	key -- key
+**  	keylen -- bytes at "key"
+**  	req -- request array
+**  	reqnum -- length of request array
+**
+**  Return value:
+**  	The matching entry, or NULL.
+**
+**  Notes:
+**  	An entry only answers a request for the same number of fields
+**  	with the same flags, since those control how a value is split.
+*/
+
+static struct dkimf_db_cacheent *
+dkimf_db_cache_find(struct dkimf_db_cache *cache, char *key, size_t keylen,
+                    DKIMF_DBDATA req, unsigned int reqnum)
+{
+	int c;
+	u_int hash;
+	struct dkimf_db_cacheent *ce;
+
+	hash = dkimf_db_cache_hash(key, keylen);
+
+	for (ce = cache->cache_buckets[hash & cache->cache_mask];
+	     ce != NULL;
+	     ce = ce->ce_hnext)
+	{
+		if (ce->ce_hash != hash || ce->ce_keylen != keylen ||
+		    ce->ce_reqnum != reqnum ||
+		    memcmp(ce->ce_key, key, keylen) != 0)
+			continue;
+
+		for (c = 0; c < reqnum; c++)
+		{
+			if (ce->ce_fields[c].cf_flags != req[c].dbdata_flags)
+				break;
+		}
+
+		if (c == reqnum)
+			return ce;
+	}
+
+	return NULL;
+}
+
+/*
+**  DKIMF_DB_CACHE_LINK -- add an entry to a result cache
+**
+**  Parameters:
+**  	cache -- result cache
+**  	ce -- entry to add
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_db_cache_link(struct dkimf_db_cache *cache,
+                    struct dkimf_db_cacheent *ce)
+{
+	u_int slot;
+
+	slot = ce->ce_hash & cache->cache_mask;
+	ce->ce_hnext = cache->cache_buckets[slot];
+	cache->cache_buckets[slot] = ce;
+
+	ce->ce_prev = NULL;
+	ce->ce_next = cache->cache_head;
+	if (ce->ce_next != NULL)
+		ce->ce_next->ce_prev = ce;
+	else
+		cache->cache_tail = ce;
+	cache->cache_head = ce;
+
+	cache->cache_stats.cs_entries++;
+	cache->cache_stats.cs_bytes += ce->ce_size;
+}
+
+/*
+**  DKIMF_DB_CACHE_UNLINK -- remove an entry from a result cache
+**
+**  Parameters:
+**  	cache -- result cache
+**  	ce -- entry to remove
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_db_cache_unlink(struct dkimf_db_cache *cache,
+                      struct dkimf_db_cacheent *ce)
+{
+	struct dkimf_db_cacheent **hp;
+
+	for (hp = &cache->cache_buckets[ce->ce_hash & cache->cache_mask];
+	     *hp != ce;
+	     hp = &(*hp)->ce_hnext)
+		assert(*hp != NULL);
+	*hp = ce->ce_hnext;
+
+	if (ce->ce_prev != NULL)
+		ce->ce_prev->ce_next = ce->ce_next;
+	else
+		cache->cache_head = ce->ce_next;
+	if (ce->ce_next != NULL)
+		ce->ce_next->ce_prev = ce->ce_prev;
+	else
+		cache->cache_tail = ce->ce_prev;
+
+	cache->cache_stats.cs_entries--;
+	cache->cache_stats.cs_bytes -= ce->ce_size;
+}
+
+/*
+**  DKIMF_DB_CACHE_FLUSH -- discard everything in a result cache
+**
+**  Parameters:
+**  	cache -- result cache
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Lookups in progress keep their placeholders.
+*/
+
+static void
+dkimf_db_cache_flush(struct dkimf_db_cache *cache)
+{
+	struct dkimf_db_cacheent *ce;
+	struct dkimf_db_cacheent *next;
+
+	pthread_mutex_lock(&cache->cache_lock);
+
+	for (ce = cache->cache_head; ce != NULL; ce = next)
+	{
+		next = ce->ce_next;
+
+		if (!ce->ce_pending)
+		{
+			dkimf_db_cache_unlink(cache, ce);
+			free(ce);
+		}
+	}
+
+	pthread_mutex_unlock(&cache->cache_lock);
+}
+
+/*
+**  DKIMF_DB_CACHE_NEW -- create a result cache
+**
+**  Parameters:
+**  	ttl -- lifetime of positive results
+**  	negttl -- lifetime of negative results
+**  	maxbytes -- memory limit
+**
+**  Return value:
+**  	A new result cache, or NULL on error.
+*/
+
+static struct dkimf_db_cache *
+dkimf_db_cache_new(u_int ttl, u_int negttl, size_t maxbytes)
+{
+	u_int nbuckets;
+	struct dkimf_db_cache *cache;
+
+	/* about one bucket for every couple of hundred bytes allowed */
+	for (nbuckets = DKIMF_DB_CACHE_MINBUCKETS;
+	     nbuckets < maxbytes / 256 &&
+	     nbuckets < DKIMF_DB_CACHE_MAXBUCKETS;
+	     nbuckets <<= 1)
+		continue;
+
+	cache = (struct dkimf_db_cache *) malloc(sizeof *cache);
+	if (cache == NULL)
+		return NULL;
+
+	memset(cache, '\0', sizeof *cache);
+
+	cache->cache_buckets = (struct dkimf_db_cacheent **) calloc(nbuckets,
+	                                                             sizeof(struct dkimf_db_cacheent *));
+	if (cache->cache_buckets == NULL)
+	{
+		free(cache);
+		return NULL;
+	}
+
+	cache->cache_mask = nbuckets - 1;
+	cache->cache_ttl = ttl;
+	cache->cache_negttl = negttl;
+	cache->cache_maxbytes = maxbytes;
+	pthread_mutex_init(&cache->cache_lock, NULL);
+	pthread_cond_init(&cache->cache_cond, NULL);
+
+	return cache;
+}
+
+/*
+**  DKIMF_DB_CACHE_FREE -- destroy a result cache
+**
+**  Parameters:
+**  	cache -- result cache
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_db_cache_free(struct dkimf_db_cache *cache)
+{
+	struct dkimf_db_cacheent *ce;
+	struct dkimf_db_cacheent *next;
+
+	for (ce = cache->cache_head; ce != NULL; ce = next)
+	{
+		next = ce->ce_next;
+		free(ce);
+	}
+
+	pthread_mutex_destroy(&cache->cache_lock);
+	pthread_cond_destroy(&cache->cache_cond);
+	free(cache->cache_buckets);
+	free(cache);
+}
+
+/*
+**  DKIMF_DB_CACHE_OPTIONS -- parse result cache options
+**
+**  Parameters:
+**  	opts -- options ("ttl=N,negttl=N,size=N"), up to a colon
+**  	ttl -- lifetime of positive results (returned)
+**  	negttl -- lifetime of negative results (returned)
+**  	maxbytes -- memory limit (returned)
+**
+**  Return value:
+**  	0 on success, -1 if the options are invalid.
+**
+**  Notes:
+**  	A size may end in "k" or "m".
+*/
+
+static int
+dkimf_db_cache_options(char *opts, u_int *ttl, u_int *negttl,
+                       size_t *maxbytes)
+{
+	u_long val;
+	char *p;
+	char *q;
+	char *end;
+
+	*ttl = DKIMF_DB_CACHE_DEFTTL;
+	*negttl = DKIMF_DB_CACHE_DEFNEGTTL;
+	*maxbytes = DKIMF_DB_CACHE_DEFSIZE;
+
+	for (p = opts; *p != ':'; p = q)
+	{
+		q = strchr(p, '=');
+		if (q == NULL)
+			return -1;
+
+		val = strtoul(q + 1, &end, 10);
+		if (end == q + 1)
+			return -1;
+
+		if (q - p == 3 && strncasecmp(p, "ttl", 3) == 0)
+		{
+			*ttl = val;
+		}
+		else if (q - p == 6 && strncasecmp(p, "negttl", 6) == 0)
+		{
+			*negttl = val;
+		}
+		else if (q - p == 4 && strncasecmp(p, "size", 4) == 0)
+		{
+			if (*end == 'k' || *end == 'K')
+			{
+				val *= 1024;
+				end++;
+			}
+			else if (*end == 'm' || *end == 'M')
+			{
+				val *= 1024 * 1024;
+				end++;
+			}
+
+			if (val == 0)
+				return -1;
+
+			*maxbytes = val;
+		}
+		else
+		{
+			return -1;
+		}
+
+		if (*end == ',')
+			end++;
+		else if (*end != ':')
+			return -1;
+
+		q = end;
+	}
+
+	return 0;
+}
+
 /*
 **  DKIMF_DB_OPEN -- open a database
 **
@@ -1817,12 +4227,21 @@ dkimf_db_erl_decode_response(ei_x_buff *resp, const char *notfound,
 **  	ldap -- an LDAP server, interace provide by OpenLDAP
 **  	lua -- a Lua script; the returned value is the result
 **  	erlang -- an erlang function to be called in a distributed erlang node
+**
+**  	Any of these may be preceded by "cache:[options:]" to put a result
+**  	cache in front of it.  The options are "ttl=N" and "negttl=N",
+**  	the seconds to keep positive and negative results, and "size=N",
+**  	the memory limit in bytes, separated by commas.
 */
 
 int
 dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
               char **err)
 {
+	_Bool cached = FALSE;
+	u_int ttl = 0;
+	u_int negttl = 0;
+	size_t maxbytes = 0;
 	DKIMF_DB new;
 	char *comma;
 	char *p;
@@ -1830,6 +4249,34 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 	assert(db != NULL);
 	assert(name != NULL);
 
+	/* result cache prefix */
+	if (strncasecmp(name, "cache:", 6) == 0)
+	{
+		cached = TRUE;
+		name += 6;
+
+		/* options come first if there's an "=" before the colon */
+		p = strchr(name, ':');
+		comma = strchr(name, '=');
+		if (comma != NULL && p != NULL && comma < p)
+		{
+			if (dkimf_db_cache_options(name, &ttl, &negttl,
+			                           &maxbytes) != 0)
+			{
+				if (err != NULL)
+					*err = "Invalid cache options";
+				return 2;
+			}
+
+			name = p + 1;
+		}
+		else
+		{
+			(void) dkimf_db_cache_options(":", &ttl, &negttl,
+			                              &maxbytes);
+		}
+	}
+
 	new = (DKIMF_DB) malloc(sizeof(struct dkimf_db));
 	if (new == NULL)
 	{
@@ -1901,8 +4348,7 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 	}
 
 	/* force DB accesses to be mutex-protected */
-	if (new->db_type == DKIMF_DB_TYPE_DSN ||
-	    new->db_type == DKIMF_DB_TYPE_SOCKET)
+	if (new->db_type == DKIMF_DB_TYPE_DSN)
 		new->db_flags |= DKIMF_DB_FLAG_MAKELOCK;
 
 	/* use provided lock, or create a new one if needed */
@@ -2092,6 +4538,13 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 		new->db_handle = list;
 		new->db_nrecs = n;
 
+		if (list != NULL &&
+		    (new->db_flags & DKIMF_DB_FLAG_NOINDEX) == 0)
+		{
+			new->db_index = dkimf_db_index_new(list, n,
+			                                   (new->db_flags & DKIMF_DB_FLAG_ICASE) != 0);
+		}
+
 		break;
 	  }
 
@@ -2290,6 +4743,13 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 		new->db_handle = list;
 		new->db_nrecs = n;
 
+		if (list != NULL &&
+		    (new->db_flags & DKIMF_DB_FLAG_NOINDEX) == 0)
+		{
+			new->db_index = dkimf_db_index_new(list, n,
+			                                   (new->db_flags & DKIMF_DB_FLAG_ICASE) != 0);
+		}
+
 		break;
 	  }
 
@@ -2402,6 +4862,9 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 				return -1;
 			}
 
+			newl->db_relist_glob = dkimf_db_mkglob(line,
+			                                       (new->db_flags & DKIMF_DB_FLAG_ICASE) != 0);
+
 			if (data != NULL)
 			{
 				newl->db_relist_data = strdup(data);
@@ -2437,6 +4900,13 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 
 		new->db_handle = head;
 
+		if (head != NULL &&
+		    (new->db_flags & DKIMF_DB_FLAG_NOINDEX) == 0)
+		{
+			new->db_retrie = dkimf_db_retrie_new(head,
+			                                     (new->db_flags & DKIMF_DB_FLAG_ICASE) != 0);
+		}
+
 		break;
 	  }
 
@@ -2468,9 +4938,67 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 		if (*p == '\0')
 		{
 			new->db_flags |= DKIMF_DB_FLAG_NOFDLOCK;
-			flags = new->db_flags;
-			p = NULL;
+			flags = new->db_flags;
+			p = NULL;
+		}
+
+# ifdef DKIMF_DB_BDB_MR
+		/* read-only files get concurrent readers instead of locks */
+		if (p != NULL && (new->db_flags & DKIMF_DB_FLAG_READONLY) != 0)
+		{
+			struct stat sb;
+			struct dkimf_db_bdb *bdb;
+
+			bdb = (struct dkimf_db_bdb *) malloc(sizeof *bdb);
+			if (bdb == NULL)
+			{
+				if (err != NULL)
+					*err = strerror(errno);
+				free(new);
+				return -1;
+			}
+			memset(bdb, '\0', sizeof *bdb);
+
+			bdb->bdb_path = strdup(p);
+			if (bdb->bdb_path == NULL)
+			{
+				if (err != NULL)
+					*err = strerror(errno);
+				free(bdb);
+				free(new);
+				return -1;
+			}
+
+			status = dkimf_db_bdb_open(p, &sb, &bdb->bdb_current);
+			if (status != 0)
+			{
+				if (err != NULL)
+					*err = DB_STRERROR(status);
+				free(bdb->bdb_path);
+				free(bdb);
+				free(new);
+				return 3;
+			}
+
+			pthread_rwlock_init(&bdb->bdb_lock, NULL);
+			dkimf_db_bdb_setid(bdb, &sb);
+			(void) time(&bdb->bdb_checked);
+
+			if ((new->db_flags & DKIMF_DB_FLAG_MAKELOCK) != 0)
+			{
+				pthread_mutex_destroy(new->db_lock);
+				free(new->db_lock);
+				new->db_flags &= ~DKIMF_DB_FLAG_MAKELOCK;
+			}
+			new->db_lock = NULL;
+			new->db_flags |= DKIMF_DB_FLAG_NOFDLOCK;
+
+			new->db_handle = bdb->bdb_current->bdbh_db;
+			new->db_data = bdb;
+
+			break;
 		}
+# endif /* DKIMF_DB_BDB_MR */
 
 # if DB_VERSION_CHECK(3,0,0)
 		status = db_create(&newdb, NULL, 0);
@@ -3188,18 +5716,17 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 #ifdef _FFR_SOCKETDB
 	  case DKIMF_DB_TYPE_SOCKET:
 	  {
+		_Bool pipeline = FALSE;
+		_Bool emptynf = FALSE;
+		int c;
 		int fd;
 		int status;
+		u_int nconns = 1;
+		char *opt;
+		char *last;
+		char *q;
 		struct dkimf_db_socket *sdb;
-
-		sdb = (struct dkimf_db_socket *) malloc(sizeof *sdb);
-		if (sdb == NULL)
-		{
-			if (err != NULL)
-				*err = strerror(errno);
-			free(new);
-			return 2;
-		}
+		char spec[BUFRSZ + 1];
 
 		if ((new->db_flags & DKIMF_DB_FLAG_READONLY) == 0)
 		{
@@ -3210,6 +5737,53 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 			return 2;
 		}
 
+		/*
+		**  options:
+		**  socket:{port@host|path}[?conns=N][&pipeline][&emptynotfound]
+		*/
+		strlcpy(spec, p, sizeof spec);
+		p = spec;
+
+		q = strchr(spec, '?');
+		if (q != NULL)
+		{
+			*q = '\0';
+
+			for (opt = strtok_r(q + 1, "&", &last);
+			     opt != NULL;
+			     opt = strtok_r(NULL, "&", &last))
+			{
+				if (strncasecmp(opt, "conns=", 6) == 0)
+				{
+					nconns = strtoul(opt + 6, &q, 10);
+					if (*q != '\0' || nconns == 0 ||
+					    nconns > DKIMF_SOCKET_MAXCONNS)
+						opt = NULL;
+				}
+				else if (strcasecmp(opt, "pipeline") == 0)
+				{
+					pipeline = TRUE;
+				}
+				else if (strcasecmp(opt, "emptynotfound") == 0)
+				{
+					emptynf = TRUE;
+				}
+				else
+				{
+					opt = NULL;
+				}
+
+				if (opt == NULL)
+				{
+					if (err != NULL)
+						*err = "Invalid socket data set option";
+					free(new);
+					errno = EINVAL;
+					return 2;
+				}
+			}
+		}
+
 		if (*p == '/')
 		{					/* UNIX domain */
 			struct sockaddr_un sun;
@@ -3529,8 +6103,76 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 			}
 		}
 
-		sdb->sockdb_fd = fd;
-		sdb->sockdb_buf = dkimf_dstring_new(BUFRSZ, 0);
+		sdb = (struct dkimf_db_socket *) malloc(sizeof *sdb);
+		if (sdb == NULL)
+		{
+			if (err != NULL)
+				*err = strerror(errno);
+			close(fd);
+			free(new);
+			return 2;
+		}
+
+		memset(sdb, '\0', sizeof *sdb);
+
+		/*
+		**  Remember the peer so lost connections can be replaced,
+		**  and make this one non-blocking like them.
+		*/
+
+		sdb->sockdb_addrlen = sizeof sdb->sockdb_addr;
+		if (getpeername(fd, (struct sockaddr *) &sdb->sockdb_addr,
+		                &sdb->sockdb_addrlen) != 0 ||
+		    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) == -1)
+		{
+			if (err != NULL)
+				*err = strerror(errno);
+			close(fd);
+			free(sdb);
+			free(new);
+			return 2;
+		}
+
+		sdb->sockdb_conns = (struct dkimf_db_sockconn *) malloc(nconns *
+		                    sizeof(struct dkimf_db_sockconn));
+		if (sdb->sockdb_conns == NULL)
+		{
+			if (err != NULL)
+				*err = strerror(errno);
+			close(fd);
+			free(sdb);
+			free(new);
+			return 2;
+		}
+
+		memset(sdb->sockdb_conns, '\0',
+		       nconns * sizeof(struct dkimf_db_sockconn));
+
+		for (c = 0; c < nconns; c++)
+		{
+			sdb->sockdb_conns[c].sc_fd = -1;
+			sdb->sockdb_conns[c].sc_buf = dkimf_dstring_new(BUFRSZ,
+			                                                0);
+			if (sdb->sockdb_conns[c].sc_buf == NULL)
+			{
+				if (err != NULL)
+					*err = strerror(errno);
+				while (--c >= 0)
+					dkimf_dstring_free(sdb->sockdb_conns[c].sc_buf);
+				close(fd);
+				free(sdb->sockdb_conns);
+				free(sdb);
+				free(new);
+				return 2;
+			}
+		}
+
+		sdb->sockdb_conns[0].sc_fd = fd;
+		sdb->sockdb_nconns = nconns;
+		sdb->sockdb_pipeline = pipeline;
+		sdb->sockdb_emptynf = emptynf;
+		pthread_mutex_init(&sdb->sockdb_lock, NULL);
+		pthread_cond_init(&sdb->sockdb_cond, NULL);
 
 		new->db_handle = sdb;
 
@@ -3542,11 +6184,17 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 	  case DKIMF_DB_TYPE_MDB:
 	  {
 		int status;
+		u_int envflags = 0;
 		struct dkimf_db_mdb *mdb;
 
 		mdb = (struct dkimf_db_mdb *) malloc(sizeof *mdb);
 		if (mdb == NULL)
 			return -1;
+		memset(mdb, '\0', sizeof *mdb);
+
+		/* read-only tables get a transaction per concurrent reader */
+		if ((new->db_flags & DKIMF_DB_FLAG_READONLY) != 0)
+			envflags = MDB_RDONLY|MDB_NOTLS;
 
 		status = mdb_env_create(&mdb->mdb_env);
 		if (status != 0)
@@ -3557,7 +6205,7 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 			return -1;
 		}
 
-		status = mdb_env_open(mdb->mdb_env, p, 0, 0);
+		status = mdb_env_open(mdb->mdb_env, p, envflags, 0);
 		if (status != 0)
 		{
 			if (err != NULL)
@@ -3567,7 +6215,8 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 			return -1;
 		}
 
-		status = mdb_txn_begin(mdb->mdb_env, NULL, 0, &mdb->mdb_txn);
+		status = mdb_txn_begin(mdb->mdb_env, NULL,
+		                       envflags & MDB_RDONLY, &mdb->mdb_txn);
 		if (status != 0)
 		{
 			if (err != NULL)
@@ -3588,6 +6237,8 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 			return -1;
 		}
 
+		pthread_mutex_init(&mdb->mdb_lock, NULL);
+
 		new->db_data = (void *) mdb;
 
 		break;
@@ -3621,6 +6272,8 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 			return -1;
 		}
 
+		pthread_mutex_init(&e->erlang_lock, NULL);
+
 		c = 0;
 
 		for (q = strtok_r(tmp, ":", &last);
@@ -3675,6 +6328,18 @@ dkimf_db_open(DKIMF_DB *db, char *name, u_int flags, pthread_mutex_t *lock,
 #endif /* USE_ERLANG */
 	}
 
+	if (cached)
+	{
+		new->db_cache = dkimf_db_cache_new(ttl, negttl, maxbytes);
+		if (new->db_cache == NULL)
+		{
+			if (err != NULL)
+				*err = strerror(errno);
+			(void) dkimf_db_close(new);
+			return -1;
+		}
+	}
+
 	*db = new;
 	return 0;
 }
@@ -3717,6 +6382,9 @@ dkimf_db_delete(DKIMF_DB db, void *buf, size_t buflen)
 	    db->db_type == DKIMF_DB_TYPE_ERLANG)
 		return EINVAL;
 
+	if (db->db_cache != NULL)
+		dkimf_db_cache_flush(db->db_cache);
+
 #ifdef USE_DB
 	bdb = (DB *) db->db_handle;
 
@@ -3873,6 +6541,9 @@ dkimf_db_put(DKIMF_DB db, void *buf, size_t buflen,
 	    db->db_type == DKIMF_DB_TYPE_REFILE)
 		return EINVAL;
 
+	if (db->db_cache != NULL)
+		dkimf_db_cache_flush(db->db_cache);
+
 #ifdef USE_DB
 	bdb = (DB *) db->db_handle;
 
@@ -4042,7 +6713,8 @@ dkimf_db_put(DKIMF_DB db, void *buf, size_t buflen,
 }
 
 /*
-**  DKIMF_DB_GET -- retrieve data from an open database
+**  DKIMF_DB_FETCH -- retrieve data from an open database, bypassing any
+**                    result cache
 **
 **  Parameters:
 **  	db -- DB handle to use for searching
@@ -4054,37 +6726,12 @@ dkimf_db_put(DKIMF_DB db, void *buf, size_t buflen,
 **  	          was found, FALSE otherwise (may be NULL)
 **
 **  Return value:
-**  	0 -- operation successful
-**	!0 -- error occurred; error code returned
-**
-**  Notes:
-**  	"req" references a caller-provided array of DKIMF_DBDATA
-**  	structures that describe the name of the attribute wanted,
-**  	the location to which to write the data, and how big that buffer is.
-**  	On completion, any found attributes will have their lengths
-**  	set to the number of bytes retrieved and the data will be copied
-**  	up to the limit (if more data was retrieved than the space available,
-**  	the available space will be filled but the returned length will be
-**  	longer); any not-found attributes will leave the buffers unchanged
-**  	and the lengths will be set to (unsigned int) -1.
-**
-**  	For LDAP queries, the attribute name is used as the LDAP attribute
-**  	name in the request.
-**
-**  	For SQL queries, the attribute name is not used; columns are specified
-**  	in the DSN (see dkimf_db_open() above), and are copied into the
-**  	request in order.
-**
-**  	For backward compatibility, text values in the other databases
-**  	that are colon-delimited will be parsed as such, and the requested
-**  	values will be filled in in order (so for "aaa:bbb", "aaa" will be
-**  	copied into the first attribute, "bbb" will be copied to the second,
-**  	and all others will receive no data.
+**  	As for dkimf_db_get().
 */
 
-int
-dkimf_db_get(DKIMF_DB db, void *buf, size_t buflen,
-             DKIMF_DBDATA req, unsigned int reqnum, _Bool *exists)
+static int
+dkimf_db_fetch(DKIMF_DB db, void *buf, size_t buflen,
+               DKIMF_DBDATA req, unsigned int reqnum, _Bool *exists)
 {
 	_Bool matched;
 
@@ -4123,50 +6770,40 @@ dkimf_db_get(DKIMF_DB db, void *buf, size_t buflen,
 	  {
 		struct dkimf_db_list *list;
 
-		for (list = (struct dkimf_db_list *) db->db_handle;
-		     list != NULL;
-		     list = list->db_list_next)
+		if (db->db_index != NULL)
 		{
-			matched = FALSE;
-
-			if ((db->db_flags & DKIMF_DB_FLAG_ICASE) == 0)
+			for (list = dkimf_db_index_find(db->db_index, buf,
+			                                (db->db_flags & DKIMF_DB_FLAG_ICASE) != 0);
+			     list != NULL;
+			     list = list->db_list_samekey)
 			{
-				if (strcmp(buf, list->db_list_key) == 0)
-					matched = TRUE;
+				if (dkimf_db_list_valmatch(db, list, req, reqnum))
+					break;
 			}
-			else
+		}
+		else
+		{
+			for (list = (struct dkimf_db_list *) db->db_handle;
+			     list != NULL;
+			     list = list->db_list_next)
 			{
-				if (strcasecmp(buf, list->db_list_key) == 0)
-					matched = TRUE;
-			}
+				matched = FALSE;
 
-			if (!matched)
-				continue;
-
-			if ((db->db_flags & DKIMF_DB_FLAG_MATCHBOTH) == 0 ||
-			    reqnum == 0 || list->db_list_value == NULL)
-				break;
-
-			matched = FALSE;
-			assert(list->db_list_value != NULL);
+				if ((db->db_flags & DKIMF_DB_FLAG_ICASE) == 0)
+				{
+					if (strcmp(buf, list->db_list_key) == 0)
+						matched = TRUE;
+				}
+				else
+				{
+					if (strcasecmp(buf, list->db_list_key) == 0)
+						matched = TRUE;
+				}
 
-			if ((db->db_flags & DKIMF_DB_FLAG_ICASE) == 0)
-			{
-				if (strncmp(req[0].dbdata_buffer,
-				            list->db_list_value,
-				            req[0].dbdata_buflen) == 0)
-					matched = TRUE;
-			}
-			else
-			{
-				if (strncasecmp(req[0].dbdata_buffer,
-				                list->db_list_value,
-				                req[0].dbdata_buflen) == 0)
-					matched = TRUE;
+				if (matched &&
+				    dkimf_db_list_valmatch(db, list, req, reqnum))
+					break;
 			}
-
-			if (matched)
-				break;
 		}
 
 		if (list == NULL)
@@ -4194,33 +6831,40 @@ dkimf_db_get(DKIMF_DB db, void *buf, size_t buflen,
 	  {
 		struct dkimf_db_relist *list;
 
-		list = (struct dkimf_db_relist *) db->db_handle;
-
-		while (list != NULL)
+		if (db->db_retrie != NULL)
+		{
+			(void) dkimf_db_retrie_find(db, buf, 0, &list);
+		}
+		else
 		{
-			if (regexec(&list->db_relist_re, buf, 0, NULL, 0) == 0)
+			for (list = (struct dkimf_db_relist *) db->db_handle;
+			     list != NULL;
+			     list = list->db_relist_next)
 			{
-				if (exists != NULL)
-					*exists = TRUE;
-
-				if (reqnum != 0 &&
-				    list->db_relist_data != NULL)
-				{
-					if (dkimf_db_datasplit(list->db_relist_data,
-					                       strlen(list->db_relist_data),
-					                       req,
-					                       reqnum) != 0)
-						return -1;
-				}
-
-				return 0;
+				if (regexec(&list->db_relist_re, buf,
+				            0, NULL, 0) == 0)
+					break;
 			}
+		}
+
+		if (list == NULL)
+		{
+			if (exists != NULL)
+				*exists = FALSE;
 
-			list = list->db_relist_next;
+			return 0;
 		}
 
 		if (exists != NULL)
-			*exists = FALSE;
+			*exists = TRUE;
+
+		if (reqnum != 0 && list->db_relist_data != NULL)
+		{
+			if (dkimf_db_datasplit(list->db_relist_data,
+			                       strlen(list->db_relist_data),
+			                       req, reqnum) != 0)
+				return -1;
+		}
 
 		return 0;
 	  }
@@ -4236,6 +6880,11 @@ dkimf_db_get(DKIMF_DB db, void *buf, size_t buflen,
 		DBT q;
 		char databuf[BUFRSZ + 1];
 
+# ifdef DKIMF_DB_BDB_MR
+		if (db->db_data != NULL)
+			bdb = dkimf_db_bdb_get(db);
+		else
+# endif /* DKIMF_DB_BDB_MR */
 		bdb = (DB *) db->db_handle;
 
 		memset(&d, 0, sizeof d);
@@ -4393,6 +7042,16 @@ dkimf_db_get(DKIMF_DB db, void *buf, size_t buflen,
 		if (db->db_lock != NULL)
 			(void) pthread_mutex_unlock(db->db_lock);
 
+# ifdef DKIMF_DB_BDB_MR
+		if (db->db_data != NULL)
+		{
+			struct dkimf_db_bdb *mr;
+
+			mr = (struct dkimf_db_bdb *) db->db_data;
+			pthread_rwlock_unlock(&mr->bdb_lock);
+		}
+# endif /* DKIMF_DB_BDB_MR */
+
 		return ret;
 	  }
 #endif /* USE_DB */
@@ -5278,91 +7937,46 @@ dkimf_db_get(DKIMF_DB db, void *buf, size_t buflen,
 	  {
 		int status;
 		size_t len;
-		size_t wlen;
-		fd_set rfds;
-		struct timeval timeout;
-		struct iovec iov[2];
+		char *val;
 		struct dkimf_db_socket *sdb;
-		char *tmp;
-		char inbuf[BUFRSZ];
+		struct dkimf_dstring *reply;
 
 		sdb = (struct dkimf_db_socket *) db->db_handle;
 
-		timeout.tv_sec = DKIMF_SOCKET_TIMEOUT;
-		timeout.tv_usec = 0;
-
-		iov[0].iov_base = buf;
-		iov[0].iov_len = buflen;
-
-		iov[1].iov_base = "\n";
-		iov[1].iov_len = 1;
-
-		/* single-thread readers */
-		if (db->db_lock != NULL)
-			(void) pthread_mutex_lock(db->db_lock);
-
-		wlen = writev(sdb->sockdb_fd, iov, 2);
-		if (wlen < buflen + 1)
+		reply = dkimf_dstring_new(BUFRSZ, 0);
+		if (reply == NULL)
 		{
 			db->db_status = errno;
-			if (db->db_lock != NULL)
-				(void) pthread_mutex_unlock(db->db_lock);
 			return -1;
 		}
 
-		FD_ZERO(&rfds);
-		FD_SET(sdb->sockdb_fd, &rfds);
-
-		dkimf_dstring_blank(sdb->sockdb_buf);
-
-		for (;;)
+		status = dkimf_db_sock_query(sdb, buf, buflen, reply);
+		if (status != 0)
 		{
-			status = select(sdb->sockdb_fd + 1, &rfds, NULL, NULL,
-			                &timeout);
-			if (status != 1)
-			{
-				db->db_status = errno;
-				if (db->db_lock != NULL)
-					(void) pthread_mutex_unlock(db->db_lock);
-				return -1;
-			}
-
-			wlen = read(sdb->sockdb_fd, inbuf, sizeof inbuf);
-			if (wlen == (size_t) -1)
-			{
-				db->db_status = errno;
-				if (db->db_lock != NULL)
-					(void) pthread_mutex_unlock(db->db_lock);
-				return -1;
-			}
-
-			if (wlen == 0)
-				break;
-
-			dkimf_dstring_catn(sdb->sockdb_buf, inbuf, wlen);
-
-			tmp = dkimf_dstring_get(sdb->sockdb_buf);
-			len = dkimf_dstring_len(sdb->sockdb_buf);
-
-			if (tmp[len - 1] == '\n')
-				break;
+			db->db_status = status;
+			dkimf_dstring_free(reply);
+			return -1;
 		}
 
-		if (len > 0 && exists != NULL)
-			*exists = TRUE;
-
-		if (dkimf_db_datasplit(tmp, len - 1, req, reqnum) != 0)
+		/* an empty reply is an empty value unless told otherwise */
+		len = dkimf_dstring_len(reply);
+		if (len == 0 && sdb->sockdb_emptynf)
 		{
-			if (db->db_lock != NULL)
-				(void) pthread_mutex_unlock(db->db_lock);
-			return -1;
+			if (exists != NULL)
+				*exists = FALSE;
 		}
 		else
 		{
-			if (db->db_lock != NULL)
-				(void) pthread_mutex_unlock(db->db_lock);
-			return 0;
+			if (exists != NULL)
+				*exists = TRUE;
+
+			val = (char *) dkimf_dstring_get(reply);
+			status = dkimf_db_datasplit(val, len, req, reqnum);
 		}
+
+		dkimf_dstring_free(reply);
+
+		return (status == 0 ? 0 : -1);
 	  }
 #endif /* _FFR_SOCKETDB */
 
@@ -5374,10 +7988,51 @@ dkimf_db_get(DKIMF_DB db, void *buf, size_t buflen,
 		MDB_val key;
 		MDB_val data;
 
-		mdb = (struct dkimf_db_mdb *) db->db_handle;
+		mdb = (struct dkimf_db_mdb *) db->db_data;
+
+		key.mv_size = buflen;
+		key.mv_data = buf;
+
+		if ((db->db_flags & DKIMF_DB_FLAG_READONLY) != 0)
+		{
+			int ret = 0;
+			struct dkimf_db_mdbreader *r;
+
+			r = dkimf_db_mdb_reader(mdb, &status);
+			if (r == NULL)
+			{
+				db->db_status = status;
+				return -1;
+			}
+
+			status = mdb_get(r->mdbr_txn, mdb->mdb_dbi,
+			                 &key, &data);
+			if (status == MDB_NOTFOUND)
+			{
+				if (exists != NULL)
+					*exists = FALSE;
+			}
+			else if (status == 0)
+			{
+				if (exists != NULL)
+					*exists = TRUE;
+
+				/* copy out before the transaction is reset */
+				if (dkimf_db_datasplit(data.mv_data,
+				                       data.mv_size,
+				                       req, reqnum) != 0)
+					ret = -1;
+			}
+			else
+			{
+				db->db_status = status;
+				ret = -1;
+			}
+
+			dkimf_db_mdb_release(mdb, r);
 
-		key.mv_size = buflen;
-		key.mv_data = buf;
+			return ret;
+		}
 
 		status = mdb_get(mdb->mdb_txn, mdb->mdb_dbi, &key, &data);
 		if (status == MDB_NOTFOUND)
@@ -5407,18 +8062,13 @@ dkimf_db_get(DKIMF_DB db, void *buf, size_t buflen,
 #ifdef USE_ERLANG
 	  case DKIMF_DB_TYPE_ERLANG:
 	  {
-		int fd;
 		int ret;
 		int res_size;
 		int res_index;
 		int res_type;
-		struct dkimf_db_erlang *e;
-		ei_cnode ec;
 		ei_x_buff args;
 		ei_x_buff resp;
 
-		e = (struct dkimf_db_erlang *) db->db_data;
-
 		ei_x_new(&args);
 		ei_x_new(&resp);
 
@@ -5426,18 +8076,7 @@ dkimf_db_get(DKIMF_DB db, void *buf, size_t buflen,
 		ei_x_encode_binary(&args, buf, strlen(buf));
 		ei_x_encode_empty_list(&args);
 
-		fd = dkimf_db_erl_connect(db, &ec);
-		if (fd < 0)
-		{
-			db->db_status = erl_errno;
-			ei_x_free(&args);
-			ei_x_free(&resp);
-			return -1;
-		}
-
-		ret = ei_rpc(&ec, fd, e->erlang_module, e->erlang_function,
-			     args.buff, args.index, &resp);
-		close(fd);
+		ret = dkimf_db_erl_rpc(db, &args, &resp);
 		if (ret == -1)
 		{
 			db->db_status = erl_errno;
@@ -5475,6 +8114,317 @@ dkimf_db_get(DKIMF_DB db, void *buf, size_t buflen,
 	/* NOTREACHED */
 }
 
+/*
+**  DKIMF_DB_CACHE_GET -- look up a key through a data set's result cache
+**
+**  Parameters:
+**  	db -- data set
+**  	buf -- key
+**  	buflen -- bytes at "buf"
+**  	req -- request array
+**  	reqnum -- length of request array
+**  	exists -- whether the key was found (returned)
+**
+**  Return value:
+**  	As for dkimf_db_get().
+**
+**  Notes:
+**  	A miss inserts a placeholder for the key before asking the data
+**  	set, so that other threads after the same key wait for that answer
+**  	instead of asking too.  Results are only kept if every requested
+**  	field fit in the caller's buffer; errors are never kept.
+*/
+
+static int
+dkimf_db_cache_get(DKIMF_DB db, void *buf, size_t buflen,
+                   DKIMF_DBDATA req, unsigned int reqnum, _Bool *exists)
+{
+	_Bool found = FALSE;
+	_Bool waited = FALSE;
+	_Bool keep;
+	int c;
+	int status;
+	size_t datalen;
+	uint64_t usecs;
+	time_t now;
+	char *data;
+	struct dkimf_db_cache *cache;
+	struct dkimf_db_cacheent *ce;
+	struct dkimf_db_cacheent *ph;
+	struct timeval start;
+	struct timeval end;
+
+	cache = db->db_cache;
+
+	pthread_mutex_lock(&cache->cache_lock);
+
+	for (;;)
+	{
+		ce = dkimf_db_cache_find(cache, buf, buflen, req, reqnum);
+		if (ce == NULL || !ce->ce_pending)
+			break;
+
+		/* somebody else is already asking; wait for the answer */
+		if (!waited)
+		{
+			cache->cache_stats.cs_coalesced++;
+			waited = TRUE;
+		}
+
+		pthread_cond_wait(&cache->cache_cond, &cache->cache_lock);
+	}
+
+	(void) time(&now);
+
+	if (ce != NULL && ce->ce_expire <= now)
+	{
+		dkimf_db_cache_unlink(cache, ce);
+		free(ce);
+		ce = NULL;
+	}
+
+	if (ce != NULL)
+	{
+		/* move it to the front */
+		if (ce->ce_prev != NULL)
+		{
+			ce->ce_prev->ce_next = ce->ce_next;
+			if (ce->ce_next != NULL)
+				ce->ce_next->ce_prev = ce->ce_prev;
+			else
+				cache->cache_tail = ce->ce_prev;
+
+			ce->ce_prev = NULL;
+			ce->ce_next = cache->cache_head;
+			cache->cache_head->ce_prev = ce;
+			cache->cache_head = ce;
+		}
+
+		cache->cache_stats.cs_hits++;
+		if (!ce->ce_exists)
+			cache->cache_stats.cs_neghits++;
+
+		for (c = 0; ce->ce_exists && c < reqnum; c++)
+		{
+			if (ce->ce_fields[c].cf_len != (size_t) -1)
+			{
+				memcpy(req[c].dbdata_buffer,
+				       ce->ce_fields[c].cf_data,
+				       MIN(ce->ce_fields[c].cf_len,
+				           req[c].dbdata_buflen));
+			}
+			req[c].dbdata_buflen = ce->ce_fields[c].cf_len;
+		}
+
+		if (exists != NULL)
+			*exists = ce->ce_exists;
+
+		pthread_mutex_unlock(&cache->cache_lock);
+
+		return 0;
+	}
+
+	/* a placeholder, which also remembers how big the buffers were */
+	ph = dkimf_db_cache_mkent(buf, buflen, req, reqnum, 0);
+	if (ph != NULL)
+	{
+		ph->ce_pending = TRUE;
+		for (c = 0; c < reqnum; c++)
+			ph->ce_fields[c].cf_len = req[c].dbdata_buflen;
+		dkimf_db_cache_link(cache, ph);
+	}
+
+	cache->cache_stats.cs_misses++;
+
+	pthread_mutex_unlock(&cache->cache_lock);
+
+	(void) gettimeofday(&start, NULL);
+	status = dkimf_db_fetch(db, buf, buflen, req, reqnum, &found);
+	(void) gettimeofday(&end, NULL);
+
+	usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+	        (end.tv_usec - start.tv_usec);
+
+	keep = (ph != NULL && status == 0 &&
+	        (found ? cache->cache_ttl : cache->cache_negttl) > 0);
+
+	datalen = 0;
+	for (c = 0; keep && found && c < reqnum; c++)
+	{
+		if (req[c].dbdata_buflen == (size_t) -1)
+			continue;
+		else if (req[c].dbdata_buflen > ph->ce_fields[c].cf_len)
+			keep = FALSE;
+		else
+			datalen += req[c].dbdata_buflen;
+	}
+
+	ce = NULL;
+	if (keep)
+	{
+		ce = dkimf_db_cache_mkent(buf, buflen, req, reqnum,
+		                          found ? datalen : 0);
+	}
+
+	if (ce != NULL)
+	{
+		ce->ce_exists = found;
+		ce->ce_expire = now + (found ? cache->cache_ttl
+		                             : cache->cache_negttl);
+
+		data = ce->ce_key + ce->ce_keylen;
+		for (c = 0; found && c < reqnum; c++)
+		{
+			ce->ce_fields[c].cf_len = req[c].dbdata_buflen;
+			if (req[c].dbdata_buflen == (size_t) -1)
+				continue;
+
+			ce->ce_fields[c].cf_data = data;
+			memcpy(data, req[c].dbdata_buffer,
+			       req[c].dbdata_buflen);
+			data += req[c].dbdata_buflen;
+		}
+	}
+
+	pthread_mutex_lock(&cache->cache_lock);
+
+	if (ph != NULL)
+	{
+		dkimf_db_cache_unlink(cache, ph);
+		free(ph);
+	}
+
+	if (ce != NULL)
+	{
+		dkimf_db_cache_link(cache, ce);
+
+		/* evict the least recently used entries to stay in bounds */
+		while (cache->cache_stats.cs_bytes > cache->cache_maxbytes)
+		{
+			struct dkimf_db_cacheent *old;
+
+			for (old = cache->cache_tail;
+			     old != NULL && old->ce_pending;
+			     old = old->ce_prev)
+				continue;
+
+			if (old == NULL)
+				break;
+
+			dkimf_db_cache_unlink(cache, old);
+			free(old);
+			cache->cache_stats.cs_evictions++;
+		}
+	}
+
+	cache->cache_stats.cs_usecs += usecs;
+	if (usecs > cache->cache_stats.cs_maxusecs)
+		cache->cache_stats.cs_maxusecs = usecs;
+
+	if (ph != NULL)
+		pthread_cond_broadcast(&cache->cache_cond);
+
+	pthread_mutex_unlock(&cache->cache_lock);
+
+	if (exists != NULL)
+		*exists = found;
+
+	return status;
+}
+
+/*
+**  DKIMF_DB_CACHESTATS -- report on a data set's result cache
+**
+**  Parameters:
+**  	db -- data set
+**  	stats -- statistics (returned)
+**
+**  Return value:
+**  	0 on success, -1 if "db" has no result cache.
+*/
+
+int
+dkimf_db_cachestats(DKIMF_DB db, struct dkimf_db_cachestats *stats)
+{
+	assert(db != NULL);
+	assert(stats != NULL);
+
+	if (db->db_cache == NULL)
+		return -1;
+
+	pthread_mutex_lock(&db->db_cache->cache_lock);
+	memcpy(stats, &db->db_cache->cache_stats, sizeof *stats);
+	pthread_mutex_unlock(&db->db_cache->cache_lock);
+
+	return 0;
+}
+
+/*
+**  DKIMF_DB_GET -- retrieve data from an open database
+**
+**  Parameters:
+**  	db -- DB handle to use for searching
+**  	buf -- pointer to the key
+**  	buflen -- length of key (use strlen() if 0)
+**  	req -- list of data requests
+**  	reqnum -- number of data requests
+**  	exists -- pointer to a "_Bool" updated to be TRUE if the record
+**  	          was found, FALSE otherwise (may be NULL)
+**
+**  Return value:
+**  	0 -- operation successful
+**	!0 -- error occurred; error code returned
+**
+**  Notes:
+**  	"req" references a caller-provided array of DKIMF_DBDATA
+**  	structures that describe the name of the attribute wanted,
+**  	the location to which to write the data, and how big that buffer is.
+**  	On completion, any found attributes will have their lengths
+**  	set to the number of bytes retrieved and the data will be copied
+**  	up to the limit (if more data was retrieved than the space available,
+**  	the available space will be filled but the returned length will be
+**  	longer); any not-found attributes will leave the buffers unchanged
+**  	and the lengths will be set to (unsigned int) -1.
+**
+**  	For LDAP queries, the attribute name is used as the LDAP attribute
+**  	name in the request.
+**
+**  	For SQL queries, the attribute name is not used; columns are specified
+**  	in the DSN (see dkimf_db_open() above), and are copied into the
+**  	request in order.
+**
+**  	If the data set has a result cache (see dkimf_db_open()), the
+**  	answer may come from there; see dkimf_db_cache_get().
+**
+**  	For backward compatibility, text values in the other databases
+**  	that are colon-delimited will be parsed as such, and the requested
+**  	values will be filled in in order (so for "aaa:bbb", "aaa" will be
+**  	copied into the first attribute, "bbb" will be copied to the second,
+**  	and all others will receive no data.
+*/
+
+int
+dkimf_db_get(DKIMF_DB db, void *buf, size_t buflen,
+             DKIMF_DBDATA req, unsigned int reqnum, _Bool *exists)
+{
+	assert(db != NULL);
+	assert(buf != NULL);
+	assert(req != NULL || reqnum == 0);
+
+	/* a "match both" query depends on more than the key */
+	if (db->db_cache != NULL &&
+	    (db->db_flags & DKIMF_DB_FLAG_MATCHBOTH) == 0)
+	{
+		if (buflen == 0)
+			buflen = strlen(buf);
+
+		return dkimf_db_cache_get(db, buf, buflen, req, reqnum,
+		                          exists);
+	}
+
+	return dkimf_db_fetch(db, buf, buflen, req, reqnum, exists);
+}
+
 /*
 **  DKIMF_DB_CLOSE -- close a DB handle
 **
@@ -5496,6 +8446,12 @@ dkimf_db_close(DKIMF_DB db)
 {
 	assert(db != NULL);
 
+	if (db->db_cache != NULL)
+	{
+		dkimf_db_cache_free(db->db_cache);
+		db->db_cache = NULL;
+	}
+
 	if (db->db_array != NULL)
 	{
 		int c;
@@ -5520,12 +8476,16 @@ dkimf_db_close(DKIMF_DB db)
 	{
 	  case DKIMF_DB_TYPE_FILE:
 	  case DKIMF_DB_TYPE_CSL:
+		if (db->db_index != NULL)
+			dkimf_db_index_free(db->db_index);
 		if (db->db_handle != NULL)
 			dkimf_db_list_free(db->db_handle);
 		free(db);
 		return 0;
 
 	  case DKIMF_DB_TYPE_REFILE:
+		if (db->db_retrie != NULL)
+			dkimf_db_retrie_free(db->db_retrie);
 		if (db->db_handle != NULL)
 			dkimf_db_relist_free(db->db_handle);
 		free(db);
@@ -5540,6 +8500,14 @@ dkimf_db_close(DKIMF_DB db)
 		if (db->db_cursor != NULL)
 			((DBC *) (db->db_cursor))->c_close((DBC *) db->db_cursor);
 # endif /* DB_VERSION_CHECK(2,0,0) */
+# ifdef DKIMF_DB_BDB_MR
+		if (db->db_data != NULL)
+		{
+			dkimf_db_bdb_free((struct dkimf_db_bdb *) db->db_data);
+			free(db);
+			return 0;
+		}
+# endif /* DKIMF_DB_BDB_MR */
 		status = DKIMF_DBCLOSE((DB *) (db->db_handle));
 		if (status != 0)
 			db->db_status = status;
@@ -5652,10 +8620,21 @@ dkimf_db_close(DKIMF_DB db)
 	  case DKIMF_DB_TYPE_SOCKET:
 		if (db->db_handle != NULL)
 		{
+
+			int c;
 			struct dkimf_db_socket *sdb;
 
 			sdb = (struct dkimf_db_socket *) db->db_handle;
-			close(sdb->sockdb_fd);
+			for (c = 0; c < sdb->sockdb_nconns; c++)
+			{
+				if (sdb->sockdb_conns[c].sc_fd != -1)
+					close(sdb->sockdb_conns[c].sc_fd);
+				dkimf_dstring_free(sdb->sockdb_conns[c].sc_buf);
+			}
+			pthread_mutex_destroy(&sdb->sockdb_lock);
+			pthread_cond_destroy(&sdb->sockdb_cond);
+			free(sdb->sockdb_conns);
+			free(sdb);
 		}
 		free(db);
 		return 0;
@@ -5671,8 +8650,19 @@ dkimf_db_close(DKIMF_DB db)
 		if (db->db_cursor != NULL)
 			mdb_cursor_close(db->db_cursor);
 
+		while (mdb->mdb_readers != NULL)
+		{
+			struct dkimf_db_mdbreader *r;
+
+			r = mdb->mdb_readers;
+			mdb->mdb_readers = r->mdbr_next;
+			mdb_txn_abort(r->mdbr_txn);
+			free(r);
+		}
+
 		mdb_txn_abort(mdb->mdb_txn);
 		mdb_env_close(mdb->mdb_env);
+		pthread_mutex_destroy(&mdb->mdb_lock);
 		free(db->db_data);
 		free(db);
 	  	return 0;
@@ -5880,22 +8870,49 @@ dkimf_db_walk(DKIMF_DB db, _Bool first, void *key, size_t *keylen,
 # endif /* DB_VERSION_CHECK(2,0,0) */
 		char databuf[BUFRSZ + 1];
 
+# if DB_VERSION_CHECK(2,0,0)
+		/* a new walk starts over, on the current file */
+		if (first)
+			dkimf_db_bdb_endwalk(db);
+
+#  ifdef DKIMF_DB_BDB_MR
+		/*
+		**  Hold the handle until the cursor refers to it; until then
+		**  a concurrent lookup could replace and close it.
+		*/
+
+		if (db->db_data != NULL)
+			bdb = dkimf_db_bdb_get(db);
+		else
+#  endif /* DKIMF_DB_BDB_MR */
 		bdb = (DB *) db->db_handle;
 
-# if DB_VERSION_CHECK(2,0,0)
 		/* establish a cursor if needed */
 		dbc = db->db_cursor;
 		if (dbc == NULL)
 		{
 			status = bdb->cursor(bdb, NULL, &dbc, 0);
-			if (status != 0)
-			{
-				db->db_status = status;
-				return -1;
-			}
+			if (status == 0)
+				db->db_cursor = dbc;
+		}
 
-			db->db_cursor = dbc;
+#  ifdef DKIMF_DB_BDB_MR
+		if (db->db_data != NULL)
+		{
+			struct dkimf_db_bdb *mr;
+
+			mr = (struct dkimf_db_bdb *) db->db_data;
+			pthread_rwlock_unlock(&mr->bdb_lock);
+		}
+#  endif /* DKIMF_DB_BDB_MR */
+
+		if (status != 0)
+		{
+			db->db_status = status;
+			return -1;
 		}
+# else /* DB_VERSION_CHECK(2,0,0) */
+		bdb = (DB *) db->db_handle;
 # endif /* DB_VERSION_CHECK(2,0,0) */
 
 		memset(&k, '\0', sizeof k);
@@ -5920,6 +8937,9 @@ dkimf_db_walk(DKIMF_DB db, _Bool first, void *key, size_t *keylen,
 # endif /* DB_VERSION_CHECK(2,0,0) */
 		if (status == DB_NOTFOUND)
 		{
+# if DB_VERSION_CHECK(2,0,0)
+			dkimf_db_bdb_endwalk(db);
+# endif /* DB_VERSION_CHECK(2,0,0) */
 			return 1;
 		}
 		else if (status != 0)
@@ -6279,7 +9299,7 @@ dkimf_db_walk(DKIMF_DB db, _Bool first, void *key, size_t *keylen,
 		struct dkimf_db_mdb *mdb;
 		char databuf[BUFRSZ + 1];
 
-		mdb = (struct dkimf_db_mdb *) db->db_handle;
+		mdb = (struct dkimf_db_mdb *) db->db_data;
 
 		dbc = db->db_cursor;
 		if (dbc == NULL)
@@ -6329,14 +9349,11 @@ dkimf_db_walk(DKIMF_DB db, _Bool first, void *key, size_t *keylen,
 #ifdef USE_ERLANG
 	  case DKIMF_DB_TYPE_ERLANG:
 	  {
-		int ret, fd;
+		int ret;
 		char *cursor;
-		struct dkimf_db_erlang *e;
-		ei_cnode ec;
 		ei_x_buff args;
 		ei_x_buff resp;
 
-		e = (struct dkimf_db_erlang *) db->db_data;
 		cursor = (char *) db->db_cursor;
 
 		ei_x_new(&args);
@@ -6364,17 +9381,7 @@ dkimf_db_walk(DKIMF_DB db, _Bool first, void *key, size_t *keylen,
 		}
 		ei_x_encode_empty_list(&args);
 
-		fd = dkimf_db_erl_connect(db, &ec);
-		if (fd < 0)
-		{
-			ei_x_free(&args);
-			ei_x_free(&resp);
-			return -1;
-		}
-
-		ret = ei_rpc(&ec, fd, e->erlang_module, e->erlang_function,
-			     args.buff, args.index, &resp);
-		close(fd);
+		ret = dkimf_db_erl_rpc(db, &args, &resp);
 		if (ret == -1)
 		{
 			ei_x_free(&args);
@@ -6788,6 +9795,32 @@ dkimf_db_rewalk(DKIMF_DB db, char *str, DKIMF_DBDATA req, unsigned int reqnum,
 	if (db->db_type != DKIMF_DB_TYPE_REFILE)
 		return -1;
 
+	if (db->db_retrie != NULL)
+	{
+		u_int after = 0;
+
+		if (ctx != NULL && *ctx != NULL)
+		{
+			re = (struct dkimf_db_relist *) *ctx;
+			after = re->db_relist_seq;
+		}
+
+		if (dkimf_db_retrie_find(db, str, after, &re) != 0)
+			return -1;
+		if (re == NULL)
+			return 1;
+
+		if (ctx != NULL)
+			*ctx = re;
+
+		if (dkimf_db_datasplit(re->db_relist_data,
+		                       strlen(re->db_relist_data),
+		                       req, reqnum) != 0)
+			return -1;
+
+		return 0;
+	}
+
 	if (ctx != NULL && *ctx != NULL)
 	{
 		re = (struct dkimf_db_relist *) *ctx;
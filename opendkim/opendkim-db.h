@@ -11,6 +11,7 @@
 
 /* system includes */
 #include <sys/types.h>
+#include <inttypes.h>
 #include <pthread.h>
 
 /* macros */
@@ -24,6 +25,7 @@
 #define	DKIMF_DB_FLAG_NOFDLOCK	0x0080
 #define	DKIMF_DB_FLAG_SOFTSTART	0x0100
 #define	DKIMF_DB_FLAG_NOCACHE	0x0200
+#define	DKIMF_DB_FLAG_NOINDEX	0x0400
 
 #define	DKIMF_DB_TYPE_UNKNOWN	(-1)
 #define	DKIMF_DB_TYPE_FILE	0
@@ -78,7 +80,21 @@ typedef struct dkimf_db_data * DKIMF_DBDATA;
 #define	DKIMF_DB_DATA_BINARY	0x01		/* data is binary */
 #define	DKIMF_DB_DATA_OPTIONAL	0x02		/* data is optional */
 
+struct dkimf_db_cachestats
+{
+	u_long		cs_hits;	/* answered from the cache */
+	u_long		cs_neghits;	/* ...of which were "not found" */
+	u_long		cs_misses;	/* passed to the data set */
+	u_long		cs_coalesced;	/* waited for another thread's miss */
+	u_long		cs_evictions;	/* removed to stay within size */
+	u_long		cs_entries;	/* currently cached */
+	size_t		cs_bytes;	/* memory used by cached entries */
+	uint64_t	cs_usecs;	/* total time spent in misses */
+	uint64_t	cs_maxusecs;	/* longest miss */
+};
+
 /* prototypes */
+extern int dkimf_db_cachestats __P((DKIMF_DB, struct dkimf_db_cachestats *));
 extern int dkimf_db_chown __P((DKIMF_DB, uid_t uid));
 extern int dkimf_db_close __P((DKIMF_DB));
 extern int dkimf_db_delete __P((DKIMF_DB, void *, size_t));
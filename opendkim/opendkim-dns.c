@@ -18,6 +18,11 @@
 #include <pthread.h>
 #include <resolv.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef USE_UNBOUND
+# include <poll.h>
+#endif /* USE_UNBOUND */
 
 /* libopendkim includes */
 #include <dkim.h>
@@ -69,16 +74,20 @@ struct dkimf_fquery
 /* struct dkimf_unbound -- unbound context */
 struct dkimf_unbound
 {
-	_Bool			ub_poller;
+	_Bool			ub_polled;
+	_Bool			ub_registered;
+	int			ub_fd;
 	struct ub_ctx *		ub_ub;
-	pthread_mutex_t		ub_lock;
-	pthread_cond_t		ub_ready;
+	struct dkimf_unbound_cb_data * ub_pending;
+	struct dkimf_unbound *	ub_next;
 };
 
 /* struct dkimf_unbound_cb_data -- libunbound callback data */
 struct dkimf_unbound_cb_data
 {
-	int			ubd_done;
+	_Bool			ubd_done;
+	_Bool			ubd_called;
+	_Bool			ubd_orphan;
 	int			ubd_rcode;
 	int			ubd_id;
 	int			ubd_type;
@@ -87,7 +96,29 @@ struct dkimf_unbound_cb_data
 	size_t			ubd_buflen;
 	u_char *		ubd_buf;
 	const char *		ubd_strerror;
+	struct timeval		ubd_start;
+	pthread_cond_t		ubd_ready;
+	struct dkimf_unbound *	ubd_ub;
+	struct dkimf_unbound_cb_data * ubd_prev;
+	struct dkimf_unbound_cb_data * ubd_next;
+};
+
+/* struct dkimf_ub_resolver -- the resolver thread */
+struct dkimf_ub_resolver
+{
+	_Bool			res_running;
+	int			res_wake[2];
+	pid_t			res_pid;
+	pthread_t		res_thread;
+	pthread_mutex_t		res_lock;
+	pthread_cond_t		res_idle;
+	struct dkimf_unbound *	res_contexts;
+	struct dkimf_ub_stats	res_stats;
 };
+
+/* globals */
+static pthread_once_t dkimf_ub_once = PTHREAD_ONCE_INIT;
+static struct dkimf_ub_resolver dkimf_ub_res;
 #endif /* USE_UNBOUND */
 
 /*
@@ -151,6 +182,120 @@ dkimf_dns_config(DKIM_LIB *lib, const char *config)
 }
 
 #ifdef USE_UNBOUND
+/*
+**  DKIMF_UB_RESINIT -- one-time initialization of the resolver thread data
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_ub_resinit(void)
+{
+	memset(&dkimf_ub_res, '\0', sizeof dkimf_ub_res);
+
+	dkimf_ub_res.res_wake[0] = -1;
+	dkimf_ub_res.res_wake[1] = -1;
+
+	pthread_mutex_init(&dkimf_ub_res.res_lock, NULL);
+	pthread_cond_init(&dkimf_ub_res.res_idle, NULL);
+}
+
+/*
+**  DKIMF_UB_WAKE -- make the resolver thread rebuild its descriptor set
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Caller must hold the resolver lock.
+*/
+
+static void
+dkimf_ub_wake(void)
+{
+	if (!dkimf_ub_res.res_running)
+		return;
+
+	/* if the pipe is full, a wakeup is already pending */
+	(void) write(dkimf_ub_res.res_wake[1], "", 1);
+}
+
+/*
+**  DKIMF_UB_UNLINK -- remove a context from the resolver thread's list
+**
+**  Parameters:
+**  	ub -- unbound context
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Caller must hold the resolver lock.
+*/
+
+static void
+dkimf_ub_unlink(struct dkimf_unbound *ub)
+{
+	struct dkimf_unbound **prev;
+
+	for (prev = &dkimf_ub_res.res_contexts;
+	     *prev != NULL;
+	     prev = &(*prev)->ub_next)
+	{
+		if (*prev == ub)
+		{
+			*prev = ub->ub_next;
+			break;
+		}
+	}
+
+	ub->ub_next = NULL;
+	ub->ub_registered = FALSE;
+}
+
+/*
+**  DKIMF_UB_FINISH -- mark a query complete and wake its requester
+**
+**  Parameters:
+**  	ubdata -- pointer to a struct dkimf_unbound_cb_data
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Caller must hold the resolver lock.
+*/
+
+static void
+dkimf_ub_finish(struct dkimf_unbound_cb_data *ubdata)
+{
+	struct dkimf_unbound *ub;
+
+	ub = ubdata->ubd_ub;
+
+	if (ubdata->ubd_prev != NULL)
+		ubdata->ubd_prev->ubd_next = ubdata->ubd_next;
+	else
+		ub->ub_pending = ubdata->ubd_next;
+	if (ubdata->ubd_next != NULL)
+		ubdata->ubd_next->ubd_prev = ubdata->ubd_prev;
+
+	ubdata->ubd_prev = NULL;
+	ubdata->ubd_next = NULL;
+	ubdata->ubd_done = TRUE;
+
+	dkimf_ub_res.res_stats.us_depth--;
+
+	pthread_cond_signal(&ubdata->ubd_ready);
+}
+
 /*
 **  DKIMF_UNBOUND_CB -- callback to handle result of DNS query
 **
@@ -161,63 +306,320 @@ dkimf_dns_config(DKIM_LIB *lib, const char *config)
 **
 **  Return value:
 **  	None.
+**
+**  Notes:
+**  	Called by ub_process() on the resolver thread.
 */
 
 static void
 dkimf_unbound_cb(void *mydata, int err, struct ub_result *result)
 {
+	int64_t usecs;
+	struct timeval now;
 	struct dkimf_unbound_cb_data *ubdata;
+	struct dkimf_ub_stats *us;
 
 	ubdata = (struct dkimf_unbound_cb_data *) mydata;
+	us = &dkimf_ub_res.res_stats;
+
+	pthread_mutex_lock(&dkimf_ub_res.res_lock);
+
+	ubdata->ubd_called = TRUE;
+
+	if (ubdata->ubd_orphan)
+	{
+		/* the requester already cancelled it */
+		pthread_mutex_unlock(&dkimf_ub_res.res_lock);
+
+		pthread_cond_destroy(&ubdata->ubd_ready);
+		free(ubdata);
+
+		if (result != NULL)
+			ub_resolve_free(result);
+
+		return;
+	}
+
+	if (ubdata->ubd_done)
+	{
+		/* already failed after a resolver error */
+		pthread_mutex_unlock(&dkimf_ub_res.res_lock);
+
+		if (result != NULL)
+			ub_resolve_free(result);
+
+		return;
+	}
 
 	if (err != 0)
 	{
-		ubdata->ubd_done = TRUE;
 		ubdata->ubd_stat = DKIM_STAT_INTERNAL;
 		ubdata->ubd_strerror = ub_strerror(err);
-		return;
 	}
+	else
+	{
+		ubdata->ubd_stat = DKIM_STAT_NOKEY;
+		ubdata->ubd_rcode = result->rcode;
+		memcpy(ubdata->ubd_buf, result->answer_packet,
+		       MIN(ubdata->ubd_buflen, result->answer_len));
+		ubdata->ubd_buflen = result->answer_len;
+
+		/*
+		**  Check whether reply is either secure or insecure.  If bogus,
+		**  treat as if no key exists.
+		*/
+
+		if (result->secure)
+			ubdata->ubd_result = DKIM_DNSSEC_SECURE;
+		else if (result->bogus)
+			ubdata->ubd_result = DKIM_DNSSEC_BOGUS;
+		else
+			ubdata->ubd_result = DKIM_DNSSEC_INSECURE;
+
+		if (!result->bogus && result->havedata &&
+		    !result->nxdomain && result->rcode == NOERROR)
+			ubdata->ubd_stat = DKIM_STAT_OK;
+	}
+
+	(void) gettimeofday(&now, NULL);
+	usecs = (int64_t) (now.tv_sec - ubdata->ubd_start.tv_sec) * 1000000 +
+	        (now.tv_usec - ubdata->ubd_start.tv_usec);
+	if (usecs < 0)
+		usecs = 0;
 
-	ubdata->ubd_done = FALSE;
-	ubdata->ubd_stat = DKIM_STAT_NOKEY;
-	ubdata->ubd_rcode = result->rcode;
-	memcpy(ubdata->ubd_buf, result->answer_packet,
-	       MIN(ubdata->ubd_buflen, result->answer_len));
-	ubdata->ubd_buflen = result->answer_len;
+	us->us_answers++;
+	us->us_usecs += usecs;
+	if (usecs > us->us_maxusecs)
+		us->us_maxusecs = usecs;
 
-	/*
-	**  Check whether reply is either secure or insecure.  If bogus,
-	**  treat as if no key exists.
-	*/
+	dkimf_ub_finish(ubdata);
 
-	if (result->secure)
+	pthread_mutex_unlock(&dkimf_ub_res.res_lock);
+
+	if (result != NULL)
+		ub_resolve_free(result);
+}
+
+/*
+**  DKIMF_UB_FAIL -- fail everything pending on a context after an error
+**
+**  Parameters:
+**  	ub -- unbound context
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Caller must hold the resolver lock.  The context leaves the
+**  	resolver thread's list; its next query puts it back.
+*/
+
+static void
+dkimf_ub_fail(struct dkimf_unbound *ub)
+{
+	struct dkimf_unbound_cb_data *ubdata;
+
+	while (ub->ub_pending != NULL)
 	{
-		ubdata->ubd_result = DKIM_DNSSEC_SECURE;
+		ubdata = ub->ub_pending;
+		ubdata->ubd_stat = DKIM_STAT_INTERNAL;
+		ubdata->ubd_strerror = "resolver processing failed";
+		dkimf_ub_res.res_stats.us_errors++;
+		dkimf_ub_finish(ubdata);
 	}
-	else if (result->bogus)
+
+	dkimf_ub_unlink(ub);
+}
+
+/*
+**  DKIMF_UB_RESOLVER -- resolver thread
+**
+**  Parameters:
+**  	arg -- unused
+**
+**  Return value:
+**  	Never returns.
+**
+**  Notes:
+**  	This is the only thread that calls ub_process(), so libunbound's
+**  	callbacks all run here.  Each one wakes only the thread waiting
+**  	for that answer.  Contexts being polled are marked so that
+**  	dkimf_ub_close() can wait until this thread is done with them.
+*/
+
+static void *
+dkimf_ub_resolver(void *arg)
+{
+	int c;
+	int n;
+	int nfds;
+	int status;
+	int maxfds = 0;
+	char junk[BUFRSZ];
+	struct pollfd *pfd = NULL;
+	struct dkimf_unbound **polled = NULL;
+	struct dkimf_unbound *ub;
+	struct dkimf_ub_resolver *res;
+
+	res = &dkimf_ub_res;
+
+	pthread_mutex_lock(&res->res_lock);
+
+	for (;;)
 	{
-		/* result was bogus */
-		ubdata->ubd_result = DKIM_DNSSEC_BOGUS;
-		return;
+		for (n = 1, ub = res->res_contexts;
+		     ub != NULL;
+		     ub = ub->ub_next)
+			n++;
+
+		if (n > maxfds)
+		{
+			struct pollfd *newpfd;
+			struct dkimf_unbound **newpolled;
+
+			newpfd = (struct pollfd *) realloc(pfd,
+			                                   n * sizeof *pfd);
+			if (newpfd != NULL)
+				pfd = newpfd;
+			newpolled = (struct dkimf_unbound **) realloc(polled,
+			                                              n * sizeof *polled);
+			if (newpolled != NULL)
+				polled = newpolled;
+
+			if (newpfd == NULL || newpolled == NULL)
+			{
+				/* try again shortly */
+				pthread_mutex_unlock(&res->res_lock);
+				sleep(1);
+				pthread_mutex_lock(&res->res_lock);
+				continue;
+			}
+
+			maxfds = n;
+		}
+
+		pfd[0].fd = res->res_wake[0];
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+
+		for (nfds = 1, ub = res->res_contexts;
+		     ub != NULL;
+		     ub = ub->ub_next, nfds++)
+		{
+			ub->ub_polled = TRUE;
+			polled[nfds] = ub;
+			pfd[nfds].fd = ub->ub_fd;
+			pfd[nfds].events = POLLIN;
+			pfd[nfds].revents = 0;
+		}
+
+		pthread_mutex_unlock(&res->res_lock);
+
+		status = poll(pfd, nfds, -1);
+
+		if (status > 0 && pfd[0].revents != 0)
+		{
+			while (read(res->res_wake[0], junk, sizeof junk) > 0)
+				continue;
+		}
+
+		for (c = 1; c < nfds; c++)
+		{
+			if (status <= 0 || pfd[c].revents == 0)
+				continue;
+
+			if (ub_process(polled[c]->ub_ub) != 0)
+			{
+				pthread_mutex_lock(&res->res_lock);
+				dkimf_ub_fail(polled[c]);
+				pthread_mutex_unlock(&res->res_lock);
+			}
+		}
+
+		pthread_mutex_lock(&res->res_lock);
+
+		for (c = 1; c < nfds; c++)
+			polled[c]->ub_polled = FALSE;
+
+		pthread_cond_broadcast(&res->res_idle);
 	}
-	else
-	{ 
-		ubdata->ubd_result = DKIM_DNSSEC_INSECURE;
+
+	/* NOTREACHED */
+	return NULL;
+}
+
+/*
+**  DKIMF_UB_START -- start the resolver thread if it isn't running
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	0 -- success
+**  	-1 -- error
+**
+**  Notes:
+**  	Caller must hold the resolver lock.  The thread is started by the
+**  	first query rather than at initialization so that it survives
+**  	the filter becoming a daemon.
+*/
+
+static int
+dkimf_ub_start(void)
+{
+	int c;
+	int flags;
+	pid_t pid;
+	struct dkimf_unbound *ub;
+	struct dkimf_ub_resolver *res;
+
+	res = &dkimf_ub_res;
+	pid = getpid();
+
+	if (res->res_running && res->res_pid == pid)
+		return 0;
+
+	if (res->res_running)
+	{
+		/* forked; the descriptors came along but the thread didn't */
+		(void) close(res->res_wake[0]);
+		(void) close(res->res_wake[1]);
+		res->res_running = FALSE;
+
+		for (ub = res->res_contexts; ub != NULL; ub = ub->ub_next)
+			ub->ub_polled = FALSE;
 	}
 
-	if (result->havedata && !result->nxdomain && result->rcode == NOERROR)
-		ubdata->ubd_stat = DKIM_STAT_OK;
+	if (pipe(res->res_wake) != 0)
+		return -1;
 
-	ub_resolve_free(result);
+	for (c = 0; c < 2; c++)
+	{
+		flags = fcntl(res->res_wake[c], F_GETFL, 0);
+		if (flags != -1)
+			(void) fcntl(res->res_wake[c], F_SETFL, flags | O_NONBLOCK);
+	}
 
-	ubdata->ubd_done = TRUE;
+	if (pthread_create(&res->res_thread, NULL, dkimf_ub_resolver,
+	                   NULL) != 0)
+	{
+		(void) close(res->res_wake[0]);
+		(void) close(res->res_wake[1]);
+		return -1;
+	}
+
+	(void) pthread_detach(res->res_thread);
+
+	res->res_running = TRUE;
+	res->res_pid = pid;
+
+	return 0;
 }
 
 /*
 **  DKIMF_UNBOUND_WAIT -- wait for a reply from libunbound
 **
 **  Parameters:
-**  	ub -- unbound handle
 **  	ubdata -- pointer to a struct dkimf_unbound_cb_data
 **  	to -- timeout (or NULL)
 **
@@ -228,14 +630,13 @@ dkimf_unbound_cb(void *mydata, int err, struct ub_result *result)
 */
 
 static int
-dkimf_unbound_wait(struct dkimf_unbound *ub,
-                   struct dkimf_unbound_cb_data *ubdata,
+dkimf_unbound_wait(struct dkimf_unbound_cb_data *ubdata,
                    struct timeval *to)
 {
+	int status;
 	struct timespec timeout;
 	struct timeval now;
 
-	assert(ub != NULL);
 	assert(ubdata != NULL);
 
 	if (to != NULL)
@@ -245,101 +646,44 @@ dkimf_unbound_wait(struct dkimf_unbound *ub,
 		timeout.tv_sec = now.tv_sec + to->tv_sec;
 		timeout.tv_nsec = now.tv_usec * 1000;
 		timeout.tv_nsec += (1000 * to->tv_usec);
-		if (timeout.tv_nsec > 1000000000)
+		if (timeout.tv_nsec >= 1000000000)
 		{
 			timeout.tv_sec += (timeout.tv_nsec / 1000000000);
 			timeout.tv_nsec = timeout.tv_nsec % 1000000000;
 		}
 	}
 
-	pthread_mutex_lock(&ub->ub_lock);
+	pthread_mutex_lock(&dkimf_ub_res.res_lock);
 
-	for (;;)
+	while (!ubdata->ubd_done)
 	{
-		/*
-		**  Wait for a signal unless/until:
-		**  	a) our request is done
-		**  	b) there's nobody polling libunbound for results
-		**  	c) we don't want to wait anymore (timeout)
-		*/
-
-		if (to != NULL)
-		{
-			while (!ubdata->ubd_done && ub->ub_poller &&
-			       !dkimf_timespec_past(&timeout))
-			{
-				(void) pthread_cond_timedwait(&ub->ub_ready,
-				                              &ub->ub_lock,
-				                              &timeout);
-			}
-		}
-		else
+		if (to == NULL)
 		{
-			while (!ubdata->ubd_done && ub->ub_poller)
-			{
-				(void) pthread_cond_wait(&ub->ub_ready,
-				                         &ub->ub_lock);
-			}
+			(void) pthread_cond_wait(&ubdata->ubd_ready,
+			                         &dkimf_ub_res.res_lock);
 		}
-
-		if (ubdata->ubd_done)
+		else if (dkimf_timespec_past(&timeout))
 		{
-			/* our request completed */
-			pthread_mutex_unlock(&ub->ub_lock);
-			return 1;
-		}
-		else if (to != NULL && dkimf_timespec_past(&timeout))
-		{
-			/* our request timed out */
-			pthread_mutex_unlock(&ub->ub_lock);
-			return 0;
+			break;
 		}
 		else
 		{
-			int status;
-
-			/* nobody's waiting for results, so we will */
-			ub->ub_poller = TRUE;
-			pthread_mutex_unlock(&ub->ub_lock);
-
-			/* wait for I/O to be available */
-			status = dkimf_wait_fd(ub_fd(ub->ub_ub),
-			                       to == NULL ? NULL : &timeout);
-
-			if (status == 0)
-			{
-				/* no answer in time */
-				pthread_mutex_lock(&ub->ub_lock);
-				ub->ub_poller = FALSE;
-				pthread_cond_signal(&ub->ub_ready);
-				pthread_mutex_unlock(&ub->ub_lock);
-				return 0;
-			}
-
-			assert(status == 1);
-			
-			/* process anything pending */
-			status = ub_process(ub->ub_ub);
-			if (status != 0)
-			{
-				/* error during processing */
-				pthread_mutex_lock(&ub->ub_lock);
-				ub->ub_poller = FALSE;
-				pthread_cond_signal(&ub->ub_ready);
-				pthread_mutex_unlock(&ub->ub_lock);
-				return -1;
-			}
+			(void) pthread_cond_timedwait(&ubdata->ubd_ready,
+			                              &dkimf_ub_res.res_lock,
+			                              &timeout);
+		}
+	}
 
-			/* recover the lock so the loop can restart */
-			pthread_mutex_lock(&ub->ub_lock);
+	if (!ubdata->ubd_done)
+		status = 0;
+	else if (ubdata->ubd_stat == DKIM_STAT_INTERNAL)
+		status = -1;
+	else
+		status = 1;
 
-			/* tell everyone to check for results */
-			pthread_cond_broadcast(&ub->ub_ready);
+	pthread_mutex_unlock(&dkimf_ub_res.res_lock);
 
-			/* clear the "someone is polling" flag */
-			ub->ub_poller = FALSE;
-		}
-	}
+	return status;
 }
 
 /*
@@ -364,6 +708,7 @@ dkimf_unbound_queue(struct dkimf_unbound *ub, char *name, int type,
                     struct dkimf_unbound_cb_data *cbdata)
 {
 	int status;
+	struct dkimf_ub_stats *us;
 
 	assert(ub != NULL);
 	assert(name != NULL);
@@ -371,6 +716,32 @@ dkimf_unbound_queue(struct dkimf_unbound *ub, char *name, int type,
 	assert(buflen > 0);
 	assert(cbdata != NULL);
 
+	us = &dkimf_ub_res.res_stats;
+
+	pthread_mutex_lock(&dkimf_ub_res.res_lock);
+
+	if (dkimf_ub_start() != 0)
+	{
+		pthread_mutex_unlock(&dkimf_ub_res.res_lock);
+		return -1;
+	}
+
+	if (!ub->ub_registered)
+	{
+		ub->ub_fd = ub_fd(ub->ub_ub);
+		if (ub->ub_fd < 0)
+		{
+			pthread_mutex_unlock(&dkimf_ub_res.res_lock);
+			return -1;
+		}
+
+		ub->ub_next = dkimf_ub_res.res_contexts;
+		dkimf_ub_res.res_contexts = ub;
+		ub->ub_registered = TRUE;
+
+		dkimf_ub_wake();
+	}
+
 	cbdata->ubd_done = FALSE;
 	cbdata->ubd_buf = buf;
 	cbdata->ubd_buflen = buflen;
@@ -378,12 +749,33 @@ dkimf_unbound_queue(struct dkimf_unbound *ub, char *name, int type,
 	cbdata->ubd_result = DKIM_DNSSEC_UNKNOWN;
 	cbdata->ubd_rcode = NOERROR;
 	cbdata->ubd_type = type;
+	cbdata->ubd_ub = ub;
+	(void) gettimeofday(&cbdata->ubd_start, NULL);
+	pthread_cond_init(&cbdata->ubd_ready, NULL);
 
+	/* the callback can't run until the lock is released */
 	status = ub_resolve_async(ub->ub_ub, name, type, C_IN,
 	                          (void *) cbdata, dkimf_unbound_cb,
 	                          &cbdata->ubd_id);
 	if (status != 0)
+	{
+		pthread_mutex_unlock(&dkimf_ub_res.res_lock);
+		pthread_cond_destroy(&cbdata->ubd_ready);
 		return -1;
+	}
+
+	cbdata->ubd_prev = NULL;
+	cbdata->ubd_next = ub->ub_pending;
+	if (ub->ub_pending != NULL)
+		ub->ub_pending->ubd_prev = cbdata;
+	ub->ub_pending = cbdata;
+
+	us->us_queries++;
+	us->us_depth++;
+	if (us->us_depth > us->us_maxdepth)
+		us->us_maxdepth = us->us_depth;
+
+	pthread_mutex_unlock(&dkimf_ub_res.res_lock);
 
 	return 0;
 }
@@ -468,8 +860,24 @@ dkimf_ub_cancel(void *srv, void *q)
 	ub = (struct dkimf_unbound *) srv;
 	ubdata = (struct dkimf_unbound_cb_data *) q;
 
-	(void) ub_cancel(ub->ub_ub, ubdata->ubd_id);
+	pthread_mutex_lock(&dkimf_ub_res.res_lock);
+
+	if (!ubdata->ubd_called && ub_cancel(ub->ub_ub, ubdata->ubd_id) != 0)
+	{
+		/* the answer is on its way; the callback will free this */
+		ubdata->ubd_orphan = TRUE;
+		if (!ubdata->ubd_done)
+			dkimf_ub_finish(ubdata);
+		pthread_mutex_unlock(&dkimf_ub_res.res_lock);
+		return DKIM_DNS_SUCCESS;
+	}
 
+	if (!ubdata->ubd_done)
+		dkimf_ub_finish(ubdata);
+
+	pthread_mutex_unlock(&dkimf_ub_res.res_lock);
+
+	pthread_cond_destroy(&ubdata->ubd_ready);
 	free(q);
 
 	return DKIM_DNS_SUCCESS;
@@ -539,16 +947,14 @@ dkimf_ub_waitreply(void *srv, void *qh, struct timeval *to, size_t *bytes,
                    int *error, int *dnssec)
 {
 	int status;
-	struct dkimf_unbound *ub;
 	struct dkimf_unbound_cb_data *ubdata;
 
 	assert(srv != NULL);
 	assert(qh != NULL);
 
-	ub = (struct dkimf_unbound *) srv;
 	ubdata = (struct dkimf_unbound_cb_data *) qh;
 
-	status = dkimf_unbound_wait(ub, ubdata, to);
+	status = dkimf_unbound_wait(ubdata, to);
 	if (status == 1 || status == -1)
 	{
 		if (dnssec != NULL)
@@ -587,9 +993,12 @@ dkimf_ub_init(void **ub)
 
 	assert(ub != NULL);
 
+	(void) pthread_once(&dkimf_ub_once, dkimf_ub_resinit);
+
 	out = (struct dkimf_unbound *) malloc(sizeof *out);
 	if (out == NULL)
 		return DKIM_DNS_ERROR;
+	memset(out, '\0', sizeof *out);
 
 	out->ub_ub = ub_ctx_create();
 	if (out->ub_ub == NULL)
@@ -604,10 +1013,7 @@ dkimf_ub_init(void **ub)
 	/* set for asynchronous operation */
 	ub_ctx_async(out->ub_ub, TRUE);
 
-	out->ub_poller = FALSE;
-
-	pthread_mutex_init(&out->ub_lock, NULL);
-	pthread_cond_init(&out->ub_ready, NULL);
+	out->ub_fd = -1;
 
 	*ub = out;
 
@@ -634,14 +1040,54 @@ dkimf_ub_close(void *srv)
 
 	ub = srv;
 
-	ub_ctx_delete(ub->ub_ub);
+	/* make sure the resolver thread is done with it */
+	pthread_mutex_lock(&dkimf_ub_res.res_lock);
+
+	if (ub->ub_registered)
+	{
+		dkimf_ub_unlink(ub);
+		dkimf_ub_wake();
+	}
+
+	while (ub->ub_polled)
+	{
+		(void) pthread_cond_wait(&dkimf_ub_res.res_idle,
+		                         &dkimf_ub_res.res_lock);
+	}
 
-	pthread_mutex_destroy(&ub->ub_lock);
-	pthread_cond_destroy(&ub->ub_ready);
+	pthread_mutex_unlock(&dkimf_ub_res.res_lock);
+
+	ub_ctx_delete(ub->ub_ub);
 
 	free(srv);
 }
 
+/*
+**  DKIMF_UB_STATS -- report resolver thread statistics
+**
+**  Parameters:
+**  	us -- statistics (returned)
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	The counters cover every libunbound context (keys, ATPS, VBR and
+**  	RBL) since the filter started.
+*/
+
+void
+dkimf_ub_stats(struct dkimf_ub_stats *us)
+{
+	assert(us != NULL);
+
+	(void) pthread_once(&dkimf_ub_once, dkimf_ub_resinit);
+
+	pthread_mutex_lock(&dkimf_ub_res.res_lock);
+	memcpy(us, &dkimf_ub_res.res_stats, sizeof *us);
+	pthread_mutex_unlock(&dkimf_ub_res.res_lock);
+}
+
 /*
 **  DKIMF_UB_NSLIST -- set nameserver list
 **
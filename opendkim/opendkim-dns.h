@@ -33,7 +33,20 @@ struct dkimf_filedns;
 /* libunbound includes */
 # include <unbound.h>
 
+/* struct dkimf_ub_stats -- resolver thread statistics */
+struct dkimf_ub_stats
+{
+	u_long		us_queries;	/* queries started */
+	u_long		us_answers;	/* answers delivered */
+	u_long		us_errors;	/* queries failed by errors */
+	u_int		us_depth;	/* queries in flight */
+	u_int		us_maxdepth;	/* most ever in flight */
+	uint64_t	us_usecs;	/* total answer latency */
+	uint64_t	us_maxusecs;	/* worst answer latency */
+};
+
 /* prototypes */
+extern void dkimf_ub_stats __P((struct dkimf_ub_stats *));
 extern int dkimf_unbound_setup __P((DKIM_LIB *));
 # ifdef _FFR_RBL
 extern int dkimf_rbl_unbound_setup __P((RBL *));
@@ -59,6 +59,7 @@
 #define	DEFRETRY	1800
 #define	DEFTTL		86400
 #define	DKIMZONE	"._domainkey"
+#define	ED25519_KEYLEN	32
 #define	HOSTMASTER	"hostmaster"
 #define	LARGEBUFRSZ	8192
 #define	MARGIN		75
@@ -262,6 +263,7 @@ main(int argc, char **argv)
 	EVP_PKEY *pkey;
 	RSA *rsa;
 #endif /* USE_GNUTLS */
+	char *keytype;
 	DKIMF_DB db;
 	char keyname[BUFRSZ + 1];
 	char domain[BUFRSZ + 1];
@@ -653,6 +655,8 @@ main(int argc, char **argv)
 			        progname, c, keyname);
 		}
 
+		keytype = "rsa";
+
 		keylen = sizeof keydata;
 		if (!loadkey(keydata, &keylen))
 		{
@@ -795,6 +799,16 @@ main(int argc, char **argv)
 			}
 
 			pkey = d2i_PrivateKey_bio(private, NULL);
+#ifdef HAVE_ED25519
+			/* a bare ed25519 private key */
+			if (pkey == NULL && outlen == ED25519_KEYLEN)
+			{
+				pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519,
+				                                    NULL,
+				                                    (u_char *) derdata,
+				                                    outlen);
+			}
+#endif /* HAVE_ED25519 */
 			if (pkey == NULL)
 			{
 				fprintf(stderr,
@@ -807,31 +821,62 @@ main(int argc, char **argv)
 			}
 		}
 
-		rsa = EVP_PKEY_get1_RSA(pkey);
-		if (rsa == NULL)
+#ifdef HAVE_ED25519
+		if (EVP_PKEY_id(pkey) == EVP_PKEY_ED25519)
 		{
-			fprintf(stderr,
-			        "%s: EVP_PKEY_get1_RSA() failed\n",
-			        progname);
-			(void) dkimf_db_close(db);
-			(void) BIO_free(private);
-			(void) EVP_PKEY_free(pkey);
-			(void) BIO_free(outbio);
-			return 1;
-		}
+			size_t rawlen;
+			u_char raw[ED25519_KEYLEN];
+			u_char b64[ED25519_KEYLEN * 2];
+
+			/* the record carries the bare public key */
+			rawlen = sizeof raw;
+			if (EVP_PKEY_get_raw_public_key(pkey, raw,
+			                                &rawlen) != 1)
+			{
+				fprintf(stderr,
+				        "%s: EVP_PKEY_get_raw_public_key() failed\n",
+				        progname);
+				(void) dkimf_db_close(db);
+				(void) BIO_free(private);
+				(void) EVP_PKEY_free(pkey);
+				(void) BIO_free(outbio);
+				return 1;
+			}
+
+			(void) EVP_EncodeBlock(b64, raw, rawlen);
+			(void) BIO_printf(outbio, "\n%s\n", b64);
 
-		/* convert private to public */
-		status = PEM_write_bio_RSA_PUBKEY(outbio, rsa);
-		if (status == 0)
+			keytype = "ed25519";
+		}
+		else
+#endif /* HAVE_ED25519 */
 		{
-			fprintf(stderr,
-			        "%s: PEM_write_bio_RSA_PUBKEY() failed\n",
-			        progname);
-			(void) dkimf_db_close(db);
-			(void) BIO_free(private);
-			(void) EVP_PKEY_free(pkey);
-			(void) BIO_free(outbio);
-			return 1;
+			rsa = EVP_PKEY_get1_RSA(pkey);
+			if (rsa == NULL)
+			{
+				fprintf(stderr,
+				        "%s: EVP_PKEY_get1_RSA() failed\n",
+				        progname);
+				(void) dkimf_db_close(db);
+				(void) BIO_free(private);
+				(void) EVP_PKEY_free(pkey);
+				(void) BIO_free(outbio);
+				return 1;
+			}
+
+			/* convert private to public */
+			status = PEM_write_bio_RSA_PUBKEY(outbio, rsa);
+			if (status == 0)
+			{
+				fprintf(stderr,
+				        "%s: PEM_write_bio_RSA_PUBKEY() failed\n",
+				        progname);
+				(void) dkimf_db_close(db);
+				(void) BIO_free(private);
+				(void) EVP_PKEY_free(pkey);
+				(void) BIO_free(outbio);
+				return 1;
+			}
 		}
 #endif /* USE_GNUTLS */
 
@@ -853,21 +898,21 @@ main(int argc, char **argv)
 			if (ttl == -1)
 			{
 				snprintf(tmpbuf, sizeof tmpbuf,
-				         "%s%s%s%s%s\tIN\tTXT\t( \"v=DKIM1; k=rsa; p=",
+				         "%s%s%s%s%s\tIN\tTXT\t( \"v=DKIM1; k=%s; p=",
 				         selector, suffix ? DKIMZONE : "",
 				         fqdnsuffix ? "." : "",
 				         fqdnsuffix ? domain : "",
-				         fqdnsuffix ? "." : "");
+				         fqdnsuffix ? "." : "", keytype);
 			}
 			else
 			{
 				snprintf(tmpbuf, sizeof tmpbuf,
-				         "%s%s%s%s%s\t%d\tIN\tTXT\t( \"v=DKIM1; k=rsa; p=",
+				         "%s%s%s%s%s\t%d\tIN\tTXT\t( \"v=DKIM1; k=%s; p=",
 				         selector, suffix ? DKIMZONE : "",
 				         fqdnsuffix ? "." : "",
 				         fqdnsuffix ? domain : "",
 				         fqdnsuffix ? "." : "",
-				         ttl);
+				         ttl, keytype);
 			}
 		}
 
@@ -12,6 +12,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
 
 /* Lua includes */
 #include <lua.h>
@@ -28,6 +29,18 @@
 #include "opendkim-db.h"
 #include "opendkim.h"
 
+/* macros */
+#if LUA_VERSION_NUM >= 503
+# define DKIMF_LUA_DUMP(l,w,d)	lua_dump((l), (w), (d), 0)
+#else /* LUA_VERSION_NUM >= 503 */
+# define DKIMF_LUA_DUMP(l,w,d)	lua_dump((l), (w), (d))
+#endif /* LUA_VERSION_NUM >= 503 */
+#if LUA_VERSION_NUM >= 502
+# define DKIMF_LUA_PUSHGLOBALS(l)	lua_pushglobaltable(l)
+#else /* LUA_VERSION_NUM >= 502 */
+# define DKIMF_LUA_PUSHGLOBALS(l)	lua_pushvalue((l), LUA_GLOBALSINDEX)
+#endif /* LUA_VERSION_NUM >= 502 */
+
 /* local data types */
 struct dkimf_lua_io
 {
@@ -37,6 +50,24 @@ struct dkimf_lua_io
 	size_t		lua_io_alloc;
 };
 
+#ifdef DKIMF_LUA_CONTEXT_HOOKS
+struct dkimf_lua_state
+{
+	size_t		ls_len;
+	void *		ls_chunk;	/* compiled script it has loaded */
+	lua_State *	ls_state;	/* idle, or NULL */
+};
+
+struct dkimf_lua_pool
+{
+	struct dkimf_lua_state	lp_states[DKIMF_LUA_NHOOKS];
+};
+
+/* globals */
+static pthread_once_t dkimf_lua_once = PTHREAD_ONCE_INIT;
+static pthread_key_t dkimf_lua_key;
+#endif /* DKIMF_LUA_CONTEXT_HOOKS */
+
 #ifdef DKIMF_LUA_CONTEXT_HOOKS
 /* libraries */
 static const luaL_Reg dkimf_lua_lib_setup[] =
@@ -282,11 +313,11 @@ dkimf_lua_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
 		free(ptr);
 		return NULL;
 	}
-# if LUA_VERSION_NUM == 502
+# if LUA_VERSION_NUM >= 502
 	else if (nsize != 0 && ptr == NULL)
-# else /* LUA_VERSION_NUM == 502 */
+# else /* LUA_VERSION_NUM >= 502 */
 	else if (nsize != 0 && osize == 0)
-# endif /* LUA_VERSION_NUM == 502 */
+# endif /* LUA_VERSION_NUM >= 502 */
 	{
 		return malloc(nsize);
 	}
@@ -424,81 +455,18 @@ dkimf_lua_gc_cleanup(struct dkimf_lua_gc *gc)
 
 #ifdef DKIMF_LUA_CONTEXT_HOOKS
 /*
-**  DKIMF_LUA_SETUP_HOOK -- hook to Lua for handling a message during setup
+**  DKIMF_LUA_DBCONSTS -- register DB handle constants
 **
 **  Parameters:
-**  	ctx -- session context, for making calls back to opendkim.c
-**  	script -- script to run
-**  	scriptlen -- length of script; if 0, use strlen()
-**  	name -- name of the script (for logging)
-**  	lres -- Lua result structure
-**  	keep -- where to save the script (or NULL)
-**  	funclen -- size of the saved object
+**  	l -- Lua state
 **
 **  Return value:
-**  	2 -- processing error
-**  	1 -- script contains a syntax error
-**  	0 -- success
-**  	-1 -- memory allocation failure
-**
-**  Side effects:
-**  	lres may be modified to relay the script's signing requests, i.e.
-**  	which key/selector(s) to use, whether to use "l=", etc.
-** 
-**  Notes:
-**  	Called by mlfi_eoh() so it can decide what signature(s) to apply.
+**  	None.
 */
 
-int
-dkimf_lua_setup_hook(void *ctx, const char *script, size_t scriptlen,
-                     const char *name, struct dkimf_lua_script_result *lres,
-                     void **keep, size_t *funclen)
+static void
+dkimf_lua_dbconsts(lua_State *l)
 {
-	int status;
-	lua_State *l = NULL;
-	struct dkimf_lua_io io;
-	struct dkimf_lua_gc gc;
-
-	assert(script != NULL);
-	assert(lres != NULL);
-
-	io.lua_io_done = FALSE;
-	io.lua_io_script = script;
-	if (scriptlen == 0)
-		io.lua_io_len = strlen(script);
-	else
-		io.lua_io_len = scriptlen;
-
-	gc.gc_head = NULL;
-	gc.gc_tail = NULL;
-
-	l = lua_newstate(dkimf_lua_alloc, NULL);
-	if (l == NULL)
-		return -1;
-
-	luaL_openlibs(l);
-
-	/*
-	**  Register functions.
-	*/
-
-# if LUA_VERSION_NUM == 502
-	luaL_newlib(l, dkimf_lua_lib_setup);
-	lua_setglobal(l, "odkim");
-# else /* LUA_VERSION_NUM == 502 */
-	luaL_register(l, "odkim", dkimf_lua_lib_setup);
-# endif /* LUA_VERSION_NUM == 502 */
-	lua_pop(l, 1);
-
-	/*
-	**  Register constants.
-	*/
-
-	/* garbage collection handle */
-	lua_pushlightuserdata(l, &gc);
-	lua_setglobal(l, DKIMF_GC);
-
-	/* DB handle constants */
 	lua_pushnumber(l, DB_DOMAINS);
 	lua_setglobal(l, "DB_DOMAINS");
 	lua_pushnumber(l, DB_THIRDPARTY);
@@ -511,8 +479,21 @@ dkimf_lua_setup_hook(void *ctx, const char *script, size_t scriptlen,
 	lua_setglobal(l, "DB_MACROS");
 	lua_pushnumber(l, DB_SIGNINGTABLE);
 	lua_setglobal(l, "DB_SIGNINGTABLE");
+}
+
+/*
+**  DKIMF_LUA_SMFISCONSTS -- register milter result code constants
+**
+**  Parameters:
+**  	l -- Lua state
+**
+**  Return value:
+**  	None.
+*/
 
-	/* set result code */
+static void
+dkimf_lua_smfisconsts(lua_State *l)
+{
 	lua_pushnumber(l, SMFIS_TEMPFAIL);
 	lua_setglobal(l, "SMFIS_TEMPFAIL");
 	lua_pushnumber(l, SMFIS_ACCEPT);
@@ -521,215 +502,454 @@ dkimf_lua_setup_hook(void *ctx, const char *script, size_t scriptlen,
 	lua_setglobal(l, "SMFIS_DISCARD");
 	lua_pushnumber(l, SMFIS_REJECT);
 	lua_setglobal(l, "SMFIS_REJECT");
+}
 
-	/* filter context */
-	lua_pushlightuserdata(l, ctx);
-	lua_setglobal(l, "ctx");
+/*
+**  DKIMF_LUA_SIGCONSTS -- register signature result constants
+**
+**  Parameters:
+**  	l -- Lua state
+**
+**  Return value:
+**  	None.
+*/
 
-	/* import other globals */
-	dkimf_import_globals(ctx, l);
+static void
+dkimf_lua_sigconsts(lua_State *l)
+{
+	/* signature "bh" result codes */
+	lua_pushnumber(l, DKIM_SIGBH_UNTESTED);
+	lua_setglobal(l, "DKIM_SIGBH_UNTESTED");
+	lua_pushnumber(l, DKIM_SIGBH_MATCH);
+	lua_setglobal(l, "DKIM_SIGBH_MATCH");
+	lua_pushnumber(l, DKIM_SIGBH_MISMATCH);
+	lua_setglobal(l, "DKIM_SIGBH_MISMATCH");
+
+	/* signature error codes */
+	lua_pushnumber(l, DKIM_SIGERROR_UNKNOWN);
+	lua_setglobal(l, "DKIM_SIGERROR_UNKNOWN");
+	lua_pushnumber(l, DKIM_SIGERROR_OK);
+	lua_setglobal(l, "DKIM_SIGERROR_OK");
+	lua_pushnumber(l, DKIM_SIGERROR_VERSION);
+	lua_setglobal(l, "DKIM_SIGERROR_VERSION");
+	lua_pushnumber(l, DKIM_SIGERROR_DOMAIN);
+	lua_setglobal(l, "DKIM_SIGERROR_DOMAIN");
+	lua_pushnumber(l, DKIM_SIGERROR_EXPIRED);
+	lua_setglobal(l, "DKIM_SIGERROR_EXPIRED");
+	lua_pushnumber(l, DKIM_SIGERROR_FUTURE);
+	lua_setglobal(l, "DKIM_SIGERROR_FUTURE");
+	lua_pushnumber(l, DKIM_SIGERROR_TIMESTAMPS);
+	lua_setglobal(l, "DKIM_SIGERROR_TIMESTAMPS");
+	lua_pushnumber(l, DKIM_SIGERROR_INVALID_HC);
+	lua_setglobal(l, "DKIM_SIGERROR_INVALID_HC");
+	lua_pushnumber(l, DKIM_SIGERROR_INVALID_BC);
+	lua_setglobal(l, "DKIM_SIGERROR_INVALID_BC");
+	lua_pushnumber(l, DKIM_SIGERROR_MISSING_A);
+	lua_setglobal(l, "DKIM_SIGERROR_MISSING_A");
+	lua_pushnumber(l, DKIM_SIGERROR_INVALID_A);
+	lua_setglobal(l, "DKIM_SIGERROR_INVALID_A");
+	lua_pushnumber(l, DKIM_SIGERROR_MISSING_H);
+	lua_setglobal(l, "DKIM_SIGERROR_MISSING_H");
+	lua_pushnumber(l, DKIM_SIGERROR_INVALID_L);
+	lua_setglobal(l, "DKIM_SIGERROR_INVALID_L");
+	lua_pushnumber(l, DKIM_SIGERROR_INVALID_Q);
+	lua_setglobal(l, "DKIM_SIGERROR_INVALID_Q");
+	lua_pushnumber(l, DKIM_SIGERROR_INVALID_QO);
+	lua_setglobal(l, "DKIM_SIGERROR_INVALID_QO");
+	lua_pushnumber(l, DKIM_SIGERROR_MISSING_D);
+	lua_setglobal(l, "DKIM_SIGERROR_MISSING_D");
+	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_D);
+	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_D");
+	lua_pushnumber(l, DKIM_SIGERROR_MISSING_S);
+	lua_setglobal(l, "DKIM_SIGERROR_MISSING_S");
+	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_S);
+	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_S");
+	lua_pushnumber(l, DKIM_SIGERROR_MISSING_B);
+	lua_setglobal(l, "DKIM_SIGERROR_MISSING_B");
+	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_B);
+	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_B");
+	lua_pushnumber(l, DKIM_SIGERROR_CORRUPT_B);
+	lua_setglobal(l, "DKIM_SIGERROR_CORRUPT_B");
+	lua_pushnumber(l, DKIM_SIGERROR_NOKEY);
+	lua_setglobal(l, "DKIM_SIGERROR_NOKEY");
+	lua_pushnumber(l, DKIM_SIGERROR_DNSSYNTAX);
+	lua_setglobal(l, "DKIM_SIGERROR_DNSSYNTAX");
+	lua_pushnumber(l, DKIM_SIGERROR_KEYFAIL);
+	lua_setglobal(l, "DKIM_SIGERROR_KEYFAIL");
+	lua_pushnumber(l, DKIM_SIGERROR_MISSING_BH);
+	lua_setglobal(l, "DKIM_SIGERROR_MISSING_BH");
+	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_BH);
+	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_BH");
+	lua_pushnumber(l, DKIM_SIGERROR_CORRUPT_BH);
+	lua_setglobal(l, "DKIM_SIGERROR_CORRUPT_BH");
+	lua_pushnumber(l, DKIM_SIGERROR_BADSIG);
+	lua_setglobal(l, "DKIM_SIGERROR_BADSIG");
+	lua_pushnumber(l, DKIM_SIGERROR_SUBDOMAIN);
+	lua_setglobal(l, "DKIM_SIGERROR_SUBDOMAIN");
+	lua_pushnumber(l, DKIM_SIGERROR_MULTIREPLY);
+	lua_setglobal(l, "DKIM_SIGERROR_MULTIREPLY");
+	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_H);
+	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_H");
+	lua_pushnumber(l, DKIM_SIGERROR_INVALID_H);
+	lua_setglobal(l, "DKIM_SIGERROR_INVALID_H");
+	lua_pushnumber(l, DKIM_SIGERROR_TOOLARGE_L);
+	lua_setglobal(l, "DKIM_SIGERROR_TOOLARGE_L");
+	lua_pushnumber(l, DKIM_SIGERROR_MBSFAILED);
+	lua_setglobal(l, "DKIM_SIGERROR_MBSFAILED");
+	lua_pushnumber(l, DKIM_SIGERROR_KEYVERSION);
+	lua_setglobal(l, "DKIM_SIGERROR_KEYVERSION");
+	lua_pushnumber(l, DKIM_SIGERROR_KEYUNKNOWNHASH);
+	lua_setglobal(l, "DKIM_SIGERROR_KEYUNKNOWNHASH");
+	lua_pushnumber(l, DKIM_SIGERROR_KEYHASHMISMATCH);
+	lua_setglobal(l, "DKIM_SIGERROR_KEYHASHMISMATCH");
+	lua_pushnumber(l, DKIM_SIGERROR_NOTEMAILKEY);
+	lua_setglobal(l, "DKIM_SIGERROR_NOTEMAILKEY");
+	lua_pushnumber(l, DKIM_SIGERROR_KEYTYPEMISSING);
+	lua_setglobal(l, "DKIM_SIGERROR_KEYTYPEMISSING");
+	lua_pushnumber(l, DKIM_SIGERROR_KEYTYPEUNKNOWN);
+	lua_setglobal(l, "DKIM_SIGERROR_KEYTYPEUNKNOWN");
+	lua_pushnumber(l, DKIM_SIGERROR_KEYREVOKED);
+	lua_setglobal(l, "DKIM_SIGERROR_KEYREVOKED");
+	lua_pushnumber(l, DKIM_SIGERROR_KEYDECODE);
+	lua_setglobal(l, "DKIM_SIGERROR_KEYDECODE");
+}
+
+/*
+**  DKIMF_LUA_NEWSTATE -- create a Lua state for one of the message hooks
+**
+**  Parameters:
+**  	hook -- hook the state will run (DKIMF_LUA_HOOK_*)
+**
+**  Return value:
+**  	A new Lua state with the hook's functions and constants registered,
+**  	or NULL on failure.
+*/
+
+static lua_State *
+dkimf_lua_newstate(int hook)
+{
+	lua_State *l;
+	const luaL_Reg *lib;
 
-# if LUA_VERSION_NUM == 502
-	switch (lua_load(l, dkimf_lua_reader, (void *) &io, name, NULL))
-# else /* LUA_VERSION_NUM == 502 */
-	switch (lua_load(l, dkimf_lua_reader, (void *) &io, name))
-# endif /* LUA_VERSION_NUM == 502 */
+	switch (hook)
 	{
-	  case 0:
+	  case DKIMF_LUA_HOOK_SETUP:
+		lib = dkimf_lua_lib_setup;
 		break;
 
-	  case LUA_ERRSYNTAX:
-		if (lua_isstring(l, 1))
-			lres->lrs_error = strdup(lua_tostring(l, 1));
-		lua_close(l);
-		return 1;
+	  case DKIMF_LUA_HOOK_SCREEN:
+		lib = dkimf_lua_lib_screen;
+		break;
 
-	  case LUA_ERRMEM:
-		if (lua_isstring(l, 1))
-			lres->lrs_error = strdup(lua_tostring(l, 1));
-		lua_close(l);
-		return -1;
+# ifdef _FFR_STATSEXT
+	  case DKIMF_LUA_HOOK_STATS:
+		lib = dkimf_lua_lib_stats;
+		break;
+# endif /* _FFR_STATSEXT */
+
+	  case DKIMF_LUA_HOOK_FINAL:
+		lib = dkimf_lua_lib_final;
+		break;
 
 	  default:
 		assert(0);
+		return NULL;
 	}
 
-	if (keep != NULL && funclen != NULL)
-	{
-		io.lua_io_done = FALSE;
-		io.lua_io_script = NULL;
-		io.lua_io_len = 0;
-		io.lua_io_alloc = 0;
+	l = lua_newstate(dkimf_lua_alloc, NULL);
+	if (l == NULL)
+		return NULL;
 
-		if (lua_dump(l, dkimf_lua_writer, &io) == 0)
-		{
-			*keep = (void *) io.lua_io_script;
-			*funclen = io.lua_io_len;
-		}
-	}
+	luaL_openlibs(l);
 
-	status = lua_pcall(l, 0, LUA_MULTRET, 0);
-	if (lua_isstring(l, 1))
-		lres->lrs_error = strdup(lua_tostring(l, 1));
+	/*
+	**  Register functions.
+	*/
 
-	dkimf_lua_gc_cleanup(&gc);
+# if LUA_VERSION_NUM >= 502
+	lua_newtable(l);
+	luaL_setfuncs(l, lib, 0);
+	lua_setglobal(l, "odkim");
+# else /* LUA_VERSION_NUM >= 502 */
+	luaL_register(l, "odkim", lib);
+	lua_pop(l, 1);
+# endif /* LUA_VERSION_NUM >= 502 */
 
-	lua_close(l);
+	/*
+	**  Register constants.
+	*/
 
-	return (status == 0 ? 0 : 2);
-}
+	switch (hook)
+	{
+	  case DKIMF_LUA_HOOK_SETUP:
+		dkimf_lua_dbconsts(l);
+		dkimf_lua_smfisconsts(l);
+		break;
 
-/*
-**  DKIMF_LUA_SCREEN_HOOK -- hook to Lua for handling a message after the
-**                           verifying handle is established and all headers
-**                           have been fed to it
+	  case DKIMF_LUA_HOOK_SCREEN:
+		dkimf_lua_dbconsts(l);
+		break;
+
+	  default:
+		dkimf_lua_smfisconsts(l);
+		dkimf_lua_sigconsts(l);
+		break;
+	}
+
+	return l;
+}
+
+/*
+**  DKIMF_LUA_SNAPSHOT -- record a state's globals so they can be restored
+**                        after each run
 **
 **  Parameters:
-**  	ctx -- session context, for making calls back to opendkim.c
-**  	script -- script to run
-**  	scriptlen -- length of script; if 0, use strlen()
-**  	name -- name of the script (for logging)
-**  	lres -- Lua result structure
-**  	keep -- where to save the script (or NULL)
-**  	funclen -- size of the saved object
+**  	l -- Lua state
 **
 **  Return value:
-**  	2 -- processing error
-**  	1 -- script contains a syntax error
-**  	0 -- success
-**  	-1 -- memory allocation failure
+**  	None.
+*/
+
+static void
+dkimf_lua_snapshot(lua_State *l)
+{
+	lua_newtable(l);
+	DKIMF_LUA_PUSHGLOBALS(l);
+
+	lua_pushnil(l);
+	while (lua_next(l, -2) != 0)
+	{
+		lua_pushvalue(l, -2);
+		lua_insert(l, -2);
+		lua_rawset(l, -5);
+	}
+
+	lua_pop(l, 1);
+	lua_setfield(l, LUA_REGISTRYINDEX, DKIMF_LUA_BASELINE);
+}
+
+/*
+**  DKIMF_LUA_RESET -- return a state's globals to their recorded values
+**
+**  Parameters:
+**  	l -- Lua state
+**
+**  Return value:
+**  	None.
 **
 **  Notes:
-**  	Called by mlfi_eom() so it can decide whether or not the message
-**  	is acceptable.
+**  	Globals added by the filter or a script for one message are removed
+**  	and any the script replaced are put back, so the next message sees
+**  	what a new state would have.  Changes made inside the standard
+**  	library tables are not undone.
 */
 
-int
-dkimf_lua_screen_hook(void *ctx, const char *script, size_t scriptlen,
-                      const char *name, struct dkimf_lua_script_result *lres,
-                      void **keep, size_t *funclen)
+static void
+dkimf_lua_reset(lua_State *l)
 {
-	int status;
-	lua_State *l = NULL;
-	struct dkimf_lua_io io;
-	struct dkimf_lua_gc gc;
+	DKIMF_LUA_PUSHGLOBALS(l);
+	lua_getfield(l, LUA_REGISTRYINDEX, DKIMF_LUA_BASELINE);
 
-	assert(script != NULL);
-	assert(lres != NULL);
+	lua_pushnil(l);
+	(void) lua_setmetatable(l, -3);
 
-	io.lua_io_done = FALSE;
-	io.lua_io_script = script;
-	if (scriptlen == 0)
-		io.lua_io_len = strlen(script);
-	else
-		io.lua_io_len = scriptlen;
+	/* drop what wasn't there before; clearing during traversal is safe */
+	lua_pushnil(l);
+	while (lua_next(l, -3) != 0)
+	{
+		lua_pop(l, 1);
+		lua_pushvalue(l, -1);
+		lua_rawget(l, -3);
+		if (lua_isnil(l, -1))
+		{
+			lua_pop(l, 1);
+			lua_pushvalue(l, -1);
+			lua_pushnil(l);
+			lua_rawset(l, -5);
+		}
+		else
+		{
+			lua_pop(l, 1);
+		}
+	}
 
-	gc.gc_head = NULL;
-	gc.gc_tail = NULL;
+	/* restore what was */
+	lua_pushnil(l);
+	while (lua_next(l, -2) != 0)
+	{
+		lua_pushvalue(l, -2);
+		lua_insert(l, -2);
+		lua_rawset(l, -5);
+	}
 
-	l = lua_newstate(dkimf_lua_alloc, NULL);
-	if (l == NULL)
-		return -1;
+	lua_pop(l, 2);
+}
 
-	luaL_openlibs(l);
+/*
+**  DKIMF_LUA_POOLFREE -- release a thread's Lua states at thread exit
+**
+**  Parameters:
+**  	p -- pool to free
+**
+**  Return value:
+**  	None.
+*/
 
-	/*
-	**  Register functions.
-	*/
+static void
+dkimf_lua_poolfree(void *p)
+{
+	int c;
+	struct dkimf_lua_pool *pool;
 
-# if LUA_VERSION_NUM == 502
-	luaL_newlib(l, dkimf_lua_lib_screen);
-	lua_setglobal(l, "odkim");
-# else /* LUA_VERSION_NUM == 502 */
-	luaL_register(l, "odkim", dkimf_lua_lib_screen);
-# endif /* LUA_VERSION_NUM == 502 */
-	lua_pop(l, 1);
+	pool = (struct dkimf_lua_pool *) p;
 
-	/*
-	**  Register constants.
-	*/
+	for (c = 0; c < DKIMF_LUA_NHOOKS; c++)
+	{
+		if (pool->lp_states[c].ls_state != NULL)
+			lua_close(pool->lp_states[c].ls_state);
+		if (pool->lp_states[c].ls_chunk != NULL)
+			free(pool->lp_states[c].ls_chunk);
+	}
 
-	/* garbage collection handle */
-	lua_pushlightuserdata(l, &gc);
-	lua_setglobal(l, DKIMF_GC);
+	free(pool);
+}
 
-	/* DB handles */
-	lua_pushnumber(l, DB_DOMAINS);
-	lua_setglobal(l, "DB_DOMAINS");
-	lua_pushnumber(l, DB_THIRDPARTY);
-	lua_setglobal(l, "DB_THIRDPARTY");
-	lua_pushnumber(l, DB_DONTSIGNTO);
-	lua_setglobal(l, "DB_DONTSIGNTO");
-	lua_pushnumber(l, DB_MTAS);
-	lua_setglobal(l, "DB_MTAS");
-	lua_pushnumber(l, DB_MACROS);
-	lua_setglobal(l, "DB_MACROS");
-	lua_pushnumber(l, DB_SIGNINGTABLE);
-	lua_setglobal(l, "DB_SIGNINGTABLE");
+/*
+**  DKIMF_LUA_POOLINIT -- one-time initialization
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	None.
+*/
 
-	/* milter context */
-	lua_pushlightuserdata(l, ctx);
-	lua_setglobal(l, "ctx");
+static void
+dkimf_lua_poolinit(void)
+{
+	(void) pthread_key_create(&dkimf_lua_key, dkimf_lua_poolfree);
+}
 
-	/* import other globals */
-	dkimf_import_globals(ctx, l);
+/*
+**  DKIMF_LUA_POOL_GET -- take this thread's idle state for a hook, if it
+**                        has already loaded a given script
+**
+**  Parameters:
+**  	hook -- hook to be run (DKIMF_LUA_HOOK_*)
+**  	chunk -- compiled script
+**  	len -- bytes at "chunk"
+**
+**  Return value:
+**  	A Lua state, or NULL if there isn't a suitable one.
+**
+**  Notes:
+**  	An idle state whose script differs (e.g. after a configuration
+**  	reload) is discarded.
+*/
 
-# if LUA_VERSION_NUM == 502
-	switch (lua_load(l, dkimf_lua_reader, (void *) &io, name, NULL))
-# else /* LUA_VERSION_NUM == 502 */
-	switch (lua_load(l, dkimf_lua_reader, (void *) &io, name))
-# endif /* LUA_VERSION_NUM == 502 */
-	{
-	  case 0:
-		break;
+static lua_State *
+dkimf_lua_pool_get(int hook, const char *chunk, size_t len)
+{
+	lua_State *l;
+	struct dkimf_lua_pool *pool;
+	struct dkimf_lua_state *ls;
 
-	  case LUA_ERRSYNTAX:
-		if (lua_isstring(l, 1))
-			lres->lrs_error = strdup(lua_tostring(l, 1));
-		lua_close(l);
-		return 1;
+	(void) pthread_once(&dkimf_lua_once, dkimf_lua_poolinit);
 
-	  case LUA_ERRMEM:
-		if (lua_isstring(l, 1))
-			lres->lrs_error = strdup(lua_tostring(l, 1));
-		lua_close(l);
-		return -1;
+	pool = (struct dkimf_lua_pool *) pthread_getspecific(dkimf_lua_key);
+	if (pool == NULL)
+		return NULL;
 
-	  default:
-		assert(0);
+	ls = &pool->lp_states[hook];
+	if (ls->ls_state == NULL)
+		return NULL;
+
+	l = ls->ls_state;
+	ls->ls_state = NULL;
+
+	if (ls->ls_len != len || memcmp(ls->ls_chunk, chunk, len) != 0)
+	{
+		lua_close(l);
+		free(ls->ls_chunk);
+		ls->ls_chunk = NULL;
+		ls->ls_len = 0;
+		return NULL;
 	}
 
-	if (keep != NULL && funclen != NULL)
+	return l;
+}
+
+/*
+**  DKIMF_LUA_POOL_PUT -- keep a state for this thread's next run of a hook
+**
+**  Parameters:
+**  	hook -- hook that was run (DKIMF_LUA_HOOK_*)
+**  	chunk -- compiled script the state has loaded
+**  	len -- bytes at "chunk"
+**  	l -- Lua state
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_lua_pool_put(int hook, const char *chunk, size_t len, lua_State *l)
+{
+	struct dkimf_lua_pool *pool;
+	struct dkimf_lua_state *ls;
+
+	(void) pthread_once(&dkimf_lua_once, dkimf_lua_poolinit);
+
+	pool = (struct dkimf_lua_pool *) pthread_getspecific(dkimf_lua_key);
+	if (pool == NULL)
 	{
-		io.lua_io_done = FALSE;
-		io.lua_io_script = NULL;
-		io.lua_io_len = 0;
-		io.lua_io_alloc = 0;
+		pool = (struct dkimf_lua_pool *) malloc(sizeof *pool);
+		if (pool == NULL)
+		{
+			lua_close(l);
+			return;
+		}
 
-		if (lua_dump(l, dkimf_lua_writer, &io) == 0)
+		memset(pool, '\0', sizeof *pool);
+		if (pthread_setspecific(dkimf_lua_key, pool) != 0)
 		{
-			*keep = (void *) io.lua_io_script;
-			*funclen = io.lua_io_len;
+			free(pool);
+			lua_close(l);
+			return;
 		}
 	}
 
-	status = lua_pcall(l, 0, LUA_MULTRET, 0);
-	if (lua_isstring(l, 1))
-		lres->lrs_error = strdup(lua_tostring(l, 1));
+	ls = &pool->lp_states[hook];
+	if (ls->ls_state != NULL)
+		lua_close(ls->ls_state);
 
-	dkimf_lua_gc_cleanup(&gc);
+	if (ls->ls_chunk == NULL || ls->ls_len != len ||
+	    memcmp(ls->ls_chunk, chunk, len) != 0)
+	{
+		if (ls->ls_chunk != NULL)
+			free(ls->ls_chunk);
 
-	lua_close(l);
+		ls->ls_len = 0;
+		ls->ls_state = NULL;
+		ls->ls_chunk = malloc(len);
+		if (ls->ls_chunk == NULL)
+		{
+			lua_close(l);
+			return;
+		}
 
-	return (status == 0 ? 0 : 2);
+		memcpy(ls->ls_chunk, chunk, len);
+		ls->ls_len = len;
+	}
+
+	ls->ls_state = l;
 }
 
-# ifdef _FFR_STATSEXT
 /*
-**  DKIMF_LUA_STATS_HOOK -- hook to Lua for recording statistics after
-**                          verifying has been done
+**  DKIMF_LUA_HOOK -- run one of the message hooks
 **
 **  Parameters:
+**  	hook -- hook to run (DKIMF_LUA_HOOK_*)
 **  	ctx -- session context, for making calls back to opendkim.c
 **  	script -- script to run
 **  	scriptlen -- length of script; if 0, use strlen()
@@ -745,16 +965,20 @@ dkimf_lua_screen_hook(void *ctx, const char *script, size_t scriptlen,
 **  	-1 -- memory allocation failure
 **
 **  Notes:
-**  	Called by mlfi_eom() so it can pass extra statistical parameters
-**  	to the stats recording module.
+**  	When running for a message (i.e. "ctx" is set and the script isn't
+**  	being saved), a state that ran the same script for an earlier
+**  	message on this thread is reused, so only the call itself is paid
+**  	for.  States are only reused after a successful run.
 */
 
-int
-dkimf_lua_stats_hook(void *ctx, const char *script, size_t scriptlen,
-                     const char *name, struct dkimf_lua_script_result *lres,
-                     void **keep, size_t *funclen)
+static int
+dkimf_lua_hook(int hook, void *ctx, const char *script, size_t scriptlen,
+               const char *name, struct dkimf_lua_script_result *lres,
+               void **keep, size_t *funclen)
 {
+	_Bool pooled;
 	int status;
+	size_t len;
 	lua_State *l = NULL;
 	struct dkimf_lua_io io;
 	struct dkimf_lua_gc gc;
@@ -762,203 +986,219 @@ dkimf_lua_stats_hook(void *ctx, const char *script, size_t scriptlen,
 	assert(script != NULL);
 	assert(lres != NULL);
 
-	io.lua_io_done = FALSE;
-	io.lua_io_script = script;
 	if (scriptlen == 0)
-		io.lua_io_len = strlen(script);
+		len = strlen(script);
 	else
-		io.lua_io_len = scriptlen;
+		len = scriptlen;
+
+	io.lua_io_done = FALSE;
+	io.lua_io_script = script;
+	io.lua_io_len = len;
 
 	gc.gc_head = NULL;
 	gc.gc_tail = NULL;
 
-	l = lua_newstate(dkimf_lua_alloc, NULL);
-	if (l == NULL)
-		return -1;
+	pooled = (ctx != NULL && keep == NULL);
+	if (pooled)
+		l = dkimf_lua_pool_get(hook, script, len);
 
-	luaL_openlibs(l);
+	if (l != NULL)
+	{
+		lua_getfield(l, LUA_REGISTRYINDEX, DKIMF_LUA_CHUNK);
+	}
+	else
+	{
+		l = dkimf_lua_newstate(hook);
+		if (l == NULL)
+			return -1;
 
-	/*
-	**  Register functions.
-	*/
+		if (pooled)
+			dkimf_lua_snapshot(l);
 
-# if LUA_VERSION_NUM == 502
-	luaL_newlib(l, dkimf_lua_lib_stats);
-	lua_setglobal(l, "odkim");
-# else /* LUA_VERSION_NUM == 502 */
-	luaL_register(l, "odkim", dkimf_lua_lib_stats);
-# endif /* LUA_VERSION_NUM == 502 */
-	lua_pop(l, 1);
+# if LUA_VERSION_NUM >= 502
+		status = lua_load(l, dkimf_lua_reader, (void *) &io, name,
+		                  NULL);
+# else /* LUA_VERSION_NUM >= 502 */
+		status = lua_load(l, dkimf_lua_reader, (void *) &io, name);
+# endif /* LUA_VERSION_NUM >= 502 */
+		switch (status)
+		{
+		  case 0:
+			break;
+
+		  case LUA_ERRSYNTAX:
+			if (lua_isstring(l, 1))
+				lres->lrs_error = strdup(lua_tostring(l, 1));
+			lua_close(l);
+			return 1;
+
+		  case LUA_ERRMEM:
+			if (lua_isstring(l, 1))
+				lres->lrs_error = strdup(lua_tostring(l, 1));
+			lua_close(l);
+			return -1;
+
+		  default:
+			assert(0);
+		}
+
+		if (keep != NULL && funclen != NULL)
+		{
+			io.lua_io_done = FALSE;
+			io.lua_io_script = NULL;
+			io.lua_io_len = 0;
+			io.lua_io_alloc = 0;
+
+			if (DKIMF_LUA_DUMP(l, dkimf_lua_writer, &io) == 0)
+			{
+				*keep = (void *) io.lua_io_script;
+				*funclen = io.lua_io_len;
+			}
+		}
+
+		if (pooled)
+		{
+			lua_pushvalue(l, -1);
+			lua_setfield(l, LUA_REGISTRYINDEX, DKIMF_LUA_CHUNK);
+		}
+	}
 
 	/*
-	**  Register constants.
+	**  Per-message globals.
 	*/
 
 	/* garbage collection handle */
 	lua_pushlightuserdata(l, &gc);
 	lua_setglobal(l, DKIMF_GC);
 
-	/* milter result codes */
-	lua_pushnumber(l, SMFIS_TEMPFAIL);
-	lua_setglobal(l, "SMFIS_TEMPFAIL");
-	lua_pushnumber(l, SMFIS_ACCEPT);
-	lua_setglobal(l, "SMFIS_ACCEPT");
-	lua_pushnumber(l, SMFIS_DISCARD);
-	lua_setglobal(l, "SMFIS_DISCARD");
-	lua_pushnumber(l, SMFIS_REJECT);
-	lua_setglobal(l, "SMFIS_REJECT");
-
-	/* signature "bh" result codes */
-	lua_pushnumber(l, DKIM_SIGBH_UNTESTED);
-	lua_setglobal(l, "DKIM_SIGBH_UNTESTED");
-	lua_pushnumber(l, DKIM_SIGBH_MATCH);
-	lua_setglobal(l, "DKIM_SIGBH_MATCH");
-	lua_pushnumber(l, DKIM_SIGBH_MISMATCH);
-	lua_setglobal(l, "DKIM_SIGBH_MISMATCH");
-
-	/* signature error codes */
-	lua_pushnumber(l, DKIM_SIGERROR_UNKNOWN);
-	lua_setglobal(l, "DKIM_SIGERROR_UNKNOWN");
-	lua_pushnumber(l, DKIM_SIGERROR_OK);
-	lua_setglobal(l, "DKIM_SIGERROR_OK");
-	lua_pushnumber(l, DKIM_SIGERROR_VERSION);
-	lua_setglobal(l, "DKIM_SIGERROR_VERSION");
-	lua_pushnumber(l, DKIM_SIGERROR_DOMAIN);
-	lua_setglobal(l, "DKIM_SIGERROR_DOMAIN");
-	lua_pushnumber(l, DKIM_SIGERROR_EXPIRED);
-	lua_setglobal(l, "DKIM_SIGERROR_EXPIRED");
-	lua_pushnumber(l, DKIM_SIGERROR_FUTURE);
-	lua_setglobal(l, "DKIM_SIGERROR_FUTURE");
-	lua_pushnumber(l, DKIM_SIGERROR_TIMESTAMPS);
-	lua_setglobal(l, "DKIM_SIGERROR_TIMESTAMPS");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_HC);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_HC");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_BC);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_BC");
-	lua_pushnumber(l, DKIM_SIGERROR_MISSING_A);
-	lua_setglobal(l, "DKIM_SIGERROR_MISSING_A");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_A);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_A");
-	lua_pushnumber(l, DKIM_SIGERROR_MISSING_H);
-	lua_setglobal(l, "DKIM_SIGERROR_MISSING_H");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_L);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_L");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_Q);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_Q");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_QO);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_QO");
-	lua_pushnumber(l, DKIM_SIGERROR_MISSING_D);
-	lua_setglobal(l, "DKIM_SIGERROR_MISSING_D");
-	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_D);
-	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_D");
-	lua_pushnumber(l, DKIM_SIGERROR_MISSING_S);
-	lua_setglobal(l, "DKIM_SIGERROR_MISSING_S");
-	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_S);
-	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_S");
-	lua_pushnumber(l, DKIM_SIGERROR_MISSING_B);
-	lua_setglobal(l, "DKIM_SIGERROR_MISSING_B");
-	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_B);
-	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_B");
-	lua_pushnumber(l, DKIM_SIGERROR_CORRUPT_B);
-	lua_setglobal(l, "DKIM_SIGERROR_CORRUPT_B");
-	lua_pushnumber(l, DKIM_SIGERROR_NOKEY);
-	lua_setglobal(l, "DKIM_SIGERROR_NOKEY");
-	lua_pushnumber(l, DKIM_SIGERROR_DNSSYNTAX);
-	lua_setglobal(l, "DKIM_SIGERROR_DNSSYNTAX");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYFAIL);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYFAIL");
-	lua_pushnumber(l, DKIM_SIGERROR_MISSING_BH);
-	lua_setglobal(l, "DKIM_SIGERROR_MISSING_BH");
-	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_BH);
-	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_BH");
-	lua_pushnumber(l, DKIM_SIGERROR_CORRUPT_BH);
-	lua_setglobal(l, "DKIM_SIGERROR_CORRUPT_BH");
-	lua_pushnumber(l, DKIM_SIGERROR_BADSIG);
-	lua_setglobal(l, "DKIM_SIGERROR_BADSIG");
-	lua_pushnumber(l, DKIM_SIGERROR_SUBDOMAIN);
-	lua_setglobal(l, "DKIM_SIGERROR_SUBDOMAIN");
-	lua_pushnumber(l, DKIM_SIGERROR_MULTIREPLY);
-	lua_setglobal(l, "DKIM_SIGERROR_MULTIREPLY");
-	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_H);
-	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_H");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_H);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_H");
-	lua_pushnumber(l, DKIM_SIGERROR_TOOLARGE_L);
-	lua_setglobal(l, "DKIM_SIGERROR_TOOLARGE_L");
-	lua_pushnumber(l, DKIM_SIGERROR_MBSFAILED);
-	lua_setglobal(l, "DKIM_SIGERROR_MBSFAILED");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYVERSION);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYVERSION");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYUNKNOWNHASH);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYUNKNOWNHASH");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYHASHMISMATCH);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYHASHMISMATCH");
-	lua_pushnumber(l, DKIM_SIGERROR_NOTEMAILKEY);
-	lua_setglobal(l, "DKIM_SIGERROR_NOTEMAILKEY");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYTYPEMISSING);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYTYPEMISSING");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYTYPEUNKNOWN);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYTYPEUNKNOWN");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYREVOKED);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYREVOKED");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYDECODE);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYDECODE");
-
-	/* milter context */
-	lua_pushlightuserdata(l, ctx);
-	lua_setglobal(l, "ctx");
+	/* filter context */
+	lua_pushlightuserdata(l, ctx);
+	lua_setglobal(l, "ctx");
 
 	/* import other globals */
 	dkimf_import_globals(ctx, l);
 
-# if LUA_VERSION_NUM == 502
-	switch (lua_load(l, dkimf_lua_reader, (void *) &io, name, NULL))
-# else /* LUA_VERSION_NUM == 502 */
-	switch (lua_load(l, dkimf_lua_reader, (void *) &io, name))
-# endif /* LUA_VERSION_NUM == 502 */
-	{
-	  case 0:
-		break;
+	status = lua_pcall(l, 0, LUA_MULTRET, 0);
+	if (lua_isstring(l, 1))
+		lres->lrs_error = strdup(lua_tostring(l, 1));
 
-	  case LUA_ERRSYNTAX:
-		if (lua_isstring(l, 1))
-			lres->lrs_error = strdup(lua_tostring(l, 1));
-		lua_close(l);
-		return 1;
+	dkimf_lua_gc_cleanup(&gc);
 
-	  case LUA_ERRMEM:
-		if (lua_isstring(l, 1))
-			lres->lrs_error = strdup(lua_tostring(l, 1));
+	if (pooled && status == 0)
+	{
+		lua_settop(l, 0);
+		dkimf_lua_reset(l);
+		dkimf_lua_pool_put(hook, script, len, l);
+	}
+	else
+	{
 		lua_close(l);
-		return -1;
-
-	  default:
-		assert(0);
 	}
 
-	if (keep != NULL && funclen != NULL)
-	{
-		io.lua_io_done = FALSE;
-		io.lua_io_script = NULL;
-		io.lua_io_len = 0;
-		io.lua_io_alloc = 0;
+	return (status == 0 ? 0 : 2);
+}
 
-		if (lua_dump(l, dkimf_lua_writer, &io) == 0)
-		{
-			*keep = (void *) io.lua_io_script;
-			*funclen = io.lua_io_len;
-		}
-	}
+/*
+**  DKIMF_LUA_SETUP_HOOK -- hook to Lua for handling a message during setup
+**
+**  Parameters:
+**  	ctx -- session context, for making calls back to opendkim.c
+**  	script -- script to run
+**  	scriptlen -- length of script; if 0, use strlen()
+**  	name -- name of the script (for logging)
+**  	lres -- Lua result structure
+**  	keep -- where to save the script (or NULL)
+**  	funclen -- size of the saved object
+**
+**  Return value:
+**  	2 -- processing error
+**  	1 -- script contains a syntax error
+**  	0 -- success
+**  	-1 -- memory allocation failure
+**
+**  Side effects:
+**  	lres may be modified to relay the script's signing requests, i.e.
+**  	which key/selector(s) to use, whether to use "l=", etc.
+** 
+**  Notes:
+**  	Called by mlfi_eoh() so it can decide what signature(s) to apply.
+*/
 
-	status = lua_pcall(l, 0, LUA_MULTRET, 0);
-	if (lua_isstring(l, 1))
-		lres->lrs_error = strdup(lua_tostring(l, 1));
+int
+dkimf_lua_setup_hook(void *ctx, const char *script, size_t scriptlen,
+                     const char *name, struct dkimf_lua_script_result *lres,
+                     void **keep, size_t *funclen)
+{
+	return dkimf_lua_hook(DKIMF_LUA_HOOK_SETUP, ctx, script,
+	                      scriptlen, name, lres, keep, funclen);
+}
 
-	dkimf_lua_gc_cleanup(&gc);
+/*
+**  DKIMF_LUA_SCREEN_HOOK -- hook to Lua for handling a message after the
+**                           verifying handle is established and all headers
+**                           have been fed to it
+**
+**  Parameters:
+**  	ctx -- session context, for making calls back to opendkim.c
+**  	script -- script to run
+**  	scriptlen -- length of script; if 0, use strlen()
+**  	name -- name of the script (for logging)
+**  	lres -- Lua result structure
+**  	keep -- where to save the script (or NULL)
+**  	funclen -- size of the saved object
+**
+**  Return value:
+**  	2 -- processing error
+**  	1 -- script contains a syntax error
+**  	0 -- success
+**  	-1 -- memory allocation failure
+**
+**  Notes:
+**  	Called by mlfi_eom() so it can decide whether or not the message
+**  	is acceptable.
+*/
 
-	lua_close(l);
+int
+dkimf_lua_screen_hook(void *ctx, const char *script, size_t scriptlen,
+                      const char *name, struct dkimf_lua_script_result *lres,
+                      void **keep, size_t *funclen)
+{
+	return dkimf_lua_hook(DKIMF_LUA_HOOK_SCREEN, ctx, script,
+	                      scriptlen, name, lres, keep, funclen);
+}
 
-	return (status == 0 ? 0 : 2);
+# ifdef _FFR_STATSEXT
+/*
+**  DKIMF_LUA_STATS_HOOK -- hook to Lua for recording statistics after
+**                          verifying has been done
+**
+**  Parameters:
+**  	ctx -- session context, for making calls back to opendkim.c
+**  	script -- script to run
+**  	scriptlen -- length of script; if 0, use strlen()
+**  	name -- name of the script (for logging)
+**  	lres -- Lua result structure
+**  	keep -- where to save the script (or NULL)
+**  	funclen -- size of the saved object
+**
+**  Return value:
+**  	2 -- processing error
+**  	1 -- script contains a syntax error
+**  	0 -- success
+**  	-1 -- memory allocation failure
+**
+**  Notes:
+**  	Called by mlfi_eom() so it can pass extra statistical parameters
+**  	to the stats recording module.
+*/
+
+int
+dkimf_lua_stats_hook(void *ctx, const char *script, size_t scriptlen,
+                     const char *name, struct dkimf_lua_script_result *lres,
+                     void **keep, size_t *funclen)
+{
+	return dkimf_lua_hook(DKIMF_LUA_HOOK_STATS, ctx, script,
+	                      scriptlen, name, lres, keep, funclen);
 }
 # endif /* _FFR_STATSEXT */
 
@@ -991,211 +1231,8 @@ dkimf_lua_final_hook(void *ctx, const char *script, size_t scriptlen,
                      const char *name, struct dkimf_lua_script_result *lres,
                      void **keep, size_t *funclen)
 {
-	int status;
-	lua_State *l = NULL;
-	struct dkimf_lua_io io;
-	struct dkimf_lua_gc gc;
-
-	assert(script != NULL);
-	assert(lres != NULL);
-
-	io.lua_io_done = FALSE;
-	io.lua_io_script = script;
-	if (scriptlen == 0)
-		io.lua_io_len = strlen(script);
-	else
-		io.lua_io_len = scriptlen;
-
-	gc.gc_head = NULL;
-	gc.gc_tail = NULL;
-
-	l = lua_newstate(dkimf_lua_alloc, NULL);
-	if (l == NULL)
-		return -1;
-
-	luaL_openlibs(l);
-
-	/*
-	**  Register functions.
-	*/
-
-# if LUA_VERSION_NUM == 502
-	luaL_newlib(l, dkimf_lua_lib_final);
-	lua_setglobal(l, "odkim");
-# else /* LUA_VERSION_NUM == 502 */
-	luaL_register(l, "odkim", dkimf_lua_lib_final);
-# endif /* LUA_VERSION_NUM == 502 */
-	lua_pop(l, 1);
-
-	/*
-	**  Register constants.
-	*/
-
-	/* garbage collection handle */
-	lua_pushlightuserdata(l, &gc);
-	lua_setglobal(l, DKIMF_GC);
-
-	/* milter result codes */
-	lua_pushnumber(l, SMFIS_TEMPFAIL);
-	lua_setglobal(l, "SMFIS_TEMPFAIL");
-	lua_pushnumber(l, SMFIS_ACCEPT);
-	lua_setglobal(l, "SMFIS_ACCEPT");
-	lua_pushnumber(l, SMFIS_DISCARD);
-	lua_setglobal(l, "SMFIS_DISCARD");
-	lua_pushnumber(l, SMFIS_REJECT);
-	lua_setglobal(l, "SMFIS_REJECT");
-
-	/* signature "bh" result codes */
-	lua_pushnumber(l, DKIM_SIGBH_UNTESTED);
-	lua_setglobal(l, "DKIM_SIGBH_UNTESTED");
-	lua_pushnumber(l, DKIM_SIGBH_MATCH);
-	lua_setglobal(l, "DKIM_SIGBH_MATCH");
-	lua_pushnumber(l, DKIM_SIGBH_MISMATCH);
-	lua_setglobal(l, "DKIM_SIGBH_MISMATCH");
-
-	/* signature error codes */
-	lua_pushnumber(l, DKIM_SIGERROR_UNKNOWN);
-	lua_setglobal(l, "DKIM_SIGERROR_UNKNOWN");
-	lua_pushnumber(l, DKIM_SIGERROR_OK);
-	lua_setglobal(l, "DKIM_SIGERROR_OK");
-	lua_pushnumber(l, DKIM_SIGERROR_VERSION);
-	lua_setglobal(l, "DKIM_SIGERROR_VERSION");
-	lua_pushnumber(l, DKIM_SIGERROR_DOMAIN);
-	lua_setglobal(l, "DKIM_SIGERROR_DOMAIN");
-	lua_pushnumber(l, DKIM_SIGERROR_EXPIRED);
-	lua_setglobal(l, "DKIM_SIGERROR_EXPIRED");
-	lua_pushnumber(l, DKIM_SIGERROR_FUTURE);
-	lua_setglobal(l, "DKIM_SIGERROR_FUTURE");
-	lua_pushnumber(l, DKIM_SIGERROR_TIMESTAMPS);
-	lua_setglobal(l, "DKIM_SIGERROR_TIMESTAMPS");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_HC);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_HC");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_BC);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_BC");
-	lua_pushnumber(l, DKIM_SIGERROR_MISSING_A);
-	lua_setglobal(l, "DKIM_SIGERROR_MISSING_A");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_A);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_A");
-	lua_pushnumber(l, DKIM_SIGERROR_MISSING_H);
-	lua_setglobal(l, "DKIM_SIGERROR_MISSING_H");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_L);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_L");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_Q);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_Q");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_QO);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_QO");
-	lua_pushnumber(l, DKIM_SIGERROR_MISSING_D);
-	lua_setglobal(l, "DKIM_SIGERROR_MISSING_D");
-	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_D);
-	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_D");
-	lua_pushnumber(l, DKIM_SIGERROR_MISSING_S);
-	lua_setglobal(l, "DKIM_SIGERROR_MISSING_S");
-	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_S);
-	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_S");
-	lua_pushnumber(l, DKIM_SIGERROR_MISSING_B);
-	lua_setglobal(l, "DKIM_SIGERROR_MISSING_B");
-	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_B);
-	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_B");
-	lua_pushnumber(l, DKIM_SIGERROR_CORRUPT_B);
-	lua_setglobal(l, "DKIM_SIGERROR_CORRUPT_B");
-	lua_pushnumber(l, DKIM_SIGERROR_NOKEY);
-	lua_setglobal(l, "DKIM_SIGERROR_NOKEY");
-	lua_pushnumber(l, DKIM_SIGERROR_DNSSYNTAX);
-	lua_setglobal(l, "DKIM_SIGERROR_DNSSYNTAX");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYFAIL);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYFAIL");
-	lua_pushnumber(l, DKIM_SIGERROR_MISSING_BH);
-	lua_setglobal(l, "DKIM_SIGERROR_MISSING_BH");
-	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_BH);
-	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_BH");
-	lua_pushnumber(l, DKIM_SIGERROR_CORRUPT_BH);
-	lua_setglobal(l, "DKIM_SIGERROR_CORRUPT_BH");
-	lua_pushnumber(l, DKIM_SIGERROR_BADSIG);
-	lua_setglobal(l, "DKIM_SIGERROR_BADSIG");
-	lua_pushnumber(l, DKIM_SIGERROR_SUBDOMAIN);
-	lua_setglobal(l, "DKIM_SIGERROR_SUBDOMAIN");
-	lua_pushnumber(l, DKIM_SIGERROR_MULTIREPLY);
-	lua_setglobal(l, "DKIM_SIGERROR_MULTIREPLY");
-	lua_pushnumber(l, DKIM_SIGERROR_EMPTY_H);
-	lua_setglobal(l, "DKIM_SIGERROR_EMPTY_H");
-	lua_pushnumber(l, DKIM_SIGERROR_INVALID_H);
-	lua_setglobal(l, "DKIM_SIGERROR_INVALID_H");
-	lua_pushnumber(l, DKIM_SIGERROR_TOOLARGE_L);
-	lua_setglobal(l, "DKIM_SIGERROR_TOOLARGE_L");
-	lua_pushnumber(l, DKIM_SIGERROR_MBSFAILED);
-	lua_setglobal(l, "DKIM_SIGERROR_MBSFAILED");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYVERSION);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYVERSION");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYUNKNOWNHASH);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYUNKNOWNHASH");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYHASHMISMATCH);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYHASHMISMATCH");
-	lua_pushnumber(l, DKIM_SIGERROR_NOTEMAILKEY);
-	lua_setglobal(l, "DKIM_SIGERROR_NOTEMAILKEY");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYTYPEMISSING);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYTYPEMISSING");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYTYPEUNKNOWN);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYTYPEUNKNOWN");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYREVOKED);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYREVOKED");
-	lua_pushnumber(l, DKIM_SIGERROR_KEYDECODE);
-	lua_setglobal(l, "DKIM_SIGERROR_KEYDECODE");
-
-	/* milter context */
-	lua_pushlightuserdata(l, ctx);
-	lua_setglobal(l, "ctx");
-
-	/* import other globals */
-	dkimf_import_globals(ctx, l);
-
-# if LUA_VERSION_NUM == 502
-	switch (lua_load(l, dkimf_lua_reader, (void *) &io, name, NULL))
-# else /* LUA_VERSION_NUM == 502 */
-	switch (lua_load(l, dkimf_lua_reader, (void *) &io, name))
-# endif /* LUA_VERSION_NUM == 502 */
-	{
-	  case 0:
-		break;
-
-	  case LUA_ERRSYNTAX:
-		if (lua_isstring(l, 1))
-			lres->lrs_error = strdup(lua_tostring(l, 1));
-		lua_close(l);
-		return 1;
-
-	  case LUA_ERRMEM:
-		if (lua_isstring(l, 1))
-			lres->lrs_error = strdup(lua_tostring(l, 1));
-		lua_close(l);
-		return -1;
-
-	  default:
-		assert(0);
-	}
-
-	if (keep != NULL && funclen != NULL)
-	{
-		io.lua_io_done = FALSE;
-		io.lua_io_script = NULL;
-		io.lua_io_len = 0;
-		io.lua_io_alloc = 0;
-
-		if (lua_dump(l, dkimf_lua_writer, &io) == 0)
-		{
-			*keep = (void *) io.lua_io_script;
-			*funclen = io.lua_io_len;
-		}
-	}
-
-	status = lua_pcall(l, 0, LUA_MULTRET, 0);
-	if (lua_isstring(l, 1))
-		lres->lrs_error = strdup(lua_tostring(l, 1));
-
-	dkimf_lua_gc_cleanup(&gc);
-
-	lua_close(l);
-
-	return (status == 0 ? 0 : 2);
+	return dkimf_lua_hook(DKIMF_LUA_HOOK_FINAL, ctx, script,
+	                      scriptlen, name, lres, keep, funclen);
 }
 #endif /* DKIMF_LUA_CONTEXT_HOOKS */
 
@@ -1249,11 +1286,11 @@ dkimf_lua_db_hook(const char *script, size_t scriptlen, const char *query,
 		lua_pushstring(l, query);
 	lua_setglobal(l, "query");
 
-# if LUA_VERSION_NUM == 502
+# if LUA_VERSION_NUM >= 502
 	switch (lua_load(l, dkimf_lua_reader, (void *) &io, script, NULL))
-# else /* LUA_VERSION_NUM == 502 */
+# else /* LUA_VERSION_NUM >= 502 */
 	switch (lua_load(l, dkimf_lua_reader, (void *) &io, script))
-# endif /* LUA_VERSION_NUM == 502 */
+# endif /* LUA_VERSION_NUM >= 502 */
 	{
 	  case 0:
 		break;
@@ -1281,7 +1318,7 @@ dkimf_lua_db_hook(const char *script, size_t scriptlen, const char *query,
 		io.lua_io_len = 0;
 		io.lua_io_alloc = 0;
 
-		if (lua_dump(l, dkimf_lua_writer, &io) == 0)
+		if (DKIMF_LUA_DUMP(l, dkimf_lua_writer, &io) == 0)
 		{
 			*keep = (void *) io.lua_io_script;
 			*funclen = io.lua_io_len;
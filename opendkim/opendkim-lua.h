@@ -34,6 +34,15 @@ struct dkimf_lua_gc
 #define	DKIMF_GC		"_DKIMF_GC"
 #define	DKIMF_LUA_GC_DB		1
 
+#define	DKIMF_LUA_HOOK_SETUP	0
+#define	DKIMF_LUA_HOOK_SCREEN	1
+#define	DKIMF_LUA_HOOK_STATS	2
+#define	DKIMF_LUA_HOOK_FINAL	3
+#define	DKIMF_LUA_NHOOKS	4
+
+#define	DKIMF_LUA_BASELINE	"_DKIMF_BASELINE"
+#define	DKIMF_LUA_CHUNK		"_DKIMF_CHUNK"
+
 /* prototypes */
 extern int dkimf_lua_db_hook __P((const char *, size_t, const char *,
                                   struct dkimf_lua_script_result *,
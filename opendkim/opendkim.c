@@ -123,6 +123,8 @@
 #include "opendkim-ar.h"
 #include "opendkim-arf.h"
 #include "opendkim-dns.h"
+#include "keycache.h"
+#include "arena.h"
 #ifdef USE_LUA
 # include "opendkim-lua.h"
 #endif /* USE_LUA */
@@ -148,6 +150,8 @@
 #define	DKIMF_MILTER_DISCARD	3
 #define	DKIMF_MILTER_QUARANTINE	4
 
+#define	DKIMF_HDRBUCKETS	64	/* header name index size */
+
 /*
 **  ADDRLIST -- address list
 */
@@ -238,6 +242,7 @@ struct dkimf_config
 	_Bool		conf_dolog_success;	/* syslog successes too? */
 	_Bool		conf_milterv2;		/* using milter v2? */
 	_Bool		conf_fixcrlf;		/* fix bare CRs and LFs? */
+	_Bool		conf_prefetchkeys;	/* start key queries at EOH? */
 	_Bool		conf_logwhy;		/* log mode decision logic */
 	_Bool		conf_allowsha1only;	/* allow rsa-sha1 verifying */
 	_Bool		conf_stricthdrs;	/* strict header checks */
@@ -376,6 +381,8 @@ struct dkimf_config
 	DKIMF_DB	conf_rephdrsdb;		/* replacement headers (DB) */
 #endif /* _FFR_REPLACE_RULES */
 	dkim_sigkey_t	conf_seckey;		/* secret key data */
+	DKIM_PRIVKEY *	conf_privkey;		/* secret key (parsed) */
+	struct dkimf_keycache * conf_keycache;	/* parsed KeyTable keys */
 	char *		conf_nslist;		/* replacement NS list */
 	char *		conf_trustanchorpath;	/* trust anchor file */
 	char *		conf_resolverconfig;	/* resolver config file */
@@ -492,12 +499,14 @@ struct msgctx
 	u_char *	mctx_jobid;		/* job ID */
 	u_char *	mctx_laddr;		/* address triggering l= */
 	DKIM *		mctx_dkimv;		/* verification handle */
+	struct dkimf_arena * mctx_arena;	/* memory for DKIM handles */
 #ifdef _FFR_VBR
 	VBR *		mctx_vbr;		/* VBR handle */
 	char *		mctx_vbrinfo;		/* VBR-Info header field */
 #endif /* _FFR_VBR */
 	struct Header *	mctx_hqhead;		/* header queue head */
 	struct Header *	mctx_hqtail;		/* header queue tail */
+	struct Header *	mctx_hindex[DKIMF_HDRBUCKETS]; /* header name index */
 	struct signreq * mctx_srhead;		/* signature request head */
 	struct signreq * mctx_srtail;		/* signature request tail */
 	struct addrlist * mctx_rcptlist;	/* recipient list */
@@ -513,6 +522,7 @@ struct msgctx
 	SHA_CTX		mctx_hash;		/* hash, for dup detection */
 # endif /* USE_GNUTLS */
 #endif /* _FFR_REPUTATION */
+	struct timeval	mctx_eohtime;		/* key queries started */
 	unsigned char	mctx_envfrom[MAXADDRESS + 1];
 						/* envelope sender */
 	unsigned char	mctx_domain[DKIM_MAXHOSTNAMELEN + 1];
@@ -628,6 +638,7 @@ struct lookup dkimf_sign[] =
 {
 	{ "rsa-sha1",		DKIM_SIGN_RSASHA1 },
 	{ "rsa-sha256",		DKIM_SIGN_RSASHA256 },
+	{ "ed25519-sha256",	DKIM_SIGN_ED25519SHA256 },
 	{ NULL,			-1 },
 };
 
@@ -727,9 +738,12 @@ static int dkimf_apply_signtable __P((struct msgctx *, DKIMF_DB, DKIMF_DB,
                                       size_t, _Bool));
 sfsistat dkimf_chgheader __P((SMFICTX *, char *, int, char *));
 static void dkimf_cleanup __P((SMFICTX *));
+static struct dkimf_config *dkimf_config_get __P((void));
+static void dkimf_config_release __P((struct dkimf_config *));
 static void dkimf_config_reload __P((void));
 sfsistat dkimf_delrcpt __P((SMFICTX *, char *));
 static Header dkimf_findheader __P((msgctx, char *, int));
+static void dkimf_indexheader __P((msgctx, Header));
 void *dkimf_getpriv __P((SMFICTX *));
 char *dkimf_getsymval __P((SMFICTX *, char *));
 sfsistat dkimf_insheader __P((SMFICTX *, int, char *, char *));
@@ -738,6 +752,7 @@ void dkimf_sendprogress __P((const void *));
 sfsistat dkimf_setpriv __P((SMFICTX *, void *));
 sfsistat dkimf_setreply __P((SMFICTX *, char *, char *, char *));
 static void dkimf_sigreport __P((connctx, struct dkimf_config *, char *));
+static uint64_t dkimf_timediff __P((struct timeval *, struct timeval *));
 
 /* GLOBALS */
 _Bool dolog;					/* logging? (exported) */
@@ -754,6 +769,10 @@ int thread_count;				/* thread count */
 #ifdef QUERY_CACHE
 time_t cache_lastlog;				/* last cache stats logged */
 #endif /* QUERY_CACHE */
+time_t prefetch_lastlog;			/* last prefetch stats logged */
+u_long prefetch_msgs;				/* messages with prefetched keys */
+uint64_t prefetch_overlap;			/* usecs overlapped with body */
+uint64_t prefetch_wait;				/* usecs spent in dkim_eom() */
 char *progname;					/* program name */
 char *sock;					/* listening socket */
 char *conffile;					/* configuration file */
@@ -765,7 +784,12 @@ char reportcmd[BUFRSZ + 1];			/* reporting command */
 char reportaddr[MAXADDRESS + 1];		/* reporting address */
 char myhostname[DKIM_MAXHOSTNAMELEN + 1];	/* hostname */
 pthread_mutex_t conf_lock;			/* config lock */
+pthread_mutex_t reload_lock;			/* one reload at a time */
 pthread_mutex_t pwdb_lock;			/* passwd/group lock */
+pthread_mutex_t prefetch_lock;			/* prefetch stats lock */
+#ifdef _FFR_RBL
+RBL_CACHE *rblcache;				/* RBL results cache */
+#endif /* _FFR_RBL */
 
 /* Other useful definitions */
 #define CRLF			"\r\n"		/* CRLF */
@@ -1375,18 +1399,26 @@ dkimf_xs_export(lua_State *l)
 **
 **  Return value:
 **  	Number of stack items pushed.
+**
+**  Notes:
+**  	If the query root is a table of RBLs, they are all queried at once
+**  	and a table is returned that maps each RBL listing the subject to
+**  	its entry, as a dotted quad.
 */
 
 int
 dkimf_xs_rblcheck(lua_State *l)
 {
 	_Bool found = FALSE;
+	int c;
+	int nqroots = 0;
 	RBL_STAT status;
 	uint32_t res;
 	double timeout = -1.;
 	double i;
 	const char *query;
 	const char *qroot = NULL;
+	u_char **qroots = NULL;
 	void *qh;
 	RBL *rbl;
 	SMFICTX *ctx;
@@ -1402,7 +1434,7 @@ dkimf_xs_rblcheck(lua_State *l)
 	}
 	else if (!lua_isuserdata(l, 1) ||
 	         !lua_isstring(l, 2) ||
-	         !lua_isstring(l, 3) ||
+	         (!lua_isstring(l, 3) && !lua_istable(l, 3)) ||
 	         (lua_gettop(l) == 4 && !lua_isnumber(l, 4)))
 	{
 		lua_pushstring(l,
@@ -1415,13 +1447,39 @@ dkimf_xs_rblcheck(lua_State *l)
 		cc = (struct connctx *) dkimf_getpriv(ctx);
 		
 	query = lua_tostring(l, 2);
-	qroot = lua_tostring(l, 3);
+	if (lua_istable(l, 3))
+	{
+		for (;;)
+		{
+			lua_rawgeti(l, 3, nqroots + 1);
+			if (!lua_isstring(l, -1))
+			{
+				lua_pop(l, 1);
+				break;
+			}
+			lua_pop(l, 1);
+			nqroots++;
+		}
+
+		if (nqroots == 0)
+		{
+			lua_pushstring(l,
+			               "odkim.rbl_check(): empty RBL list");
+			lua_error(l);
+		}
+	}
+	else
+	{
+		qroot = lua_tostring(l, 3);
+	}
 	if (lua_gettop(l) == 4)
 		timeout = lua_tonumber(l, 4);
-	lua_pop(l, lua_gettop(l));
 
 	if (cc == NULL)
+	{
+		lua_pop(l, lua_gettop(l));
 		return 0;
+	}
 
 	conf = cc->cctx_config;
 
@@ -1433,6 +1491,8 @@ dkimf_xs_rblcheck(lua_State *l)
 		lua_error(l);
 	}
 
+	rbl_setcache(rbl, rblcache);
+
 #  ifdef USE_UNBOUND
 	dkimf_rbl_unbound_setup(rbl);
 #  endif /* USE_UNBOUND */
@@ -1479,6 +1539,81 @@ dkimf_xs_rblcheck(lua_State *l)
 		}
 	}
 
+	/* copy the RBL list last, so the errors above can't leak it */
+	if (nqroots > 0)
+	{
+		qroots = (u_char **) malloc((nqroots + 1) * sizeof(u_char *));
+		if (qroots == NULL)
+		{
+			rbl_close(rbl);
+			lua_pushfstring(l, "odkim.rbl_check(): malloc(): %s",
+			                strerror(errno));
+			lua_error(l);
+		}
+
+		for (c = 0; c < nqroots; c++)
+		{
+			lua_rawgeti(l, 3, c + 1);
+			qroots[c] = (u_char *) strdup(lua_tostring(l, -1));
+			lua_pop(l, 1);
+			if (qroots[c] == NULL)
+			{
+				nqroots = c;
+				break;
+			}
+		}
+		qroots[nqroots] = NULL;
+	}
+
+	lua_pop(l, lua_gettop(l));
+
+	to.tv_usec = modf(timeout, &i) * 1000000;
+	to.tv_sec = (u_int) i;
+
+	if (qroots != NULL)
+	{
+		char addr[INET_ADDRSTRLEN];
+
+		status = rbl_batch_start(rbl, (u_char *) query, qroots, &qh);
+		if (status != RBL_STAT_OK)
+		{
+			for (c = 0; c < nqroots; c++)
+				TRYFREE(qroots[c]);
+			free(qroots);
+			rbl_close(rbl);
+			lua_pushstring(l,
+			               "odkim.rbl_check(): RBL query failed");
+			lua_error(l);
+		}
+
+		(void) rbl_batch_check(rbl, qh,
+		                       timeout == -1. ? NULL : &to);
+
+		lua_newtable(l);
+
+		for (c = 0; c < nqroots; c++)
+		{
+			if (rbl_batch_result(rbl, qh, c, &res) == RBL_STAT_FOUND)
+			{
+				snprintf(addr, sizeof addr, "%u.%u.%u.%u",
+				         res >> 24, (res >> 16) & 0xff,
+				         (res >> 8) & 0xff, res & 0xff);
+
+				lua_pushstring(l, (char *) qroots[c]);
+				lua_pushstring(l, addr);
+				lua_settable(l, -3);
+			}
+
+			TRYFREE(qroots[c]);
+		}
+
+		free(qroots);
+		(void) rbl_batch_cancel(rbl, qh);
+		rbl_close(rbl);
+
+		return 1;
+	}
+
 	rbl_setdomain(rbl, (u_char *) qroot);
 
 	status = rbl_query_start(rbl, (u_char *) query, &qh);
@@ -1490,9 +1625,6 @@ dkimf_xs_rblcheck(lua_State *l)
 		lua_error(l);
 	}
 
-	to.tv_usec = modf(timeout, &i);
-	to.tv_sec = (u_int) i;
-
 	status = rbl_query_check(rbl, qh, timeout == -1. ? NULL : &to, &res);
 
 	if (status != RBL_STAT_NOTFOUND &&
@@ -2999,8 +3131,8 @@ dkimf_xs_verify(lua_State *l)
 			DKIM_STAT status;
 
 			dfc->mctx_dkimv = dkim_verify(conf->conf_libopendkim,
-			                              dfc->mctx_jobid, NULL,
-			                              &status);
+			                              dfc->mctx_jobid,
+			                              dfc->mctx_arena, &status);
 
 			if (dfc->mctx_dkimv == NULL)
 			{
@@ -4825,6 +4957,25 @@ dkimf_securefile(const char *path, ino_t *ino, uid_t myuid, char *err,
 #endif /* HAVE_REALPATH */
 }
 
+/*
+**  DKIMF_KEYISPATH -- determine whether key data names a file
+**
+**  Parameters:
+**  	buf -- key data
+**
+**  Return value:
+**  	TRUE iff "buf" looks like a filename rather than a key.
+*/
+
+static _Bool
+dkimf_keyispath(const char *buf)
+{
+	assert(buf != NULL);
+
+	return (buf[0] == '/' || (buf[0] == '.' && buf[1] == '/') ||
+	        (buf[0] == '.' && buf[1] == '.' && buf[2] == '/'));
+}
+
 /*
 **  DKIMF_LOADKEY -- resolve a key
 **
@@ -4852,8 +5003,7 @@ dkimf_loadkey(char *buf, size_t *buflen, _Bool *insecure, char *error,
 	assert(buf != NULL);
 	assert(buflen != NULL);
 
-	if (buf[0] == '/' || (buf[0] == '.' && buf[1] == '/') ||
-	    (buf[0] == '.' && buf[1] == '.' && buf[2] == '/'))
+	if (dkimf_keyispath(buf))
 	{
 		int fd;
 		int status;
@@ -4929,9 +5079,14 @@ dkimf_add_signrequest(struct msgctx *dfc, DKIMF_DB keytable, char *keyname,
 {
 	_Bool found = FALSE;
 	size_t keydatasz = 0;
+	char *cachename = NULL;
+	char *inlinedata = NULL;
 	struct signreq *new;
+	DKIM_PRIVKEY *privkey = NULL;
+	struct stat sb;
 	struct dkimf_db_data dbd[3];
 	char keydata[MAXBUFRSZ + 1];
+	char keypath[MAXPATHLEN + 1];
 	char domain[DKIM_MAXHOSTNAMELEN + 1];
 	char selector[BUFRSZ + 1];
 	char err[BUFRSZ + 1];
@@ -5045,47 +5200,118 @@ dkimf_add_signrequest(struct msgctx *dfc, DKIMF_DB keytable, char *keyname,
 			memcpy(keydata, tmpdata, sizeof keydata);
 		}
 
-		keydatasz = sizeof keydata - 1;
-		insecure = FALSE;
-		if (!dkimf_loadkey(dbd[2].dbdata_buffer, &keydatasz,
-		                   &insecure, err, sizeof err))
+		/*
+		**  Try the parsed key cache first.  A key file's entry is
+		**  used only until the file is replaced, modified or has
+		**  its ownership or permissions changed, and the full load
+		**  path with its security checks is run again periodically
+		**  in any case.  An inline key is cached under its KeyTable
+		**  name along with its data, so a key changed in the
+		**  KeyTable replaces the old entry.
+		*/
+
+		if (curconf->conf_keycache != NULL)
 		{
-			if (dolog)
+			if (!dkimf_keyispath(keydata))
 			{
-				syslog(LOG_ERR, "can't load key from %s: %s",
-				       dbd[2].dbdata_buffer, err);
+				inlinedata = strdup(keydata);
+				if (inlinedata != NULL)
+				{
+					cachename = keyname;
+					privkey = dkimf_keycache_get(curconf->conf_keycache,
+					                             cachename,
+					                             NULL,
+					                             inlinedata);
+				}
+			}
+			else if (stat(keydata, &sb) == 0)
+			{
+				strlcpy(keypath, keydata, sizeof keypath);
+				cachename = keypath;
+				privkey = dkimf_keycache_get(curconf->conf_keycache,
+				                             cachename, &sb,
+				                             NULL);
 			}
-
-			return 2;
 		}
 
-		if (insecure)
+		if (privkey == NULL)
 		{
-			if (dolog)
+			keydatasz = sizeof keydata - 1;
+			insecure = FALSE;
+			if (!dkimf_loadkey(dbd[2].dbdata_buffer, &keydatasz,
+			                   &insecure, err, sizeof err))
 			{
-				int sev;
+				if (dolog)
+				{
+					syslog(LOG_ERR, "can't load key from %s: %s",
+					       dbd[2].dbdata_buffer, err);
+				}
 
-				sev = (curconf->conf_safekeys ? LOG_ERR
-				                              : LOG_WARNING);
+				if (inlinedata != NULL)
+					free(inlinedata);
 
-				syslog(sev, "%s: key data is not secure: %s",
-				       keyname, err);
+				return 2;
 			}
 
- 			if (curconf->conf_safekeys)
-				return 2;
+			if (insecure)
+			{
+				if (dolog)
+				{
+					int sev;
+
+					sev = (curconf->conf_safekeys ? LOG_ERR
+					                              : LOG_WARNING);
+
+					syslog(sev, "%s: key data is not secure: %s",
+					       keyname, err);
+				}
+
+				if (curconf->conf_safekeys)
+				{
+					if (inlinedata != NULL)
+						free(inlinedata);
+
+					return 2;
+				}
+			}
+
+			/* cache it unless it's insecure */
+			if (cachename != NULL && !insecure)
+			{
+				DKIM_STAT status;
+
+				privkey = dkim_privkey_new(curconf->conf_libopendkim,
+				                           (dkim_sigkey_t) keydata,
+				                           &status);
+				if (privkey != NULL)
+				{
+					dkimf_keycache_put(curconf->conf_keycache,
+					                   cachename,
+					                   cachename == keypath ? &sb
+					                                        : NULL,
+					                   inlinedata, privkey);
+				}
+			}
 		}
+
+		if (inlinedata != NULL)
+			free(inlinedata);
 	}
 
 	new = malloc(sizeof *new);
 	if (new == NULL)
+	{
+		if (privkey != NULL)
+			dkim_privkey_free(privkey);
 		return -1;
+	}
 
 	new->srq_next = NULL;
 	new->srq_dkim = NULL;
 	new->srq_domain = NULL;
 	new->srq_selector = NULL;
 	new->srq_keydata = NULL;
+	new->srq_privkey = privkey;
 	new->srq_signlen = signlen;
 	if (signer != NULL && signer[0] != '\0')
 		new->srq_signer = (u_char *) strdup(signer);
@@ -5100,14 +5326,20 @@ dkimf_add_signrequest(struct msgctx *dfc, DKIMF_DB keytable, char *keyname,
 			new->srq_domain = (u_char *) strdup((char *) domain);
 
 		new->srq_selector = (u_char *) strdup((char *) selector);
-		new->srq_keydata = (void *) malloc(keydatasz + 1);
-		if (new->srq_keydata == NULL)
+
+		/* the raw key is only needed if it wasn't parsed here */
+		if (privkey == NULL)
 		{
-			free(new);
-			return -1;
+			new->srq_keydata = (void *) malloc(keydatasz + 1);
+			if (new->srq_keydata == NULL)
+			{
+				free(new);
+				return -1;
+			}
+			memset(new->srq_keydata, '\0', keydatasz + 1);
+			memcpy(new->srq_keydata, dbd[2].dbdata_buffer,
+			       keydatasz);
 		}
-		memset(new->srq_keydata, '\0', keydatasz + 1);
-		memcpy(new->srq_keydata, dbd[2].dbdata_buffer, keydatasz);
 	}
 
 	if (dfc->mctx_srtail != NULL)
@@ -5789,6 +6021,12 @@ dkimf_zapkey(struct dkimf_config *conf)
 		free(conf->conf_seckey);
 		conf->conf_seckey = NULL;
 	}
+
+	if (conf->conf_privkey != NULL)
+	{
+		dkim_privkey_free(conf->conf_privkey);
+		conf->conf_privkey = NULL;
+	}
 }
 
 /*
@@ -5884,6 +6122,76 @@ dkimf_config_new(void)
 	return new;
 }
 
+/*
+**  DKIMF_LOGCACHESTATS -- log a data set's result cache statistics
+**
+**  Parameters:
+**  	name -- configuration item that names the data set
+**  	db -- data set (may be NULL)
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_logcachestats(char *name, DKIMF_DB db)
+{
+	uint64_t avg;
+	struct dkimf_db_cachestats cs;
+
+	if (db == NULL || dkimf_db_cachestats(db, &cs) != 0)
+		return;
+
+	avg = (cs.cs_misses == 0 ? 0 : cs.cs_usecs / cs.cs_misses);
+
+	syslog(LOG_INFO,
+	       "%s cache: %lu hit%s (%lu negative), %lu miss%s (%lu coalesced), %lu eviction%s, %lu entr%s (%lu bytes), miss time avg %lu.%03lums max %lu.%03lums",
+	       name, cs.cs_hits, cs.cs_hits == 1 ? "" : "s", cs.cs_neghits,
+	       cs.cs_misses, cs.cs_misses == 1 ? "" : "es", cs.cs_coalesced,
+	       cs.cs_evictions, cs.cs_evictions == 1 ? "" : "s",
+	       cs.cs_entries, cs.cs_entries == 1 ? "y" : "ies",
+	       (u_long) cs.cs_bytes,
+	       (u_long) (avg / 1000), (u_long) (avg % 1000),
+	       (u_long) (cs.cs_maxusecs / 1000),
+	       (u_long) (cs.cs_maxusecs % 1000));
+}
+
+#ifdef USE_UNBOUND
+/*
+**  DKIMF_LOGUBSTATS -- log the resolver thread's statistics
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_logubstats(void)
+{
+	uint64_t avg;
+	struct dkimf_ub_stats us;
+
+	dkimf_ub_stats(&us);
+
+	if (us.us_queries == 0)
+		return;
+
+	avg = (us.us_answers == 0 ? 0 : us.us_usecs / us.us_answers);
+
+	syslog(LOG_INFO,
+	       "resolver: %lu quer%s, %lu answer%s, %lu error%s, %u in flight (max %u), answer time avg %lu.%03lums max %lu.%03lums",
+	       us.us_queries, us.us_queries == 1 ? "y" : "ies",
+	       us.us_answers, us.us_answers == 1 ? "" : "s",
+	       us.us_errors, us.us_errors == 1 ? "" : "s",
+	       us.us_depth, us.us_maxdepth,
+	       (u_long) (avg / 1000), (u_long) (avg % 1000),
+	       (u_long) (us.us_maxusecs / 1000),
+	       (u_long) (us.us_maxusecs % 1000));
+}
+#endif /* USE_UNBOUND */
+
 /*
 **  DKIMF_CONFIG_FREE -- destroy a configuration handle
 **
@@ -5902,6 +6210,42 @@ dkimf_config_free(struct dkimf_config *conf)
 
 	dkimf_zapkey(conf);
 
+	if (conf->conf_keycache != NULL)
+	{
+		if (conf->conf_dolog)
+		{
+			u_long hits;
+			u_long misses;
+
+			dkimf_keycache_stats(conf->conf_keycache,
+			                     &hits, &misses);
+
+			syslog(LOG_INFO, "key cache: %lu hit%s, %lu miss%s",
+			       hits, hits == 1 ? "" : "s",
+			       misses, misses == 1 ? "" : "es");
+		}
+
+		dkimf_keycache_free(conf->conf_keycache);
+	}
+
+	if (conf->conf_dolog)
+	{
+		dkimf_logcachestats("KeyTable", conf->conf_keytabledb);
+		dkimf_logcachestats("SigningTable", conf->conf_signtabledb);
+		dkimf_logcachestats("Domain", conf->conf_domainsdb);
+		dkimf_logcachestats("ExemptDomains", conf->conf_exemptdb);
+		dkimf_logcachestats("InternalHosts", conf->conf_internal);
+		dkimf_logcachestats("PeerList", conf->conf_peerdb);
+		dkimf_logcachestats("DontSignMailTo",
+		                    conf->conf_dontsigntodb);
+#ifdef _FFR_RESIGN
+		dkimf_logcachestats("ResignMailTo", conf->conf_resigndb);
+#endif /* _FFR_RESIGN */
+#ifdef USE_UNBOUND
+		dkimf_logubstats();
+#endif /* USE_UNBOUND */
+	}
+
 	if (conf->conf_libopendkim != NULL)
 		dkim_close(conf->conf_libopendkim);
 
@@ -5995,7 +6339,13 @@ dkimf_config_free(struct dkimf_config *conf)
 	if (conf->conf_ratelimitdb != NULL)
 		dkimf_db_close(conf->conf_ratelimitdb);
 	if (conf->conf_flowdatadb != NULL)
+	{
+		if (dkimf_rate_flush(conf->conf_flowdatadb) != 0 &&
+		    conf->conf_dolog)
+			syslog(LOG_ERR, "can't write flow data");
+
 		dkimf_db_close(conf->conf_flowdatadb);
+	}
 #endif /* _FFR_RATE_LIMIT */
 
 #ifdef _FFR_REPUTATION
@@ -6048,6 +6398,65 @@ dkimf_config_free(struct dkimf_config *conf)
 	free(conf);
 }
 
+/*
+**  DKIMF_CONFIG_GET -- take a reference to the current configuration
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	The current configuration handle, which stays valid until passed
+**  	to dkimf_config_release().
+*/
+
+static struct dkimf_config *
+dkimf_config_get(void)
+{
+	struct dkimf_config *conf;
+
+	pthread_mutex_lock(&conf_lock);
+
+	conf = curconf;
+	conf->conf_refcnt++;
+
+	pthread_mutex_unlock(&conf_lock);
+
+	return conf;
+}
+
+/*
+**  DKIMF_CONFIG_RELEASE -- drop a reference to a configuration
+**
+**  Parameters:
+**  	conf -- configuration handle from dkimf_config_get()
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	A configuration replaced by a reload is freed when its last
+**  	reference is dropped.  Nothing can take a new reference to it by
+**  	then, so it's freed after "conf_lock" is released.
+*/
+
+static void
+dkimf_config_release(struct dkimf_config *conf)
+{
+	_Bool stale;
+
+	assert(conf != NULL);
+
+	pthread_mutex_lock(&conf_lock);
+
+	conf->conf_refcnt--;
+	stale = (conf->conf_refcnt == 0 && conf != curconf);
+
+	pthread_mutex_unlock(&conf_lock);
+
+	if (stale)
+		dkimf_config_free(conf);
+}
+
 /*
 **  DKIMF_PARSEHANDLER -- parse a handler
 **
@@ -6296,6 +6705,10 @@ dkimf_config_load(struct config *data, struct dkimf_config *conf,
 		                  &conf->conf_fixcrlf,
 		                  sizeof conf->conf_fixcrlf);
 
+		(void) config_get(data, "PrefetchKeys",
+		                  &conf->conf_prefetchkeys,
+		                  sizeof conf->conf_prefetchkeys);
+
 		(void) config_get(data, "KeepTemporaryFiles",
 		                  &conf->conf_keeptmpfiles,
 		                  sizeof conf->conf_keeptmpfiles);
@@ -8467,7 +8880,7 @@ dkimf_config_setlib(struct dkimf_config *conf, char **err)
 	lib = conf->conf_libopendkim;
 	if (lib == NULL)
 	{
-		lib = dkim_init(NULL, NULL);
+		lib = dkim_init(dkimf_arena_malloc, dkimf_arena_free);
 		if (lib == NULL)
 		{
 			if (err != NULL)
@@ -8557,7 +8970,7 @@ dkimf_config_setlib(struct dkimf_config *conf, char **err)
 
 	if (conf->conf_sendreports || conf->conf_keeptmpfiles ||
 	    conf->conf_stricthdrs || conf->conf_blen || conf->conf_ztags ||
-	    conf->conf_fixcrlf)
+	    conf->conf_fixcrlf || conf->conf_prefetchkeys)
 	{
 		u_int opts;
 
@@ -8581,6 +8994,8 @@ dkimf_config_setlib(struct dkimf_config *conf, char **err)
 			opts |= DKIM_LIBFLAGS_ZTAGS;
 		if (conf->conf_fixcrlf)
 			opts |= DKIM_LIBFLAGS_FIXCRLF;
+		if (conf->conf_prefetchkeys)
+			opts |= DKIM_LIBFLAGS_DELAYSIGPROC;
 		if (conf->conf_acceptdk)
 			opts |= DKIM_LIBFLAGS_ACCEPTDK;
 		if (conf->conf_stricthdrs)
@@ -8741,6 +9156,29 @@ dkimf_config_setlib(struct dkimf_config *conf, char **err)
 		return FALSE;
 	}
 
+	/*
+	**  Parse the default key once.  If that fails, leave it to
+	**  dkim_sign() to report the problem when a message is signed.
+	*/
+
+	if (conf->conf_seckey != NULL && conf->conf_privkey == NULL)
+	{
+		conf->conf_privkey = dkim_privkey_new(conf->conf_libopendkim,
+		                                      conf->conf_seckey,
+		                                      &status);
+	}
+
+	if (conf->conf_keytabledb != NULL && conf->conf_keycache == NULL)
+	{
+		conf->conf_keycache = dkimf_keycache_new();
+		if (conf->conf_keycache == NULL)
+		{
+			if (err != NULL)
+				*err = "failed to create key cache";
+			return FALSE;
+		}
+	}
+
 	return TRUE;
 }
 
@@ -8756,33 +9194,52 @@ dkimf_config_setlib(struct dkimf_config *conf, char **err)
 **  Side effects:
 **  	If a reload was requested and is successful, "curconf" now points
 **  	to a new configuration handle.
+**
+**  Notes:
+**  	The new configuration is read, checked and has its databases opened
+**  	without holding "conf_lock", so connections arriving meanwhile
+**  	carry on with the old one; the lock is taken only to swap
+**  	"curconf".  Only one thread reloads at a time, and others don't
+**  	wait for it.  Only the reloading thread changes "curconf", so it
+**  	may read it without the lock.  The old configuration is freed here
+**  	if no connection holds it, or else by the last one to let go of it.
 */
 
 static void
 dkimf_config_reload(void)
 {
 	struct dkimf_config *new;
+	struct dkimf_config *old = NULL;
+	struct timeval start;
+	struct timeval end;
 	char errbuf[BUFRSZ + 1];
 
-	pthread_mutex_lock(&conf_lock);
+	if (!reload)
+		return;
+
+	if (pthread_mutex_trylock(&reload_lock) != 0)
+		return;
 
 	if (!reload)
 	{
-		pthread_mutex_unlock(&conf_lock);
+		pthread_mutex_unlock(&reload_lock);
 		return;
 	}
 
+	/* a signal arriving from here on asks for another reload */
+	reload = FALSE;
+
 	if (conffile == NULL)
 	{
 		if (curconf->conf_dolog)
 			syslog(LOG_ERR, "ignoring reload signal");
 
-		reload = FALSE;
-
-		pthread_mutex_unlock(&conf_lock);
+		pthread_mutex_unlock(&reload_lock);
 		return;
 	}
 
+	(void) gettimeofday(&start, NULL);
+
 	new = dkimf_config_new();
 	if (new == NULL)
 	{
@@ -8878,25 +9335,37 @@ dkimf_config_reload(void)
 
 		if (!err)
 		{
+			new->conf_data = cfg;
+
+			pthread_mutex_lock(&conf_lock);
+
 			if (curconf->conf_refcnt == 0)
-				dkimf_config_free(curconf);
+				old = curconf;
 
 			dolog = new->conf_dolog;
 			curconf = new;
-			new->conf_data = cfg;
+
+			pthread_mutex_unlock(&conf_lock);
+
+			if (old != NULL)
+				dkimf_config_free(old);
+
+			(void) gettimeofday(&end, NULL);
 
 			if (new->conf_dolog)
 			{
+				u_long ms;
+
+				ms = (u_long) (dkimf_timediff(&start, &end) / 1000);
+
 				syslog(LOG_INFO,
-				       "configuration reloaded from %s",
-				       conffile);
+				       "configuration reloaded from %s in %lu.%03lus",
+				       conffile, ms / 1000, ms % 1000);
 			}
 		}
 	}
 
-	reload = FALSE;
-
-	pthread_mutex_unlock(&conf_lock);
+	pthread_mutex_unlock(&reload_lock);
 
 	return;
 }
@@ -9010,6 +9479,31 @@ dkimf_stdio(void)
 	(void) setsid();
 }
 
+/*
+**  DKIMF_TIMEDIFF -- compute the time between two timestamps
+**
+**  Parameters:
+**  	start -- earlier timestamp
+**  	end -- later timestamp
+**
+**  Return value:
+**  	Microseconds from "start" to "end", or 0 if "end" isn't later.
+*/
+
+static uint64_t
+dkimf_timediff(struct timeval *start, struct timeval *end)
+{
+	int64_t diff;
+
+	assert(start != NULL);
+	assert(end != NULL);
+
+	diff = (int64_t) (end->tv_sec - start->tv_sec) * 1000000 +
+	       (end->tv_usec - start->tv_usec);
+
+	return diff < 0 ? 0 : (uint64_t) diff;
+}
+
 /*
 **  DKIMF_SENDPROGRESS -- tell the MTA "we're working on it!"
 **
@@ -9075,6 +9569,9 @@ dkimf_initcontext(struct dkimf_config *conf)
 	ctx->mctx_bodycanon = conf->conf_bodycanon;
 	ctx->mctx_signalg = DKIM_SIGN_DEFAULT;
 	ctx->mctx_queryalg = DKIM_QUERY_DEFAULT;
+
+	/* DKIM handles for this message allocate from here; NULL is fine */
+	ctx->mctx_arena = dkimf_arena_get();
 #ifdef USE_UNBOUND
 	ctx->mctx_dnssec_key = DKIM_DNSSEC_UNKNOWN;
 #endif /* USE_UNBOUND */
@@ -9214,6 +9711,8 @@ dkimf_cleanup(SMFICTX *ctx)
 
 				if (sr->srq_dkim != NULL)
 					dkim_free(sr->srq_dkim);
+				if (sr->srq_privkey != NULL)
+					dkim_privkey_free(sr->srq_privkey);
 				TRYFREE(sr->srq_keydata);
 				TRYFREE(sr->srq_domain);
 				TRYFREE(sr->srq_selector);
@@ -9277,6 +9776,10 @@ dkimf_cleanup(SMFICTX *ctx)
 		}
 #endif /* USE_LUA */
 
+		/* the DKIM handles above were the arena's only users */
+		if (dfc->mctx_arena != NULL)
+			dkimf_arena_put(dfc->mctx_arena);
+
 		free(dfc);
 		cc->cctx_msg = NULL;
 	}
@@ -9630,6 +10133,30 @@ dkimf_libstatus(SMFICTX *ctx, DKIM *dkim, char *where, int status)
 	return retcode;
 }
 
+/*
+**  DKIMF_HDRHASH -- hash a header field name for the header name index
+**
+**  Parameters:
+**  	hname -- header field name
+**
+**  Return value:
+**  	Bucket number in the range [0, DKIMF_HDRBUCKETS).
+*/
+
+static u_int
+dkimf_hdrhash(char *hname)
+{
+	uint32_t hash = 2166136261U;
+
+	for (; *hname != '\0'; hname++)
+	{
+		hash ^= (uint32_t) tolower((u_char) *hname);
+		hash *= 16777619U;
+	}
+
+	return hash % DKIMF_HDRBUCKETS;
+}
+
 /*
 **  DKIMF_FINDHEADER -- find a header
 **
@@ -9653,30 +10180,80 @@ dkimf_findheader(msgctx dfc, char *hname, int instance)
 	assert(dfc != NULL);
 	assert(hname != NULL);
 
+	for (hdr = dfc->mctx_hindex[dkimf_hdrhash(hname)];
+	     hdr != NULL;
+	     hdr = hdr->hdr_hashnext)
+	{
+		if (strcasecmp(hdr->hdr_hdr, hname) == 0)
+			break;
+	}
+
+	if (hdr == NULL)
+		return NULL;
+
 	if (instance < 0)
-		hdr = dfc->mctx_hqtail;
+	{
+		for (hdr = hdr->hdr_samelast;
+		     hdr != NULL && instance < -1;
+		     hdr = hdr->hdr_sameprev)
+			instance++;
+	}
 	else
-		hdr = dfc->mctx_hqhead;
-
-	while (hdr != NULL)
 	{
-		if (strcasecmp(hdr->hdr_hdr, hname) == 0)
-		{
-			if (instance == 0 || instance == -1)
-				return hdr;
-			else if (instance > 0)
-				instance--;
-			else
-				instance++;
-		}
+		for (; hdr != NULL && instance > 0; hdr = hdr->hdr_samenext)
+			instance--;
+	}
 
-		if (instance < 0)
-			hdr = hdr->hdr_prev;
-		else
-			hdr = hdr->hdr_next;
+	return hdr;
+}
+
+/*
+**  DKIMF_INDEXHEADER -- add a header just queued to the header name index
+**
+**  Parameters:
+**  	dfc -- filter context
+**  	hdr -- header, already appended to the queue
+**
+**  Return value:
+**  	None.
+*/
+
+static void
+dkimf_indexheader(msgctx dfc, Header hdr)
+{
+	u_int bucket;
+	Header first;
+
+	assert(dfc != NULL);
+	assert(hdr != NULL);
+
+	hdr->hdr_samenext = NULL;
+	hdr->hdr_sameprev = NULL;
+	hdr->hdr_samelast = NULL;
+	hdr->hdr_hashnext = NULL;
+
+	bucket = dkimf_hdrhash(hdr->hdr_hdr);
+
+	for (first = dfc->mctx_hindex[bucket];
+	     first != NULL;
+	     first = first->hdr_hashnext)
+	{
+		if (strcasecmp(first->hdr_hdr, hdr->hdr_hdr) == 0)
+			break;
 	}
 
-	return NULL;
+	if (first == NULL)
+	{
+		hdr->hdr_samelast = hdr;
+		hdr->hdr_hashnext = dfc->mctx_hindex[bucket];
+		dfc->mctx_hindex[bucket] = hdr;
+	}
+	else
+	{
+		hdr->hdr_sameprev = first->hdr_samelast;
+		first->hdr_samelast->hdr_samenext = hdr;
+		first->hdr_samelast = hdr;
+	}
 }
 
 /*
@@ -10778,13 +11355,8 @@ mlfi_negotiate(SMFICTX *ctx,
 
 	memset(cc, '\0', sizeof(struct connctx));
 
-	pthread_mutex_lock(&conf_lock);
-
-	cc->cctx_config = curconf;
-	curconf->conf_refcnt++;
-	conf = curconf;
-
-	pthread_mutex_unlock(&conf_lock);
+	conf = dkimf_config_get();
+	cc->cctx_config = conf;
 
 	/* verify the actions we need are available */
 	if (conf->conf_remarall ||
@@ -10818,9 +11390,7 @@ mlfi_negotiate(SMFICTX *ctx,
 			       f0, reqactions);
 		}
 
-		pthread_mutex_lock(&conf_lock);
-		conf->conf_refcnt--;
-		pthread_mutex_unlock(&conf_lock);
+		dkimf_config_release(conf);
 
 		free(cc);
 
@@ -10876,9 +11446,7 @@ mlfi_negotiate(SMFICTX *ctx,
 					       "mlfi_negotiate(): macro list overflow");
 				}
 
-				pthread_mutex_lock(&conf_lock);
-				conf->conf_refcnt--;
-				pthread_mutex_unlock(&conf_lock);
+				dkimf_config_release(conf);
 
 				free(cc);
 
@@ -10891,9 +11459,7 @@ mlfi_negotiate(SMFICTX *ctx,
 			if (conf->conf_dolog)
 				syslog(LOG_ERR, "smfi_setsymlist() failed");
 
-			pthread_mutex_lock(&conf_lock);
-			conf->conf_refcnt--;
-			pthread_mutex_unlock(&conf_lock);
+			dkimf_config_release(conf);
 
 			free(cc);
 
@@ -10964,14 +11530,8 @@ mlfi_connect(SMFICTX *ctx, char *host, _SOCK_ADDR *ip)
 
 		memset(cc, '\0', sizeof(struct connctx));
 
-		pthread_mutex_lock(&conf_lock);
-
-		cc->cctx_config = curconf;
-		curconf->conf_refcnt++;
-
-		conf = curconf;
-
-		pthread_mutex_unlock(&conf_lock);
+		conf = dkimf_config_get();
+		cc->cctx_config = conf;
 
 		dkimf_setpriv(ctx, cc);
 	}
@@ -11510,6 +12070,8 @@ mlfi_header(SMFICTX *ctx, char *headerf, char *headerv)
 
 	dfc->mctx_hqtail = newhdr;
 
+	dkimf_indexheader(dfc, newhdr);
+
 	if (strcasecmp(headerf, conf->conf_selectcanonhdr) == 0)
 	{
 		int c;
@@ -12364,8 +12926,8 @@ mlfi_eoh(SMFICTX *ctx)
 #endif /* _FFR_RESIGN */
 	{
 		dfc->mctx_dkimv = dkim_verify(conf->conf_libopendkim,
-		                              dfc->mctx_jobid, NULL,
-		                              &status);
+		                              dfc->mctx_jobid,
+		                              dfc->mctx_arena, &status);
 
 		if (dfc->mctx_dkimv == NULL && status != DKIM_STAT_OK)
 		{
@@ -12397,6 +12959,7 @@ mlfi_eoh(SMFICTX *ctx)
 		u_char *selector;
 		struct signreq *sr;
 		dkim_sigkey_t keydata;
+		DKIM_PRIVKEY *privkey;
 
 		if (conf->conf_dolog && dfc->mctx_laddr != NULL)
 		{
@@ -12426,9 +12989,10 @@ mlfi_eoh(SMFICTX *ctx)
 			else
 				signlen = sr->srq_signlen;
 
-			if (sr->srq_keydata != NULL)
+			if (sr->srq_keydata != NULL || sr->srq_privkey != NULL)
 			{
 				keydata = sr->srq_keydata;
+				privkey = sr->srq_privkey;
 				selector = sr->srq_selector;
 				if (sr->srq_domain != NULL)
 					sdomain = sr->srq_domain;
@@ -12439,17 +13003,34 @@ mlfi_eoh(SMFICTX *ctx)
 			{
 				sdomain = dfc->mctx_domain;
 				keydata = (dkim_sigkey_t) conf->conf_seckey;
+				privkey = conf->conf_privkey;
 				selector = conf->conf_selector;
 			}
 
-			sr->srq_dkim = dkim_sign(conf->conf_libopendkim,
-			                         dfc->mctx_jobid,
-			                         NULL, keydata, selector,
-			                         sdomain,
-			                         dfc->mctx_hdrcanon,
-			                         dfc->mctx_bodycanon,
-			                         dfc->mctx_signalg,
-			                         signlen, &status);
+			if (privkey != NULL)
+			{
+				sr->srq_dkim = dkim_sign_privkey(conf->conf_libopendkim,
+				                                 dfc->mctx_jobid,
+				                                 dfc->mctx_arena,
+				                                 privkey,
+				                                 selector, sdomain,
+				                                 dfc->mctx_hdrcanon,
+				                                 dfc->mctx_bodycanon,
+				                                 dfc->mctx_signalg,
+				                                 signlen, &status);
+			}
+			else
+			{
+				sr->srq_dkim = dkim_sign(conf->conf_libopendkim,
+				                         dfc->mctx_jobid,
+				                         dfc->mctx_arena,
+				                         keydata, selector,
+				                         sdomain,
+				                         dfc->mctx_hdrcanon,
+				                         dfc->mctx_bodycanon,
+				                         dfc->mctx_signalg,
+				                         signlen, &status);
+			}
 
 			if (sr->srq_dkim == NULL || status != DKIM_STAT_OK)
 			{
@@ -12875,6 +13456,8 @@ mlfi_eoh(SMFICTX *ctx)
 					dfc->mctx_hqtail->hdr_next = newhdr;
 
 				dfc->mctx_hqtail = newhdr;
+
+				dkimf_indexheader(dfc, newhdr);
 			}
 		}
 	}
@@ -12995,6 +13578,15 @@ mlfi_eoh(SMFICTX *ctx)
 		(void) dkim_set_user_context(dfc->mctx_dkimv, ctx);
 		lastdkim = dfc->mctx_dkimv;
 		status = dkim_eoh(dfc->mctx_dkimv);
+
+		/*
+		**  With DKIM_LIBFLAGS_DELAYSIGPROC set, dkim_eoh() has
+		**  only started the key queries; dkim_eom() collects
+		**  the replies.  Note when that began.
+		*/
+
+		if (status == DKIM_STAT_OK && conf->conf_prefetchkeys)
+			(void) gettimeofday(&dfc->mctx_eohtime, NULL);
 	}
 
 #ifdef USE_LUA
@@ -13530,9 +14122,27 @@ mlfi_eom(SMFICTX *ctx)
 		**  Signal end-of-message to DKIM
 		*/
 
+		struct timeval eomstart;
+		struct timeval eomend;
+
+		if (dfc->mctx_eohtime.tv_sec != 0)
+			(void) gettimeofday(&eomstart, NULL);
+
 		status = dkim_eom(dfc->mctx_dkimv, &testkey);
 		lastdkim = dfc->mctx_dkimv;
 
+		if (dfc->mctx_eohtime.tv_sec != 0)
+		{
+			(void) gettimeofday(&eomend, NULL);
+
+			pthread_mutex_lock(&prefetch_lock);
+			prefetch_msgs++;
+			prefetch_overlap += dkimf_timediff(&dfc->mctx_eohtime,
+			                                   &eomstart);
+			prefetch_wait += dkimf_timediff(&eomstart, &eomend);
+			pthread_mutex_unlock(&prefetch_lock);
+		}
+
 		if (conf->conf_logresults && conf->conf_dolog)
 		{
 			int c;
@@ -15138,19 +15748,32 @@ mlfi_close(SMFICTX *ctx)
 	cc = (connctx) dkimf_getpriv(ctx);
 	if (cc != NULL)
 	{
-		pthread_mutex_lock(&conf_lock);
+		dkimf_config_release(cc->cctx_config);
 
-		cc->cctx_config->conf_refcnt--;
+		free(cc);
+		dkimf_setpriv(ctx, NULL);
+	}
 
-		if (cc->cctx_config->conf_refcnt == 0 &&
-		    cc->cctx_config != curconf)
-			dkimf_config_free(cc->cctx_config);
+	pthread_mutex_lock(&prefetch_lock);
+	if (prefetch_msgs != 0 && dolog)
+	{
+		time_t now;
 
-		pthread_mutex_unlock(&conf_lock);
+		(void) time(&now);
+		if (prefetch_lastlog + CACHESTATSINT < now)
+		{
+			prefetch_lastlog = now;
 
-		free(cc);
-		dkimf_setpriv(ctx, NULL);
+			syslog(LOG_INFO,
+			       "key prefetch: %lu message%s, %lu.%03lus overlapped with message transfer, %lu.%03lus in end-of-message",
+			       prefetch_msgs, prefetch_msgs == 1 ? "" : "s",
+			       (u_long) (prefetch_overlap / 1000000),
+			       (u_long) ((prefetch_overlap / 1000) % 1000),
+			       (u_long) (prefetch_wait / 1000000),
+			       (u_long) ((prefetch_wait / 1000) % 1000));
+		}
 	}
+	pthread_mutex_unlock(&prefetch_lock);
 
 #ifdef QUERY_CACHE
 	if (querycache)
@@ -15551,7 +16174,12 @@ main(int argc, char **argv)
 			printf("\tSupported signing algorithms:\n");
 			for (c = 0; dkimf_sign[c].str != NULL; c++)
 			{
-				if (dkimf_sign[c].code != DKIM_SIGN_RSASHA256 ||
+				if (dkimf_sign[c].code == DKIM_SIGN_ED25519SHA256 &&
+				    !dkim_libfeature(curconf->conf_libopendkim,
+				                     DKIM_FEATURE_ED25519))
+					continue;
+
+				if (dkimf_sign[c].code == DKIM_SIGN_RSASHA1 ||
 	    			    dkim_libfeature(curconf->conf_libopendkim,
 				                    DKIM_FEATURE_SHA256))
 					printf("\t\t%s\n", dkimf_sign[c].str);
@@ -15746,7 +16374,7 @@ main(int argc, char **argv)
 			                "\trepute:server[:reporter]\n"
 #endif /* _FFR_REPUTATION */
 #ifdef _FFR_SOCKETDB
-			                "\tsocket:{ port@host | path}\n"
+			                "\tsocket:{ port@host | path}[?conns=N][&pipeline]\n"
 #endif /* _FFR_SOCKETDB */
 #ifdef USE_MDB
 			                "\tmdb:path\n"
@@ -16792,7 +17420,14 @@ main(int argc, char **argv)
 	}
 
 	pthread_mutex_init(&conf_lock, NULL);
+	pthread_mutex_init(&reload_lock, NULL);
 	pthread_mutex_init(&pwdb_lock, NULL);
+	pthread_mutex_init(&prefetch_lock, NULL);
+
+#ifdef _FFR_RBL
+	/* shared by every odkim.rbl_check() call; none is no great loss */
+	rblcache = rbl_cache_new(RBLCACHESIZE);
+#endif /* _FFR_RBL */
 
 	/* perform test mode */
 	if (testfile != NULL)
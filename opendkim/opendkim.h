@@ -63,6 +63,7 @@
 #define	MAXSIGNATURE	1024
 #define	MTAMARGIN	78
 #define	NULLDOMAIN	"(invalid)"
+#define	RBLCACHESIZE	1024
 #define	SUPERUSER	"root"
 #define	UNKNOWN		"unknown"
 
@@ -106,6 +107,10 @@ struct Header
 	char *		hdr_val;
 	struct Header *	hdr_next;
 	struct Header *	hdr_prev;
+	struct Header *	hdr_samenext;		/* next of this name */
+	struct Header *	hdr_sameprev;		/* previous of this name */
+	struct Header *	hdr_samelast;		/* last of this name (first only) */
+	struct Header *	hdr_hashnext;		/* bucket chain (first only) */
 };
 
 /*
@@ -117,6 +122,7 @@ struct signreq
 {
 	ssize_t			srq_signlen;
 	void *			srq_keydata;
+	DKIM_PRIVKEY *		srq_privkey;
 	u_char *		srq_domain;
 	u_char *		srq_selector;
 	u_char *		srq_signer;
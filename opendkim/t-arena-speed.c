@@ -0,0 +1,358 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sysexits.h>
+#include <string.h>
+#include <unistd.h>
+
+/* libopendkim includes */
+#include <dkim.h>
+
+/* opendkim includes */
+#include "arena.h"
+
+/* signing key and message data from the library's unit tests */
+#include "tests/t-testdata.h"
+
+/* macros */
+#define	BUFRSZ		1024
+#define	CMDLINEOPTS	"m:n:t:"
+#define	DEFMSGSIZE	8192
+#define	DEFNMSGS	5000
+#define	DEFTMPDIR	"/tmp"
+#define	MAXHEADER	4096
+#define	TMPTEMPLATE	"arenaspeedXXXXXX"
+
+/* prototypes */
+int usage(void);
+
+/* globals */
+char *progname;
+u_long mallocs;
+
+/*
+**  USAGE -- print a usage message
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	EX_USAGE
+*/
+
+int
+usage(void)
+{
+	fprintf(stderr,
+	        "%s: usage: %s [options]\nValid options:\n"
+	        "\t-m bytes   \tmessage body size (default %d)\n"
+	        "\t-n messages\tnumber of messages (default %d)\n"
+	        "\t-t path    \tdirectory for temporary files\n",
+	        progname, progname, DEFMSGSIZE, DEFNMSGS);
+
+	return EX_USAGE;
+}
+
+/*
+**  COUNT_MALLOC, COUNT_FREE -- libopendkim allocators that count calls
+**  to malloc()
+*/
+
+static void *
+count_malloc(void *closure, size_t nbytes)
+{
+	mallocs++;
+	return malloc(nbytes);
+}
+
+static void
+count_free(void *closure, void *ptr)
+{
+	free(ptr);
+}
+
+static void *
+count_arena_malloc(void *closure, size_t nbytes)
+{
+	if (closure == NULL)
+		mallocs++;
+	return dkimf_arena_malloc(closure, nbytes);
+}
+
+/*
+**  MESSAGE -- sign a message, then verify it
+**
+**  Parameters:
+**  	lib -- library handle
+**  	arena -- arena for the handles (or NULL)
+**  	body -- message body
+**  	bodylen -- bytes at "body"
+**
+**  Return value:
+**  	0 on success, -1 on failure.
+*/
+
+static int
+message(DKIM_LIB *lib, struct dkimf_arena *arena, u_char *body,
+        size_t bodylen)
+{
+	int c;
+	DKIM_STAT status;
+	DKIM *dkim;
+	u_char *hdrs[] = { HEADER02, HEADER03, HEADER04, HEADER05,
+	                   HEADER06, HEADER07, HEADER08, HEADER09, NULL };
+	u_char sighdr[MAXHEADER + 1];
+
+	dkim = dkim_sign(lib, JOBID, arena, KEY, SELECTOR, DOMAIN,
+	                 DKIM_CANON_RELAXED, DKIM_CANON_SIMPLE,
+	                 DKIM_SIGN_DEFAULT, -1L, &status);
+	if (dkim == NULL)
+		return -1;
+
+	for (c = 0; hdrs[c] != NULL; c++)
+		(void) dkim_header(dkim, hdrs[c], strlen(hdrs[c]));
+	(void) dkim_eoh(dkim);
+	(void) dkim_body(dkim, body, bodylen);
+	status = dkim_eom(dkim, NULL);
+	if (status == DKIM_STAT_OK)
+	{
+		snprintf(sighdr, sizeof sighdr, "%s: ", DKIM_SIGNHEADER);
+		status = dkim_getsighdr(dkim, sighdr + strlen(sighdr),
+		                        sizeof sighdr - strlen(sighdr),
+		                        strlen(sighdr) + 1);
+	}
+	(void) dkim_free(dkim);
+	if (status != DKIM_STAT_OK)
+		return -1;
+
+	dkim = dkim_verify(lib, JOBID, arena, &status);
+	if (dkim == NULL)
+		return -1;
+
+	(void) dkim_header(dkim, sighdr, strlen(sighdr));
+	for (c = 0; hdrs[c] != NULL; c++)
+		(void) dkim_header(dkim, hdrs[c], strlen(hdrs[c]));
+	(void) dkim_eoh(dkim);
+	(void) dkim_body(dkim, body, bodylen);
+	status = dkim_eom(dkim, NULL);
+	(void) dkim_free(dkim);
+
+	return (status == DKIM_STAT_OK ? 0 : -1);
+}
+
+/*
+**  RUN -- process messages with or without an arena
+**
+**  Parameters:
+**  	keyfile -- key file for verification
+**  	usearena -- use an arena per message?
+**  	nmsgs -- number of messages
+**  	body -- message body
+**  	bodylen -- bytes at "body"
+**  	arenaallocs -- allocations served by arenas (returned)
+**
+**  Return value:
+**  	Elapsed time in microseconds, or -1 on error.
+*/
+
+static long
+run(char *keyfile, _Bool usearena, int nmsgs, u_char *body, size_t bodylen,
+    u_long *arenaallocs)
+{
+	int c;
+	u_long allocs;
+	u_long sysallocs;
+	u_long before;
+	u_long sysbefore;
+	dkim_query_t qtype = DKIM_QUERY_FILE;
+	struct timeval start;
+	struct timeval end;
+	struct dkimf_arena *arena = NULL;
+	DKIM_LIB *lib;
+
+	if (usearena)
+		lib = dkim_init(count_arena_malloc, dkimf_arena_free);
+	else
+		lib = dkim_init(count_malloc, count_free);
+	if (lib == NULL)
+		return -1;
+
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_QUERYMETHOD,
+	                    &qtype, sizeof qtype);
+	(void) dkim_options(lib, DKIM_OP_SETOPT, DKIM_OPTS_QUERYINFO,
+	                    keyfile, strlen(keyfile));
+
+	mallocs = 0;
+	*arenaallocs = 0;
+
+	(void) gettimeofday(&start, NULL);
+
+	for (c = 0; c < nmsgs; c++)
+	{
+		if (usearena)
+		{
+			arena = dkimf_arena_get();
+			if (arena == NULL)
+				break;
+			dkimf_arena_stats(arena, &before, &sysbefore);
+		}
+
+		if (message(lib, arena, body, bodylen) != 0)
+		{
+			if (arena != NULL)
+				dkimf_arena_put(arena);
+			break;
+		}
+
+		if (usearena)
+		{
+			dkimf_arena_stats(arena, &allocs, &sysallocs);
+			*arenaallocs += allocs - before;
+			mallocs += sysallocs - sysbefore;
+			dkimf_arena_put(arena);
+		}
+	}
+
+	(void) gettimeofday(&end, NULL);
+
+	dkim_close(lib);
+
+	if (c < nmsgs)
+		return -1;
+
+	return (end.tv_sec - start.tv_sec) * 1000000L +
+	       (end.tv_usec - start.tv_usec);
+}
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	argc, argv -- the usual
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+main(int argc, char **argv)
+{
+	int c;
+	int fd;
+	int w;
+	int nmsgs = DEFNMSGS;
+	size_t msgsize = DEFMSGSIZE;
+	long elapsed[2];
+	u_long nmallocs[2];
+	u_long arenaallocs;
+	char *p;
+	char *tmpdir = DEFTMPDIR;
+	u_char *body;
+	FILE *f;
+	char fn[BUFRSZ + 1];
+
+	progname = (p = strrchr(argv[0], '/')) == NULL ? argv[0] : p + 1;
+
+	while ((c = getopt(argc, argv, CMDLINEOPTS)) != -1)
+	{
+		switch (c)
+		{
+		  case 'm':
+			msgsize = strtoul(optarg, &p, 10);
+			if (*p != '\0' || msgsize == 0)
+				return usage();
+			break;
+
+		  case 'n':
+			nmsgs = strtol(optarg, &p, 10);
+			if (*p != '\0' || nmsgs <= 0)
+				return usage();
+			break;
+
+		  case 't':
+			tmpdir = optarg;
+			break;
+
+		  default:
+			return usage();
+		}
+	}
+
+	body = (u_char *) malloc(msgsize);
+	if (body == NULL)
+	{
+		fprintf(stderr, "%s: malloc(): %s\n", progname,
+		        strerror(errno));
+		return EX_OSERR;
+	}
+
+	/* a body of printable lines */
+	for (c = 0, w = 0; c < msgsize; c++)
+	{
+		if (w >= 75 && c < msgsize - 2)
+		{
+			body[c++] = '\r';
+			body[c] = '\n';
+			w = 0;
+			continue;
+		}
+
+		body[c] = 'a' + (c % 26);
+		w++;
+	}
+
+	/* publish the test key */
+	snprintf(fn, sizeof fn, "%s/%s", tmpdir, TMPTEMPLATE);
+	fd = mkstemp(fn);
+	if (fd < 0 || (f = fdopen(fd, "w")) == NULL)
+	{
+		fprintf(stderr, "%s: %s: %s\n", progname, fn,
+		        strerror(errno));
+		return EX_CANTCREAT;
+	}
+	fprintf(f, "%s.%s.%s %s\n", SELECTOR, DKIM_DNSKEYNAME, DOMAIN,
+	        PUBLICKEY);
+	fclose(f);
+
+	fprintf(stdout, "%s: %d messages signed and verified, %lu bytes\n",
+	        progname, nmsgs, (u_long) msgsize);
+
+	for (c = 0; c < 2; c++)
+	{
+		elapsed[c] = run(fn, c == 1, nmsgs, body, msgsize,
+		                 &arenaallocs);
+		nmallocs[c] = mallocs;
+		if (elapsed[c] <= 0)
+		{
+			fprintf(stderr, "%s: signing or verifying failed\n",
+			        progname);
+			(void) unlink(fn);
+			return EX_SOFTWARE;
+		}
+	}
+
+	(void) unlink(fn);
+
+	fprintf(stdout,
+	        "%s: malloc():  %.1f calls/msg, %.0f msgs/sec\n",
+	        progname, (double) nmallocs[0] / nmsgs,
+	        nmsgs / (elapsed[0] / 1000000.0));
+	fprintf(stdout,
+	        "%s: arena:     %.1f calls/msg, %.0f msgs/sec (%.1f arena allocations/msg)\n",
+	        progname, (double) nmallocs[1] / nmsgs,
+	        nmsgs / (elapsed[1] / 1000000.0),
+	        (double) arenaallocs / nmsgs);
+
+	free(body);
+
+	return EX_OK;
+}
@@ -0,0 +1,492 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sysexits.h>
+#include <string.h>
+#include <unistd.h>
+
+/* libbsd if found */
+#ifdef USE_BSD_H
+# include <bsd/string.h>
+#endif /* USE_BSD_H */
+
+/* libstrl if needed */
+#ifdef USE_STRL_H
+# include <strl.h>
+#endif /* USE_STRL_H */
+
+/* opendkim includes */
+#include "opendkim-db.h"
+
+/* macros */
+#ifndef FALSE
+# define FALSE		0
+#endif /* ! FALSE */
+#ifndef TRUE
+# define TRUE		1
+#endif /* ! TRUE */
+
+#define	BUFRSZ		1024
+#define	DEFTMPDIR	"/tmp"
+#define	NTHREADS	8
+#define	POSTTL		4
+#define	NEGTTL		1
+#define	SLOWDELAY	500000
+#define	TMPTEMPLATE	"dbcacheXXXXXX"
+
+/* data types */
+struct lookup
+{
+	DKIMF_DB		lk_db;
+	char *			lk_key;
+	int			lk_status;
+	_Bool			lk_exists;
+	char			lk_value[BUFRSZ + 1];
+};
+
+/* globals */
+char *progname;
+u_int srvdelay;
+u_long srvqueries;
+pthread_mutex_t srvlock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+**  SRVCONNECTION -- answer queries from one client connection
+**
+**  Parameters:
+**  	arg -- pointer to the connected descriptor
+**
+**  Return value:
+**  	Always NULL.
+**
+**  Notes:
+**  	Keys beginning "missing" get an empty reply; any other key "k"
+**  	gets "k-value".  Every query is counted in "srvqueries".
+*/
+
+void *
+srvconnection(void *arg)
+{
+	int fd;
+	size_t inlen = 0;
+	ssize_t rlen;
+	char *eol;
+	char *p;
+	char in[BUFRSZ * 4];
+	char reply[BUFRSZ + 1];
+
+	fd = *(int *) arg;
+	free(arg);
+
+	for (;;)
+	{
+		rlen = read(fd, in + inlen, sizeof in - inlen);
+		if (rlen <= 0)
+			break;
+		inlen += rlen;
+
+		p = in;
+		while ((eol = memchr(p, '\n', inlen - (p - in))) != NULL)
+		{
+			*eol = '\0';
+
+			pthread_mutex_lock(&srvlock);
+			srvqueries++;
+			pthread_mutex_unlock(&srvlock);
+
+			if (srvdelay > 0)
+				usleep(srvdelay);
+
+			if (strncmp(p, "missing", 7) == 0)
+				strlcpy(reply, "\n", sizeof reply);
+			else
+				snprintf(reply, sizeof reply, "%s-value\n", p);
+
+			(void) write(fd, reply, strlen(reply));
+
+			p = eol + 1;
+		}
+
+		inlen -= p - in;
+		memmove(in, p, inlen);
+		if (inlen == sizeof in)
+			break;
+	}
+
+	close(fd);
+
+	return NULL;
+}
+
+/*
+**  SRVLISTEN -- accept client connections
+**
+**  Parameters:
+**  	arg -- listening descriptor
+**
+**  Return value:
+**  	Never returns.
+*/
+
+void *
+srvlisten(void *arg)
+{
+	int fd;
+	int lfd;
+	int *fdp;
+	pthread_t tid;
+
+	lfd = *(int *) arg;
+
+	for (;;)
+	{
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		fdp = (int *) malloc(sizeof *fdp);
+		if (fdp == NULL)
+		{
+			close(fd);
+			continue;
+		}
+
+		*fdp = fd;
+
+		if (pthread_create(&tid, NULL, srvconnection, fdp) != 0)
+		{
+			free(fdp);
+			close(fd);
+			continue;
+		}
+
+		(void) pthread_detach(tid);
+	}
+
+	return NULL;
+}
+
+/*
+**  SRVSTART -- start a local socket data set server
+**
+**  Parameters:
+**  	path -- UNIX domain socket to create
+**
+**  Return value:
+**  	0 on success, -1 on error.
+**
+**  Notes:
+**  	The server runs until the program exits.
+*/
+
+int
+srvstart(char *path)
+{
+	static int lfd;
+	pthread_t tid;
+	struct sockaddr_un sun;
+
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (lfd < 0)
+		return -1;
+
+	memset(&sun, '\0', sizeof sun);
+	sun.sun_family = AF_UNIX;
+	strlcpy(sun.sun_path, path, sizeof sun.sun_path);
+
+	if (bind(lfd, (struct sockaddr *) &sun, sizeof sun) != 0 ||
+	    listen(lfd, 128) != 0 ||
+	    pthread_create(&tid, NULL, srvlisten, &lfd) != 0)
+	{
+		close(lfd);
+		return -1;
+	}
+
+	(void) pthread_detach(tid);
+
+	return 0;
+}
+
+/*
+**  LOOKUP -- look up a key
+**
+**  Parameters:
+**  	db -- data set
+**  	key -- key
+**  	value -- value (returned)
+**  	valuelen -- bytes available at "value"
+**  	exists -- whether the key was found (returned)
+**
+**  Return value:
+**  	As for dkimf_db_get().
+*/
+
+int
+lookup(DKIMF_DB db, char *key, char *value, size_t valuelen, _Bool *exists)
+{
+	struct dkimf_db_data dbd;
+
+	memset(value, '\0', valuelen);
+	dbd.dbdata_buffer = value;
+	dbd.dbdata_buflen = valuelen - 1;
+	dbd.dbdata_flags = 0;
+
+	*exists = FALSE;
+
+	return dkimf_db_get(db, key, strlen(key), &dbd, 1, exists);
+}
+
+/*
+**  LOOKUPTHREAD -- look up a key in a thread of its own
+**
+**  Parameters:
+**  	arg -- a lookup structure
+**
+**  Return value:
+**  	Always NULL.
+*/
+
+void *
+lookupthread(void *arg)
+{
+	struct lookup *lk;
+
+	lk = (struct lookup *) arg;
+
+	lk->lk_status = lookup(lk->lk_db, lk->lk_key, lk->lk_value,
+	                       sizeof lk->lk_value, &lk->lk_exists);
+
+	return NULL;
+}
+
+/*
+**  CHECK -- look up a key and confirm the answer and the server's work
+**
+**  Parameters:
+**  	db -- data set
+**  	key -- key
+**  	found -- whether the key should be found
+**  	queries -- number of queries the server should have seen after
+**  	           the lookup
+**
+**  Return value:
+**  	0 if everything was as expected, -1 otherwise.
+*/
+
+int
+check(DKIMF_DB db, char *key, _Bool found, u_long queries)
+{
+	_Bool exists;
+	u_long seen;
+	char value[BUFRSZ + 1];
+	char expect[BUFRSZ + 1];
+
+	if (lookup(db, key, value, sizeof value, &exists) != 0)
+	{
+		fprintf(stderr, "%s: lookup of \"%s\" failed\n", progname,
+		        key);
+		return -1;
+	}
+
+	snprintf(expect, sizeof expect, "%s-value", key);
+
+	if (exists != found || (found && strcmp(value, expect) != 0))
+	{
+		fprintf(stderr, "%s: lookup of \"%s\": got %s \"%s\"\n",
+		        progname, key, exists ? "found" : "not found", value);
+		return -1;
+	}
+
+	pthread_mutex_lock(&srvlock);
+	seen = srvqueries;
+	pthread_mutex_unlock(&srvlock);
+
+	if (seen != queries)
+	{
+		fprintf(stderr,
+		        "%s: after lookup of \"%s\": server saw %lu queries, expected %lu\n",
+		        progname, key, seen, queries);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	argc, argv -- the usual
+**
+**  Return value:
+**  	Exit status.
+**
+**  Notes:
+**  	Runs a server in this process for a socket data set behind a
+**  	result cache, then checks that found and not-found results are
+**  	answered from the cache until their separate lifetimes end, and
+**  	that concurrent lookups of one key make a single query.
+*/
+
+int
+main(int argc, char **argv)
+{
+	int c;
+	int fd;
+	int status;
+	u_long seen;
+	char *p;
+	char *err = NULL;
+	char *tmpdir;
+	DKIMF_DB db;
+	struct dkimf_db_cachestats cs;
+	pthread_t tids[NTHREADS];
+	struct lookup lks[NTHREADS];
+	char path[BUFRSZ + 1];
+	char dbname[BUFRSZ + 1];
+
+	progname = (p = strrchr(argv[0], '/')) == NULL ? argv[0] : p + 1;
+
+	tmpdir = getenv("TMPDIR");
+	if (tmpdir == NULL)
+		tmpdir = DEFTMPDIR;
+
+	snprintf(path, sizeof path, "%s/%s", tmpdir, TMPTEMPLATE);
+	fd = mkstemp(path);
+	if (fd < 0)
+	{
+		fprintf(stderr, "%s: mkstemp(): %s\n", progname,
+		        strerror(errno));
+		return EX_CANTCREAT;
+	}
+	close(fd);
+	(void) unlink(path);
+
+	if (srvstart(path) != 0)
+	{
+		fprintf(stderr, "%s: %s: %s\n", progname, path,
+		        strerror(errno));
+		(void) unlink(path);
+		return EX_OSERR;
+	}
+
+	snprintf(dbname, sizeof dbname,
+	         "cache:ttl=%d,negttl=%d:socket:%s?emptynotfound&conns=%d",
+	         POSTTL, NEGTTL, path, NTHREADS);
+	if (dkimf_db_open(&db, dbname, DKIMF_DB_FLAG_READONLY, NULL,
+	                  &err) != 0)
+	{
+		fprintf(stderr, "%s: %s: dkimf_db_open(): %s\n", progname,
+		        dbname, err);
+		(void) unlink(path);
+		return EX_SOFTWARE;
+	}
+
+	status = EX_SOFTWARE;
+
+	/* found and not-found results are each queried once */
+	if (check(db, "key", TRUE, 1) != 0 ||
+	    check(db, "key", TRUE, 1) != 0 ||
+	    check(db, "missing", FALSE, 2) != 0 ||
+	    check(db, "missing", FALSE, 2) != 0)
+		goto done;
+
+	/* the not-found result expires first... */
+	sleep(NEGTTL + 1);
+	if (check(db, "missing", FALSE, 3) != 0 ||
+	    check(db, "key", TRUE, 3) != 0)
+		goto done;
+
+	/* ...then the found one */
+	sleep(POSTTL - NEGTTL);
+	if (check(db, "key", TRUE, 4) != 0)
+		goto done;
+
+	/* concurrent lookups of a slow key share one query */
+	srvdelay = SLOWDELAY;
+
+	for (c = 0; c < NTHREADS; c++)
+	{
+		lks[c].lk_db = db;
+		lks[c].lk_key = "slow";
+		lks[c].lk_status = -1;
+		lks[c].lk_exists = FALSE;
+
+		if (pthread_create(&tids[c], NULL, lookupthread,
+		                   &lks[c]) != 0)
+		{
+			fprintf(stderr, "%s: pthread_create(): %s\n",
+			        progname, strerror(errno));
+			goto done;
+		}
+	}
+
+	for (c = 0; c < NTHREADS; c++)
+		(void) pthread_join(tids[c], NULL);
+
+	for (c = 0; c < NTHREADS; c++)
+	{
+		if (lks[c].lk_status != 0 || !lks[c].lk_exists ||
+		    strcmp(lks[c].lk_value, "slow-value") != 0)
+		{
+			fprintf(stderr,
+			        "%s: concurrent lookup %d of \"slow\" failed\n",
+			        progname, c);
+			goto done;
+		}
+	}
+
+	pthread_mutex_lock(&srvlock);
+	seen = srvqueries;
+	pthread_mutex_unlock(&srvlock);
+
+	if (seen != 5)
+	{
+		fprintf(stderr,
+		        "%s: concurrent lookups made %lu queries, expected 1\n",
+		        progname, seen - 4);
+		goto done;
+	}
+
+	if (dkimf_db_cachestats(db, &cs) != 0)
+	{
+		fprintf(stderr, "%s: no cache statistics\n", progname);
+		goto done;
+	}
+
+	/*
+	**  Threads that found the query in progress waited for it and were
+	**  then answered from the cache, like any that started after it
+	**  finished.
+	*/
+
+	if (cs.cs_misses != 5 || cs.cs_hits != 3 + NTHREADS - 1 ||
+	    cs.cs_neghits != 1 || cs.cs_coalesced == 0)
+	{
+		fprintf(stderr,
+		        "%s: cache: %lu hits (%lu negative), %lu misses, %lu coalesced\n",
+		        progname, cs.cs_hits, cs.cs_neghits, cs.cs_misses,
+		        cs.cs_coalesced);
+		goto done;
+	}
+
+	status = EX_OK;
+
+  done:
+	dkimf_db_close(db);
+	(void) unlink(path);
+
+	return status;
+}
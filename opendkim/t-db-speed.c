@@ -0,0 +1,1221 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <sys/time.h>
+#ifdef _FFR_SOCKETDB
+# include <sys/socket.h>
+# include <sys/un.h>
+#endif /* _FFR_SOCKETDB */
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sysexits.h>
+#include <string.h>
+#include <unistd.h>
+
+/* libbsd if found */
+#ifdef USE_BSD_H
+# include <bsd/string.h>
+#endif /* USE_BSD_H */
+
+/* libstrl if needed */
+#ifdef USE_STRL_H
+# include <strl.h>
+#endif /* USE_STRL_H */
+
+/* opendkim includes */
+#include "opendkim-db.h"
+
+/* macros */
+#ifndef FALSE
+# define FALSE		0
+#endif /* ! FALSE */
+#ifndef TRUE
+# define TRUE		1
+#endif /* ! TRUE */
+
+#define	BUFRSZ		1024
+#define	CMDLINEOPTS	"D:d:in:q:rst:T:"
+#define	DEFNRECS	80000
+#define	DEFNQUERIES	20000
+#define	DEFSRVDELAY	100
+#define	DEFTMPDIR	"/tmp"
+#define	SRVWORKERS	16
+#define	TMPTEMPLATE	"dbspeedXXXXXX"
+
+/* data types */
+struct speedthread
+{
+	DKIMF_DB		st_db;
+	int			st_nrecs;
+	int			st_nqueries;
+	_Bool			st_icase;
+	long *			st_results;
+	long			st_elapsed;
+};
+
+#ifdef _FFR_SOCKETDB
+struct srvconn
+{
+	int			sc_fd;
+	int			sc_refs;
+	pthread_mutex_t		sc_lock;	/* serializes replies */
+};
+
+struct srvreq
+{
+	struct srvconn *	sr_conn;
+	struct srvreq *		sr_next;
+	char			sr_line[BUFRSZ + 1];
+};
+#endif /* _FFR_SOCKETDB */
+
+/* prototypes */
+int usage(void);
+
+/* globals */
+char *progname;
+#ifdef _FFR_SOCKETDB
+_Bool srvpipeline;
+u_int srvdelay = DEFSRVDELAY;
+DKIMF_DB srvdb;
+struct srvreq *srvhead;
+struct srvreq *srvtail;
+pthread_mutex_t srvlock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t srvcond = PTHREAD_COND_INITIALIZER;
+#endif /* _FFR_SOCKETDB */
+
+/*
+**  USAGE -- print a usage message
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	EX_USAGE
+*/
+
+int
+usage(void)
+{
+	fprintf(stderr,
+	        "%s: usage: %s [options]\nValid options:\n"
+	        "\t-D usecs   \tsocket server time per query (default %d)\n"
+	        "\t-d type    \tbuild a table of this type (db or mdb)\n"
+	        "\t-i         \tcase-insensitive table\n"
+	        "\t-n records \tnumber of table records (default %d)\n"
+	        "\t-q queries \tnumber of queries (default %d)\n"
+	        "\t-r         \ttest a regular expression (refile) table\n"
+	        "\t-s         \ttest socket tables against a local server\n"
+	        "\t-t path    \tdirectory for temporary files\n"
+	        "\t-T threads \tmeasure scaling up to this many threads\n",
+	        progname, progname, DEFSRVDELAY, DEFNRECS, DEFNQUERIES);
+
+	return EX_USAGE;
+}
+
+/*
+**  MKTABLE -- write out a test table
+**
+**  Parameters:
+**  	f -- output stream
+**  	nrecs -- number of table records
+**  	refile -- write patterns for a refile table
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Refile patterns are mostly "*@domain", with some "*@*.domain"
+**  	and a few that need a full regular expression match, so that
+**  	several entries can match the same address.
+*/
+
+void
+mktable(FILE *f, int nrecs, _Bool refile)
+{
+	int c;
+
+	for (c = 0; c < nrecs; c++)
+	{
+		if (!refile)
+			fprintf(f, "d%d.example.com\t%d\n", c, c);
+		else if (c % 50 == 0)
+			fprintf(f, "user[0-9]@d%d.example.com\t%d\n", c / 4, c);
+		else if (c % 10 == 0)
+			fprintf(f, "*@*.d%d.example.com\t%d\n", c / 4, c);
+		else
+			fprintf(f, "*@d%d.example.com\t%d\n", c / 4, c);
+	}
+}
+
+/*
+**  QUERY -- build the text of a query
+**
+**  Parameters:
+**  	n -- query number
+**  	nrecs -- number of table records
+**  	icase -- use mixed case
+**  	refile -- build an address for a refile table
+**  	buf -- output buffer
+**  	buflen -- bytes available at "buf"
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	Three queries in four hit the table, mimicking a signing table
+**  	search that tries a full address before finding a domain.
+*/
+
+void
+query(int n, int nrecs, _Bool icase, _Bool refile, char *buf, size_t buflen)
+{
+	int rec;
+
+	rec = (int) (((unsigned int) n * 2654435761U) % (nrecs + nrecs / 3));
+
+	if (refile)
+	{
+		snprintf(buf, buflen, "%s@%sd%d.%s",
+		         n % 3 == 0 ? "user1" : "user",
+		         n % 5 == 0 ? "mail." : "",
+		         rec / 4,
+		         icase && n % 2 == 0 ? "Example.COM" : "example.com");
+	}
+	else if (rec >= nrecs)
+	{
+		snprintf(buf, buflen, "user@d%d.example.com", rec);
+	}
+	else if (icase && n % 2 == 0)
+	{
+		snprintf(buf, buflen, "D%d.Example.COM", rec);
+	}
+	else
+	{
+		snprintf(buf, buflen, "d%d.example.com", rec);
+	}
+}
+
+/*
+**  RUN -- time a set of queries against a table
+**
+**  Parameters:
+**  	db -- table to query
+**  	nrecs -- number of table records
+**  	nqueries -- number of queries
+**  	icase -- use mixed case
+**  	refile -- walk a refile table for all matches
+**  	results -- per-query results (returned or checked)
+**  	check -- check against "results" rather than filling it in
+**
+**  Return value:
+**  	Elapsed time in microseconds, or -1 on error.
+**
+**  Notes:
+**  	For refile tables, the result of a query folds together the
+**  	values of every matching entry in the order dkimf_db_rewalk()
+**  	returned them, so a change in walk order shows up as a mismatch.
+*/
+
+long
+run(DKIMF_DB db, int nrecs, int nqueries, _Bool icase, _Bool refile,
+    long *results, _Bool check)
+{
+	_Bool exists;
+	int n;
+	int status;
+	long got;
+	char *end;
+	void *ctx;
+	struct timeval start;
+	struct timeval stop;
+	struct dkimf_db_data dbd;
+	char buf[BUFRSZ + 1];
+	char value[BUFRSZ + 1];
+
+	gettimeofday(&start, NULL);
+
+	for (n = 0; n < nqueries; n++)
+	{
+		query(n, nrecs, icase, refile, buf, sizeof buf);
+
+		got = -1;
+		ctx = NULL;
+
+		for (;;)
+		{
+			memset(value, '\0', sizeof value);
+			dbd.dbdata_buffer = value;
+			dbd.dbdata_buflen = sizeof value - 1;
+			dbd.dbdata_flags = 0;
+			exists = FALSE;
+
+			if (refile)
+			{
+				status = dkimf_db_rewalk(db, buf, &dbd, 1, &ctx);
+				if (status == 0)
+					exists = TRUE;
+			}
+			else
+			{
+				status = dkimf_db_get(db, buf, strlen(buf),
+				                      &dbd, 1, &exists);
+			}
+
+			if (status == -1)
+			{
+				fprintf(stderr, "%s: lookup of \"%s\" failed\n",
+				        progname, buf);
+				return -1;
+			}
+
+			if (!exists)
+				break;
+
+			got = got * 31 + strtol(value, &end, 10);
+
+			if (!refile)
+				break;
+		}
+
+		if (!check)
+		{
+			results[n] = got;
+		}
+		else if (results[n] != got)
+		{
+			fprintf(stderr,
+			        "%s: \"%s\": indexed lookup returned %ld, list scan returned %ld\n",
+			        progname, buf, got, results[n]);
+			return -1;
+		}
+	}
+
+	gettimeofday(&stop, NULL);
+
+	return (stop.tv_sec - start.tv_sec) * 1000000L +
+	       (stop.tv_usec - start.tv_usec);
+}
+
+/*
+**  MKDBTABLE -- build a test table of a type that supports writes
+**
+**  Parameters:
+**  	dbname -- table specification
+**  	nrecs -- number of table records
+**
+**  Return value:
+**  	0 on success, -1 on error.
+*/
+
+int
+mkdbtable(char *dbname, int nrecs)
+{
+	int c;
+	DKIMF_DB db;
+	char *err = NULL;
+	char key[BUFRSZ + 1];
+	char value[BUFRSZ + 1];
+
+	if (dkimf_db_open(&db, dbname, 0, NULL, &err) != 0)
+	{
+		fprintf(stderr, "%s: %s: dkimf_db_open(): %s\n", progname,
+		        dbname, err);
+		return -1;
+	}
+
+	for (c = 0; c < nrecs; c++)
+	{
+		snprintf(key, sizeof key, "d%d.example.com", c);
+		snprintf(value, sizeof value, "%d", c);
+
+		if (dkimf_db_put(db, key, strlen(key),
+		                 value, strlen(value)) != 0)
+		{
+			fprintf(stderr, "%s: %s: dkimf_db_put() failed\n",
+			        progname, dbname);
+			(void) dkimf_db_close(db);
+			return -1;
+		}
+	}
+
+	(void) dkimf_db_close(db);
+
+	return 0;
+}
+
+/*
+**  RMDBTABLE -- remove a table built by mkdbtable()
+**
+**  Parameters:
+**  	path -- file (Berkeley DB) or directory (LMDB) to remove
+**  	isdir -- "path" is a directory
+**
+**  Return value:
+**  	None.
+*/
+
+void
+rmdbtable(char *path, _Bool isdir)
+{
+	char fn[BUFRSZ + 1];
+
+	if (isdir)
+	{
+		snprintf(fn, sizeof fn, "%s/data.mdb", path);
+		(void) unlink(fn);
+		snprintf(fn, sizeof fn, "%s/lock.mdb", path);
+		(void) unlink(fn);
+		(void) rmdir(path);
+	}
+	else
+	{
+		(void) unlink(path);
+	}
+}
+
+/*
+**  SPEEDTHREAD -- run queries in a thread of their own
+**
+**  Parameters:
+**  	arg -- a speedthread structure
+**
+**  Return value:
+**  	Always NULL.
+*/
+
+void *
+speedthread(void *arg)
+{
+	struct speedthread *st;
+
+	st = (struct speedthread *) arg;
+
+	st->st_elapsed = run(st->st_db, st->st_nrecs, st->st_nqueries,
+	                     st->st_icase, FALSE, st->st_results, TRUE);
+
+	return NULL;
+}
+
+/*
+**  SCALING -- measure throughput with increasing numbers of threads
+**
+**  Parameters:
+**  	db -- table to query
+**  	nrecs -- number of table records
+**  	nqueries -- number of queries per thread
+**  	icase -- use mixed case
+**  	results -- expected results
+**  	maxthreads -- largest number of threads to try
+**
+**  Return value:
+**  	0 on success, -1 on error.
+**
+**  Notes:
+**  	Every thread makes the same set of queries, so with no contention
+**  	the elapsed time stays flat as threads are added (up to the
+**  	number of CPUs available).
+*/
+
+int
+scaling(DKIMF_DB db, int nrecs, int nqueries, _Bool icase, long *results,
+        int maxthreads)
+{
+	int c;
+	int nthreads;
+	int status = 0;
+	long elapsed;
+	struct speedthread *st;
+	pthread_t *tids;
+	struct timeval start;
+	struct timeval stop;
+
+	st = (struct speedthread *) malloc(sizeof *st * maxthreads);
+	tids = (pthread_t *) malloc(sizeof *tids * maxthreads);
+	if (st == NULL || tids == NULL)
+	{
+		fprintf(stderr, "%s: malloc(): %s\n", progname,
+		        strerror(errno));
+		free(st);
+		free(tids);
+		return -1;
+	}
+
+	for (nthreads = 1; status == 0; nthreads *= 2)
+	{
+		if (nthreads > maxthreads)
+			nthreads = maxthreads;
+
+		gettimeofday(&start, NULL);
+
+		for (c = 0; c < nthreads; c++)
+		{
+			st[c].st_db = db;
+			st[c].st_nrecs = nrecs;
+			st[c].st_nqueries = nqueries;
+			st[c].st_icase = icase;
+			st[c].st_results = results;
+			st[c].st_elapsed = 0;
+
+			if (pthread_create(&tids[c], NULL, speedthread,
+			                   &st[c]) != 0)
+			{
+				fprintf(stderr, "%s: pthread_create() failed\n",
+				        progname);
+				status = -1;
+				break;
+			}
+		}
+
+		nthreads = c;
+		for (c = 0; c < nthreads; c++)
+		{
+			(void) pthread_join(tids[c], NULL);
+			if (st[c].st_elapsed < 0)
+				status = -1;
+		}
+
+		gettimeofday(&stop, NULL);
+
+		if (status != 0)
+			break;
+
+		elapsed = (stop.tv_sec - start.tv_sec) * 1000000L +
+		          (stop.tv_usec - start.tv_usec);
+
+		fprintf(stdout, "%s: %d thread%s: %ld.%06lds, %.0f queries/s\n",
+		        progname, nthreads, nthreads == 1 ? "" : "s",
+		        elapsed / 1000000L, elapsed % 1000000L,
+		        elapsed <= 0 ? 0.0
+		                     : (double) nthreads * nqueries * 1000000.0 / elapsed);
+
+		if (nthreads == maxthreads)
+			break;
+	}
+
+	free(st);
+	free(tids);
+
+	return status;
+}
+
+#ifdef _FFR_SOCKETDB
+/*
+**  SRVANSWER -- answer one query as a socket data set server would
+**
+**  Parameters:
+**  	line -- query, without its newline (modified)
+**  	reply -- reply, including its newline (returned)
+**  	replylen -- bytes available at "reply"
+**
+**  Return value:
+**  	None.
+**
+**  Notes:
+**  	The server sleeps for "srvdelay" microseconds per query to stand
+**  	in for the work a real policy daemon does.
+*/
+
+void
+srvanswer(char *line, char *reply, size_t replylen)
+{
+	_Bool exists = FALSE;
+	char *id = NULL;
+	char *key = line;
+	struct dkimf_db_data dbd;
+	char value[BUFRSZ + 1];
+
+	if (srvpipeline)
+	{
+		id = line;
+		key = strchr(line, ' ');
+		if (key == NULL)
+			key = line + strlen(line);
+		else
+			*key++ = '\0';
+	}
+
+	if (srvdelay > 0)
+		usleep(srvdelay);
+
+	memset(value, '\0', sizeof value);
+	dbd.dbdata_buffer = value;
+	dbd.dbdata_buflen = sizeof value - 1;
+	dbd.dbdata_flags = 0;
+
+	if (dkimf_db_get(srvdb, key, strlen(key), &dbd, 1, &exists) != 0 ||
+	    !exists)
+		value[0] = '\0';
+
+	if (id != NULL)
+		snprintf(reply, replylen, "%s %s\n", id, value);
+	else
+		snprintf(reply, replylen, "%s\n", value);
+}
+
+/*
+**  SRVRELEASE -- drop a reference to a server connection
+**
+**  Parameters:
+**  	conn -- connection
+**
+**  Return value:
+**  	None.
+*/
+
+void
+srvrelease(struct srvconn *conn)
+{
+	_Bool last;
+
+	pthread_mutex_lock(&srvlock);
+	last = (--conn->sc_refs == 0);
+	pthread_mutex_unlock(&srvlock);
+
+	if (last)
+	{
+		close(conn->sc_fd);
+		pthread_mutex_destroy(&conn->sc_lock);
+		free(conn);
+	}
+}
+
+/*
+**  SRVWORKER -- answer queued pipelined queries
+**
+**  Parameters:
+**  	arg -- unused
+**
+**  Return value:
+**  	Never returns.
+**
+**  Notes:
+**  	Several of these run at once, so replies on a connection can come
+**  	back in a different order from the queries.
+*/
+
+void *
+srvworker(void *arg)
+{
+	struct srvreq *req;
+	char reply[BUFRSZ + 1];
+
+	for (;;)
+	{
+		pthread_mutex_lock(&srvlock);
+		while (srvhead == NULL)
+			pthread_cond_wait(&srvcond, &srvlock);
+		req = srvhead;
+		srvhead = req->sr_next;
+		if (srvhead == NULL)
+			srvtail = NULL;
+		pthread_mutex_unlock(&srvlock);
+
+		srvanswer(req->sr_line, reply, sizeof reply);
+
+		pthread_mutex_lock(&req->sr_conn->sc_lock);
+		(void) write(req->sr_conn->sc_fd, reply, strlen(reply));
+		pthread_mutex_unlock(&req->sr_conn->sc_lock);
+
+		srvrelease(req->sr_conn);
+		free(req);
+	}
+
+	return NULL;
+}
+
+/*
+**  SRVCONNECTION -- read queries from one client connection
+**
+**  Parameters:
+**  	arg -- a srvconn structure
+**
+**  Return value:
+**  	Always NULL.
+**
+**  Notes:
+**  	Plain queries are answered in order, one at a time; pipelined
+**  	queries are handed to the workers.
+*/
+
+void *
+srvconnection(void *arg)
+{
+	size_t inlen = 0;
+	ssize_t rlen;
+	char *eol;
+	char *p;
+	struct srvconn *conn;
+	struct srvreq *req;
+	char in[BUFRSZ * 4];
+	char reply[BUFRSZ + 1];
+
+	conn = (struct srvconn *) arg;
+
+	for (;;)
+	{
+		rlen = read(conn->sc_fd, in + inlen, sizeof in - inlen);
+		if (rlen <= 0)
+			break;
+		inlen += rlen;
+
+		p = in;
+		while ((eol = memchr(p, '\n', inlen - (p - in))) != NULL)
+		{
+			*eol = '\0';
+
+			if (!srvpipeline)
+			{
+				srvanswer(p, reply, sizeof reply);
+				(void) write(conn->sc_fd, reply,
+				             strlen(reply));
+			}
+			else if ((req = malloc(sizeof *req)) != NULL)
+			{
+				req->sr_conn = conn;
+				req->sr_next = NULL;
+				strlcpy(req->sr_line, p, sizeof req->sr_line);
+
+				pthread_mutex_lock(&srvlock);
+				conn->sc_refs++;
+				if (srvtail == NULL)
+					srvhead = req;
+				else
+					srvtail->sr_next = req;
+				srvtail = req;
+				pthread_cond_signal(&srvcond);
+				pthread_mutex_unlock(&srvlock);
+			}
+
+			p = eol + 1;
+		}
+
+		inlen -= p - in;
+		memmove(in, p, inlen);
+		if (inlen == sizeof in)
+			break;
+	}
+
+	srvrelease(conn);
+
+	return NULL;
+}
+
+/*
+**  SRVLISTEN -- accept client connections
+**
+**  Parameters:
+**  	arg -- listening descriptor
+**
+**  Return value:
+**  	Never returns.
+*/
+
+void *
+srvlisten(void *arg)
+{
+	int fd;
+	int lfd;
+	pthread_t tid;
+	struct srvconn *conn;
+
+	lfd = *(int *) arg;
+
+	for (;;)
+	{
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		conn = (struct srvconn *) malloc(sizeof *conn);
+		if (conn == NULL)
+		{
+			close(fd);
+			continue;
+		}
+
+		conn->sc_fd = fd;
+		conn->sc_refs = 1;
+		pthread_mutex_init(&conn->sc_lock, NULL);
+
+		if (pthread_create(&tid, NULL, srvconnection, conn) != 0)
+		{
+			srvrelease(conn);
+			continue;
+		}
+
+		(void) pthread_detach(tid);
+	}
+
+	return NULL;
+}
+
+/*
+**  SRVSTART -- start a local socket data set server
+**
+**  Parameters:
+**  	path -- UNIX domain socket to create
+**
+**  Return value:
+**  	0 on success, -1 on error.
+**
+**  Notes:
+**  	The server runs until the program exits.
+*/
+
+int
+srvstart(char *path)
+{
+	int c;
+	static int lfd;
+	pthread_t tid;
+	struct sockaddr_un sun;
+
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (lfd < 0)
+		return -1;
+
+	memset(&sun, '\0', sizeof sun);
+	sun.sun_family = AF_UNIX;
+	strlcpy(sun.sun_path, path, sizeof sun.sun_path);
+
+	if (bind(lfd, (struct sockaddr *) &sun, sizeof sun) != 0 ||
+	    listen(lfd, 128) != 0 ||
+	    pthread_create(&tid, NULL, srvlisten, &lfd) != 0)
+	{
+		close(lfd);
+		return -1;
+	}
+
+	(void) pthread_detach(tid);
+
+	for (c = 0; c < SRVWORKERS; c++)
+	{
+		if (pthread_create(&tid, NULL, srvworker, NULL) != 0)
+			return -1;
+		(void) pthread_detach(tid);
+	}
+
+	return 0;
+}
+
+/*
+**  SOCKETSPEED -- compare socket table configurations
+**
+**  Parameters:
+**  	tmpdir -- directory for temporary files
+**  	nrecs -- number of table records
+**  	nqueries -- number of queries
+**  	maxthreads -- largest number of threads to try
+**
+**  Return value:
+**  	Exit status.
+**
+**  Notes:
+**  	A file table is served over a UNIX domain socket by a server in
+**  	this process, then queried through a single connection, through
+**  	one connection per thread, and through a single pipelined
+**  	connection, and finally through a cache in front of one
+**  	connection per thread.  Every answer is checked against the file
+**  	table.
+*/
+
+int
+socketspeed(char *tmpdir, int nrecs, int nqueries, int maxthreads)
+{
+	int c;
+	int fd;
+	int status = EX_OK;
+	long elapsed;
+	long *results;
+	char *err = NULL;
+	FILE *f;
+	DKIMF_DB db;
+	char fn[BUFRSZ + 1];
+	char path[BUFRSZ + 1];
+	char dbname[BUFRSZ + 1];
+	char opts[4][BUFRSZ + 1];
+	struct dkimf_db_cachestats cs;
+
+	results = (long *) malloc(sizeof(long) * nqueries);
+	if (results == NULL)
+	{
+		fprintf(stderr, "%s: malloc(): %s\n", progname,
+		        strerror(errno));
+		return EX_OSERR;
+	}
+
+	/* the server's data */
+	snprintf(fn, sizeof fn, "%s/%s", tmpdir, TMPTEMPLATE);
+	fd = mkstemp(fn);
+	if (fd < 0 || (f = fdopen(fd, "w")) == NULL)
+	{
+		fprintf(stderr, "%s: %s: %s\n", progname, fn, strerror(errno));
+		return EX_CANTCREAT;
+	}
+
+	mktable(f, nrecs, FALSE);
+
+	fclose(f);
+
+	snprintf(dbname, sizeof dbname, "file:%s", fn);
+	if (dkimf_db_open(&srvdb, dbname, DKIMF_DB_FLAG_READONLY, NULL,
+	                  &err) != 0)
+	{
+		fprintf(stderr, "%s: dkimf_db_open(): %s\n", progname, err);
+		(void) unlink(fn);
+		return EX_SOFTWARE;
+	}
+
+	(void) unlink(fn);
+
+	if (run(srvdb, nrecs, nqueries, FALSE, FALSE, results, FALSE) < 0)
+		return EX_SOFTWARE;
+
+	/* the server; mkstemp() just picks a name for the socket */
+	snprintf(path, sizeof path, "%s/%s", tmpdir, TMPTEMPLATE);
+	fd = mkstemp(path);
+	if (fd < 0)
+	{
+		fprintf(stderr, "%s: %s: %s\n", progname, path,
+		        strerror(errno));
+		return EX_CANTCREAT;
+	}
+	close(fd);
+	(void) unlink(path);
+
+	/* a client giving up on a pipelined query mustn't kill the server */
+	(void) signal(SIGPIPE, SIG_IGN);
+
+	if (srvstart(path) != 0)
+	{
+		fprintf(stderr, "%s: %s: %s\n", progname, path,
+		        strerror(errno));
+		(void) unlink(path);
+		return EX_OSERR;
+	}
+
+	fprintf(stdout, "%s: %d socket records, %d queries, %uus per query\n",
+	        progname, nrecs, nqueries, srvdelay);
+
+	/* the server answers a missing key with an empty reply */
+	strlcpy(opts[0], "?emptynotfound", sizeof opts[0]);
+	snprintf(opts[1], sizeof opts[1], "?emptynotfound&conns=%d",
+	         maxthreads);
+	strlcpy(opts[2], "?emptynotfound&pipeline", sizeof opts[2]);
+	snprintf(opts[3], sizeof opts[3], "?emptynotfound&conns=%d",
+	         maxthreads);
+
+	for (c = 0; c < 4 && status == EX_OK; c++)
+	{
+		srvpipeline = (strstr(opts[c], "pipeline") != NULL);
+
+		snprintf(dbname, sizeof dbname, "%ssocket:%s%s",
+		         c == 3 ? "cache:" : "", path, opts[c]);
+		if (dkimf_db_open(&db, dbname, DKIMF_DB_FLAG_READONLY, NULL,
+		                  &err) != 0)
+		{
+			fprintf(stderr, "%s: %s: dkimf_db_open(): %s\n",
+			        progname, dbname, err);
+			status = EX_SOFTWARE;
+			break;
+		}
+
+		fprintf(stdout, "%s: %s\n", progname, dbname);
+
+		elapsed = run(db, nrecs, nqueries, FALSE, FALSE, results,
+		              TRUE);
+		if (elapsed < 0)
+		{
+			status = EX_SOFTWARE;
+		}
+		else
+		{
+			fprintf(stdout, "%s: lookups: %ld.%06lds\n", progname,
+			        elapsed / 1000000L, elapsed % 1000000L);
+
+			if (maxthreads > 1 &&
+			    scaling(db, nrecs, nqueries, FALSE, results,
+			            maxthreads) != 0)
+				status = EX_SOFTWARE;
+		}
+
+		if (dkimf_db_cachestats(db, &cs) == 0)
+		{
+			fprintf(stdout,
+			        "%s: cache: %lu hits, %lu misses, %lu coalesced\n",
+			        progname, cs.cs_hits,
+			        cs.cs_misses, cs.cs_coalesced);
+		}
+
+		(void) dkimf_db_close(db);
+	}
+
+	(void) unlink(path);
+	free(results);
+
+	return status;
+}
+#endif /* _FFR_SOCKETDB */
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	argc, argv -- the usual
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+main(int argc, char **argv)
+{
+	_Bool icase = FALSE;
+	_Bool refile = FALSE;
+	_Bool sockets = FALSE;
+	int c;
+	int fd;
+	int nrecs = DEFNRECS;
+	int nqueries = DEFNQUERIES;
+	int maxthreads = 1;
+	u_int flags;
+	long scantime;
+	long indextime;
+	long *results;
+	char *p;
+	char *tmpdir = DEFTMPDIR;
+	char *dbtype = NULL;
+	char *err = NULL;
+	FILE *f;
+	DKIMF_DB scandb;
+	DKIMF_DB indexdb;
+	char fn[BUFRSZ + 1];
+	char dbname[BUFRSZ + 1];
+
+	progname = (p = strrchr(argv[0], '/')) == NULL ? argv[0] : p + 1;
+
+	while ((c = getopt(argc, argv, CMDLINEOPTS)) != -1)
+	{
+		switch (c)
+		{
+		  case 'D':
+#ifdef _FFR_SOCKETDB
+			srvdelay = strtoul(optarg, &p, 10);
+			if (*p != '\0')
+				return usage();
+			break;
+#else /* _FFR_SOCKETDB */
+			return usage();
+#endif /* _FFR_SOCKETDB */
+
+		  case 'd':
+			if (strcasecmp(optarg, "db") != 0 &&
+			    strcasecmp(optarg, "mdb") != 0)
+				return usage();
+			dbtype = optarg;
+			break;
+
+		  case 'i':
+			icase = TRUE;
+			break;
+
+		  case 'n':
+			nrecs = strtol(optarg, &p, 10);
+			if (*p != '\0' || nrecs <= 0)
+				return usage();
+			break;
+
+		  case 'q':
+			nqueries = strtol(optarg, &p, 10);
+			if (*p != '\0' || nqueries <= 0)
+				return usage();
+			break;
+
+		  case 'r':
+			refile = TRUE;
+			break;
+
+		  case 's':
+			sockets = TRUE;
+			break;
+
+		  case 't':
+			tmpdir = optarg;
+			break;
+
+		  case 'T':
+			maxthreads = strtol(optarg, &p, 10);
+			if (*p != '\0' || maxthreads <= 0)
+				return usage();
+			break;
+
+		  default:
+			return usage();
+		}
+	}
+
+	if (sockets)
+	{
+		if (refile || dbtype != NULL)
+			return usage();
+
+#ifdef _FFR_SOCKETDB
+		return socketspeed(tmpdir, nrecs, nqueries, maxthreads);
+#else /* _FFR_SOCKETDB */
+		fprintf(stderr, "%s: socket data sets not supported\n",
+		        progname);
+		return EX_UNAVAILABLE;
+#endif /* _FFR_SOCKETDB */
+	}
+
+	results = (long *) malloc(sizeof(long) * nqueries);
+	if (results == NULL)
+	{
+		fprintf(stderr, "%s: malloc(): %s\n", progname,
+		        strerror(errno));
+		return EX_OSERR;
+	}
+
+	flags = DKIMF_DB_FLAG_READONLY;
+	if (icase)
+		flags |= DKIMF_DB_FLAG_ICASE;
+
+	snprintf(fn, sizeof fn, "%s/%s", tmpdir, TMPTEMPLATE);
+
+	if (dbtype != NULL)
+	{
+		_Bool isdir;
+
+		if (refile)
+			return usage();
+
+		/* LMDB wants a directory; Berkeley DB creates its own file */
+		isdir = (strcasecmp(dbtype, "mdb") == 0);
+		if (isdir)
+		{
+			if (mkdtemp(fn) == NULL)
+			{
+				fprintf(stderr, "%s: %s: %s\n", progname, fn,
+				        strerror(errno));
+				return EX_CANTCREAT;
+			}
+		}
+		else
+		{
+			fd = mkstemp(fn);
+			if (fd < 0)
+			{
+				fprintf(stderr, "%s: %s: %s\n", progname, fn,
+				        strerror(errno));
+				return EX_CANTCREAT;
+			}
+			close(fd);
+			(void) unlink(fn);
+		}
+
+		snprintf(dbname, sizeof dbname, "%s:%s", dbtype, fn);
+
+		if (mkdbtable(dbname, nrecs) != 0 ||
+		    dkimf_db_open(&indexdb, dbname, flags, NULL, &err) != 0)
+		{
+			if (err != NULL)
+			{
+				fprintf(stderr, "%s: dkimf_db_open(): %s\n",
+				        progname, err);
+			}
+			rmdbtable(fn, isdir);
+			return EX_SOFTWARE;
+		}
+
+		fprintf(stdout, "%s: %d %s records, %d queries\n", progname,
+		        nrecs, dbtype, nqueries);
+
+		/* keys are stored as given, so mixed-case queries would miss */
+		indextime = run(indexdb, nrecs, nqueries, FALSE, FALSE,
+		                results, FALSE);
+		if (indextime >= 0)
+		{
+			fprintf(stdout, "%s: lookups: %ld.%06lds\n", progname,
+			        indextime / 1000000L, indextime % 1000000L);
+		}
+
+		if (indextime < 0 ||
+		    (maxthreads > 1 &&
+		     scaling(indexdb, nrecs, nqueries, FALSE, results,
+		             maxthreads) != 0))
+		{
+			(void) dkimf_db_close(indexdb);
+			rmdbtable(fn, isdir);
+			return EX_SOFTWARE;
+		}
+
+		(void) dkimf_db_close(indexdb);
+		rmdbtable(fn, isdir);
+		free(results);
+
+		return EX_OK;
+	}
+
+	fd = mkstemp(fn);
+	if (fd < 0 || (f = fdopen(fd, "w")) == NULL)
+	{
+		fprintf(stderr, "%s: %s: %s\n", progname, fn, strerror(errno));
+		return EX_CANTCREAT;
+	}
+
+	mktable(f, nrecs, refile);
+
+	fclose(f);
+
+	snprintf(dbname, sizeof dbname, "%s:%s", refile ? "refile" : "file",
+	         fn);
+
+	if (dkimf_db_open(&scandb, dbname, flags | DKIMF_DB_FLAG_NOINDEX,
+	                  NULL, &err) != 0 ||
+	    dkimf_db_open(&indexdb, dbname, flags, NULL, &err) != 0)
+	{
+		fprintf(stderr, "%s: dkimf_db_open(): %s\n", progname, err);
+		(void) unlink(fn);
+		return EX_SOFTWARE;
+	}
+
+	(void) unlink(fn);
+
+	fprintf(stdout, "%s: %d %s records, %d queries%s\n", progname,
+	        nrecs, refile ? "refile" : "file", nqueries,
+	        icase ? ", case-insensitive" : "");
+
+	scantime = run(scandb, nrecs, nqueries, icase, refile, results,
+	               FALSE);
+	if (scantime < 0)
+		return EX_SOFTWARE;
+	fprintf(stdout, "%s: list scan: %ld.%06lds\n", progname,
+	        scantime / 1000000L, scantime % 1000000L);
+
+	indextime = run(indexdb, nrecs, nqueries, icase, refile, results,
+	                TRUE);
+	if (indextime < 0)
+		return EX_SOFTWARE;
+	fprintf(stdout, "%s: indexed: %ld.%06lds\n", progname,
+	        indextime / 1000000L, indextime % 1000000L);
+
+	if (maxthreads > 1 && !refile &&
+	    scaling(indexdb, nrecs, nqueries, icase, results,
+	            maxthreads) != 0)
+		return EX_SOFTWARE;
+
+	(void) dkimf_db_close(scandb);
+	(void) dkimf_db_close(indexdb);
+	free(results);
+
+	return EX_OK;
+}
@@ -0,0 +1,549 @@
+/*
+**  Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+*/
+
+#include "build-config.h"
+
+/* system includes */
+#include <sys/types.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sysexits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* opendkim includes */
+#include "opendkim-db.h"
+#include "flowrate.h"
+
+/* macros */
+#ifndef FALSE
+# define FALSE		0
+#endif /* ! FALSE */
+#ifndef TRUE
+# define TRUE		1
+#endif /* ! TRUE */
+
+#define	BUFRSZ		1024
+#define	CMDLINEOPTS	"f:n:q:t:T:"
+#define	DEFNDOMAINS	1000
+#define	DEFNCHECKS	100000
+#define	DEFNTHREADS	32
+#define	DEFTMPDIR	"/tmp"
+#define	FLOWTTL		86400
+#define	TMPTEMPLATE	"ratespeedXXXXXX"
+
+/* data types */
+struct flowdata
+{
+	time_t		fd_since;
+	unsigned int	fd_limit;
+	unsigned int	fd_count;
+};
+
+struct speedthread
+{
+	_Bool			st_locked;
+	int			st_id;
+	int			st_run;
+	int			st_ndomains;
+	int			st_nchecks;
+	int			st_exceeded;
+	long			st_elapsed;
+	long			st_max;
+	DKIMF_DB		st_ratedb;
+	DKIMF_DB		st_flowdb;
+};
+
+/* prototypes */
+int usage(void);
+
+/* globals */
+char *progname;
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+**  USAGE -- print a usage message
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	EX_USAGE
+*/
+
+int
+usage(void)
+{
+	fprintf(stderr,
+	        "%s: usage: %s [options]\nValid options:\n"
+	        "\t-f dataset \tflow data set (default a Berkeley DB file)\n"
+	        "\t-n domains \tnumber of domains (default %d)\n"
+	        "\t-q checks  \tchecks per thread (default %d)\n"
+	        "\t-t path    \tdirectory for temporary files\n"
+	        "\t-T threads \tlargest number of threads (default %d)\n",
+	        progname, progname, DEFNDOMAINS, DEFNCHECKS, DEFNTHREADS);
+
+	return EX_USAGE;
+}
+
+#ifdef _FFR_RATE_LIMIT
+/*
+**  LOCKEDCHECK -- rate limit check as done before flow data was kept in
+**                 memory: under one lock, reading and writing the flow
+**                 data set every time
+**
+**  Parameters:
+**  	As for dkimf_rate_check().
+**
+**  Return value:
+**  	As for dkimf_rate_check().
+*/
+
+int
+lockedcheck(const char *domain, DKIMF_DB ratedb, DKIMF_DB flowdb,
+            int factor, int ttl, unsigned int *limit)
+{
+	_Bool found = FALSE;
+	int status;
+	time_t now;
+	char *p;
+	struct dkimf_db_data dbd;
+	struct flowdata f;
+	char limbuf[BUFRSZ];
+
+	memset(&f, '\0', sizeof f);
+
+	pthread_mutex_lock(&lock);
+
+	dbd.dbdata_buffer = (void *) &f;
+	dbd.dbdata_buflen = sizeof f;
+	dbd.dbdata_flags = DKIMF_DB_DATA_BINARY;
+	status = dkimf_db_get(flowdb, (void *) domain, 0, &dbd, 1, &found);
+	if (status != 0)
+	{
+		pthread_mutex_unlock(&lock);
+		return -1;
+	}
+
+	(void) time(&now);
+
+	if (!found || f.fd_since + ttl <= now)
+	{
+		memset(limbuf, '\0', sizeof limbuf);
+
+		dbd.dbdata_buffer = limbuf;
+		dbd.dbdata_buflen = sizeof limbuf - 1;
+		dbd.dbdata_flags = 0;
+		status = dkimf_db_get(ratedb, (void *) domain, 0, &dbd, 1,
+		                      &found);
+		if (status != 0 || !found)
+		{
+			pthread_mutex_unlock(&lock);
+			return (status != 0 ? -1 : 0);
+		}
+
+		f.fd_count = 0;
+		f.fd_limit = (unsigned int) strtoul(limbuf, &p, 10) / factor;
+		f.fd_since = now;
+	}
+
+	f.fd_count++;
+
+	status = dkimf_db_put(flowdb, (void *) domain, strlen(domain),
+	                      &f, sizeof f);
+
+	pthread_mutex_unlock(&lock);
+
+	if (status != 0)
+		return -1;
+
+	if (limit != NULL)
+		*limit = f.fd_limit;
+
+	return (f.fd_count >= f.fd_limit ? 1 : 0);
+}
+
+/*
+**  SPEEDTHREAD -- make rate limit checks in a thread of their own
+**
+**  Parameters:
+**  	arg -- a speedthread structure
+**
+**  Return value:
+**  	Always NULL.
+**
+**  Notes:
+**  	Threads work through the domains from different starting points,
+**  	each checking every domain equally often.
+*/
+
+void *
+speedthread(void *arg)
+{
+	int c;
+	int status;
+	long usecs;
+	unsigned int limit;
+	struct speedthread *st;
+	struct timeval start;
+	struct timeval before;
+	struct timeval after;
+	char domain[BUFRSZ + 1];
+
+	st = (struct speedthread *) arg;
+
+	gettimeofday(&start, NULL);
+
+	for (c = 0; c < st->st_nchecks; c++)
+	{
+		snprintf(domain, sizeof domain, "d%d.r%d.example.com",
+		         (c + st->st_id * 7) % st->st_ndomains, st->st_run);
+
+		gettimeofday(&before, NULL);
+
+		if (st->st_locked)
+		{
+			status = lockedcheck(domain, st->st_ratedb,
+			                     st->st_flowdb, 1, FLOWTTL,
+			                     &limit);
+		}
+		else
+		{
+			status = dkimf_rate_check(domain, st->st_ratedb,
+			                          st->st_flowdb, 1, FLOWTTL,
+			                          &limit);
+		}
+
+		gettimeofday(&after, NULL);
+
+		if (status == -1)
+		{
+			st->st_elapsed = -1;
+			return NULL;
+		}
+		else if (status == 1)
+		{
+			st->st_exceeded++;
+		}
+
+		usecs = (after.tv_sec - before.tv_sec) * 1000000L +
+		        (after.tv_usec - before.tv_usec);
+		if (usecs > st->st_max)
+			st->st_max = usecs;
+	}
+
+	st->st_elapsed = (after.tv_sec - start.tv_sec) * 1000000L +
+	                 (after.tv_usec - start.tv_usec);
+
+	return NULL;
+}
+
+/*
+**  RUN -- time rate limit checks from several threads
+**
+**  Parameters:
+**  	locked -- use lockedcheck() instead of dkimf_rate_check()
+**  	flowdb -- flow data set
+**  	tmpdir -- directory for temporary files
+**  	run -- run number, making domain names unique to this run
+**  	ndomains -- number of domains
+**  	nchecks -- checks per thread
+**  	nthreads -- number of threads
+**
+**  Return value:
+**  	0 on success, -1 on error.
+**
+**  Notes:
+**  	Each domain's limit is the number of checks it will get, so
+**  	exactly one check per domain reaches it unless counts are lost.
+*/
+
+int
+run(_Bool locked, DKIMF_DB flowdb, char *tmpdir, int run, int ndomains,
+    int nchecks, int nthreads)
+{
+	int c;
+	int fd;
+	int status = 0;
+	int exceeded = 0;
+	long max = 0;
+	long elapsed = 0;
+	long wall;
+	char *err = NULL;
+	FILE *f;
+	DKIMF_DB ratedb;
+	struct speedthread *st;
+	pthread_t *tids;
+	struct timeval start;
+	struct timeval stop;
+	char fn[BUFRSZ + 1];
+	char dbname[BUFRSZ + 1];
+
+	/* the limits */
+	snprintf(fn, sizeof fn, "%s/%s", tmpdir, TMPTEMPLATE);
+	fd = mkstemp(fn);
+	if (fd < 0 || (f = fdopen(fd, "w")) == NULL)
+	{
+		fprintf(stderr, "%s: %s: %s\n", progname, fn, strerror(errno));
+		return -1;
+	}
+
+	for (c = 0; c < ndomains; c++)
+	{
+		fprintf(f, "d%d.r%d.example.com %d\n", c, run,
+		        nchecks / ndomains * nthreads);
+	}
+
+	fclose(f);
+
+	snprintf(dbname, sizeof dbname, "file:%s", fn);
+	status = dkimf_db_open(&ratedb, dbname,
+	                       DKIMF_DB_FLAG_READONLY | DKIMF_DB_FLAG_ICASE,
+	                       NULL, &err);
+	(void) unlink(fn);
+	if (status != 0)
+	{
+		fprintf(stderr, "%s: %s: dkimf_db_open(): %s\n", progname,
+		        dbname, err);
+		return -1;
+	}
+
+	st = (struct speedthread *) malloc(sizeof *st * nthreads);
+	tids = (pthread_t *) malloc(sizeof *tids * nthreads);
+	if (st == NULL || tids == NULL)
+	{
+		fprintf(stderr, "%s: malloc(): %s\n", progname,
+		        strerror(errno));
+		free(st);
+		free(tids);
+		(void) dkimf_db_close(ratedb);
+		return -1;
+	}
+
+	memset(st, '\0', sizeof *st * nthreads);
+
+	gettimeofday(&start, NULL);
+
+	for (c = 0; c < nthreads; c++)
+	{
+		st[c].st_locked = locked;
+		st[c].st_id = c;
+		st[c].st_run = run;
+		st[c].st_ndomains = ndomains;
+		st[c].st_nchecks = nchecks;
+		st[c].st_ratedb = ratedb;
+		st[c].st_flowdb = flowdb;
+
+		if (pthread_create(&tids[c], NULL, speedthread, &st[c]) != 0)
+		{
+			fprintf(stderr, "%s: pthread_create() failed\n",
+			        progname);
+			status = -1;
+			break;
+		}
+	}
+
+	nthreads = c;
+	for (c = 0; c < nthreads; c++)
+	{
+		(void) pthread_join(tids[c], NULL);
+		if (st[c].st_elapsed < 0)
+			status = -1;
+		elapsed += st[c].st_elapsed;
+		exceeded += st[c].st_exceeded;
+		if (st[c].st_max > max)
+			max = st[c].st_max;
+	}
+
+	gettimeofday(&stop, NULL);
+
+	free(st);
+	free(tids);
+	(void) dkimf_db_close(ratedb);
+
+	if (status != 0)
+	{
+		fprintf(stderr, "%s: %s: rate limit check failed\n",
+		        progname, locked ? "global lock" : "in memory");
+		return -1;
+	}
+
+	wall = (stop.tv_sec - start.tv_sec) * 1000000L +
+	       (stop.tv_usec - start.tv_usec);
+
+	fprintf(stdout,
+	        "%s: %s, %d thread%s: %.3fus/check mean, %ldus max, %.0f checks/s\n",
+	        progname, locked ? "global lock" : "in memory",
+	        nthreads, nthreads == 1 ? "" : "s",
+	        (double) elapsed / ((double) nchecks * nthreads), max,
+	        wall <= 0 ? 0.0
+	                  : (double) nchecks * nthreads * 1000000.0 / wall);
+
+	if (exceeded != ndomains)
+	{
+		fprintf(stderr,
+		        "%s: %d domains reached their limits, expected %d\n",
+		        progname, exceeded, ndomains);
+		return -1;
+	}
+
+	return 0;
+}
+#endif /* _FFR_RATE_LIMIT */
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	argc, argv -- the usual
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+main(int argc, char **argv)
+{
+	int c;
+	int ndomains = DEFNDOMAINS;
+	int nchecks = DEFNCHECKS;
+	int maxthreads = DEFNTHREADS;
+	char *p;
+	char *tmpdir = DEFTMPDIR;
+	char *flowname = NULL;
+#ifdef _FFR_RATE_LIMIT
+	_Bool writable = TRUE;
+	_Bool tmpflow = FALSE;
+	int fd;
+	int nruns = 0;
+	int nthreads;
+	int status = EX_OK;
+	char *err = NULL;
+	DKIMF_DB flowdb;
+	char fn[BUFRSZ + 1];
+	char dbname[BUFRSZ + 1];
+#endif /* _FFR_RATE_LIMIT */
+
+	progname = (p = strrchr(argv[0], '/')) == NULL ? argv[0] : p + 1;
+
+	while ((c = getopt(argc, argv, CMDLINEOPTS)) != -1)
+	{
+		switch (c)
+		{
+		  case 'f':
+			flowname = optarg;
+			break;
+
+		  case 'n':
+			ndomains = strtol(optarg, &p, 10);
+			if (*p != '\0' || ndomains <= 0)
+				return usage();
+			break;
+
+		  case 'q':
+			nchecks = strtol(optarg, &p, 10);
+			if (*p != '\0' || nchecks <= 0)
+				return usage();
+			break;
+
+		  case 't':
+			tmpdir = optarg;
+			break;
+
+		  case 'T':
+			maxthreads = strtol(optarg, &p, 10);
+			if (*p != '\0' || maxthreads <= 0)
+				return usage();
+			break;
+
+		  default:
+			return usage();
+		}
+	}
+
+#ifdef _FFR_RATE_LIMIT
+	/* every domain gets the same number of checks */
+	nchecks -= nchecks % ndomains;
+	if (nchecks == 0)
+		return usage();
+
+	if (flowname == NULL)
+	{
+		snprintf(fn, sizeof fn, "%s/%s", tmpdir, TMPTEMPLATE);
+		fd = mkstemp(fn);
+		if (fd < 0)
+		{
+			fprintf(stderr, "%s: %s: %s\n", progname, fn,
+			        strerror(errno));
+			return EX_CANTCREAT;
+		}
+		close(fd);
+		(void) unlink(fn);
+
+		snprintf(dbname, sizeof dbname, "db:%s", fn);
+		flowname = dbname;
+		tmpflow = TRUE;
+	}
+
+	if (dkimf_db_open(&flowdb, flowname,
+	                  DKIMF_DB_FLAG_ICASE | DKIMF_DB_FLAG_MAKELOCK,
+	                  NULL, &err) != 0)
+	{
+		fprintf(stderr, "%s: %s: dkimf_db_open(): %s\n", progname,
+		        flowname, err);
+		return EX_SOFTWARE;
+	}
+
+	if (dkimf_db_put(flowdb, "x", 1, "x", 1) != 0)
+	{
+		fprintf(stderr,
+		        "%s: %s is not writable; skipping global lock runs\n",
+		        progname, flowname);
+		writable = FALSE;
+	}
+
+	fprintf(stdout, "%s: %d domains, %d checks per thread\n",
+	        progname, ndomains, nchecks);
+
+	for (nthreads = 1; status == EX_OK; nthreads *= 2)
+	{
+		if (nthreads > maxthreads)
+			nthreads = maxthreads;
+
+		if (writable &&
+		    run(TRUE, flowdb, tmpdir, nruns++, ndomains, nchecks,
+		        nthreads) != 0)
+			status = EX_SOFTWARE;
+
+		if (status == EX_OK &&
+		    run(FALSE, flowdb, tmpdir, nruns++, ndomains, nchecks,
+		        nthreads) != 0)
+			status = EX_SOFTWARE;
+
+		if (nthreads == maxthreads)
+			break;
+	}
+
+	if (writable && dkimf_rate_flush(flowdb) != 0)
+	{
+		fprintf(stderr, "%s: %s: dkimf_rate_flush() failed\n",
+		        progname, flowname);
+		status = EX_SOFTWARE;
+	}
+
+	(void) dkimf_db_close(flowdb);
+
+	if (tmpflow)
+		(void) unlink(fn);
+
+	return status;
+#else /* _FFR_RATE_LIMIT */
+	fprintf(stderr, "%s: rate limiting not supported\n", progname);
+	return EX_UNAVAILABLE;
+#endif /* _FFR_RATE_LIMIT */
+}
@@ -0,0 +1,103 @@
+-- Copyright (c) 2015, The Trusted Domain Project.  All rights reserved.
+
+-- simple/simple signing test of several messages with one Lua setup script
+-- 
+-- Sends the messages on one connection, so the filter runs the setup script
+-- for each of them on the same thread.  The script fails if it can still
+-- see a global it changed while handling an earlier message.
+
+mt.echo("*** simple/simple signing test reusing a Lua setup script")
+
+-- setup
+if TESTSOCKET ~= nil then
+	sock = TESTSOCKET
+else
+	sock = "unix:" .. mt.getcwd() .. "/t-lua-reuse.sock"
+end
+binpath = mt.getcwd() .. "/.."
+if os.getenv("srcdir") ~= nil then
+	mt.chdir(os.getenv("srcdir"))
+end
+
+-- try to start the filter
+mt.startfilter(binpath .. "/opendkim", "-x", "t-lua-reuse.conf", "-p", sock)
+
+-- try to connect to it
+conn = mt.connect(sock, 40, 0.25)
+if conn == nil then
+	error("mt.connect() failed")
+end
+
+-- send connection information
+-- mt.negotiate() is called implicitly
+if mt.conninfo(conn, "localhost", "127.0.0.1") ~= nil then
+	error("mt.conninfo() failed")
+end
+if mt.getreply(conn) ~= SMFIR_CONTINUE then
+	error("mt.conninfo() unexpected reply")
+end
+
+for x = 1, 3 do
+	-- send envelope macros and sender data
+	-- mt.helo() is called implicitly
+	mt.macro(conn, SMFIC_MAIL, "i", "t-lua-reuse-" .. x)
+	if mt.mailfrom(conn, "user@example.com") ~= nil then
+		error("mt.mailfrom() failed")
+	end
+	if mt.getreply(conn) ~= SMFIR_CONTINUE then
+		error("mt.mailfrom() unexpected reply")
+	end
+
+	-- send headers
+	-- mt.rcptto() is called implicitly
+	if mt.header(conn, "From", "user@example.com") ~= nil then
+		error("mt.header(From) failed")
+	end
+	if mt.getreply(conn) ~= SMFIR_CONTINUE then
+		error("mt.header(From) unexpected reply")
+	end
+	if mt.header(conn, "Date", "Tue, 22 Dec 2009 13:04:12 -0800") ~= nil then
+		error("mt.header(Date) failed")
+	end
+	if mt.getreply(conn) ~= SMFIR_CONTINUE then
+		error("mt.header(Date) unexpected reply")
+	end
+	if mt.header(conn, "Subject", "Signing test") ~= nil then
+		error("mt.header(Subject) failed")
+	end
+	if mt.getreply(conn) ~= SMFIR_CONTINUE then
+		error("mt.header(Subject) unexpected reply")
+	end
+
+	-- send EOH; the setup script runs here
+	if mt.eoh(conn) ~= nil then
+		error("mt.eoh() failed")
+	end
+	if mt.getreply(conn) ~= SMFIR_CONTINUE then
+		error("mt.eoh() unexpected reply for message " .. x)
+	end
+
+	-- send body
+	if mt.bodystring(conn, "This is a test!\r\n") ~= nil then
+		error("mt.bodystring() failed")
+	end
+	if mt.getreply(conn) ~= SMFIR_CONTINUE then
+		error("mt.bodystring() unexpected reply")
+	end
+
+	-- end of message; let the filter react
+	if mt.eom(conn) ~= nil then
+		error("mt.eom() failed")
+	end
+	if mt.getreply(conn) ~= SMFIR_ACCEPT then
+		error("mt.eom() unexpected reply")
+	end
+
+	-- verify that a signature got added
+	if not mt.eom_check(conn, MT_HDRINSERT, "DKIM-Signature") and
+	   not mt.eom_check(conn, MT_HDRADD, "DKIM-Signature") then
+		error("no signature added to message " .. x)
+	end
+end
+
+mt.disconnect(conn)
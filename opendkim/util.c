@@ -1861,56 +1861,4 @@ dkimf_timespec_past(struct timespec *ts)
 	else
 		return FALSE;
 }
-
-/*
-**  DKIMF_WAIT_FD -- wait for a descriptor to become read-ready
-**
-**  Parameters:
-**  	fd -- descriptor of interest
-**  	until -- maximum wait time
-**
-**  Return value:
-**  	1 -- descriptor is ready
-**  	0 -- timeout
-**  	-1 -- error
-*/
-
-int
-dkimf_wait_fd(int fd, struct timespec *until)
-{
-	fd_set fds;
-	struct timeval now;
-	struct timeval left;
-
-	assert(fd >= 0);
-
-	(void) gettimeofday(&now, NULL);
-
-	if (until != NULL)
-	{
-		if (until->tv_sec < now.tv_sec ||
-		    (until->tv_sec == now.tv_sec &&
-		     until->tv_nsec < now.tv_usec * 1000))
-		{
-			left.tv_sec = 0;
-			left.tv_usec = 0;
-		}
-		else
-		{
-			left.tv_sec = until->tv_sec - now.tv_sec;
-			left.tv_usec = until->tv_nsec / 1000 - now.tv_usec;
-
-			if (until->tv_nsec / 1000 < now.tv_usec)
-			{
-				left.tv_usec += 1000000;
-				left.tv_sec--;
-			}
-		}
-	}
-
-	FD_ZERO(&fds);
-	FD_SET(fd, &fds);
-
-	return select(fd + 1, &fds, NULL, NULL, until == NULL ? NULL : &left);
-}
 #endif /* USE_UNBOUND */
@@ -80,7 +80,6 @@ extern size_t dkimf_dstring_printf __P((struct dkimf_dstring *, char *, ...));
 
 #ifdef USE_UNBOUND
 extern _Bool dkimf_timespec_past __P((struct timespec *tv));
-extern int dkimf_wait_fd __P((int fd, struct timespec *until));
 #endif /* USE_UNBOUND */
 
 #endif /* _UTIL_H_ */
@@ -1,5 +1,5 @@
 /*
-**  Copyright (c) 2010-2013, The Trusted Domain Project.  All rights reserved.
+**  Copyright (c) 2010-2013, 2015, The Trusted Domain Project.  All rights reserved.
 */
 
 #include "build-config.h"
@@ -7,6 +7,7 @@
 /* system includes */
 #include <sys/param.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <sysexits.h>
 #include <assert.h>
 #include <unistd.h>
@@ -14,7 +15,9 @@
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
 #ifdef HAVE_GETOPT_LONG
 # define _GNU_SOURCE
 # include <getopt.h>
@@ -41,15 +44,24 @@
 #endif /* USE_ODBX */
 
 /* macros, definitions */
-#define	CMDLINEOPTS	"d:EFh:mP:p:rSs:u:vx"
+#define	CMDLINEOPTS	"Bb:d:EFh:j:mP:p:rSs:T:u:vx"
 
+#define	BULKROWS	256
+#define	DEFBATCH	10000
 #define	DEFDBHOST	"localhost"
 #define	DEFDBNAME	"opendkim"
 #define	DEFDBSCHEME	SQL_BACKEND
 #define	DEFDBUSER	"opendkim"
+#define	DIMBUCKETS	1024
 
+#define	MAXJOBS		64
 #define	MAXLINE		2048
 #define	MAXREPORTER	256
+#define	MAXTIMESTAMP	32
+
+#define	DIM_REPORTERS	0
+#define	DIM_DOMAINS	1
+#define	DIM_IPADDRS	2
 
 /* data structures */
 struct table
@@ -58,10 +70,110 @@ struct table
 	char *		tbl_right;
 };
 
+/* a growing SQL statement */
+struct sqlbuf
+{
+	size_t		sb_len;
+	size_t		sb_alloc;
+	char *		sb_buf;
+};
+
+/* a cached reporter, domain or IP address ID */
+struct dimentry
+{
+	int		de_id;
+	char *		de_name;
+	struct dimentry * de_next;
+};
+
+/* a table of reporters, domains or IP addresses, and its ID cache */
+struct dimension
+{
+	char *		dim_table;
+	char *		dim_column;
+	char *		dim_what;
+	u_int		dim_nbuckets;
+	u_int		dim_count;
+	struct dimentry ** dim_buckets;
+};
+
+/* a message record waiting to be inserted in bulk mode */
+struct bulkmsg
+{
+	int		bm_id;
+	int		bm_dup;
+	int		bm_dupof;
+	int		bm_line;
+	int		bm_repid;
+	char *		bm_jobid;
+	char *		bm_values;
+	char		bm_msgtime[MAXTIMESTAMP + 1];
+};
+
+/* a signature or extension record waiting for its message's ID */
+struct bulkrow
+{
+	int		br_msg;
+	char *		br_values;
+};
+
+/* per-connection import state */
+struct importer
+{
+	int		imp_nmsgs;
+	int		imp_nsigs;
+	int		imp_maxsigs;
+	int		imp_nexts;
+	int		imp_maxexts;
+	u_long		imp_txrows;
+	odbx_t *	imp_db;
+	struct bulkrow * imp_sigs;
+	struct bulkrow * imp_exts;
+	struct sqlbuf	imp_sql;
+	struct bulkmsg	imp_msgs[BULKROWS];
+};
+
 /* globals */
-char *progname;
-char reporter[MAXREPORTER + 1];
+int batchsize;
+int bulk;
+int dontskip;
+#ifdef _FFR_STATSEXT
+int extensions;
+#endif /* _FFR_STATSEXT */
+int failstatus;
+int fatalerrors;
+int interval;
+int lastmsgid;
+int mail;
+int nextfile;
+int nfiles;
+int norepadd;
+int showfields;
 int verbose;
+u_long rowsdone;
+time_t lastreport;
+char *progname;
+char *lastrow;
+char *dbhost;
+char *dbname;
+char *dbscheme;
+char *dbuser;
+char *dbpassword;
+char *dbport;
+char **files;
+odbx_t *dimdb;
+pthread_mutex_t dimlock;
+struct dimension claimed;
+pthread_mutex_t filelock;
+pthread_mutex_t proglock;
+struct timeval starttime;
+
+struct dimension dimensions[] =
+{
+	{ "reporters",	"name",	"reporter" },
+	{ "domains",	"name",	"domain" },
+	{ "ipaddrs",	"addr",	"IP address" }
+};
 
 struct table last_insert_id[] =
 {
@@ -75,12 +187,16 @@ struct table last_insert_id[] =
 /* getopt long option names */
 struct option long_option[] =
 {
+	{ "batch",	required_argument,	NULL,	'b' },
+	{ "bulk",	no_argument,		NULL,	'B' },
 	{ "dbhost",	required_argument,	NULL,	'h' },
 	{ "dbname",	required_argument,	NULL,	'd' },
 	{ "dbpasswd",	required_argument,	NULL,	'p' },
 	{ "dbport",	required_argument,	NULL,	'P' },
 	{ "dbscheme",	required_argument,	NULL,	's' },
 	{ "dbuser",	required_argument,	NULL,	'u' },
+	{ "jobs",	required_argument,	NULL,	'j' },
+	{ "progress",	required_argument,	NULL,	'T' },
 	{ "verbose",	required_argument,	NULL,	'v' },
 	{ NULL,		0,			NULL,	'\0' }
 };
@@ -199,7 +315,7 @@ int
 sql_mktime(const char *in, char *out, size_t outlen)
 {
 	time_t convert;
-	struct tm *local;
+	struct tm local;
 	char *p;
 
 	assert(in != NULL);
@@ -210,9 +326,10 @@ sql_mktime(const char *in, char *out, size_t outlen)
 	if (errno != 0 || *p != '\0')
 		return 0;
 
-	local = localtime(&convert);
+	if (localtime_r(&convert, &local) == NULL)
+		return 0;
 
-	return strftime(out, outlen, "%Y-%m-%d %H:%M:%S", local);
+	return strftime(out, outlen, "%Y-%m-%d %H:%M:%S", &local);
 }
 
 /*
@@ -350,678 +467,1377 @@ sql_do(odbx_t *db, char *sql)
 }
 
 /*
-**  USAGE -- print usage message and exit
+**  SQLBUF_PRINTF -- append to a growing SQL statement
 **
 **  Parameters:
-**  	None.
+**  	sb -- statement buffer
+**  	fmt -- format string
+**  	... -- arguments
 **
 **  Return value:
-**  	EX_USAGE
+**  	-1 -- error
+**  	0 -- success
 */
 
 int
-usage(void)
+sqlbuf_printf(struct sqlbuf *sb, const char *fmt, ...)
 {
-	fprintf(stderr, "%s: usage: %s [options]\n"
-#ifdef HAVE_GETOPT_LONG
-	                "\t-d, --dbname=name    \tdatabase name (default: \"%s\")\n"
-	                "\t-E                   \tinput errors are fatal\n"
-	                "\t-F                   \tdump parsed fields on errors\n"
-	                "\t-h, --dbhost=host    \tdatabase host/address (default: \"%s\")\n"
-	                "\t-m                   \tinput is in email format\n"
-	                "\t-P, --dbport=port    \tdatabase port\n"
-	                "\t-p, --dbpasswd=passwd\tdatabase password\n"
-	                "\t-r                   \tdon't add unknown reporters\n"
-	                "\t-S                   \tdon't skip duplicate messages\n"
-	                "\t-s, --dbscheme=scheme\tdatabase scheme (default: \"%s\")\n"
-	                "\t-u, --dbuser=user    \tdatabase user (default: \"%s\")\n"
-	                "\t-v, --verbose        \tincrease verbose output\n"
-# ifdef _FFR_STATSEXT
-	                "\t-x                   \timport extension records\n"
-# endif /* _FFR_STATSEXT */
+	int n;
+	size_t newsz;
+	char *new;
+	va_list ap;
 
-#else /* HAVE_GETOPT_LONG */
+	assert(sb != NULL);
+	assert(fmt != NULL);
 
-	                "\t-d name  \tdatabase name (default: \"%s\")\n"
-	                "\t-E       \tinput errors are fatal\n"
-	                "\t-F       \tdump parsed fields on errors\n"
-	                "\t-h host  \tdatabase host/address (default: \"%s\")\n"
-	                "\t-m       \tinput is in email format\n"
-	                "\t-P port  \tdatabase port\n"
-	                "\t-p passwd\tdatabase password\n"
-	                "\t-r       \tdon't add unknown reporters\n"
-	                "\t-S       \tdon't skip duplicate messages\n"
-	                "\t-s scheme\tdatabase scheme (default: \"%s\")\n"
-	                "\t-u user  \tdatabase user (default: \"%s\")\n"
-	                "\t-v       \tincrease verbose output\n"
-# ifdef _FFR_STATSEXT
-	                "\t-x       \timport extension records\n"
-# endif /* _FFR_STATSEXT */
-#endif /* HAVE_GETOPT_LONG */
-	        ,
-	        progname, progname, DEFDBNAME, DEFDBHOST, DEFDBSCHEME,
-	        DEFDBUSER);
+	for (;;)
+	{
+		va_start(ap, fmt);
+		n = vsnprintf(sb->sb_buf == NULL ? NULL : sb->sb_buf + sb->sb_len,
+		              sb->sb_alloc - sb->sb_len, fmt, ap);
+		va_end(ap);
 
-	return EX_USAGE;
+		if (n < 0)
+			return -1;
+
+		if (sb->sb_len + n < sb->sb_alloc)
+		{
+			sb->sb_len += n;
+			return 0;
+		}
+
+		newsz = MAX(sb->sb_alloc * 2, sb->sb_len + n + MAXLINE);
+		new = (char *) realloc(sb->sb_buf, newsz);
+		if (new == NULL)
+		{
+			fprintf(stderr, "%s: realloc(): %s\n", progname,
+			        strerror(errno));
+			return -1;
+		}
+
+		sb->sb_buf = new;
+		sb->sb_alloc = newsz;
+	}
 }
 
 /*
-**  MAIN -- program mainline
+**  ELAPSED -- seconds since the import started
 **
 **  Parameters:
-**  	argc, argv -- the usual
+**  	None.
 **
 **  Return value:
-**  	Exit status.
+**  	Elapsed time, in seconds.
 */
 
-int
-main(int argc, char **argv)
+double
+elapsed(void)
 {
-	int c;
-	int n;
-#ifdef _FFR_STATSEXT
-	int extensions = 0;
-#endif /* _FFR_STATSEXT */
-	int nfields = 0;
-	int line;
-	int err;
-	int mail = 0;
-	int dontskip = 0;
-	int fatalerrors = 0;
-	int showfields = 0;
-	int skipsigs = 0;
-	int norepadd = 0;
-	int repid;
-	int domid;
-	int addrid;
-	int msgid;
-	int sigid;
-	int inversion = -1;
-#ifdef HAVE_GETOPT_LONG
-	int long_opt_index = 0;
-#endif /* HAVE_GETOPT_LONG */
-	char *p;
-	char *lastrow = NULL;
-	char *dbhost = DEFDBHOST;
-	char *dbname = DEFDBNAME;
-	char *dbscheme = DEFDBSCHEME;
-	char *dbuser = DEFDBUSER;
-	char *dbpassword = NULL;
-	char *dbport = NULL;
-	char **fields = NULL;
-	odbx_t *db = NULL;
-	char buf[MAXLINE + 1];
-	char timebuf[MAXLINE + 1];
-	char sql[MAXLINE + 1];
-	char safesql[MAXLINE * 2 + 1];
-
-	progname = (p = strrchr(argv[0], '/')) == NULL ? argv[0] : p + 1;
+	struct timeval now;
 
-	verbose = 0;
+	(void) gettimeofday(&now, NULL);
 
-#ifdef HAVE_GETOPT_LONG
-	while ((c = getopt_long(argc, argv, CMDLINEOPTS,
-	                        long_option, &long_opt_index)) != -1)
-#else /* HAVE_GETOPT_LONG */
-	while ((c = getopt(argc, argv, CMDLINEOPTS)) != -1)
-#endif /* HAVE_GETOPT_LONG */
-	{
-		switch (c)
-		{
-		  case 'd':
-			dbname = optarg;
-			break;
+	return (now.tv_sec - starttime.tv_sec) +
+	       (now.tv_usec - starttime.tv_usec) / 1000000.0;
+}
 
-		  case 'E':
-			fatalerrors = 1;
-			break;
+/*
+**  PROGRESS -- count imported rows, and report the rate now and then
+**
+**  Parameters:
+**  	rows -- rows just written
+**
+**  Return value:
+**  	None.
+*/
 
-		  case 'F':
-			showfields = 1;
-			break;
+void
+progress(u_long rows)
+{
+	double secs;
 
-		  case 'h':
-			dbhost = optarg;
-			break;
+	pthread_mutex_lock(&proglock);
 
-		  case 'm':
-			mail = 1;
-			break;
+	rowsdone += rows;
 
-		  case 'P':
-			dbport = optarg;
-			break;
+	if (interval > 0 && time(NULL) >= lastreport + interval)
+	{
+		secs = elapsed();
 
-		  case 'p':
-			dbpassword = optarg;
-			break;
+		fprintf(stderr, "%s: %lu rows, %.0f rows/sec\n", progname,
+		        rowsdone, secs > 0 ? rowsdone / secs : 0.0);
 
-		  case 'r':
-			norepadd = 1;
-			break;
+		lastreport = time(NULL);
+	}
 
-		  case 'S':
-			dontskip = 1;
-			break;
+	pthread_mutex_unlock(&proglock);
+}
 
-		  case 's':
-			dbscheme = optarg;
-			break;
+/*
+**  DIM_HASH -- hash a reporter, domain or IP address
+**
+**  Parameters:
+**  	name -- string to hash
+**
+**  Return value:
+**  	Hash of "name".
+*/
 
-		  case 'u':
-			dbuser = optarg;
-			break;
+u_int
+dim_hash(char *name)
+{
+	u_int h = 5381;
+	char *p;
 
-		  case 'v':
-			verbose++;
-			break;
+	for (p = name; *p != '\0'; p++)
+		h = (h << 5) + h + (u_char) *p;
 
-#ifdef _FFR_STATSEXT
-		  case 'x':
-			extensions = 1;
-			break;
-#endif /* _FFR_STATSEXT */
+	return h;
+}
 
-		  default:
-			return usage();
-		}
-	}
+/*
+**  DIM_ADD -- add an ID to a dimension's cache
+**
+**  Parameters:
+**  	d -- dimension
+**  	name -- name
+**  	id -- its ID
+**
+**  Return value:
+**  	-1 -- error
+**  	0 -- success
+**
+**  Notes:
+**  	Caller must hold "dimlock".
+*/
 
-	for (c = 0; ; c++)
+int
+dim_add(struct dimension *d, char *name, int id)
+{
+	u_int c;
+	u_int h;
+	u_int newnb;
+	struct dimentry *de;
+	struct dimentry *next;
+	struct dimentry **new;
+
+	/* grow the table; if that fails, the old one still works */
+	if (d->dim_count >= d->dim_nbuckets * 2)
 	{
-		if (strcasecmp(last_insert_id[c].tbl_left, dbscheme) == 0)
+		newnb = d->dim_nbuckets * 2;
+		new = (struct dimentry **) calloc(newnb, sizeof *new);
+		if (new != NULL)
 		{
-			lastrow = last_insert_id[c].tbl_right;
-			break;
+			for (c = 0; c < d->dim_nbuckets; c++)
+			{
+				for (de = d->dim_buckets[c]; de != NULL; de = next)
+				{
+					next = de->de_next;
+					h = dim_hash(de->de_name) % newnb;
+					de->de_next = new[h];
+					new[h] = de;
+				}
+			}
+
+			free(d->dim_buckets);
+			d->dim_buckets = new;
+			d->dim_nbuckets = newnb;
 		}
 	}
 
-	if (lastrow == NULL)
+	de = (struct dimentry *) malloc(sizeof *de);
+	if (de == NULL)
 	{
-		fprintf(stderr, "%s: scheme \"%s\" not currently supported\n",
-		        progname, dbscheme);
-		return EX_SOFTWARE;
+		fprintf(stderr, "%s: malloc(): %s\n", progname,
+		        strerror(errno));
+		return -1;
 	}
 
-	/* try to connect to the database */
-	if (odbx_init(&db, dbscheme, dbhost, dbport) < 0)
+	de->de_name = strdup(name);
+	if (de->de_name == NULL)
 	{
-		fprintf(stderr, "%s: odbx_init() failed\n", progname);
-		return EX_TEMPFAIL;
+		fprintf(stderr, "%s: strdup(): %s\n", progname,
+		        strerror(errno));
+		free(de);
+		return -1;
 	}
 
-	/* bind with user, password, database information */
-	err = odbx_bind(db, dbname, dbuser, dbpassword, ODBX_BIND_SIMPLE);
-	if (err < 0)
-	{
-		fprintf(stderr, "%s: odbx_bind(): %s\n", progname,
-		        odbx_error(db, err));
-		(void) odbx_finish(db);
-		return EX_TEMPFAIL;
-	}
+	de->de_id = id;
 
-	/* initialize stuff */
-	memset(buf, '\0', sizeof buf);
-	memset(reporter, '\0', sizeof reporter);
-	line = 0;
-	repid = 0;
-	msgid = 0;
-	sigid = 0;
+	h = dim_hash(name) % d->dim_nbuckets;
+	de->de_next = d->dim_buckets[h];
+	d->dim_buckets[h] = de;
+	d->dim_count++;
 
-	/* read lines from stdin */
-	while (fgets(buf, sizeof buf - 1, stdin) != NULL)
-	{
-		line++;
+	return 0;
+}
 
-		/* eat the newline */
-		for (p = buf; *p != '\0'; p++)
-		{
-			if (*p == '\n')
-			{
-				*p = '\0';
-				break;
-			}
-		}
+/*
+**  DIM_FIND -- look up an ID in a dimension's cache
+**
+**  Parameters:
+**  	d -- dimension
+**  	name -- name
+**
+**  Return value:
+**  	0 -- not cached
+**  	>0 -- the ID
+**
+**  Notes:
+**  	Caller must hold "dimlock".
+*/
 
-		if (mail == 1)
-		{
-			if (strlen(buf) > 0)
-				continue;
+int
+dim_find(struct dimension *d, char *name)
+{
+	u_int h;
+	struct dimentry *de;
 
-			mail = 0;
-			continue;
-		}
+	h = dim_hash(name) % d->dim_nbuckets;
+	for (de = d->dim_buckets[h]; de != NULL; de = de->de_next)
+	{
+		if (strcmp(de->de_name, name) == 0)
+			return de->de_id;
+	}
 
-		/* first byte identifies the record type */
-		c = buf[0];
+	return 0;
+}
 
-		/* reset fields array */
-		if (fields != NULL)
-			memset(fields, '\0', sizeof(char *) * nfields);
+/*
+**  DIM_GETID -- get, or create, a reporter, domain or IP address ID in
+**               bulk mode
+**
+**  Parameters:
+**  	imp -- importer
+**  	dim -- DIM_* table index
+**  	name -- name to look up
+**  	create -- add it if it's not already there
+**
+**  Return value:
+**  	-1 -- error
+**  	0 -- not found and not created
+**  	>0 -- the ID
+**
+**  Notes:
+**  	The cache is shared by all workers.  When there is more than one
+**  	worker, new records are made on a separate connection that isn't
+**  	inside a transaction so that the other workers can see them right
+**  	away; "dimlock" serializes use of that connection too.
+*/
 
-		/* now break out the fields */
-		n = 0;
-		for (p = strtok(buf + 1, "\t");
-		     p != NULL;
-		     p = strtok(NULL, "\t"))
-		{
-			if (nfields == n)
-			{
-				int newnf;
-				size_t newsz;
-				char **new;
+int
+dim_getid(struct importer *imp, int dim, char *name, int create)
+{
+	int id;
+	odbx_t *db;
+	struct dimension *d;
+	char sql[MAXLINE + 1];
+	char safesql[MAXLINE * 2 + 1];
 
-				newnf = MAX(nfields * 2, 8);
-				newsz = sizeof(char *) * newnf;
+	assert(imp != NULL);
+	assert(name != NULL);
 
-				if (nfields == 0)
-					new = (char **) malloc(newsz);
-				else
-					new = (char **) realloc(fields, newsz);
+	d = &dimensions[dim];
+	db = (dimdb != NULL ? dimdb : imp->imp_db);
 
-				if (new == NULL)
-				{
-					fprintf(stderr,
-					        "%s: %salloc(): %s\n",
-					        progname,
-					        fields == NULL ? "m" : "re",
-					        strerror(errno));
-					(void) odbx_finish(db);
-					return EX_SOFTWARE;
-				}
+	pthread_mutex_lock(&dimlock);
 
-				nfields = newnf;
-				fields = new;
-			}
+	id = dim_find(d, name);
+	if (id > 0)
+	{
+		pthread_mutex_unlock(&dimlock);
+		return id;
+	}
 
-			fields[n++] = p;
-		}
+	(void) sanitize(db, name, safesql, sizeof safesql);
 
-		sigid = 0;
+	snprintf(sql, sizeof sql, "SELECT id FROM %s WHERE %s = '%s'",
+	         d->dim_table, d->dim_column, safesql);
 
-		/* processing section for messages */
-		if (c == '\0')
+	id = sql_get_int(db, sql);
+	if (id == 0 && create)
+	{
+		snprintf(sql, sizeof sql, "INSERT INTO %s (%s) VALUES ('%s')",
+		         d->dim_table, d->dim_column, safesql);
+
+		if (sql_do(db, sql) == -1)
 		{
-			continue;
+			/* repeat the get */
+			snprintf(sql, sizeof sql,
+			         "SELECT id FROM %s WHERE %s = '%s'",
+			         d->dim_table, d->dim_column, safesql);
 		}
-		else if (c == 'V')
+		else
 		{
-			if (n != 1)
-			{
-				fprintf(stderr,
-				        "%s: unexpected version field count (%d) at input line %d\n",
-				        progname, n, line);
+			snprintf(sql, sizeof sql, "SELECT %s", lastrow);
+		}
 
-				if (showfields == 1)
-					dumpfields(stderr, fields, n);
+		id = sql_get_int(db, sql);
+		if (id == 0)
+		{
+			fprintf(stderr,
+			        "%s: failed to create %s record for '%s'\n",
+			        progname, d->dim_what, name);
+			id = -1;
+		}
+	}
 
-				if (fatalerrors == 1)
-				{
-					(void) odbx_finish(db);
-					return EX_DATAERR;
-				}
+	if (id > 0 && dim_add(d, name, id) != 0)
+		id = -1;
 
-				continue;
-			}
+	pthread_mutex_unlock(&dimlock);
 
-			inversion = atoi(fields[0]);
-		}
-		else if (c == 'M')
-		{
-			if (inversion != DKIMS_VERSION)
-			{
-				fprintf(stderr,
-				        "%s: ignoring old format at input line %d\n",
-				        progname, line);
+	return id;
+}
 
-				continue;
-			}
+/*
+**  BULK_ADDROW -- queue a signature or extension record in bulk mode
+**
+**  Parameters:
+**  	rows -- array of queued rows (updated)
+**  	n -- number of rows queued (updated)
+**  	max -- rows allocated (updated)
+**  	msg -- index of the row's message among those pending
+**  	values -- SQL for the row
+**
+**  Return value:
+**  	-1 -- error
+**  	0 -- success
+*/
 
-			if (n != DKIMS_MI_MAX + 1)
-			{
-				fprintf(stderr,
-				        "%s: unexpected message field count (%d) at input line %d\n",
-				        progname, n, line);
+int
+bulk_addrow(struct bulkrow **rows, int *n, int *max, int msg, char *values)
+{
+	assert(rows != NULL);
+	assert(n != NULL);
+	assert(max != NULL);
+	assert(values != NULL);
 
-				if (showfields == 1)
-					dumpfields(stderr, fields, n);
+	if (*n == *max)
+	{
+		int newmax;
+		struct bulkrow *new;
 
-				if (fatalerrors == 1)
-				{
-					(void) odbx_finish(db);
-					return EX_DATAERR;
-				}
+		newmax = MAX(*max * 2, BULKROWS);
+		new = (struct bulkrow *) realloc(*rows,
+		                                 newmax * sizeof(struct bulkrow));
+		if (new == NULL)
+		{
+			fprintf(stderr, "%s: realloc(): %s\n", progname,
+			        strerror(errno));
+			return -1;
+		}
 
-				continue;
-			}
+		*rows = new;
+		*max = newmax;
+	}
 
-			skipsigs = 0;
+	(*rows)[*n].br_values = strdup(values);
+	if ((*rows)[*n].br_values == NULL)
+	{
+		fprintf(stderr, "%s: strdup(): %s\n", progname,
+		        strerror(errno));
+		return -1;
+	}
 
-			/* get, or create, the reporter ID if needed */
-			if (strcasecmp(reporter, fields[1]) != 0)
-			{
-				(void) sanitize(db, fields[1], safesql,
-				                sizeof safesql);
+	(*rows)[*n].br_msg = msg;
+	(*n)++;
 
-				snprintf(sql, sizeof sql,
-				         "SELECT id FROM reporters WHERE name = '%s'",
-				         safesql);
+	return 0;
+}
 
-				repid = sql_get_int(db, sql);
-				if (repid == -1)
-				{
-					(void) odbx_finish(db);
-					return EX_SOFTWARE;
-				}
-				else if (repid == 0)
-				{
-					if (norepadd == 1)
-					{
-						fprintf(stderr,
-						        "%s: no such reporter '%s' at line %d\n",
-						        progname, fields[1],
-						        line);
+/*
+**  BULK_CLEAR -- discard everything queued in bulk mode
+**
+**  Parameters:
+**  	imp -- importer
+**
+**  Return value:
+**  	None.
+*/
 
-						skipsigs = 1;
+void
+bulk_clear(struct importer *imp)
+{
+	int c;
 
-						continue;
-					}
+	assert(imp != NULL);
 
-					snprintf(sql, sizeof sql,
-					         "INSERT INTO reporters (name) VALUES ('%s')",
-					         safesql);
+	for (c = 0; c < imp->imp_nmsgs; c++)
+	{
+		free(imp->imp_msgs[c].bm_jobid);
+		free(imp->imp_msgs[c].bm_values);
+	}
 
-					repid = sql_do(db, sql);
-					if (repid == -1)
-					{
-						(void) odbx_finish(db);
-						return EX_SOFTWARE;
-					}
+	for (c = 0; c < imp->imp_nsigs; c++)
+		free(imp->imp_sigs[c].br_values);
 
-					snprintf(sql, sizeof sql,
-					         "SELECT %s", lastrow);
+	for (c = 0; c < imp->imp_nexts; c++)
+		free(imp->imp_exts[c].br_values);
 
-					repid = sql_get_int(db, sql);
-					if (repid == -1)
-					{
-						(void) odbx_finish(db);
-						return EX_SOFTWARE;
-					}
-					else if (repid == 0)
-					{
-						fprintf(stderr,
-						        "%s: failed to create reporter record for '%s'\n",
-						        progname,
-						        fields[1]);
-						(void) odbx_finish(db);
-						return EX_SOFTWARE;
-					}
-				}
+	imp->imp_nmsgs = 0;
+	imp->imp_nsigs = 0;
+	imp->imp_nexts = 0;
+}
 
-				strlcpy(reporter, fields[1], sizeof reporter);
-			}
+/*
+**  BULK_DUPCHECK -- find queued messages that are already in the database
+**                   or appear earlier in the queue
+**
+**  Parameters:
+**  	imp -- importer
+**
+**  Return value:
+**  	-1 -- error
+**  	0 -- success
+**
+**  Notes:
+**  	Sets bm_dup on each duplicate, and either bm_dupof to the index
+**  	of the earlier queued copy or bm_id to the ID of the stored one.
+*/
 
-			/* get, or create, the domain ID if needed */
-			(void) sanitize(db, fields[2], safesql,
-			                sizeof safesql);
+int
+bulk_dupcheck(struct importer *imp)
+{
+	int c;
+	int d;
+	int n;
+	int err;
+	int id;
+	int repid;
+	const char *jobid;
+	const char *msgtime;
+	const char *p;
+	struct bulkmsg *bm;
+	odbx_result_t *result = NULL;
 
-			snprintf(sql, sizeof sql,
-			         "SELECT id FROM domains WHERE name = '%s'",
-			         safesql);
+	assert(imp != NULL);
 
-			domid = sql_get_int(db, sql);
-			if (domid == -1)
-			{
-				(void) odbx_finish(db);
-				return EX_SOFTWARE;
-			}
-			else if (domid == 0)
-			{
-				snprintf(sql, sizeof sql,
-				         "INSERT INTO domains (name) VALUES ('%s')",
-				         safesql);
+	imp->imp_sql.sb_len = 0;
 
-				domid = sql_do(db, sql);
-				if (domid == -1)
-				{
-					(void) odbx_finish(db);
-					return EX_SOFTWARE;
-				}
+	for (c = 0, n = 0; c < imp->imp_nmsgs; c++)
+	{
+		bm = &imp->imp_msgs[c];
 
-				snprintf(sql, sizeof sql,
-				         "SELECT %s", lastrow);
+		bm->bm_id = 0;
+		bm->bm_dup = 0;
+		bm->bm_dupof = -1;
 
-				domid = sql_get_int(db, sql);
-				if (domid == -1)
-				{
-					(void) odbx_finish(db);
-					return EX_SOFTWARE;
-				}
-				else if (domid == 0)
-				{
-					fprintf(stderr,
-					        "%s: failed to create domain record for '%s'\n",
-					        progname, fields[2]);
-					(void) odbx_finish(db);
-					return EX_SOFTWARE;
-				}
+		for (d = 0; d < c; d++)
+		{
+			if (imp->imp_msgs[d].bm_dup == 0 &&
+			    imp->imp_msgs[d].bm_repid == bm->bm_repid &&
+			    strcmp(imp->imp_msgs[d].bm_jobid, bm->bm_jobid) == 0 &&
+			    strcmp(imp->imp_msgs[d].bm_msgtime,
+			           bm->bm_msgtime) == 0)
+			{
+				bm->bm_dup = 1;
+				bm->bm_dupof = d;
+				break;
 			}
+		}
 
-			/* get, or create, the IP address ID if needed */
-			(void) sanitize(db, fields[3], safesql,
-			                sizeof safesql);
+		if (bm->bm_dup == 1)
+			continue;
 
-			snprintf(sql, sizeof sql,
-			         "SELECT id FROM ipaddrs WHERE addr = '%s'",
-			         safesql);
+		if (sqlbuf_printf(&imp->imp_sql,
+		                  "%s (reporter = %d AND jobid = '%s' AND msgtime = '%s')",
+		                  n == 0 ? "SELECT id, reporter, jobid, msgtime FROM messages WHERE" : " OR",
+		                  bm->bm_repid, bm->bm_jobid,
+		                  bm->bm_msgtime) != 0)
+			return -1;
 
-			addrid = sql_get_int(db, sql);
-			if (addrid == -1)
-			{
-				(void) odbx_finish(db);
-				return EX_SOFTWARE;
-			}
-			else if (addrid == 0)
-			{
-				snprintf(sql, sizeof sql,
-				         "INSERT INTO ipaddrs (addr) VALUES ('%s')",
-				         safesql);
+		n++;
+	}
 
-				addrid = sql_do(db, sql);
-				if (addrid == -1)
-				{
-					/* repeat the get */
-					snprintf(sql, sizeof sql,
-					         "SELECT id FROM ipaddrs WHERE addr = '%s'",
-					         safesql);
+	if (n == 0)
+		return 0;
 
-					addrid = sql_get_int(db, sql);
-					if (addrid == -1)
-					{
-						(void) odbx_finish(db);
-						return EX_SOFTWARE;
-					}
-				}
-				else
-				{
-					snprintf(sql, sizeof sql,
-					         "SELECT %s", lastrow);
+	if (verbose > 0)
+		fprintf(stderr, "> %s\n", imp->imp_sql.sb_buf);
 
-					addrid = sql_get_int(db, sql);
-					if (addrid == -1)
-					{
-						(void) odbx_finish(db);
-						return EX_SOFTWARE;
-					}
-					else if (addrid == 0)
-					{
-						fprintf(stderr,
-						        "%s: failed to create IP address record for '%s'\n",
-						        progname, fields[3]);
-						(void) odbx_finish(db);
-						return EX_SOFTWARE;
-					}
-				}
-			}
+	err = odbx_query(imp->imp_db, imp->imp_sql.sb_buf,
+	                 imp->imp_sql.sb_len);
+	if (err < 0)
+	{
+		fprintf(stderr, "%s: odbx_query(): %s\n",
+		        progname, odbx_error(imp->imp_db, err));
+		return -1;
+	}
 
-			/* verify data safety */
-			if (sanitize(db, fields[0], safesql, sizeof safesql) ||
-			    sanitize(db, fields[4], safesql, sizeof safesql) ||
-			    sanitize(db, fields[5], safesql, sizeof safesql) ||
-			    sanitize(db, fields[6], safesql, sizeof safesql) ||
-			    sanitize(db, fields[7], safesql, sizeof safesql) ||
-			    sanitize(db, fields[8], safesql, sizeof safesql))
-			{
-				fprintf(stderr,
-				        "%s: unsafe data at input line %d\n",
-				        progname, line);
+	err = odbx_result(imp->imp_db, &result, NULL, 0);
+	if (err < 0)
+	{
+		fprintf(stderr, "%s: odbx_result(): %s\n",
+		        progname, odbx_error(imp->imp_db, err));
+		return -1;
+	}
 
-				skipsigs = 1;
+	for (;;)
+	{
+		err = odbx_row_fetch(result);
+		if (err == ODBX_ROW_DONE)
+		{
+			break;
+		}
+		else if (err < 0)
+		{
+			fprintf(stderr, "%s: odbx_row_fetch(): %s\n",
+			        progname, odbx_error(imp->imp_db, err));
+			odbx_result_finish(result);
+			return -1;
+		}
 
-				continue;
-			}
+		p = odbx_field_value(result, 0);
+		id = (p == NULL ? 0 : atoi(p));
+		p = odbx_field_value(result, 1);
+		repid = (p == NULL ? 0 : atoi(p));
+		jobid = odbx_field_value(result, 2);
+		msgtime = odbx_field_value(result, 3);
+		if (id <= 0 || jobid == NULL || msgtime == NULL)
+			continue;
 
-			/* see if this is a duplicate */
-			(void) sql_mktime(fields[4], timebuf, sizeof timebuf);
-			snprintf(sql, sizeof sql,
-			         "SELECT id FROM messages WHERE jobid = '%s' AND reporter = %d AND msgtime = '%s'",
-			         fields[0], repid, timebuf);
+		for (c = 0; c < imp->imp_nmsgs; c++)
+		{
+			bm = &imp->imp_msgs[c];
 
-			msgid = sql_get_int(db, sql);
-			if (msgid == -1)
+			if (bm->bm_dup == 0 &&
+			    bm->bm_repid == repid &&
+			    strcmp(bm->bm_jobid, jobid) == 0 &&
+			    strcmp(bm->bm_msgtime, msgtime) == 0)
 			{
-				(void) odbx_finish(db);
-				return EX_SOFTWARE;
+				bm->bm_dup = 1;
+				bm->bm_id = id;
 			}
-			else if (msgid != 0)
-			{
-				if (dontskip == 0)
-				{
-					fprintf(stderr,
-					        "%s: skipping duplicate message at line %d\n",
-					        progname, line);
-					skipsigs = 1;
-				}
+		}
+	}
 
-				continue;
-			}
+	odbx_result_finish(result);
 
-			(void) sql_mktime(fields[4], timebuf, sizeof timebuf);
-			snprintf(sql, sizeof sql,
-			         "INSERT INTO messages (jobid, reporter, from_domain, ip, msgtime, size, sigcount, atps, spam) VALUES ('%s', %d, %d, %d, '%s', %s, %s, %s, %s)",
-			         fields[0],	/* jobid */
-			         repid,		/* reporter */
-			         domid,		/* from_domain */
-			         addrid,	/* ip */
-			         timebuf,	/* msgtime */
-			         fields[5],	/* size */
-			         fields[6],	/* sigcount */
-			         fields[7],	/* atps */
-			         fields[8]);	/* spam */
+	return 0;
+}
 
-			msgid = sql_do(db, sql);
-			if (msgid == -1)
-			{
-				(void) odbx_finish(db);
-				return EX_SOFTWARE;
-			}
+/*
+**  BULK_FLUSH -- write out everything queued in bulk mode
+**
+**  Parameters:
+**  	imp -- importer
+**
+**  Return value:
+**  	-1 -- error
+**  	0 -- success
+**
+**  Notes:
+**  	Messages get their IDs here rather than from the database, so
+**  	that all of them and all of their signatures can be written with
+**  	one statement each.  The transaction is committed, and a new one
+**  	begun, once "batchsize" rows have been written in it.
+**
+**  	With more than one worker, bulk_dupcheck() can't see messages
+**  	another worker has written but not yet committed, so every message
+**  	numbered in this run is also remembered in "claimed"; a later copy
+**  	of one, from any worker, is a duplicate of the first.
+*/
 
-			/* get back the message ID */
-			snprintf(sql, sizeof sql, "SELECT %s", lastrow);
+int
+bulk_flush(struct importer *imp)
+{
+	int c;
+	int id;
+	int status = 0;
+	u_long nmsgs = 0;
+	u_long nsigs = 0;
+	struct bulkmsg *bm;
+	struct bulkrow *br;
+	char sql[MAXLINE + 1];
 
-			msgid = sql_get_int(db, sql);
-			if (msgid == -1)
+	assert(imp != NULL);
+
+	if (imp->imp_nmsgs == 0)
+		return 0;
+
+	if (bulk_dupcheck(imp) != 0)
+		return -1;
+
+	/* number the new messages */
+	pthread_mutex_lock(&dimlock);
+	for (c = 0; c < imp->imp_nmsgs; c++)
+	{
+		bm = &imp->imp_msgs[c];
+
+		if (bm->bm_dup == 1)
+			continue;
+
+		if (claimed.dim_buckets == NULL)
+		{
+			bm->bm_id = ++lastmsgid;
+			continue;
+		}
+
+		snprintf(sql, sizeof sql, "%d\t%s\t%s", bm->bm_repid,
+		         bm->bm_jobid, bm->bm_msgtime);
+
+		id = dim_find(&claimed, sql);
+		if (id > 0)
+		{
+			bm->bm_dup = 1;
+			bm->bm_id = id;
+		}
+		else
+		{
+			bm->bm_id = ++lastmsgid;
+			if (dim_add(&claimed, sql, bm->bm_id) != 0)
 			{
-				(void) odbx_finish(db);
-				return EX_SOFTWARE;
+				status = -1;
+				break;
 			}
-			else if (msgid == 0)
+		}
+	}
+	pthread_mutex_unlock(&dimlock);
+
+	imp->imp_sql.sb_len = 0;
+
+	for (c = 0; status == 0 && c < imp->imp_nmsgs; c++)
+	{
+		bm = &imp->imp_msgs[c];
+
+		if (bm->bm_dup == 1)
+		{
+			if (bm->bm_dupof != -1)
+				bm->bm_id = imp->imp_msgs[bm->bm_dupof].bm_id;
+
+			if (dontskip == 0)
 			{
 				fprintf(stderr,
-				        "%s: failed to create message record for '%s'\n",
-				        progname, fields[0]);
-				(void) odbx_finish(db);
-				return EX_SOFTWARE;
+				        "%s: skipping duplicate message at line %d\n",
+				        progname, bm->bm_line);
+				bm->bm_id = 0;
 			}
+
+			continue;
 		}
 
-		/* processing section for signatures */
-		else if (c == 'S')
+		if (sqlbuf_printf(&imp->imp_sql, "%s(%d, %s)",
+		                  nmsgs == 0 ? "INSERT INTO messages (id, jobid, reporter, from_domain, ip, msgtime, size, sigcount, atps, spam) VALUES " : ", ",
+		                  bm->bm_id, bm->bm_values) != 0)
 		{
-			if (inversion != DKIMS_VERSION)
-			{
-				fprintf(stderr,
-				        "%s: ignoring old format at input line %d\n",
-				        progname, line);
+			status = -1;
+			break;
+		}
 
-				continue;
-			}
+		nmsgs++;
+	}
 
-			if (n != DKIMS_SI_MAX + 1)
-			{
-				fprintf(stderr,
-				        "%s: unexpected signature field count (%d) at input line %d\n",
-				        progname, n, line);
-				continue;
-			}
-			else if (msgid <= 0)
-			{
-				fprintf(stderr,
-				        "%s: signature record before message record at input line %d\n",
-				        progname, line);
-				continue;
-			}
-			else if (skipsigs == 1)
-			{
-				continue;
-			}
+	if (status == 0 && nmsgs > 0)
+		status = sql_do(imp->imp_db, imp->imp_sql.sb_buf);
 
-			/* get, or create, the domain ID if needed */
-			(void) sanitize(db, fields[0], safesql,
-			                sizeof safesql);
+	imp->imp_sql.sb_len = 0;
 
-			snprintf(sql, sizeof sql,
-			         "SELECT id FROM domains WHERE name = '%s'",
-			         safesql);
+	for (c = 0; status == 0 && c < imp->imp_nsigs; c++)
+	{
+		br = &imp->imp_sigs[c];
+		bm = &imp->imp_msgs[br->br_msg];
 
-			domid = sql_get_int(db, sql);
-			if (domid == -1)
-			{
-				(void) odbx_finish(db);
-				return EX_SOFTWARE;
-			}
-			else if (domid == 0)
-			{
-				snprintf(sql, sizeof sql,
-				         "INSERT INTO domains (name) VALUES ('%s')",
-				         safesql);
+		if (bm->bm_id == 0)
+			continue;
 
-				domid = sql_do(db, sql);
-				if (domid == -1)
-				{
-					(void) odbx_finish(db);
-					return EX_SOFTWARE;
-				}
+		status = sqlbuf_printf(&imp->imp_sql, "%s(%d, %s)",
+		                       nsigs == 0 ? "INSERT INTO signatures (message, domain, pass, fail_body, siglength, sigerror, dnssec) VALUES " : ", ",
+		                       bm->bm_id, br->br_values);
 
-				snprintf(sql, sizeof sql, "SELECT %s",
-				         lastrow);
+		nsigs++;
+	}
 
-				domid = sql_get_int(db, sql);
-				if (domid == -1)
-				{
-					(void) odbx_finish(db);
-					return EX_SOFTWARE;
-				}
-				else if (domid == 0)
-				{
-					fprintf(stderr,
-					        "%s: failed to create domain record for '%s'\n",
-					        progname, fields[0]);
-					(void) odbx_finish(db);
-					return EX_SOFTWARE;
-				}
-			}
+	if (status == 0 && nsigs > 0)
+		status = sql_do(imp->imp_db, imp->imp_sql.sb_buf);
+
+	for (c = 0; status == 0 && c < imp->imp_nexts; c++)
+	{
+		br = &imp->imp_exts[c];
+		bm = &imp->imp_msgs[br->br_msg];
+
+		if (bm->bm_id == 0)
+			continue;
+
+		snprintf(sql, sizeof sql, "UPDATE messages SET %s WHERE id = %d",
+		         br->br_values, bm->bm_id);
+
+		status = sql_do(imp->imp_db, sql);
+	}
+
+	bulk_clear(imp);
+
+	if (status != 0)
+		return -1;
+
+	progress(nmsgs + nsigs);
+
+	imp->imp_txrows += nmsgs + nsigs;
+	if (imp->imp_txrows >= batchsize)
+	{
+		if (sql_do(imp->imp_db, "COMMIT") != 0 ||
+		    sql_do(imp->imp_db, "BEGIN") != 0)
+			return -1;
+
+		imp->imp_txrows = 0;
+	}
+
+	return 0;
+}
+
+/*
+**  BULK_MESSAGE -- queue a message record in bulk mode
+**
+**  Parameters:
+**  	imp -- importer
+**  	fields -- fields of the "M" record
+**  	line -- input line number
+**
+**  Return value:
+**  	-1 -- error
+**  	0 -- record skipped
+**  	>0 -- handle for the message, for use by bulk_signature()
+*/
+
+int
+bulk_message(struct importer *imp, char **fields, int line)
+{
+	int repid;
+	int domid;
+	int addrid;
+	struct bulkmsg *bm;
+	char values[MAXLINE + 1];
+	char safesql[MAXLINE * 2 + 1];
+
+	assert(imp != NULL);
+	assert(fields != NULL);
+
+	repid = dim_getid(imp, DIM_REPORTERS, fields[1], norepadd == 0);
+	if (repid == -1)
+	{
+		return -1;
+	}
+	else if (repid == 0)
+	{
+		fprintf(stderr, "%s: no such reporter '%s' at line %d\n",
+		        progname, fields[1], line);
+		return 0;
+	}
+
+	domid = dim_getid(imp, DIM_DOMAINS, fields[2], 1);
+	if (domid == -1)
+		return -1;
+
+	addrid = dim_getid(imp, DIM_IPADDRS, fields[3], 1);
+	if (addrid == -1)
+		return -1;
+
+	/* verify data safety */
+	if (sanitize(imp->imp_db, fields[0], safesql, sizeof safesql) ||
+	    sanitize(imp->imp_db, fields[4], safesql, sizeof safesql) ||
+	    sanitize(imp->imp_db, fields[5], safesql, sizeof safesql) ||
+	    sanitize(imp->imp_db, fields[6], safesql, sizeof safesql) ||
+	    sanitize(imp->imp_db, fields[7], safesql, sizeof safesql) ||
+	    sanitize(imp->imp_db, fields[8], safesql, sizeof safesql))
+	{
+		fprintf(stderr, "%s: unsafe data at input line %d\n",
+		        progname, line);
+		return 0;
+	}
+
+	if (imp->imp_nmsgs == BULKROWS && bulk_flush(imp) != 0)
+		return -1;
+
+	bm = &imp->imp_msgs[imp->imp_nmsgs];
+
+	(void) sql_mktime(fields[4], bm->bm_msgtime, sizeof bm->bm_msgtime);
+
+	snprintf(values, sizeof values,
+	         "'%s', %d, %d, %d, '%s', %s, %s, %s, %s",
+	         fields[0],		/* jobid */
+	         repid,			/* reporter */
+	         domid,			/* from_domain */
+	         addrid,		/* ip */
+	         bm->bm_msgtime,	/* msgtime */
+	         fields[5],		/* size */
+	         fields[6],		/* sigcount */
+	         fields[7],		/* atps */
+	         fields[8]);		/* spam */
+
+	bm->bm_jobid = strdup(fields[0]);
+	bm->bm_values = strdup(values);
+	if (bm->bm_jobid == NULL || bm->bm_values == NULL)
+	{
+		fprintf(stderr, "%s: strdup(): %s\n", progname,
+		        strerror(errno));
+		free(bm->bm_jobid);
+		free(bm->bm_values);
+		return -1;
+	}
+
+	bm->bm_line = line;
+	bm->bm_repid = repid;
+
+	imp->imp_nmsgs++;
+
+	return imp->imp_nmsgs;
+}
+
+/*
+**  BULK_SIGNATURE -- queue a signature record in bulk mode
+**
+**  Parameters:
+**  	imp -- importer
+**  	fields -- fields of the "S" record
+**  	msg -- handle returned by bulk_message()
+**  	line -- input line number
+**
+**  Return value:
+**  	-1 -- error
+**  	0 -- success, or record skipped
+*/
+
+int
+bulk_signature(struct importer *imp, char **fields, int msg, int line)
+{
+	int domid;
+	char values[MAXLINE + 1];
+	char safesql[MAXLINE * 2 + 1];
+
+	assert(imp != NULL);
+	assert(fields != NULL);
+	assert(msg > 0 && msg <= imp->imp_nmsgs);
+
+	domid = dim_getid(imp, DIM_DOMAINS, fields[0], 1);
+	if (domid == -1)
+		return -1;
+
+	if (sanitize(imp->imp_db, fields[1], safesql, sizeof safesql) ||
+	    sanitize(imp->imp_db, fields[2], safesql, sizeof safesql) ||
+	    sanitize(imp->imp_db, fields[3], safesql, sizeof safesql) ||
+	    sanitize(imp->imp_db, fields[4], safesql, sizeof safesql) ||
+	    sanitize(imp->imp_db, fields[5], safesql, sizeof safesql))
+	{
+		fprintf(stderr, "%s: unsafe data at input line %d\n",
+		        progname, line);
+		return 0;
+	}
+
+	snprintf(values, sizeof values, "%d, %s, %s, %s, %s, %s",
+	         domid,			/* domain */
+	         fields[1],		/* pass */
+	         fields[2],		/* fail_body */
+	         fields[3],		/* siglength */
+	         fields[4],		/* sigerror */
+	         fields[5]);		/* dnssec */
+
+	return bulk_addrow(&imp->imp_sigs, &imp->imp_nsigs,
+	                   &imp->imp_maxsigs, msg - 1, values);
+}
+
+/*
+**  IMPORTFILE -- import one input stream
+**
+**  Parameters:
+**  	imp -- importer
+**  	in -- input stream
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+importfile(struct importer *imp, FILE *in)
+{
+	int c;
+	int n;
+	int nfields = 0;
+	int line;
+	int err;
+	int inmail;
+	int skipsigs = 0;
+	int repid;
+	int domid;
+	int addrid;
+	int msgid;
+	int sigid;
+	int inversion = -1;
+	char *p;
+	char **fields = NULL;
+	odbx_t *db;
+	char reporter[MAXREPORTER + 1];
+	char buf[MAXLINE + 1];
+	char timebuf[MAXLINE + 1];
+	char sql[MAXLINE + 1];
+	char safesql[MAXLINE * 2 + 1];
+
+	assert(imp != NULL);
+	assert(in != NULL);
+
+	db = imp->imp_db;
+
+	/* initialize stuff */
+	memset(buf, '\0', sizeof buf);
+	memset(reporter, '\0', sizeof reporter);
+	inmail = mail;
+	line = 0;
+	repid = 0;
+	msgid = 0;
+	sigid = 0;
+
+	/* read lines from the input */
+	while (fgets(buf, sizeof buf - 1, in) != NULL)
+	{
+		line++;
+
+		/* eat the newline */
+		for (p = buf; *p != '\0'; p++)
+		{
+			if (*p == '\n')
+			{
+				*p = '\0';
+				break;
+			}
+		}
+
+		if (inmail == 1)
+		{
+			if (strlen(buf) > 0)
+				continue;
+
+			inmail = 0;
+			continue;
+		}
+
+		/* first byte identifies the record type */
+		c = buf[0];
+
+		/* reset fields array */
+		if (fields != NULL)
+			memset(fields, '\0', sizeof(char *) * nfields);
+
+		/* now break out the fields */
+		n = 0;
+		for (p = strtok(buf + 1, "\t");
+		     p != NULL;
+		     p = strtok(NULL, "\t"))
+		{
+			if (nfields == n)
+			{
+				int newnf;
+				size_t newsz;
+				char **new;
+
+				newnf = MAX(nfields * 2, 8);
+				newsz = sizeof(char *) * newnf;
+
+				if (nfields == 0)
+					new = (char **) malloc(newsz);
+				else
+					new = (char **) realloc(fields, newsz);
+
+				if (new == NULL)
+				{
+					fprintf(stderr,
+					        "%s: %salloc(): %s\n",
+					        progname,
+					        fields == NULL ? "m" : "re",
+					        strerror(errno));
+					return EX_SOFTWARE;
+				}
+
+				nfields = newnf;
+				fields = new;
+			}
+
+			fields[n++] = p;
+		}
+
+		sigid = 0;
+
+		/* processing section for messages */
+		if (c == '\0')
+		{
+			continue;
+		}
+		else if (c == 'V')
+		{
+			if (n != 1)
+			{
+				fprintf(stderr,
+				        "%s: unexpected version field count (%d) at input line %d\n",
+				        progname, n, line);
+
+				if (showfields == 1)
+					dumpfields(stderr, fields, n);
+
+				if (fatalerrors == 1)
+				{
+					return EX_DATAERR;
+				}
+
+				continue;
+			}
+
+			inversion = atoi(fields[0]);
+		}
+		else if (c == 'M')
+		{
+			if (inversion != DKIMS_VERSION)
+			{
+				fprintf(stderr,
+				        "%s: ignoring old format at input line %d\n",
+				        progname, line);
+
+				continue;
+			}
+
+			if (n != DKIMS_MI_MAX + 1)
+			{
+				fprintf(stderr,
+				        "%s: unexpected message field count (%d) at input line %d\n",
+				        progname, n, line);
+
+				if (showfields == 1)
+					dumpfields(stderr, fields, n);
+
+				if (fatalerrors == 1)
+				{
+					return EX_DATAERR;
+				}
+
+				continue;
+			}
+
+			skipsigs = 0;
+
+			if (bulk == 1)
+			{
+				err = bulk_message(imp, fields, line);
+				if (err == -1)
+					return EX_SOFTWARE;
+				else if (err == 0)
+					skipsigs = 1;
+				else
+					msgid = err;
+
+				continue;
+			}
+
+			/* get, or create, the reporter ID if needed */
+			if (strcasecmp(reporter, fields[1]) != 0)
+			{
+				(void) sanitize(db, fields[1], safesql,
+				                sizeof safesql);
+
+				snprintf(sql, sizeof sql,
+				         "SELECT id FROM reporters WHERE name = '%s'",
+				         safesql);
+
+				repid = sql_get_int(db, sql);
+				if (repid == -1)
+				{
+					return EX_SOFTWARE;
+				}
+				else if (repid == 0)
+				{
+					if (norepadd == 1)
+					{
+						fprintf(stderr,
+						        "%s: no such reporter '%s' at line %d\n",
+						        progname, fields[1],
+						        line);
+
+						skipsigs = 1;
+
+						continue;
+					}
+
+					snprintf(sql, sizeof sql,
+					         "INSERT INTO reporters (name) VALUES ('%s')",
+					         safesql);
+
+					repid = sql_do(db, sql);
+					if (repid == -1)
+					{
+						return EX_SOFTWARE;
+					}
+
+					snprintf(sql, sizeof sql,
+					         "SELECT %s", lastrow);
+
+					repid = sql_get_int(db, sql);
+					if (repid == -1)
+					{
+						return EX_SOFTWARE;
+					}
+					else if (repid == 0)
+					{
+						fprintf(stderr,
+						        "%s: failed to create reporter record for '%s'\n",
+						        progname,
+						        fields[1]);
+						return EX_SOFTWARE;
+					}
+				}
+
+				strlcpy(reporter, fields[1], sizeof reporter);
+			}
+
+			/* get, or create, the domain ID if needed */
+			(void) sanitize(db, fields[2], safesql,
+			                sizeof safesql);
+
+			snprintf(sql, sizeof sql,
+			         "SELECT id FROM domains WHERE name = '%s'",
+			         safesql);
+
+			domid = sql_get_int(db, sql);
+			if (domid == -1)
+			{
+				return EX_SOFTWARE;
+			}
+			else if (domid == 0)
+			{
+				snprintf(sql, sizeof sql,
+				         "INSERT INTO domains (name) VALUES ('%s')",
+				         safesql);
+
+				domid = sql_do(db, sql);
+				if (domid == -1)
+				{
+					return EX_SOFTWARE;
+				}
+
+				snprintf(sql, sizeof sql,
+				         "SELECT %s", lastrow);
+
+				domid = sql_get_int(db, sql);
+				if (domid == -1)
+				{
+					return EX_SOFTWARE;
+				}
+				else if (domid == 0)
+				{
+					fprintf(stderr,
+					        "%s: failed to create domain record for '%s'\n",
+					        progname, fields[2]);
+					return EX_SOFTWARE;
+				}
+			}
+
+			/* get, or create, the IP address ID if needed */
+			(void) sanitize(db, fields[3], safesql,
+			                sizeof safesql);
+
+			snprintf(sql, sizeof sql,
+			         "SELECT id FROM ipaddrs WHERE addr = '%s'",
+			         safesql);
+
+			addrid = sql_get_int(db, sql);
+			if (addrid == -1)
+			{
+				return EX_SOFTWARE;
+			}
+			else if (addrid == 0)
+			{
+				snprintf(sql, sizeof sql,
+				         "INSERT INTO ipaddrs (addr) VALUES ('%s')",
+				         safesql);
+
+				addrid = sql_do(db, sql);
+				if (addrid == -1)
+				{
+					/* repeat the get */
+					snprintf(sql, sizeof sql,
+					         "SELECT id FROM ipaddrs WHERE addr = '%s'",
+					         safesql);
+
+					addrid = sql_get_int(db, sql);
+					if (addrid == -1)
+					{
+						return EX_SOFTWARE;
+					}
+				}
+				else
+				{
+					snprintf(sql, sizeof sql,
+					         "SELECT %s", lastrow);
+
+					addrid = sql_get_int(db, sql);
+					if (addrid == -1)
+					{
+						return EX_SOFTWARE;
+					}
+					else if (addrid == 0)
+					{
+						fprintf(stderr,
+						        "%s: failed to create IP address record for '%s'\n",
+						        progname, fields[3]);
+						return EX_SOFTWARE;
+					}
+				}
+			}
+
+			/* verify data safety */
+			if (sanitize(db, fields[0], safesql, sizeof safesql) ||
+			    sanitize(db, fields[4], safesql, sizeof safesql) ||
+			    sanitize(db, fields[5], safesql, sizeof safesql) ||
+			    sanitize(db, fields[6], safesql, sizeof safesql) ||
+			    sanitize(db, fields[7], safesql, sizeof safesql) ||
+			    sanitize(db, fields[8], safesql, sizeof safesql))
+			{
+				fprintf(stderr,
+				        "%s: unsafe data at input line %d\n",
+				        progname, line);
+
+				skipsigs = 1;
+
+				continue;
+			}
+
+			/* see if this is a duplicate */
+			(void) sql_mktime(fields[4], timebuf, sizeof timebuf);
+			snprintf(sql, sizeof sql,
+			         "SELECT id FROM messages WHERE jobid = '%s' AND reporter = %d AND msgtime = '%s'",
+			         fields[0], repid, timebuf);
+
+			msgid = sql_get_int(db, sql);
+			if (msgid == -1)
+			{
+				return EX_SOFTWARE;
+			}
+			else if (msgid != 0)
+			{
+				if (dontskip == 0)
+				{
+					fprintf(stderr,
+					        "%s: skipping duplicate message at line %d\n",
+					        progname, line);
+					skipsigs = 1;
+				}
+
+				continue;
+			}
+
+			(void) sql_mktime(fields[4], timebuf, sizeof timebuf);
+			snprintf(sql, sizeof sql,
+			         "INSERT INTO messages (jobid, reporter, from_domain, ip, msgtime, size, sigcount, atps, spam) VALUES ('%s', %d, %d, %d, '%s', %s, %s, %s, %s)",
+			         fields[0],	/* jobid */
+			         repid,		/* reporter */
+			         domid,		/* from_domain */
+			         addrid,	/* ip */
+			         timebuf,	/* msgtime */
+			         fields[5],	/* size */
+			         fields[6],	/* sigcount */
+			         fields[7],	/* atps */
+			         fields[8]);	/* spam */
+
+			msgid = sql_do(db, sql);
+			if (msgid == -1)
+			{
+				return EX_SOFTWARE;
+			}
+
+			/* get back the message ID */
+			snprintf(sql, sizeof sql, "SELECT %s", lastrow);
+
+			msgid = sql_get_int(db, sql);
+			if (msgid == -1)
+			{
+				return EX_SOFTWARE;
+			}
+			else if (msgid == 0)
+			{
+				fprintf(stderr,
+				        "%s: failed to create message record for '%s'\n",
+				        progname, fields[0]);
+				return EX_SOFTWARE;
+			}
+
+			progress(1);
+		}
+
+		/* processing section for signatures */
+		else if (c == 'S')
+		{
+			if (inversion != DKIMS_VERSION)
+			{
+				fprintf(stderr,
+				        "%s: ignoring old format at input line %d\n",
+				        progname, line);
+
+				continue;
+			}
+
+			if (n != DKIMS_SI_MAX + 1)
+			{
+				fprintf(stderr,
+				        "%s: unexpected signature field count (%d) at input line %d\n",
+				        progname, n, line);
+				continue;
+			}
+			else if (msgid <= 0)
+			{
+				fprintf(stderr,
+				        "%s: signature record before message record at input line %d\n",
+				        progname, line);
+				continue;
+			}
+			else if (skipsigs == 1)
+			{
+				continue;
+			}
+
+			if (bulk == 1)
+			{
+				if (bulk_signature(imp, fields, msgid, line) != 0)
+					return EX_SOFTWARE;
+
+				continue;
+			}
+
+			/* get, or create, the domain ID if needed */
+			(void) sanitize(db, fields[0], safesql,
+			                sizeof safesql);
+
+			snprintf(sql, sizeof sql,
+			         "SELECT id FROM domains WHERE name = '%s'",
+			         safesql);
+
+			domid = sql_get_int(db, sql);
+			if (domid == -1)
+			{
+				return EX_SOFTWARE;
+			}
+			else if (domid == 0)
+			{
+				snprintf(sql, sizeof sql,
+				         "INSERT INTO domains (name) VALUES ('%s')",
+				         safesql);
+
+				domid = sql_do(db, sql);
+				if (domid == -1)
+				{
+					return EX_SOFTWARE;
+				}
+
+				snprintf(sql, sizeof sql, "SELECT %s",
+				         lastrow);
+
+				domid = sql_get_int(db, sql);
+				if (domid == -1)
+				{
+					return EX_SOFTWARE;
+				}
+				else if (domid == 0)
+				{
+					fprintf(stderr,
+					        "%s: failed to create domain record for '%s'\n",
+					        progname, fields[0]);
+					return EX_SOFTWARE;
+				}
+			}
 
 			if (sanitize(db, fields[1], safesql, sizeof safesql) ||
 			    sanitize(db, fields[2], safesql, sizeof safesql) ||
@@ -1036,243 +1852,748 @@ main(int argc, char **argv)
 			}
 
 			snprintf(sql, sizeof sql,
-			         "INSERT INTO signatures (message, domain, pass, fail_body, siglength, sigerror, dnssec) VALUES (%d, %d, %s, %s, %s, %s, %s)",
-			         msgid,		/* message */
-			         domid,		/* domain */
-			         fields[1],	/* pass */
-			         fields[2],	/* fail_body */
-			         fields[3],	/* siglength */
-			         fields[4],	/* sigerror */
-			         fields[5]);	/* dnssec */
+			         "INSERT INTO signatures (message, domain, pass, fail_body, siglength, sigerror, dnssec) VALUES (%d, %d, %s, %s, %s, %s, %s)",
+			         msgid,		/* message */
+			         domid,		/* domain */
+			         fields[1],	/* pass */
+			         fields[2],	/* fail_body */
+			         fields[3],	/* siglength */
+			         fields[4],	/* sigerror */
+			         fields[5]);	/* dnssec */
+
+			sigid = sql_do(db, sql);
+			if (sigid == -1)
+			{
+				return EX_SOFTWARE;
+			}
+
+			/* get back the signature ID */
+			snprintf(sql, sizeof sql, "SELECT %s", lastrow);
+
+			sigid = sql_get_int(db, sql);
+			if (sigid == -1)
+			{
+				return EX_SOFTWARE;
+			}
+			else if (sigid == 0)
+			{
+				fprintf(stderr,
+				        "%s: failed to create signature record for input line %d\n",
+				        progname, line);
+				return EX_SOFTWARE;
+			}
+
+			progress(1);
+		}
+
+		/* processing section for message status updates */
+		else if (c == 'U' && inversion == DKIMS_VERSION)
+		{
+			/* the message may still be queued */
+			if (bulk == 1)
+			{
+				if (bulk_flush(imp) != 0)
+					return EX_SOFTWARE;
+
+				msgid = 0;
+			}
+
+			if (n != 4)
+			{
+				fprintf(stderr,
+				        "%s: unexpected update field count (%d) at input line %d\n",
+				        progname, n, line);
+
+				if (showfields == 1)
+					dumpfields(stderr, fields, n);
+
+				continue;
+			}
+
+			/* get the reporter ID */
+			if (strcasecmp(reporter, fields[1]) != 0)
+			{
+				(void) sanitize(db, fields[1], safesql,
+				                sizeof safesql);
+
+				snprintf(sql, sizeof sql,
+				         "SELECT id FROM reporters WHERE name = '%s'",
+				         safesql);
+
+				repid = sql_get_int(db, sql);
+				if (repid == -1)
+				{
+					return EX_SOFTWARE;
+				}
+				else if (repid == 0)
+				{
+					if (norepadd == 1)
+					{
+						fprintf(stderr,
+						        "%s: no such reporter '%s' at line %d\n",
+						        progname, fields[1],
+						        line);
+					}
+
+					continue;
+				}
+
+				strlcpy(reporter, fields[1], sizeof reporter);
+			}
+
+			/* verify data safety */
+			if (sanitize(db, fields[0], safesql, sizeof safesql) ||
+			    sanitize(db, fields[2], safesql, sizeof safesql) ||
+			    sanitize(db, fields[3], safesql, sizeof safesql))
+			{
+				fprintf(stderr,
+				        "%s: unsafe data at input line %d\n",
+				        progname, line);
+
+				continue;
+			}
+
+			/* get the message ID */
+			if (strcmp(fields[2], "0") == 0)
+			{
+				snprintf(sql, sizeof sql,
+				         "SELECT MAX(id) FROM messages WHERE jobid = '%s' AND reporter = %d",
+				         fields[0], repid);
+			}
+			else
+			{
+				(void) sql_mktime(fields[2], timebuf,
+				                  sizeof timebuf);
+				snprintf(sql, sizeof sql,
+				         "SELECT id FROM messages WHERE jobid = '%s' AND reporter = %d AND msgtime = '%s'",
+				         fields[0], repid, timebuf);
+			}
+
+			msgid = sql_get_int(db, sql);
+			if (msgid == -1)
+			{
+				return EX_SOFTWARE;
+			}
+			else if (msgid == 0)
+			{
+				fprintf(stderr,
+				        "%s: unknown message for update at line %d\n",
+				        progname, line);
+				continue;
+			}
+
+			snprintf(sql, sizeof sql,
+			         "UPDATE messages SET spam = %s WHERE id = %d",
+			         fields[3],	/* spam */
+			         msgid);	/* message ID */
+
+			msgid = sql_do(db, sql);
+			if (msgid == -1)
+			{
+				return EX_SOFTWARE;
+			}
+		}
+
+#ifdef _FFR_STATSEXT
+		/* processing section for extensions */
+		else if (c == 'X')
+		{
+			if (inversion != DKIMS_VERSION)
+			{
+				fprintf(stderr,
+				        "%s: ignoring old format at input line %d\n",
+				        progname, line);
+
+				continue;
+			}
+
+			if (n != 2)
+			{
+				fprintf(stderr,
+				        "%s: unexpected extension field count (%d) at input line %d\n",
+				        progname, n, line);
+
+				if (showfields == 1)
+					dumpfields(stderr, fields, n);
+
+				continue;
+			}
+			else if (msgid <= 0)
+			{
+				fprintf(stderr,
+				        "%s: extension record before message record at input line %d\n",
+				        progname, line);
+				continue;
+			}
+			else if (skipsigs == 1 || extensions == 0)
+			{
+				continue;
+			}
+
+			if (sanitize(db, fields[0], safesql, sizeof safesql) ||
+			    sanitize(db, fields[1], safesql, sizeof safesql))
+			{
+				fprintf(stderr,
+				        "%s: unsafe data at input line %d\n",
+				        progname, line);
+				continue;
+			}
+
+			if (bulk == 1)
+			{
+				snprintf(sql, sizeof sql, "%s = %s",
+				         fields[0], fields[1]);
+
+				if (bulk_addrow(&imp->imp_exts, &imp->imp_nexts,
+				                &imp->imp_maxexts, msgid - 1,
+				                sql) != 0)
+					return EX_SOFTWARE;
+
+				continue;
+			}
+
+			snprintf(sql, sizeof sql,
+			         "UPDATE messages SET %s = %s WHERE id = %d",
+			         fields[0], fields[1], msgid);
 
-			sigid = sql_do(db, sql);
-			if (sigid == -1)
+			err = sql_do(db, sql);
+			if (err == -1)
 			{
-				(void) odbx_finish(db);
 				return EX_SOFTWARE;
 			}
+		}
+#endif /* _FFR_STATSEXT */
+
+		/* unknown record type */
+		else
+		{
+			fprintf(stderr,
+			        "%s: unknown record type '%c' at input line %d\n",
+			        progname, c, line);
+
+			if (fatalerrors == 1)
+			{
+				return EX_DATAERR;
+			}
+		}
+	}
+
+	if (fields != NULL)
+		free(fields);
+
+	if (ferror(in))
+	{
+		fprintf(stderr, "%s: fgets(): %s\n", progname,
+		        strerror(errno));
+		return EX_OSERR;
+	}
+
+	return EX_OK;
+}
+
+/*
+**  DBCONNECT -- connect to the database
+**
+**  Parameters:
+**  	db -- new DB handle (returned)
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+dbconnect(odbx_t **db)
+{
+	int err;
+
+	assert(db != NULL);
+
+	/* try to connect to the database */
+	if (odbx_init(db, dbscheme, dbhost, dbport) < 0)
+	{
+		fprintf(stderr, "%s: odbx_init() failed\n", progname);
+		*db = NULL;
+		return EX_TEMPFAIL;
+	}
+
+	/* bind with user, password, database information */
+	err = odbx_bind(*db, dbname, dbuser, dbpassword, ODBX_BIND_SIMPLE);
+	if (err < 0)
+	{
+		fprintf(stderr, "%s: odbx_bind(): %s\n", progname,
+		        odbx_error(*db, err));
+		(void) odbx_finish(*db);
+		*db = NULL;
+		return EX_TEMPFAIL;
+	}
+
+	return EX_OK;
+}
+
+/*
+**  DBDISCONNECT -- disconnect from the database
+**
+**  Parameters:
+**  	db -- DB handle
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+dbdisconnect(odbx_t *db)
+{
+	int err;
+
+	assert(db != NULL);
+
+	/* unbind */
+	err = odbx_unbind(db);
+	if (err < 0)
+	{
+		fprintf(stderr, "%s: odbx_unbind(): %s\n", progname,
+		        odbx_error(db, err));
+		(void) odbx_finish(db);
+		return EX_SOFTWARE;
+	}
+
+	/* shut down */
+	if (odbx_finish(db) < 0)
+	{
+		fprintf(stderr, "%s: odbx_finish() failed\n", progname);
+		return EX_SOFTWARE;
+	}
+
+	return EX_OK;
+}
+
+/*
+**  WORKER -- import input files until none are left
+**
+**  Parameters:
+**  	arg -- unused
+**
+**  Return value:
+**  	Always NULL; errors are recorded in "failstatus".
+*/
+
+void *
+worker(void *arg)
+{
+	int status;
+	char *fn;
+	FILE *in;
+	struct importer imp;
+
+	memset(&imp, '\0', sizeof imp);
+
+	status = dbconnect(&imp.imp_db);
+
+	if (status == EX_OK && bulk == 1 && sql_do(imp.imp_db, "BEGIN") != 0)
+		status = EX_SOFTWARE;
+
+	while (status == EX_OK)
+	{
+		pthread_mutex_lock(&filelock);
+		if (failstatus != EX_OK || nextfile >= nfiles)
+			fn = NULL;
+		else
+			fn = files[nextfile++];
+		pthread_mutex_unlock(&filelock);
+
+		if (fn == NULL)
+			break;
+
+		if (strcmp(fn, "-") == 0)
+		{
+			in = stdin;
+		}
+		else
+		{
+			in = fopen(fn, "r");
+			if (in == NULL)
+			{
+				fprintf(stderr, "%s: %s: fopen(): %s\n",
+				        progname, fn, strerror(errno));
+				status = EX_NOINPUT;
+				break;
+			}
+		}
+
+		status = importfile(&imp, in);
+
+		if (in != stdin)
+			fclose(in);
+	}
+
+	if (status == EX_OK && bulk == 1)
+	{
+		if (bulk_flush(&imp) != 0 ||
+		    sql_do(imp.imp_db, "COMMIT") != 0)
+			status = EX_SOFTWARE;
+	}
+
+	bulk_clear(&imp);
+	free(imp.imp_sigs);
+	free(imp.imp_exts);
+	free(imp.imp_sql.sb_buf);
+
+	if (imp.imp_db != NULL)
+	{
+		if (status == EX_OK)
+			status = dbdisconnect(imp.imp_db);
+		else
+			(void) odbx_finish(imp.imp_db);
+	}
+
+	if (status != EX_OK)
+	{
+		pthread_mutex_lock(&filelock);
+		if (failstatus == EX_OK)
+			failstatus = status;
+		pthread_mutex_unlock(&filelock);
+	}
+
+	return NULL;
+}
+
+/*
+**  USAGE -- print usage message and exit
+**
+**  Parameters:
+**  	None.
+**
+**  Return value:
+**  	EX_USAGE
+*/
+
+int
+usage(void)
+{
+	fprintf(stderr, "%s: usage: %s [options] [file ...]\n"
+#ifdef HAVE_GETOPT_LONG
+	                "\t-B, --bulk           \tbulk load mode\n"
+	                "\t-b, --batch=rows     \trows per transaction in bulk mode (default: %d)\n"
+	                "\t-d, --dbname=name    \tdatabase name (default: \"%s\")\n"
+	                "\t-E                   \tinput errors are fatal\n"
+	                "\t-F                   \tdump parsed fields on errors\n"
+	                "\t-h, --dbhost=host    \tdatabase host/address (default: \"%s\")\n"
+	                "\t-j, --jobs=n         \tfiles to import at once in bulk mode (default: 1)\n"
+	                "\t-m                   \tinput is in email format\n"
+	                "\t-P, --dbport=port    \tdatabase port\n"
+	                "\t-p, --dbpasswd=passwd\tdatabase password\n"
+	                "\t-r                   \tdon't add unknown reporters\n"
+	                "\t-S                   \tdon't skip duplicate messages\n"
+	                "\t-s, --dbscheme=scheme\tdatabase scheme (default: \"%s\")\n"
+	                "\t-T, --progress=secs  \treport progress every \"secs\" seconds\n"
+	                "\t-u, --dbuser=user    \tdatabase user (default: \"%s\")\n"
+	                "\t-v, --verbose        \tincrease verbose output\n"
+# ifdef _FFR_STATSEXT
+	                "\t-x                   \timport extension records\n"
+# endif /* _FFR_STATSEXT */
+
+#else /* HAVE_GETOPT_LONG */
+
+	                "\t-B       \tbulk load mode\n"
+	                "\t-b rows  \trows per transaction in bulk mode (default: %d)\n"
+	                "\t-d name  \tdatabase name (default: \"%s\")\n"
+	                "\t-E       \tinput errors are fatal\n"
+	                "\t-F       \tdump parsed fields on errors\n"
+	                "\t-h host  \tdatabase host/address (default: \"%s\")\n"
+	                "\t-j n     \tfiles to import at once in bulk mode (default: 1)\n"
+	                "\t-m       \tinput is in email format\n"
+	                "\t-P port  \tdatabase port\n"
+	                "\t-p passwd\tdatabase password\n"
+	                "\t-r       \tdon't add unknown reporters\n"
+	                "\t-S       \tdon't skip duplicate messages\n"
+	                "\t-s scheme\tdatabase scheme (default: \"%s\")\n"
+	                "\t-T secs  \treport progress every \"secs\" seconds\n"
+	                "\t-u user  \tdatabase user (default: \"%s\")\n"
+	                "\t-v       \tincrease verbose output\n"
+# ifdef _FFR_STATSEXT
+	                "\t-x       \timport extension records\n"
+# endif /* _FFR_STATSEXT */
+#endif /* HAVE_GETOPT_LONG */
+	        ,
+	        progname, progname, DEFBATCH, DEFDBNAME, DEFDBHOST,
+	        DEFDBSCHEME, DEFDBUSER);
+
+	return EX_USAGE;
+}
+
+/*
+**  MAIN -- program mainline
+**
+**  Parameters:
+**  	argc, argv -- the usual
+**
+**  Return value:
+**  	Exit status.
+*/
+
+int
+main(int argc, char **argv)
+{
+	int c;
+	int jobs = 1;
+	int firstmsgid = 0;
+	int status;
+#ifdef HAVE_GETOPT_LONG
+	int long_opt_index = 0;
+#endif /* HAVE_GETOPT_LONG */
+	char *p;
+	odbx_t *db = NULL;
+	char *stdinonly[] = { "-", NULL };
+	pthread_t tids[MAXJOBS];
+	char sql[MAXLINE + 1];
+
+	progname = (p = strrchr(argv[0], '/')) == NULL ? argv[0] : p + 1;
+
+	verbose = 0;
+	batchsize = DEFBATCH;
+	dbhost = DEFDBHOST;
+	dbname = DEFDBNAME;
+	dbscheme = DEFDBSCHEME;
+	dbuser = DEFDBUSER;
+
+#ifdef HAVE_GETOPT_LONG
+	while ((c = getopt_long(argc, argv, CMDLINEOPTS,
+	                        long_option, &long_opt_index)) != -1)
+#else /* HAVE_GETOPT_LONG */
+	while ((c = getopt(argc, argv, CMDLINEOPTS)) != -1)
+#endif /* HAVE_GETOPT_LONG */
+	{
+		switch (c)
+		{
+		  case 'B':
+			bulk = 1;
+			break;
+
+		  case 'b':
+			batchsize = strtol(optarg, &p, 10);
+			if (*p != '\0' || batchsize <= 0)
+				return usage();
+			break;
+
+		  case 'd':
+			dbname = optarg;
+			break;
+
+		  case 'E':
+			fatalerrors = 1;
+			break;
 
-			/* get back the signature ID */
-			snprintf(sql, sizeof sql, "SELECT %s", lastrow);
+		  case 'F':
+			showfields = 1;
+			break;
 
-			sigid = sql_get_int(db, sql);
-			if (sigid == -1)
-			{
-				(void) odbx_finish(db);
-				return EX_SOFTWARE;
-			}
-			else if (sigid == 0)
-			{
-				fprintf(stderr,
-				        "%s: failed to create signature record for input line %d\n",
-				        progname, line);
-				(void) odbx_finish(db);
-				return EX_SOFTWARE;
-			}
-		}
+		  case 'h':
+			dbhost = optarg;
+			break;
 
-		/* processing section for message status updates */
-		else if (c == 'U' && inversion == DKIMS_VERSION)
-		{
-			if (n != 4)
-			{
-				fprintf(stderr,
-				        "%s: unexpected update field count (%d) at input line %d\n",
-				        progname, n, line);
+		  case 'j':
+			jobs = strtol(optarg, &p, 10);
+			if (*p != '\0' || jobs <= 0 || jobs > MAXJOBS)
+				return usage();
+			break;
 
-				if (showfields == 1)
-					dumpfields(stderr, fields, n);
+		  case 'm':
+			mail = 1;
+			break;
 
-				continue;
-			}
+		  case 'P':
+			dbport = optarg;
+			break;
 
-			/* get the reporter ID */
-			if (strcasecmp(reporter, fields[1]) != 0)
-			{
-				(void) sanitize(db, fields[1], safesql,
-				                sizeof safesql);
+		  case 'p':
+			dbpassword = optarg;
+			break;
 
-				snprintf(sql, sizeof sql,
-				         "SELECT id FROM reporters WHERE name = '%s'",
-				         safesql);
+		  case 'r':
+			norepadd = 1;
+			break;
 
-				repid = sql_get_int(db, sql);
-				if (repid == -1)
-				{
-					(void) odbx_finish(db);
-					return EX_SOFTWARE;
-				}
-				else if (repid == 0)
-				{
-					if (norepadd == 1)
-					{
-						fprintf(stderr,
-						        "%s: no such reporter '%s' at line %d\n",
-						        progname, fields[1],
-						        line);
-					}
+		  case 'S':
+			dontskip = 1;
+			break;
 
-					continue;
-				}
+		  case 's':
+			dbscheme = optarg;
+			break;
 
-				strlcpy(reporter, fields[1], sizeof reporter);
-			}
+		  case 'T':
+			interval = strtol(optarg, &p, 10);
+			if (*p != '\0' || interval <= 0)
+				return usage();
+			break;
 
-			/* verify data safety */
-			if (sanitize(db, fields[0], safesql, sizeof safesql) ||
-			    sanitize(db, fields[2], safesql, sizeof safesql) ||
-			    sanitize(db, fields[3], safesql, sizeof safesql))
-			{
-				fprintf(stderr,
-				        "%s: unsafe data at input line %d\n",
-				        progname, line);
+		  case 'u':
+			dbuser = optarg;
+			break;
 
-				continue;
-			}
+		  case 'v':
+			verbose++;
+			break;
 
-			/* get the message ID */
-			if (strcmp(fields[2], "0") == 0)
-			{
-				snprintf(sql, sizeof sql,
-				         "SELECT MAX(id) FROM messages WHERE jobid = '%s' AND reporter = %d",
-				         fields[0], repid);
-			}
-			else
-			{
-				(void) sql_mktime(fields[2], timebuf,
-				                  sizeof timebuf);
-				snprintf(sql, sizeof sql,
-				         "SELECT id FROM messages WHERE jobid = '%s' AND reporter = %d AND msgtime = '%s'",
-				         fields[0], repid, timebuf);
-			}
+#ifdef _FFR_STATSEXT
+		  case 'x':
+			extensions = 1;
+			break;
+#endif /* _FFR_STATSEXT */
 
-			msgid = sql_get_int(db, sql);
-			if (msgid == -1)
-			{
-				(void) odbx_finish(db);
-				return EX_SOFTWARE;
-			}
-			else if (msgid == 0)
-			{
-				fprintf(stderr,
-				        "%s: unknown message for update at line %d\n",
-				        progname, line);
-				continue;
-			}
+		  default:
+			return usage();
+		}
+	}
 
-			snprintf(sql, sizeof sql,
-			         "UPDATE messages SET spam = %s WHERE id = %d",
-			         fields[3],	/* spam */
-			         msgid);	/* message ID */
+	/* parallel imports rely on bulk mode's shared ID cache */
+	if (jobs > 1 && bulk == 0)
+		return usage();
 
-			msgid = sql_do(db, sql);
-			if (msgid == -1)
-			{
-				(void) odbx_finish(db);
-				return EX_SOFTWARE;
-			}
+	for (c = 0; last_insert_id[c].tbl_left != NULL; c++)
+	{
+		if (strcasecmp(last_insert_id[c].tbl_left, dbscheme) == 0)
+		{
+			lastrow = last_insert_id[c].tbl_right;
+			break;
 		}
+	}
 
-#ifdef _FFR_STATSEXT
-		/* processing section for extensions */
-		else if (c == 'X')
-		{
-			if (inversion != DKIMS_VERSION)
-			{
-				fprintf(stderr,
-				        "%s: ignoring old format at input line %d\n",
-				        progname, line);
+	if (lastrow == NULL)
+	{
+		fprintf(stderr, "%s: scheme \"%s\" not currently supported\n",
+		        progname, dbscheme);
+		return EX_SOFTWARE;
+	}
 
-				continue;
-			}
+	if (optind < argc)
+	{
+		files = argv + optind;
+		nfiles = argc - optind;
+	}
+	else
+	{
+		files = stdinonly;
+		nfiles = 1;
+	}
 
-			if (n != 2)
-			{
-				fprintf(stderr,
-				        "%s: unexpected extension field count (%d) at input line %d\n",
-				        progname, n, line);
+	if (jobs > nfiles)
+		jobs = nfiles;
 
-				if (showfields == 1)
-					dumpfields(stderr, fields, n);
+	pthread_mutex_init(&dimlock, NULL);
+	pthread_mutex_init(&filelock, NULL);
+	pthread_mutex_init(&proglock, NULL);
 
-				continue;
-			}
-			else if (msgid <= 0)
-			{
-				fprintf(stderr,
-				        "%s: extension record before message record at input line %d\n",
-				        progname, line);
-				continue;
-			}
-			else if (skipsigs == 1 || extensions == 0)
-			{
-				continue;
-			}
+	(void) gettimeofday(&starttime, NULL);
+	lastreport = starttime.tv_sec;
 
-			if (sanitize(db, fields[0], safesql, sizeof safesql) ||
-			    sanitize(db, fields[1], safesql, sizeof safesql))
+	if (bulk == 1)
+	{
+		for (c = 0; c < sizeof dimensions / sizeof dimensions[0]; c++)
+		{
+			dimensions[c].dim_nbuckets = DIMBUCKETS;
+			dimensions[c].dim_buckets = (struct dimentry **) calloc(DIMBUCKETS,
+			                                                        sizeof(struct dimentry *));
+			if (dimensions[c].dim_buckets == NULL)
 			{
-				fprintf(stderr,
-				        "%s: unsafe data at input line %d\n",
-				        progname, line);
-				continue;
+				fprintf(stderr, "%s: calloc(): %s\n",
+				        progname, strerror(errno));
+				return EX_SOFTWARE;
 			}
+		}
 
-			snprintf(sql, sizeof sql,
-			         "UPDATE messages SET %s = %s WHERE id = %d",
-			         fields[0], fields[1], msgid);
+		status = dbconnect(&db);
+		if (status != EX_OK)
+			return status;
 
-			err = sql_do(db, sql);
-			if (err == -1)
-			{
-				(void) odbx_finish(db);
-				return EX_SOFTWARE;
-			}
+		/* bulk mode numbers messages itself */
+		lastmsgid = sql_get_int(db,
+		                        "SELECT COALESCE(MAX(id), 0) FROM messages");
+		if (lastmsgid == -1)
+		{
+			(void) odbx_finish(db);
+			return EX_SOFTWARE;
 		}
-#endif /* _FFR_STATSEXT */
 
-		/* unknown record type */
-		else
+		firstmsgid = lastmsgid;
+
+		/* workers share this connection for new reporters etc. */
+		if (jobs > 1)
 		{
-			fprintf(stderr,
-			        "%s: unknown record type '%c' at input line %d\n",
-			        progname, c, line);
+			dimdb = db;
 
-			if (fatalerrors == 1)
+			claimed.dim_what = "message";
+			claimed.dim_nbuckets = DIMBUCKETS;
+			claimed.dim_buckets = (struct dimentry **) calloc(DIMBUCKETS,
+			                                                  sizeof(struct dimentry *));
+			if (claimed.dim_buckets == NULL)
 			{
+				fprintf(stderr, "%s: calloc(): %s\n",
+				        progname, strerror(errno));
 				(void) odbx_finish(db);
-				return EX_DATAERR;
+				return EX_SOFTWARE;
 			}
 		}
 	}
 
-	if (fields != NULL)
-		free(fields);
+	failstatus = EX_OK;
 
-	if (ferror(stdin))
+	if (jobs == 1)
 	{
-		fprintf(stderr, "%s: fgets(): %s\n", progname,
-		        strerror(errno));
-		(void) odbx_finish(db);
-		return EX_OSERR;
+		(void) worker(NULL);
 	}
+	else
+	{
+		for (c = 0; c < jobs; c++)
+		{
+			status = pthread_create(&tids[c], NULL, worker, NULL);
+			if (status != 0)
+			{
+				fprintf(stderr, "%s: pthread_create(): %s\n",
+				        progname, strerror(status));
 
-	/* unbind */
-	err = odbx_unbind(db);
-	if (err < 0)
+				pthread_mutex_lock(&filelock);
+				if (failstatus == EX_OK)
+					failstatus = EX_OSERR;
+				pthread_mutex_unlock(&filelock);
+
+				break;
+			}
+		}
+
+		while (c > 0)
+			(void) pthread_join(tids[--c], NULL);
+	}
+
+	if (bulk == 1)
 	{
-		fprintf(stderr, "%s: odbx_unbind(): %s\n", progname,
-		        odbx_error(db, err));
-		(void) odbx_finish(db);
-		return EX_SOFTWARE;
+		/* move the message ID sequence past the ones we used */
+		if (lastmsgid > firstmsgid &&
+		    strcasecmp(dbscheme, "pgsql") == 0)
+		{
+			snprintf(sql, sizeof sql,
+			         "SELECT setval(pg_get_serial_sequence('messages', 'id'), %d)",
+			         lastmsgid);
+
+			if (sql_get_int(db, sql) == -1 && failstatus == EX_OK)
+				failstatus = EX_SOFTWARE;
+		}
+
+		status = dbdisconnect(db);
+		if (failstatus == EX_OK)
+			failstatus = status;
 	}
 
-	/* shut down */
-	if (odbx_finish(db) < 0)
+	if (interval > 0)
 	{
-		fprintf(stderr, "%s: odbx_finish() failed\n", progname);
-		return EX_SOFTWARE;
+		double secs;
+
+		secs = elapsed();
+
+		fprintf(stderr, "%s: %lu rows in %.1f seconds, %.0f rows/sec\n",
+		        progname, rowsdone, secs,
+		        secs > 0 ? rowsdone / secs : 0.0);
 	}
 
-	return EX_OK;
+	return failstatus;
 }